@@ -197,6 +197,26 @@ IRBaboonAudioProcessorEditor::IRBaboonAudioProcessorEditor (IRBaboonAudioProcess
 	makeupSizeMenu.setVisible(false);
 
 	
+	/* partition size and zero latency are applied by the host's next prepareToPlay() */
+	addAndMakeVisible(&partitionSizeMenu);
+	partitionSizeMenu.addItem("Auto partition", 1);
+	partitionSizeMenu.addItem("32", 2);
+	partitionSizeMenu.addItem("64", 3);
+	partitionSizeMenu.addItem("128", 4);
+	partitionSizeMenu.addItem("256", 5);
+	partitionSizeMenu.addItem("512", 6);
+	partitionSizeMenu.addItem("1024", 7);
+	partitionSizeMenu.addItem("2048", 8);
+	partitionSizeMenu.addItem("4096", 9);
+	partitionSizeMenu.setText("Auto partition");
+	partitionSizeMenu.onChange = [this] { partitionSizeMenuChanged(); };
+	
+	addAndMakeVisible(&zeroLatencyButton);
+	zeroLatencyButton.onClick = [this] {
+		processor.setZeroLatency(zeroLatencyButton.getToggleState());
+	};
+
+	
 	addAndMakeVisible (&swapButton);
 	swapButton.onClick = [this] { processor.swapTargetBase(); };
 	
@@ -337,6 +357,26 @@ void IRBaboonAudioProcessorEditor::makeupSizeMenuChanged(){
 }
 
 
+void IRBaboonAudioProcessorEditor::partitionSizeMenuChanged(){
+	
+	int partitionSize = 0;
+	
+	switch (partitionSizeMenu.getSelectedId()){
+		case 1: partitionSize = 0;		break;
+		case 2: partitionSize = 32;		break;
+		case 3: partitionSize = 64;		break;
+		case 4: partitionSize = 128;	break;
+		case 5: partitionSize = 256;	break;
+		case 6: partitionSize = 512;	break;
+		case 7: partitionSize = 1024;	break;
+		case 8: partitionSize = 2048;	break;
+		case 9: partitionSize = 4096;	break;
+	}
+	
+	processor.setPartitionSize(partitionSize);
+}
+
+
 void IRBaboonAudioProcessorEditor::changeListenerCallback(ChangeBroadcaster* source){
 	repaint();
 }
@@ -466,10 +506,18 @@ void IRBaboonAudioProcessorEditor::resized()
 						 getLocalBounds().getWidth(),
 						 thumbnailHeightMargin);
 	
-	// output volume slider
+	// output volume slider and partition size
 	outputVolumeSlider.setBounds(labelOffset,
 								 2*buttonHeight + sliderHeightMargin,
-								 getWidth() - labelOffset,
+								 getWidth() - labelOffset - getWidth()/3,
+								 sliderHeight);
+	partitionSizeMenu.setBounds(getWidth() - getWidth()/3,
+								 2*buttonHeight + sliderHeightMargin,
+								 getWidth()/6,
+								 sliderHeight);
+	zeroLatencyButton.setBounds(getWidth() - getWidth()/6,
+								 2*buttonHeight + sliderHeightMargin,
+								 getWidth()/6,
 								 sliderHeight);
 	
 	
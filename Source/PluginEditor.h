@@ -43,6 +43,7 @@ public:
 	void playFiltAudioClick (bool toggleState);
 	void loadTargetClicked();
 	void makeupSizeMenuChanged();
+	void partitionSizeMenuChanged();
 	void presweepSilenceMenuChanged();
 
 	/* thumbnails */
@@ -109,6 +110,8 @@ private:
 	int presweepSilence = 16384;
 	ComboBox makeupSizeMenu;
 	int makeupSize = 2048;
+	ComboBox partitionSizeMenu;
+	ToggleButton zeroLatencyButton { "Zero latency" };
 	TextButton swapButton { "Swap target <-> base" };
 	TextButton loadTargetButton { "Load target..." };
 	
@@ -17,6 +17,28 @@ IRBaboonAudioProcessor::IRBaboonAudioProcessor()
 		Thread ("Print and thumbnail")
 {
 	
+	addParameter (morphAmount = new AudioParameterFloat ("morph", "Morph", 0.0f, 1.0f, 0.0f));
+	addParameter (morphSource = new AudioParameterChoice ("morphSource", "Morph Source", { "Off", "Pulse to Filter", "Base to Target" }, MORPH_OFF));
+	addParameter (morphPolar = new AudioParameterBool ("morphPolar", "Morph Polar", false));
+	addParameter (partitionThreshold = new AudioParameterFloat ("partitionThreshold", "Partition Threshold", -160.0f, -60.0f,
+																PartitionedConvolver::defaultPartitionThresholddB));
+	addParameter (tailDecimationSetting = new AudioParameterChoice ("tailDecimation", "Tail Decimation", { "Off", "2", "4" }, 0));
+	addParameter (doubleAccumulation = new AudioParameterBool ("doubleAccumulation", "Double Accumulation", false));
+	addParameter (filtContrast = new AudioParameterFloat ("filtContrast", "Filter Contrast", 0.0f, kernels::maxShapeExponent, 1.0f));
+	addParameter (filtTilt = new AudioParameterFloat ("filtTilt", "Filter Tilt", -6.0f, 6.0f, 0.0f));
+	addParameter (filtLowGain = new AudioParameterFloat ("filtLowGain", "Filter Low Gain", -24.0f, 24.0f, 0.0f));
+	addParameter (filtMidGain = new AudioParameterFloat ("filtMidGain", "Filter Mid Gain", -24.0f, 24.0f, 0.0f));
+	addParameter (filtHighGain = new AudioParameterFloat ("filtHighGain", "Filter High Gain", -24.0f, 24.0f, 0.0f));
+	addParameter (filtPhaseFlattening = new AudioParameterFloat ("filtPhaseFlattening", "Filter Phase Flattening", 0.0f, 1.0f, 0.0f));
+	
+	/* the parameters that IRs are built from, or that are handed on */
+	morphSource->addListener (this);
+	morphPolar->addListener (this);
+	partitionThreshold->addListener (this);
+	doubleAccumulation->addListener (this);
+	for (AudioParameterFloat* shapeParameter : { filtContrast, filtTilt, filtLowGain, filtMidGain, filtHighGain, filtPhaseFlattening })
+		shapeParameter->addListener (this);
+	
 	/* remove previously printed files */
 	// TODO: regex all 'thumbnail' and remove
 	boost::filesystem::remove(printDirectoryDebug + "thumbnailBase.wav");
@@ -45,6 +67,15 @@ IRBaboonAudioProcessor::IRBaboonAudioProcessor()
 	/* init IRs */
 	IRpulse.makeCopyOf(tools::generatePulse(makeupIRLengthSamples, 100));
 	
+	preparedIRpulse = new PreparedIR(IRpulse, processBlockSize, maxPartitionSize);
+	
+	/* Application Support on the Mac, like JUCE's PropertiesFile */
+	File wisdomDirectory = File::getSpecialLocation(File::userApplicationDataDirectory);
+   #if JUCE_MAC
+	wisdomDirectory = wisdomDirectory.getChildFile("Application Support");
+   #endif
+	convolutionPlanner.setWisdomFile(wisdomDirectory.getChildFile("IRBaboon").getChildFile("ConvolutionWisdom.xml"));
+	
 	IRTargPtr = new ReferenceCountedBuffer("IRTarg", 0, 0);
 	IRBasePtr = new ReferenceCountedBuffer("IRBase", 0, 0);
 	IRFiltPtr = new ReferenceCountedBuffer("IRFilt", 0, 0);
@@ -58,29 +89,6 @@ IRBaboonAudioProcessor::IRBaboonAudioProcessor()
 	
 	setLatencySamples(processBlockSize);
 	
-	N = 1;
-	while (N < (processBlockSize * 2 - 1)){
-		N *= 2;
-	}
-	fftBlockSize = N * 2;
-	
-	// initialise numChannels and numSamples for audio fft array buffers
-	audioFftBufferArray.clearAndResize(0, generalInputAudioChannels, fftBlockSize);
-	
-	// initialise FFTs
-	BigInteger fftBitMask = (BigInteger) N;
-	
-	fftIR = new dsp::FFT::FFT (fftBitMask.getHighestBit());
-	fftForward = new dsp::FFT::FFT  (fftBitMask.getHighestBit());
-	fftInverse = new dsp::FFT::FFT  (fftBitMask.getHighestBit());
-	
-	// initialise auxiliary buffers
-	inplaceBuffer.setSize(generalInputAudioChannels, fftBlockSize);
-	inplaceBuffer.clear();
-	
-	overlapBuffer.setSize(generalInputAudioChannels, processBlockSize);
-	overlapBuffer.clear();
-	
 	 // Thread
 	startThread();
 	
@@ -88,10 +96,6 @@ IRBaboonAudioProcessor::IRBaboonAudioProcessor()
 
 IRBaboonAudioProcessor::~IRBaboonAudioProcessor()
 {
-	delete fftIR;
-	delete fftForward;
-	delete fftInverse;
-	
 	stopThread(-1); // A negative value in here will wait forever to time-out.
 }
 
@@ -128,9 +132,11 @@ bool IRBaboonAudioProcessor::isMidiEffect() const
    #endif
 }
 
+/* the output goes on for the latency plus the IR that is playing, up to its last sample that isn't zero */
 double IRBaboonAudioProcessor::getTailLengthSeconds() const
 {
-    return 0.0;
+    double hostSampleRate = getSampleRate();
+    return hostSampleRate > 0.0 ? (double) (getLatencySamples() + playingIRTailLength.load()) / hostSampleRate : 0.0;
 }
 
 int IRBaboonAudioProcessor::getNumPrograms()
@@ -163,15 +169,43 @@ void IRBaboonAudioProcessor::changeProgramName (int index, const String& newName
 //==============================================================================
 void IRBaboonAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
-	sampleRate = (int) sampleRate;
+	this->sampleRate = (int) sampleRate;
 	generalHostBlockSize = samplesPerBlock;
 	
-	if (generalHostBlockSize > processBlockSize) {
-		setLatencySamples(generalHostBlockSize);
-	}
-	else {
-		setLatencySamples(processBlockSize);
+	/* the IRs are routed from the main inputs to the main outputs, see PreparedIR::getPathChannel() */
+	generalInputAudioChannels = getMainBusNumInputChannels();
+	generalOutputAudioChannels = getMainBusNumOutputChannels();
+	
+	/* small host blocks get a small partition for low latency, large ones a large one for fewer FFTs */
+	int partitionSize = partitionSizeSetting > 0 ? partitionSizeSetting : tools::nextPowerOfTwo(generalHostBlockSize);
+	processBlockSize = jlimit(minPartitionSize, maxHeadPartitionSize, partitionSize);
+	tailDecimation = 1 << tailDecimationSetting->getIndex();
+	
+	/* the output is delayed by a whole number of host blocks, and at least processBlockSize - 1 samples,
+	 * so that a block has always been convolved before its first sample is due,
+	 * also when the host calls processBlock() with fewer samples than samplesPerBlock */
+	outputDelayBlocks = std::max(1, (int) std::ceil((float) (processBlockSize - 1) / (float) generalHostBlockSize));
+	int partitionedLatency = outputDelayBlocks * generalHostBlockSize;
+	
+	/* offline rendering keeps the latency of realtime playback, so that a bounce lines up with what was heard,
+	 * whatever block size the host renders with. Any delay of at least processBlockSize - 1 samples works,
+	 * so the head partition is as large as that latency allows, and the rest of the engine is planned for throughput */
+	renderMode = isNonRealtime();
+	
+	if (renderMode && realtimePartitionedLatency > 0){
+		partitionedLatency = realtimePartitionedLatency;
+		processBlockSize = jlimit(minPartitionSize, maxHeadPartitionSize, tools::nextPowerOfTwo(partitionedLatency + 2) / 2);
 	}
+	else if (NOT renderMode)
+		realtimePartitionedLatency = partitionedLatency;
+	
+	/* in zero latency mode the DirectFIR takes the taps that this latency covers, up to maxDirectTaps */
+	zeroLatency = zeroLatencySetting && partitionedLatency <= maxDirectTaps;
+	if (zeroLatencySetting && NOT zeroLatency)
+		DBG("prepareToPlay(): host block size too large for zero latency.\n");
+	
+	directHeadTaps = zeroLatency ? partitionedLatency : 0;
+	setLatencySamples(zeroLatency ? 0 : partitionedLatency);
 	
 	
 	/* delete previously existing printed bufs */
@@ -180,57 +214,84 @@ void IRBaboonAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlo
 	}
 	
 	
-	/* init sweep circ buf array */
+	/* init sweep capture */
 	if (sweepBuf.getNumSamples() == 0){
-		DBG("divideSweepBufIntoArray() error: sweepBuf not initialised yet.\n");
+		DBG("prepareToPlay() error: sweepBuf not initialised yet.\n");
 		return;
 	}
 		
-	int sweepBufArraySize = sweepBuf.getNumSamples() / generalHostBlockSize;
-	sweepBufArray.clearAndResize(sweepBufArraySize, 1, generalHostBlockSize);
-	
-	for (int buf = 0; buf < sweepBufArraySize; buf++){
-		sweepBufArray.getWriteBufferPtr()->copyFrom(0, 0, sweepBuf, 0, buf * generalHostBlockSize, generalHostBlockSize);
-		sweepBufArray.incrWriteIndex();
-	}
-
-	
-	/* input capture array is the same size as the sweep array */
-	inputCaptureArray.clearAndResize(sweepBufArray.getArraySize(), 1, generalHostBlockSize);
-	
-	
-	/* init circ buf arrays for convolution */
-	int inputArraySize = (int) std::ceil((float) generalHostBlockSize / (float) processBlockSize);
-	/* outputArraySize needs to be rounded up to the closest power of 2 */
-	int outputArraySize = tools::nextPowerOfTwo(std::ceil((float) processBlockSize / (float) generalHostBlockSize) + 1);
-
-	/* apply array sizes */
-	inputBufferArray.		clearAndResize(inputArraySize, generalInputAudioChannels, fftBlockSize);
-	convResultBufferArray.	clearAndResize(inputArraySize, generalInputAudioChannels, fftBlockSize);
-	outputBufferArray.		clearAndResize(outputArraySize, generalInputAudioChannels, generalHostBlockSize);
-	bypassOutputBufferArray.clearAndResize(outputArraySize, generalInputAudioChannels, generalHostBlockSize);
+	/* the capture is as long as the sweep, including its silence at the end */
+	inputCaptureBuffer.setSize(1, sweepBuf.getNumSamples());
+	inputCaptureBuffer.clear();
+	sweepSampleIndex = 0;
 	
-	if (inputBufferArray.getArraySize() > audioFftBufferArray.getArraySize()){
-		audioFftBufferArray.clearAndResize(inputBufferArray.getArraySize(), generalInputAudioChannels, fftBlockSize);
-	}
-	
-	/* size is always at least 2, and we always want it to start 1 above the first one for proper latency behaviour */
-	outputBufferArray.setReadIndex(1);
-	
-	inputBufferSampleIndex = 0;
-	outputBufferSampleIndex = 0;
-	savedIndex = audioFftBufferArray.getArraySize() - 1;
 	
-	
-	irPartitions = (int) std::ceil((float) IRpulse.getNumSamples() / (float) processBlockSize);
-	irFftBufferArray.clearAndResize(irPartitions, 1, fftBlockSize);
-	
-	/* tricky tricks */
-	int newAudioArraySize = std::max(irPartitions, inputBufferArray.getArraySize());
-	audioFftBufferArray.changeArraySize(newAudioArraySize);
-	audioFftBufferArray.setReadIndex(audioFftBufferArray.getWriteIndex());
-	audioFftBufferArray.decrReadIndex();
-	savedIndex = audioFftBufferArray.getReadIndex();
+	/* init staging for convolution */
+	inputBlockBuffer.setSize(generalInputAudioChannels, processBlockSize);
+	convResultBuffer.setSize(generalOutputAudioChannels, processBlockSize);
+	inputBlockBuffer.clear();
+	inputBufferSampleIndex = 0;
+
+	/* the output fifo starts with exactly the reported latency in silence. A completed block is pushed at most
+	 * processBlockSize - 1 samples after its first sample came in, so the fifo never runs dry.
+	 * It holds at most the latency plus one host block */
+	outputFifo.setSize(generalOutputAudioChannels, partitionedLatency + generalHostBlockSize);
+	outputFifo.pushSilence(partitionedLatency);
+	
+	int bypassLatency = zeroLatency ? 0 : partitionedLatency;
+	bypassFifo.setSize(generalOutputAudioChannels, bypassLatency + generalHostBlockSize);
+	bypassFifo.pushSilence(bypassLatency);
+	
+	directFIR.prepare(generalInputAudioChannels, generalOutputAudioChannels, maxDirectTaps, generalHostBlockSize);
+	directOutputBuffer.setSize(generalOutputAudioChannels, generalHostBlockSize);
+	
+	
+	/* the convolver allocates for the longest makeup size, so that it can be changed during playback, and is planned for it.
+	 * Offline, the partitions can grow as large as the IR, and this thread waits for the workers rather than dropping their results */
+	ConvolutionPlanner::Config planConfig;
+	planConfig.numInputChannels = generalInputAudioChannels;
+	planConfig.numOutputChannels = generalOutputAudioChannels;
+	planConfig.blockSize = processBlockSize;
+	planConfig.hostBlockSize = generalHostBlockSize;
+	planConfig.maxIRSamples = maxMakeupIRLengthSamples;
+	planConfig.tailDecimation = tailDecimation;
+	planConfig.maxWorkerThreads = jlimit(0, maxConvolutionWorkerThreads, SystemStats::getNumCpus() - 1);
+	planConfig.sampleRate = sampleRate;
+	planConfig.render = renderMode;
+	planConfig.doubleAccumulation = doubleAccumulation->get();
+	
+	int partitionSizeLimit = renderMode ? tools::nextPowerOfTwo(maxMakeupIRLengthSamples) : maxPartitionSizeLimit;
+	ConvolutionPlanner::Plan plan = convolutionPlanner.getPlan(planConfig, partitionSizeLimit);
+	maxPartitionSize = plan.maxPartitionSize;
+	
+	
+	/* the prepared IRs are partitioned for one head and max partition size and number of direct taps, so they are rebuilt if these changed.
+	 * Until the print and thumbnail thread has rebuilt the filter, the pulse is played */
+	int numDirectTapsPulse = getNumDirectTaps(IRpulse.getNumSamples());
+	
+	if (preparedIRpulse->getHeadPartitionSize() != processBlockSize || preparedIRpulse->getMaxPartitionSize() != maxPartitionSize
+		|| preparedIRpulse->getNumDirectTaps() != numDirectTapsPulse || preparedIRpulse->getTailDecimation() != tailDecimation){
+		PreparedIR::Ptr newPreparedIR = new PreparedIR(IRpulse, processBlockSize, maxPartitionSize, 0, true, numDirectTapsPulse, tailDecimation);
+		
+		{
+			const ScopedLock IRSelectionScopedLock (IRSelectionLock);
+			preparedIRpulse = newPreparedIR;
+			preparedIRFilt = nullptr;
+			preparedIRFiltUnshaped = nullptr;
+			preparedIRMorph = nullptr;
+		}
+		
+		if (filtReady()){
+			IRFiltNeedsPreparing = true;
+			notify();
+		}
+	}
+	
+	
+	publishIR();
+	convolver.prepare(generalInputAudioChannels, generalOutputAudioChannels, processBlockSize, maxPartitionSize, maxMakeupIRLengthSamples, plan.numWorkerThreads,
+					  tailDecimation, renderMode);
+	convolver.setDoubleAccumulation(doubleAccumulation->get());
 }
 
 
@@ -239,24 +300,23 @@ void IRBaboonAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlo
 
 void IRBaboonAudioProcessor::releaseResources()
 {
-    /* memory used by buffer arrays is freed up */
-	inputBufferArray.changeArraySize(0);
-	audioFftBufferArray.changeArraySize(0);
-	irFftBufferArray.changeArraySize(0);
-	convResultBufferArray.changeArraySize(0);
-	outputBufferArray.changeArraySize(0);
+    /* memory used by the staging buffers is freed up */
+	inputBlockBuffer.setSize(0, 0);
+	convResultBuffer.setSize(0, 0);
+	outputFifo.setSize(0, 0);
+	bypassFifo.setSize(0, 0);
 }
 
 /* Boilerplate JUCE, to check whether channel layouts are supported. */
 bool IRBaboonAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) const
 {
-    // In this template code we only support mono or stereo.
+    // Mono or stereo in and out. A mono IR goes from mono to stereo and back, a matrix IR can route anything
     if (layouts.getMainOutputChannelSet() != AudioChannelSet::mono()
      && layouts.getMainOutputChannelSet() != AudioChannelSet::stereo())
         return false;
 
-    // This checks if the input layout matches the output layout
-    if (layouts.getMainOutputChannelSet() != layouts.getMainInputChannelSet())
+    if (layouts.getMainInputChannelSet() != AudioChannelSet::mono()
+     && layouts.getMainInputChannelSet() != AudioChannelSet::stereo())
         return false;
 
     return true;
@@ -267,12 +327,33 @@ bool IRBaboonAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts)
 
 
 void IRBaboonAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer& midiMessages)
+{
+	processSamples(buffer);
+}
+
+
+void IRBaboonAudioProcessor::processBlock (AudioBuffer<double>& buffer, MidiBuffer& midiMessages)
+{
+	processSamples(buffer);
+}
+
+
+bool IRBaboonAudioProcessor::supportsDoublePrecisionProcessing() const
+{
+	return true;
+}
+
+
+
+
+template <typename SampleType>
+void IRBaboonAudioProcessor::processSamples(AudioBuffer<SampleType>& buffer)
 {
     ScopedNoDenormals noDenormals;
     auto totalNumOutputChannels = getTotalNumOutputChannels();
 
     // This is here to avoid people getting screaming feedback
-    for (auto i = generalInputAudioChannels; i < totalNumOutputChannels; ++i)
+    for (auto i = generalOutputAudioChannels; i < totalNumOutputChannels; ++i)
         buffer.clear (i, 0, buffer.getNumSamples());
 
 	
@@ -282,60 +363,33 @@ void IRBaboonAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffe
 		return;
 	}
 	
-	AudioSampleBuffer micBuffer = getBusBuffer(buffer, true, 1); // second buffer block = mic input
+	AudioBuffer<SampleType> micBuffer = getBusBuffer(buffer, true, 1); // second buffer block = mic input
 	
 	/*
-	 * Capture input
+	 * Capture / sweep done: empty buffers before resuming throughput
 	 */
+	
+	if (IRCapture.state == IRCAP_END) {
+		samplesWaitForResumeThroughput -= currentHostBlockSize;
 
-	if (IRCapture.state == IRCAP_CAPTURE){
-		
-		inputCaptureArray.getWriteBufferPtr()->copyFrom(0, 0, micBuffer, 0, 0, generalHostBlockSize);
-		inputCaptureArray.incrWriteIndex();
-		
-		/* when capture is done */
-		if (inputCaptureArray.getWriteIndex() == 0){
-
-			/* there is a random buffer offset between sweep play and input capture. (what is the host doing...?)
-			 * it's nice if IRFilt doesn't fold back though, when sweepTarg happens before sweepBase.
-			 * a 3 buffers-to-the-right offset was used before, but actually 0 seems to work fine now too.
-			 */
-			
-			if (IRCapture.type == IR_TARGET) {
-				sweepTargPtr->getBuffer()->makeCopyOf(inputCaptureArray.consolidate(0));
-				IRTargPtr->getBuffer()->makeCopyOf(convolution::deconvolve(sweepTargPtr->getBuffer(), &sweepBufForDeconv, sampleRate));
-
-				saveIRCustomType = IR_TARGET;
-			}
-			else if (IRCapture.type == IR_BASE) {
-				sweepBasePtr->getBuffer()->makeCopyOf(inputCaptureArray.consolidate(0));
-				IRBasePtr->getBuffer()->makeCopyOf(convolution::deconvolve(sweepBasePtr->getBuffer(), &sweepBufForDeconv, sampleRate));
-
-				saveIRCustomType = IR_BASE;
-			}
-			
-
-			IRCapture.type = IR_NONE;
-
-			/* create filter if both target and base have been captured */
-			if (IRTargPtr->bufferNotEmpty() && IRBasePtr->bufferNotEmpty()){
-				createIRFilt();
-			}
-			
-			IRCapture.state = IRCAP_END;
-			
-			/* run print thumbnail thread */
-			notify();
-			
-		} // when capture is done
-		
-	} // if (IRCapture.state == IRCAP_CAPTURE)
+		if (samplesWaitForResumeThroughput > 0){
+			buffer.clear();
+		}
+		else {
+			IRCapture.state = IRCAP_IDLE;
+			/* fade in on first buffer */
+			tools::linearFade (&buffer, true, 0, buffer.getNumSamples());
+		}
+	}
 
 	
 	/*
 	 * Play empty buffers before starting sweep / capture
 	 */
 	
+	/* the sweep and the capture start this many samples into the block, right after the silence */
+	int sweepStartSample = 0;
+	
 	if (IRCapture.state == IRCAP_PREP) {
 	
 		/* first, fade out last buffer of throughput */
@@ -344,57 +398,55 @@ void IRBaboonAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffe
 			IRCapture.doFadeout = false;
 		}
 		else {
-			buffersWaitForInputCapture--;
+			sweepStartSample = std::min(currentHostBlockSize, samplesWaitForInputCapture);
+			samplesWaitForInputCapture -= sweepStartSample;
 			buffer.clear();
-		}
-		
-		/* when done: play sweep now, start input capture next block */
-		if (buffersWaitForInputCapture <= 0){
-			IRCapture.state = IRCAP_CAPTURE;
-			IRCapture.playSweep = true;
+			
+			/* when done: play sweep and capture input from the next sample on */
+			if (samplesWaitForInputCapture <= 0){
+				IRCapture.state = IRCAP_CAPTURE;
+				sweepSampleIndex = 0;
+			}
 		}
 	}
 
 	
 	/*
-	 * Play sweep
+	 * Play sweep and capture input, sample-accurately aligned
 	 */
 	
-	if (IRCapture.playSweep) {
+	if (IRCapture.state == IRCAP_CAPTURE) {
+		
+		int numSamples = std::min(currentHostBlockSize - sweepStartSample, sweepBuf.getNumSamples() - sweepSampleIndex);
 		
-		/* output sweep */
-		const float* readPtr = sweepBufArray.getReadBufferPtr()->getReadPointer(0, 0);
+		/* capture input first, the mic can share a channel of the buffer with the outputs */
+		if (micBuffer.getNumChannels() > 0)
+			tools::copySamples(inputCaptureBuffer.getWritePointer(0, sweepSampleIndex), micBuffer.getReadPointer(0, sweepStartSample), numSamples);
+		else
+			inputCaptureBuffer.clear(0, sweepSampleIndex, numSamples);
+		
+		/* output sweep, with silence before and after it in this block */
+		buffer.clear();
 		for (int channel = 0; channel < totalNumOutputChannels; channel++){
-			for (int sample = 0; sample < generalHostBlockSize; sample++){
-				buffer.setSample(channel, sample, *(readPtr + sample));
-			}
+			tools::copySamples(buffer.getWritePointer(channel, sweepStartSample), sweepBuf.getReadPointer(0, sweepSampleIndex), numSamples);
 		}
-		sweepBufArray.incrReadIndex();
+		sweepSampleIndex += numSamples;
 		
-		/* when sweep is done */
-		if (sweepBufArray.getReadIndex() == 0){
-			IRCapture.playSweep = false;
-			buffersWaitForResumeThroughput = samplesWaitBeforeInputCapture / 256;
-		}
-	}
+		/* when capture is done: the deconvolution is left to the print and thumbnail thread, see processCapture() */
+		if (sweepSampleIndex >= sweepBuf.getNumSamples()){
 
-	
-	/*
-	 * Capture / sweep done: empty buffers before resuming throughput
-	 */
-	
-	if (IRCapture.state == IRCAP_END) {
-		buffersWaitForResumeThroughput--;
+			capturedType = IRCapture.type;
+			IRCapture.type = IR_NONE;
+			IRCapture.state = IRCAP_END;
+			samplesWaitForResumeThroughput = samplesWaitBeforeInputCapture;
+			
+			/* run print thumbnail thread */
+			notify();
+			
+		} // when capture is done
+		
+	} // if (IRCapture.state == IRCAP_CAPTURE)
 
-		if (buffersWaitForResumeThroughput > 0){
-			buffer.clear();
-		}
-		else {
-			IRCapture.state = IRCAP_IDLE;
-			/* fade in on first buffer */
-			tools::linearFade (&buffer, true, 0, buffer.getNumSamples());
-		}
-	}
 	
 
 	
@@ -407,186 +459,125 @@ void IRBaboonAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffe
 	
 	if (IRCapture.state == IRCAP_IDLE) {
 
-		/* set IR to convolve with */
-		if (playFiltered)
-			IRtoConvolve = IRFiltPtr->getBuffer();
-		else
-			IRtoConvolve = &IRpulse;
+		convolver.setMorphAmount(*morphAmount);
 		
+		/* the staging buffers are sized for generalHostBlockSize, larger host blocks are convolved in pieces */
+		for (int startSample = 0; startSample < currentHostBlockSize; startSample += generalHostBlockSize){
 			
-		/*
-		 * Copy input to input buffers, and input buffers to audio fft array
-		 */
-	
-		for (int sample = 0; sample < currentHostBlockSize; sample++){
-			for (int channel = 0; channel < generalInputAudioChannels; channel++){
-				inputBufferArray.getWriteBufferPtr()->setSample(channel, inputBufferSampleIndex, buffer.getSample(channel, sample));
-			}
-			inputBufferSampleIndex++;
-			
-			/* when input buffer completed: copy to fft buffer array, perform fft, incr to next input buffers */
-			if (inputBufferSampleIndex >= processBlockSize){
-				
-				inputBufferArray.setReadIndex(inputBufferArray.getWriteIndex());
-				audioFftBufferArray.getWriteBufferPtr()->makeCopyOf(*inputBufferArray.getReadBufferPtr());
-				
-				
-				for (int channel = 0; channel < generalInputAudioChannels; channel++){
-					fftForward->performRealOnlyForwardTransform(audioFftBufferArray.getWriteBufferPtr()->getWritePointer(channel, 0), true);
-				}
-				audioFftBufferArray.incrWriteIndex();
-				
-				inputBufferArray.incrWriteIndex();
-				inputBufferArray.getWriteBufferPtr()->clear();
-				
-				inputBufferSampleIndex = 0;
-				blocksToProcess++;
-			}
+			int numSamples = std::min(generalHostBlockSize, currentHostBlockSize - startSample);
+			AudioBuffer<SampleType> piece (buffer.getArrayOfWritePointers(), buffer.getNumChannels(), startSample, numSamples);
+			convolve(piece);
 		}
 	
-		
-		/*
-		 * Process blocks
-		 */
+	} // if (IRCapture.state == IRCAP_IDLE)  [aka not playing sweep / capturing]
 	
-		while (blocksToProcess > 0){
-			
-			/* always read an IR block */
-			irFftBufferArray.getWriteBufferPtr()->clear();
-
-			irFftBufferArray.getWriteBufferPtr()->copyFrom(0, 0, *IRtoConvolve, 0, irFftBufferArray.getWriteIndex() * processBlockSize, processBlockSize);
-			
-			fftIR->performRealOnlyForwardTransform(irFftBufferArray.getWriteBufferPtr()->getWritePointer(0, 0), true);
-			
-			irFftBufferArray.incrWriteIndex();
-			
-			
-			
-			/* DSP loop */
-			convResultBufferArray.getWriteBufferPtr()->clear();
-			
-			audioFftBufferArray.setReadIndex(savedIndex);
-			audioFftBufferArray.incrReadIndex();
-			savedIndex = audioFftBufferArray.getReadIndex();
-			
-			for (int channel = 0; channel < generalInputAudioChannels; channel++) {
-				
-				float* overlapBufferPtr = overlapBuffer.getWritePointer(channel, 0);
-				float* convResultPtr = convResultBufferArray.getWriteBufferPtr()->getWritePointer(channel, 0);
-				
-				int irFftReadIndex = 0; // IR fft index should always start at 0 and not fold back, so its readIndex is not used
-				audioFftBufferArray.setReadIndex(savedIndex); // for iteration >1 of the channel
-				
-				while (irFftReadIndex < irFftBufferArray.getArraySize()){
-					
-					inplaceBuffer.makeCopyOf(*audioFftBufferArray.getReadBufferPtr());
-					float* inplaceBufferPtr = inplaceBuffer.getWritePointer(channel, 0);
-
-					const float* irFftPtr = irFftBufferArray.getBufferPtrAtIndex(irFftReadIndex)->getReadPointer(0, 0);
-					
-					/* complex multiplication of 1 audio fft block and 1 IR fft block */
-					for (int i = 0; i <= N; i += 2){
-						tools::complexMul(inplaceBufferPtr + i,
-											 inplaceBufferPtr + i + 1,
-											 irFftPtr[i],
-											 irFftPtr[i + 1]);
-					}
-					
-					/* sum multiplications in convolution result buffer */
-					for (int i = 0; i < fftBlockSize; i++){
-						convResultPtr[i] += inplaceBufferPtr[i];
-					}
-					irFftReadIndex++;
-					audioFftBufferArray.decrReadIndex();
-				}
-				
-				/* FDL method -> IFFT after summing */
-				fftInverse->performRealOnlyInverseTransform(convResultPtr);
-				
-				/* add existing overlap and save new overlap */
-				for (int i = 0; i < processBlockSize; i++){
-					convResultPtr[i] += overlapBufferPtr[i];
-					overlapBufferPtr[i] = convResultPtr[processBlockSize + i];
-				}
-				
-			} // end DSP loop
-			
-			convResultBufferArray.incrWriteIndex();
-			blocksToOutputBuffer++;
-			blocksToProcess--;
-			
-		} // end while() Process blocks
+		
+		
+	/* standard attenuation */
+	buffer.applyGain((SampleType) tools::dBToLin(outputVolumedB));
 	
 	
-		/*
-		 * Write completed convolution result blocks to output buffers
-		 */
+	/* makeshift limiter lol */
+	if (tools::linTodB(buffer.getMagnitude(0, 0, currentHostBlockSize)) > 0.0){
+		tools::normalize(&buffer, 0.0, false);
+		DBG("processBlock limiter engaged\n");
+	}
+	
+}
+
+
+
+
+/* stages the input of one host block (or a piece of one) into the convolver's blocks,
+ * and replaces it with the output of outputFifo, which is exactly the reported latency behind.
+ * The IR is handed to the convolver by publishIR(), and taken in convolver.process().
+ * In zero latency mode the direct taps follow the convolver's IR and crossfade, and are convolved straight
+ * from the input, in pieces that line up with the convolver's blocks */
+template <typename SampleType>
+void IRBaboonAudioProcessor::convolve(AudioBuffer<SampleType>& buffer){
 	
-		while (blocksToOutputBuffer > 0){
-			
-			for (int sample = 0; sample < processBlockSize; sample++){
-				if (outputBufferSampleIndex == 0)
-					outputBufferArray.getWriteBufferPtr()->clear();
-				for (int channel = 0; channel < generalInputAudioChannels; channel++) {
-				
-					outputBufferArray.getWriteBufferPtr()->setSample(channel, outputBufferSampleIndex,
-																	 convResultBufferArray.getReadBufferPtr()->getSample(channel, sample));
-				}
-				outputBufferSampleIndex++;
-				if (outputBufferSampleIndex >= generalHostBlockSize){
-					outputBufferArray.incrWriteIndex();
-					outputBufferSampleIndex = 0;
-				}
-			}
-			convResultBufferArray.incrReadIndex();
-			blocksToOutputBuffer--;
-		}
+	int numSamples = buffer.getNumSamples();
+	int blockSize = processBlockSize;
+	bool useDirectFIR = directHeadTaps > 0;
 	
+	/*
+	 * Copy input to the input block, and convolve every completed input block into the output fifo
+	 */
 	
-		/*
-		 * Output buffers to real output
-		 */
+	int sample = 0;
 	
-		for (int sample = 0; sample < currentHostBlockSize; sample++){
-			
-			for (int channel = 0; channel < generalInputAudioChannels; channel++)
-				buffer.setSample(channel, sample, outputBufferArray.getReadBufferPtr()->getSample(channel, outputSampleIndex));
-			
-			outputSampleIndex++;
-			if(outputSampleIndex >= generalHostBlockSize){
-				outputBufferArray.incrReadIndex();
-				outputSampleIndex = 0;
-			}
+	while (sample < numSamples){
+		
+		int numSamplesToCopy = std::min(numSamples - sample, blockSize - inputBufferSampleIndex);
+		
+		if (useDirectFIR){
+			directFIR.process(buffer, directOutputBuffer, sample, numSamplesToCopy,
+							  convolver.getIR(), convolver.getFadingOutIR(), convolver.getFadeGain());
 		}
-	
-	} // if (IRCapture.state == IRCAP_IDLE)  [aka not playing sweep / capturing]
-	
 		
+		for (int channel = 0; channel < generalInputAudioChannels; channel++){
+			tools::copySamples(inputBlockBuffer.getWritePointer(channel, inputBufferSampleIndex), buffer.getReadPointer(channel, sample), numSamplesToCopy);
+		}
+		inputBufferSampleIndex += numSamplesToCopy;
+		sample += numSamplesToCopy;
 		
-	/* standard attenuation */
-	buffer.applyGain(tools::dBToLin(outputVolumedB));
+		if (inputBufferSampleIndex >= blockSize){
+			convolver.process(inputBlockBuffer, convResultBuffer);
+			outputFifo.push(convResultBuffer, 0, blockSize);
+			inputBufferSampleIndex = 0;
+		}
+	}
 	
+	/* a share of the work of the next block, so that it isn't all left for the callback that completes it.
+	 * Offline only the total counts */
+	if (inputBufferSampleIndex > 0 && NOT renderMode)
+		convolver.processSlice(inputBufferSampleIndex);
 	
-	/* makeshift limiter lol */
-	if (tools::linTodB(buffer.getMagnitude(0, 0, generalHostBlockSize)) > 0.0){
-		tools::normalize(&buffer, 0.0, false);
-		DBG("processBlock limiter engaged\n");
+	/*
+	 * Output fifo to real output
+	 */
+	
+	if (outputFifo.pop(buffer, 0, numSamples) < numSamples)
+		DBG("convolve() error: output fifo ran dry.\n");
+	
+	/* the partitioned output lags exactly directHeadTaps samples, which is where the IR it got starts */
+	if (useDirectFIR){
+		for (int channel = 0; channel < generalOutputAudioChannels; channel++)
+			tools::addSamples(buffer.getWritePointer(channel, 0), directOutputBuffer.getReadPointer(channel, 0), numSamples);
 	}
-	
 }
 
 
 
 
-/* when plugin is bypassed, the latency of 1 processBlock should be maintained.
- * A CircularBufferArray is used for this.
+/* when plugin is bypassed, the latency should be maintained.
+ * The bypass fifo starts with the latency in silence, like the output fifo.
  */
 void IRBaboonAudioProcessor::processBlockBypassed(AudioBuffer<float>& buffer, MidiBuffer& midiMessages)
 {
-	bypassOutputBufferArray.getWriteBufferPtr()->makeCopyOf(buffer);
-	bypassOutputBufferArray.incrWriteIndex();
-	bypassOutputBufferArray.incrReadIndex();
-	buffer.makeCopyOf(*bypassOutputBufferArray.getReadBufferPtr());
+	bypassSamples(buffer);
+}
+
+
+void IRBaboonAudioProcessor::processBlockBypassed(AudioBuffer<double>& buffer, MidiBuffer& midiMessages)
+{
+	bypassSamples(buffer);
+}
+
+
+template <typename SampleType>
+void IRBaboonAudioProcessor::bypassSamples(AudioBuffer<SampleType>& buffer)
+{
+	int currentHostBlockSize = buffer.getNumSamples();
+	
+	for (int startSample = 0; startSample < currentHostBlockSize; startSample += generalHostBlockSize){
+		
+		int numSamples = std::min(generalHostBlockSize, currentHostBlockSize - startSample);
+		AudioBuffer<SampleType> piece (buffer.getArrayOfWritePointers(), buffer.getNumChannels(), startSample, numSamples);
+		
+		bypassFifo.push(piece, 0, numSamples);
+		bypassFifo.pop(piece, 0, numSamples);
+	}
 }
 
 
@@ -598,20 +589,255 @@ void IRBaboonAudioProcessor::startCapture(IRType type){
 	IRCapture.state = IRCAP_PREP;
 	IRCapture.doFadeout = true;
 
-	buffersWaitForInputCapture = samplesWaitBeforeInputCapture / processBlockSize;
+	samplesWaitForInputCapture = samplesWaitBeforeInputCapture;
 }
 
 
 
+/* the filter is deconvolved and partitioned by the print and thumbnail thread, after notify() */
 void IRBaboonAudioProcessor::createIRFilt(){
+	IRFiltNeedsUpdate = true;
+	requestPrint();
+}
+
+
+/* runs on the print and thumbnail thread: copies a finished capture out of the capture array, and deconvolves it.
+ * The audio thread only writes the capture array again after the next startCapture() and the silence before the sweep */
+void IRBaboonAudioProcessor::processCapture(){
+	
+	IRType type = capturedType.exchange(IR_NONE);
+	
+	/* the capture starts on the same sample as the sweep, so the IR starts at the round trip latency of the interface
+	 * and doesn't fold back. The capture is copied, the audio thread writes it again after the next startCapture()
+	 */
+	AudioSampleBuffer sweep (inputCaptureBuffer);
+	AudioSampleBuffer IR (convolution::deconvolve(&sweep, &sweepBufForDeconv, sampleRate));
+	
+	{
+		const ScopedLock IRBuffersScopedLock (IRBuffersLock);
+		
+		if (type == IR_TARGET) {
+			sweepTargPtr->getBuffer()->makeCopyOf(sweep);
+			IRTargPtr->getBuffer()->makeCopyOf(IR);
+		}
+		else if (type == IR_BASE) {
+			sweepBasePtr->getBuffer()->makeCopyOf(sweep);
+			IRBasePtr->getBuffer()->makeCopyOf(IR);
+		}
+	}
+	
+	saveIRCustomType = type;
+	
+	/* create filter if both target and base have been captured */
+	createIRFilt();
+}
+
+
+/* runs on the print and thumbnail thread. The target and base are copied, so that the message thread
+ * doesn't have to wait for the deconvolution */
+void IRBaboonAudioProcessor::updateIRFilt(){
+	
+	IRFiltNeedsUpdate = false;
+	
+	AudioSampleBuffer IRTarg, IRBase;
+	{
+		const ScopedLock IRBuffersScopedLock (IRBuffersLock);
+		IRTarg.makeCopyOf(*IRTargPtr->getBuffer());
+		IRBase.makeCopyOf(*IRBasePtr->getBuffer());
+	}
+	
+	if (IRTarg.getNumSamples() == 0 || IRBase.getNumSamples() == 0)
+		return;
+	
+	AudioSampleBuffer IRFilt (convolution::deconvolve(&IRTarg, &IRBase, sampleRate, true, includePhaseFilt, includeAmplFilt));
 	
-	IRFiltPtr->getBuffer()->makeCopyOf(convolution::deconvolve(IRTargPtr->getBuffer(),
-															   IRBasePtr->getBuffer(),
-															   sampleRate,
-															   true,
-															   includePhaseFilt,
-															   includeAmplFilt)
-									   );
+	{
+		const ScopedLock IRBuffersScopedLock (IRBuffersLock);
+		IRFiltPtr->getBuffer()->makeCopyOf(IRFilt);
+	}
+	
+	prepareIRFilt();
+}
+
+
+/* runs on the print and thumbnail thread, the only thread that writes the filter buffer */
+void IRBaboonAudioProcessor::prepareIRFilt(){
+	
+	IRFiltNeedsPreparing = false;
+	
+	/* the filter is truncated to the makeup size */
+	int partitionSize = processBlockSize;
+	int largestPartitionSize = maxPartitionSize;
+	int numDirectTaps = getNumDirectTaps(makeupIRLengthSamples);
+	int decimation = tailDecimation;
+	PreparedIR::Ptr newPreparedIR = new PreparedIR(*IRFiltPtr->getBuffer(), partitionSize, largestPartitionSize, makeupIRLengthSamples, true, numDirectTaps,
+												   decimation);
+	
+	/* prepareToPlay() changed the partition sizes, latency mode or tail decimation in the meantime, try again */
+	if (partitionSize != processBlockSize || largestPartitionSize != maxPartitionSize || numDirectTaps != getNumDirectTaps(makeupIRLengthSamples)
+		|| decimation != tailDecimation){
+		IRFiltNeedsPreparing = true;
+		return;
+	}
+	
+	{
+		const ScopedLock IRSelectionScopedLock (IRSelectionLock);
+		preparedIRFiltUnshaped = newPreparedIR;
+	}
+	
+	shapeIRFilt();
+}
+
+
+/* runs on the print and thumbnail thread: the filter to play, from the unshaped one. The morph is built on it, and published with it */
+void IRBaboonAudioProcessor::shapeIRFilt(){
+	
+	IRFiltNeedsShaping = false;
+	
+	PreparedIR::Ptr source;
+	{
+		const ScopedLock IRSelectionScopedLock (IRSelectionLock);
+		source = preparedIRFiltUnshaped;
+	}
+	
+	if (source == nullptr)
+		return;
+	
+	PreparedIR::Shape shape;
+	shape.contrast = filtContrast->get();
+	shape.tiltdBPerOctave = filtTilt->get();
+	shape.phaseFlattening = filtPhaseFlattening->get();
+	
+	float gainsdB[3] = { filtLowGain->get(), filtMidGain->get(), filtHighGain->get() };
+	if (gainsdB[0] != 0.0f || gainsdB[1] != 0.0f || gainsdB[2] != 0.0f){
+		for (int point = 0; point < 3; point++)
+			shape.gainCurve.push_back({ filtShapeFrequencies[point], gainsdB[point] });
+	}
+	
+	/* the filter samples are shaped as a whole, and prepared on the layout of the unshaped filter, so that they can replace each other.
+	 * This thread is the only one that writes the filter buffer */
+	PreparedIR::Ptr newPreparedIR = source;
+	if (NOT shape.isNeutral()){
+		AudioSampleBuffer& IRFilt = *IRFiltPtr->getBuffer();
+		AudioSampleBuffer shapedIR (IRFilt.getNumChannels(), source->getNumSamples());
+		shapedIR.clear();
+		for (int channel = 0; channel < IRFilt.getNumChannels(); channel++)
+			shapedIR.copyFrom(channel, 0, IRFilt, channel, 0, std::min(IRFilt.getNumSamples(), shapedIR.getNumSamples()));
+		PreparedIR::applyShape(shapedIR, shape, sampleRate);
+		newPreparedIR = new PreparedIR(shapedIR, *source);
+	}
+	
+	/* prepareToPlay() dropped the filter in the meantime */
+	{
+		const ScopedLock IRSelectionScopedLock (IRSelectionLock);
+		if (preparedIRFiltUnshaped != source)
+			return;
+		preparedIRFilt = newPreparedIR;
+	}
+	
+	prepareIRMorph();
+}
+
+
+/* the shape is taken by the print and thumbnail thread, which wakes up for it right away */
+void IRBaboonAudioProcessor::requestShaping(){
+	IRFiltNeedsShaping = true;
+	notify();
+}
+
+
+/* runs on the print and thumbnail thread: the pair of the morph source, prepared on the layout of the filter,
+ * and the morph of the two, starting at the current amount */
+void IRBaboonAudioProcessor::prepareIRMorph(){
+	
+	IRMorphNeedsPreparing = false;
+	
+	MorphSource source = (MorphSource) morphSource->getIndex();
+	PreparedIR::Ptr layout;
+	{
+		const ScopedLock IRSelectionScopedLock (IRSelectionLock);
+		layout = preparedIRFilt;
+	}
+	
+	PreparedIR::Ptr newPreparedIR;
+	
+	if (source != MORPH_OFF && layout != nullptr){
+		PreparedIR::Ptr from, to;
+		
+		if (source == MORPH_PULSE_FILTER){
+			from = new PreparedIR(IRpulse, *layout);
+			to = layout;
+		}
+		else {
+			AudioSampleBuffer IRTarg, IRBase;
+			{
+				const ScopedLock IRBuffersScopedLock (IRBuffersLock);
+				IRTarg.makeCopyOf(*IRTargPtr->getBuffer());
+				IRBase.makeCopyOf(*IRBasePtr->getBuffer());
+			}
+			from = new PreparedIR(IRBase, *layout);
+			to = new PreparedIR(IRTarg, *layout);
+		}
+		
+		PreparedIR::MorphMode mode = morphPolar->get() ? PreparedIR::morphPolar : PreparedIR::morphLinear;
+		
+		if (from->getNumChannels() > 0 && PreparedIR::isMorphable(*from, *to))
+			newPreparedIR = new PreparedIR(from, to, mode, *morphAmount);
+		else
+			DBG("prepareIRMorph() error: the IRs of the morph have different channels.\n");
+	}
+	
+	/* prepareToPlay() dropped the filter in the meantime, the morph follows the next one */
+	{
+		const ScopedLock IRSelectionScopedLock (IRSelectionLock);
+		if (preparedIRFilt != layout)
+			return;
+		preparedIRMorph = newPreparedIR;
+	}
+	
+	publishIR();
+}
+
+
+/* hands the IR to play to the convolver, which crossfades to it: the pulse for the unprocessed audio,
+ * and the morph or else the filter for the filtered audio. Not for the audio thread */
+void IRBaboonAudioProcessor::publishIR(){
+	
+	const ScopedLock IRSelectionScopedLock (IRSelectionLock);
+	
+	PreparedIR::Ptr IRToPlay = preparedIRpulse;
+	if (playFiltered && preparedIRMorph != nullptr)
+		IRToPlay = preparedIRMorph;
+	else if (playFiltered && preparedIRFilt != nullptr)
+		IRToPlay = preparedIRFilt;
+	playingIRTailLength = IRToPlay->getTailLength();
+	convolver.setIR(IRToPlay);
+}
+
+
+/* the print and thumbnail thread prints after this, and not on every wake-up */
+void IRBaboonAudioProcessor::requestPrint(){
+	printPending = true;
+	notify();
+}
+
+
+/* the taps of an IR that the DirectFIR convolves, the partitioned convolution gets the rest.
+ * Only in zero latency mode: the taps that the partitioned latency covers, or all of a short IR if that is cheaper */
+int IRBaboonAudioProcessor::getNumDirectTaps(int irSamples){
+	
+	int headTaps = directHeadTaps;
+	
+	if (headTaps == 0)
+		return 0;
+	if (irSamples <= headTaps)
+		return irSamples;
+	
+	float hybridCost = convolution::directFormCost(headTaps) + convolution::partitionedCost(irSamples - headTaps, processBlockSize, maxPartitionSize);
+	if (irSamples <= maxDirectOnlyTaps && convolution::directFormCost(irSamples) <= hybridCost)
+		return irSamples;
+	
+	return headTaps;
 }
 
 
@@ -628,18 +854,26 @@ int IRBaboonAudioProcessor::getSamplerate(){
 }
 
 
+int IRBaboonAudioProcessor::getNumMissedConvolutionDeadlines(){
+	return convolver.getNumMissedDeadlines();
+}
+
+
 bool IRBaboonAudioProcessor::filtReady(){
+	const ScopedLock IRBuffersScopedLock (IRBuffersLock);
 	return (IRFiltPtr->bufferNotEmpty());
 }
 
 
 AudioSampleBuffer IRBaboonAudioProcessor::getIRFilt(){
+	const ScopedLock IRBuffersScopedLock (IRBuffersLock);
 	return *IRFiltPtr->getBuffer();
 }
 
 
 void IRBaboonAudioProcessor::setPlayFiltered (bool filtered){
 	playFiltered = filtered;
+	publishIR();
 }
 
 
@@ -647,14 +881,30 @@ void IRBaboonAudioProcessor::setPlayFiltered (bool filtered){
 void IRBaboonAudioProcessor::run() {
 	while (NOT threadShouldExit()) {
 		
-		saveCustomExt(saveIRCustomType);
+		if (capturedType != IR_NONE)
+			processCapture();
+		if (IRFiltNeedsUpdate)
+			updateIRFilt();
+		if (IRFiltNeedsPreparing)
+			prepareIRFilt();
+		if (IRFiltNeedsShaping)
+			shapeIRFilt();
+		if (IRMorphNeedsPreparing)
+			prepareIRMorph();
 		
-		/* always print debug tsv and wav and thumbnails */
-		printDebug();
-		printThumbnails();
+		/* IRs the convolver has faded out are freed here, never on the audio thread */
+		convolver.releaseRetiredIRs();
 		
-		/* A negative timeout value means that the method will wait indefinitely (until notify() is called) */
-		wait (-1);
+		if (printPending.exchange(false)){
+			saveCustomExt(saveIRCustomType);
+			
+			/* always print debug tsv and wav and thumbnails */
+			printDebug();
+			printThumbnails();
+		}
+		
+		/* wakes up on notify(), or after a while to release retired IRs */
+		wait (50);
 	}
 }
 
@@ -712,24 +962,28 @@ void IRBaboonAudioProcessor::printDebug() {
 	ParallelBufferPrinter freqPrinter;
 
 	/* dereference the buffers */
-	AudioSampleBuffer sweepPrintTarg (*(sweepTargPtr->getBuffer()));
-	AudioSampleBuffer IRPrintTarg (*(IRTargPtr->getBuffer()));
-	AudioSampleBuffer sweepPrintBase (*(sweepBasePtr->getBuffer()));
-	AudioSampleBuffer IRPrintBase (*(IRBasePtr->getBuffer()));
-	AudioSampleBuffer IRPrintFilt (*(IRFiltPtr->getBuffer()));
+	AudioSampleBuffer sweepPrintTarg, IRPrintTarg, sweepPrintBase, IRPrintBase, IRPrintFilt;
+	{
+		const ScopedLock IRBuffersScopedLock (IRBuffersLock);
+		sweepPrintTarg.makeCopyOf(*(sweepTargPtr->getBuffer()));
+		IRPrintTarg.makeCopyOf(*(IRTargPtr->getBuffer()));
+		sweepPrintBase.makeCopyOf(*(sweepBasePtr->getBuffer()));
+		IRPrintBase.makeCopyOf(*(IRBasePtr->getBuffer()));
+		IRPrintFilt.makeCopyOf(*(IRFiltPtr->getBuffer()));
+	}
 
 	/* print freq */
 	if (IRPrintTarg.getNumSamples() > 0) {
-		AudioSampleBuffer IRrefprint_fft (tools::fftTransform(IRPrintTarg));
-		freqPrinter.appendBuffer("fft IR target", IRrefprint_fft);
+		HalfSpectrum IRrefprint_fft (tools::fftTransform(IRPrintTarg));
+		freqPrinter.appendBuffer("fft IR target", IRrefprint_fft.getBuffer());
 	}
 	if (IRPrintBase.getNumSamples() > 0) {
-		AudioSampleBuffer IRcurrprint_fft (tools::fftTransform(IRPrintBase));
-		freqPrinter.appendBuffer("fft IR base", IRcurrprint_fft);
+		HalfSpectrum IRcurrprint_fft (tools::fftTransform(IRPrintBase));
+		freqPrinter.appendBuffer("fft IR base", IRcurrprint_fft.getBuffer());
 	}
 	if (IRPrintFilt.getNumSamples() > 0) {
-		AudioSampleBuffer IRinvfiltprint_fft (tools::fftTransform(IRPrintFilt));
-		freqPrinter.appendBuffer("fft IR filter", IRinvfiltprint_fft);
+		HalfSpectrum IRinvfiltprint_fft (tools::fftTransform(IRPrintFilt));
+		freqPrinter.appendBuffer("fft IR filter", IRinvfiltprint_fft.getBuffer());
 	}
 	if (freqPrinter.getMaxBufferLength() > 0){
 		freqPrinter.printFreqToCsv(sampleRate, printDirectoryDebug);
@@ -751,11 +1005,15 @@ void IRBaboonAudioProcessor::printThumbnails() {
 	ParallelBufferPrinter wavPrinter;
 
 	/* dereference the buffers */
-	AudioSampleBuffer sweepPrintTarg (*(sweepTargPtr->getBuffer()));
-	AudioSampleBuffer IRPrintTarg (*(IRTargPtr->getBuffer()));
-	AudioSampleBuffer sweepPrintBase (*(sweepBasePtr->getBuffer()));
-	AudioSampleBuffer IRPrintBase (*(IRBasePtr->getBuffer()));
-	AudioSampleBuffer IRPrintFilt (*(IRFiltPtr->getBuffer()));
+	AudioSampleBuffer sweepPrintTarg, IRPrintTarg, sweepPrintBase, IRPrintBase, IRPrintFilt;
+	{
+		const ScopedLock IRBuffersScopedLock (IRBuffersLock);
+		sweepPrintTarg.makeCopyOf(*(sweepTargPtr->getBuffer()));
+		IRPrintTarg.makeCopyOf(*(IRTargPtr->getBuffer()));
+		sweepPrintBase.makeCopyOf(*(sweepBasePtr->getBuffer()));
+		IRPrintBase.makeCopyOf(*(IRBasePtr->getBuffer()));
+		IRPrintFilt.makeCopyOf(*(IRFiltPtr->getBuffer()));
+	}
 	
 	// create target sweep & IR file for thumbnail
 	AudioSampleBuffer thumbnailTarg (2, std::max(sweepPrintTarg.getNumSamples(), IRPrintTarg.getNumSamples()));
@@ -815,19 +1073,19 @@ std::string IRBaboonAudioProcessor::getSavedIRExtension(){
 
 void IRBaboonAudioProcessor::setZoomTarg(float dB){
 	zoomTargdB = dB;
-	notify();
+	requestPrint();
 }
 
 
 void IRBaboonAudioProcessor::setZoomBase(float dB){
 	zoomBasedB = dB;
-	notify();
+	requestPrint();
 }
 
 
 void IRBaboonAudioProcessor::setZoomFilt(float dB){
 	zoomFiltdB = dB;
-	notify();
+	requestPrint();
 }
 
 
@@ -839,23 +1097,13 @@ void IRBaboonAudioProcessor::setOutputVolume(float dB){
 
 void IRBaboonAudioProcessor::setPhaseFilt(bool includePhase){
 	includePhaseFilt = includePhase;
-	
-	if (IRTargPtr->bufferNotEmpty() && IRBasePtr->bufferNotEmpty()){
-		createIRFilt();
-	}
-	
-	notify();
+	createIRFilt();
 }
 
 
 void IRBaboonAudioProcessor::setAmplFilt(bool includeAmplitude){
 	includeAmplFilt = includeAmplitude;
-	
-	if (IRTargPtr->bufferNotEmpty() && IRBasePtr->bufferNotEmpty()){
-		createIRFilt();
-	}
-	
-	notify();
+	createIRFilt();
 }
 
 
@@ -864,33 +1112,48 @@ void IRBaboonAudioProcessor::setPresweepSilence(int presweepSilence){
 }
 
 
+/* 0 = follow the host block size. Takes effect in the next prepareToPlay(), which sets the latency */
+void IRBaboonAudioProcessor::setPartitionSize(int partitionSize){
+	partitionSizeSetting = partitionSize > 0 ? jlimit(minPartitionSize, maxHeadPartitionSize, partitionSize) : 0;
+}
+
+
+int IRBaboonAudioProcessor::getPartitionSize(){
+	return processBlockSize;
+}
+
+
+/* the FIR head covers the latency of the partitioned convolution. Takes effect in the next prepareToPlay() */
+void IRBaboonAudioProcessor::setZeroLatency(bool zeroLatency){
+	zeroLatencySetting = zeroLatency;
+}
+
+
+/* the filter is only truncated to the makeup size when it is prepared, so it isn't deconvolved again */
 void IRBaboonAudioProcessor::setMakeupSize(int makeupSize){
 	makeupIRLengthSamples = makeupSize;
-	
-	if (IRTargPtr->bufferNotEmpty() && IRBasePtr->bufferNotEmpty()){
-		createIRFilt();
+	if (filtReady()){
+		IRFiltNeedsPreparing = true;
+		notify();
 	}
-
-	notify();
 }
 
 
 void IRBaboonAudioProcessor::swapTargetBase(){
 	
-	AudioSampleBuffer savedSweep (*(sweepTargPtr->getBuffer()));
-	AudioSampleBuffer savedIR (*(IRTargPtr->getBuffer()));
-	sweepTargPtr->getBuffer()->makeCopyOf(*(sweepBasePtr->getBuffer()));
-	IRTargPtr->getBuffer()->makeCopyOf(*(IRBasePtr->getBuffer()));
-	sweepBasePtr->getBuffer()->makeCopyOf(savedSweep);
-	IRBasePtr->getBuffer()->makeCopyOf(savedIR);
-
-	/* generate new makeup */
-	if (IRTargPtr->bufferNotEmpty() && IRBasePtr->bufferNotEmpty()){
-		createIRFilt();
+	{
+		const ScopedLock IRBuffersScopedLock (IRBuffersLock);
+		
+		AudioSampleBuffer savedSweep (*(sweepTargPtr->getBuffer()));
+		AudioSampleBuffer savedIR (*(IRTargPtr->getBuffer()));
+		sweepTargPtr->getBuffer()->makeCopyOf(*(sweepBasePtr->getBuffer()));
+		IRTargPtr->getBuffer()->makeCopyOf(*(IRBasePtr->getBuffer()));
+		sweepBasePtr->getBuffer()->makeCopyOf(savedSweep);
+		IRBasePtr->getBuffer()->makeCopyOf(savedIR);
 	}
-	
-	/* reprint */
-	notify();
+
+	/* generate new makeup, and reprint */
+	createIRFilt();
 }
 
 
@@ -905,26 +1168,25 @@ void IRBaboonAudioProcessor::loadTarget(File file){
 	File fileToLoad (pathWav);
 	AudioSampleBuffer sweepAndIR (tools::fileToBuffer(fileToLoad));
 	
-	if (IRTargPtr->getBuffer()->getNumSamples() == 0){
-		sweepTargPtr->getBuffer()->setSize(1, totalSweepBreakSamples);
-		IRTargPtr->getBuffer()->setSize(1, totalSweepBreakSamples);
-	}
-	
-	sweepTargPtr->getBuffer()->clear();
-	sweepTargPtr->getBuffer()->copyFrom(0, 0, sweepAndIR, 0, 0, totalSweepBreakSamples);
-	IRTargPtr->getBuffer()->clear();
-	IRTargPtr->getBuffer()->copyFrom(0, 0, sweepAndIR, 1, 0, totalSweepBreakSamples);
-	
-	/* generate new makeup */
-	if (IRTargPtr->bufferNotEmpty() && IRBasePtr->bufferNotEmpty()){
-		createIRFilt();
+	{
+		const ScopedLock IRBuffersScopedLock (IRBuffersLock);
+		
+		if (IRTargPtr->getBuffer()->getNumSamples() == 0){
+			sweepTargPtr->getBuffer()->setSize(1, totalSweepBreakSamples);
+			IRTargPtr->getBuffer()->setSize(1, totalSweepBreakSamples);
+		}
+		
+		sweepTargPtr->getBuffer()->clear();
+		sweepTargPtr->getBuffer()->copyFrom(0, 0, sweepAndIR, 0, 0, totalSweepBreakSamples);
+		IRTargPtr->getBuffer()->clear();
+		IRTargPtr->getBuffer()->copyFrom(0, 0, sweepAndIR, 1, 0, totalSweepBreakSamples);
 	}
 	
 	/* rerename wav */
 	boost::filesystem::rename(pathWav, pathCustomExtension);
 	
-	/* reprint */
-	notify();
+	/* generate new makeup, and reprint */
+	createIRFilt();
 }
 
 
@@ -941,17 +1203,58 @@ AudioProcessorEditor* IRBaboonAudioProcessor::createEditor()
 }
 
 //==============================================================================
+/* the state is the normalised value of every parameter, by parameter ID. Parameters that a state doesn't have keep their value */
 void IRBaboonAudioProcessor::getStateInformation (MemoryBlock& destData)
 {
-    // You should use this method to store your parameters in the memory block.
-    // You could do that either as raw data, or use the XML or ValueTree classes
-    // as intermediaries to make it easy to save and load complex data.
+	XmlElement state ("IRBaboonState");
+	
+	for (AudioProcessorParameter* parameter : getParameters()){
+		if (auto* parameterWithID = dynamic_cast<AudioProcessorParameterWithID*> (parameter))
+			state.setAttribute (parameterWithID->paramID, parameterWithID->getValue());
+	}
+	
+	copyXmlToBinary (state, destData);
 }
 
 void IRBaboonAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    // You should use this method to restore your parameters from this memory block,
-    // whose contents will have been created by the getStateInformation() call.
+	std::unique_ptr<XmlElement> state (getXmlFromBinary (data, sizeInBytes));
+	
+	if (state == nullptr || NOT state->hasTagName ("IRBaboonState"))
+		return;
+	
+	for (AudioProcessorParameter* parameter : getParameters()){
+		auto* parameterWithID = dynamic_cast<AudioProcessorParameterWithID*> (parameter);
+		if (parameterWithID != nullptr && state->hasAttribute (parameterWithID->paramID))
+			parameterWithID->setValueNotifyingHost ((float) state->getDoubleAttribute (parameterWithID->paramID));
+	}
+}
+
+//==============================================================================
+/* called on whichever thread changed a parameter, the audio thread included, so the IRs it affects are only flagged
+ * for the print and thumbnail thread to rebuild. The partition threshold and double accumulation go to the convolver, which takes them on any thread.
+ * The other parameters are read where they are used */
+void IRBaboonAudioProcessor::parameterValueChanged (int parameterIndex, float newValue)
+{
+	if (parameterIndex == morphSource->getParameterIndex() || parameterIndex == morphPolar->getParameterIndex()){
+		IRMorphNeedsPreparing = true;
+		notify();
+	}
+	else if (parameterIndex == partitionThreshold->getParameterIndex()){
+		convolver.setPartitionThreshold (partitionThreshold->get());
+	}
+	else if (parameterIndex == doubleAccumulation->getParameterIndex()){
+		convolver.setDoubleAccumulation (doubleAccumulation->get());
+	}
+	else if (parameterIndex == filtContrast->getParameterIndex() || parameterIndex == filtTilt->getParameterIndex()
+			 || parameterIndex == filtLowGain->getParameterIndex() || parameterIndex == filtMidGain->getParameterIndex()
+			 || parameterIndex == filtHighGain->getParameterIndex() || parameterIndex == filtPhaseFlattening->getParameterIndex()){
+		requestShaping();
+	}
+}
+
+void IRBaboonAudioProcessor::parameterGestureChanged (int parameterIndex, bool gestureIsStarting)
+{
 }
 
 //==============================================================================
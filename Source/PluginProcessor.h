@@ -12,7 +12,7 @@
 
 
 
-class IRBaboonAudioProcessor  : public AudioProcessor, public Thread
+class IRBaboonAudioProcessor  : public AudioProcessor, public AudioProcessorParameter::Listener, public Thread
 {
 public:
 	
@@ -60,10 +60,16 @@ public:
 		IRCAP_END,
 	};
 	
+	/* the pair of IRs that the morph amount blends between, see prepareIRMorph(). The choices of the morph source parameter */
+	enum MorphSource {
+		MORPH_OFF,
+		MORPH_PULSE_FILTER,
+		MORPH_BASE_TARGET
+	};
+	
 	struct IRCapStruct {
 		IRType 	type;
 		IRCapState	state;
-		bool		playSweep;
 		bool 		doFadeout;
 	};
 	
@@ -77,8 +83,11 @@ public:
     bool isBusesLayoutSupported (const BusesLayout& layouts) const override;
    #endif
 
-    void processBlock (AudioBuffer<float>&, MidiBuffer&) override;
+    void processBlock (AudioBuffer<float>&, MidiBuffer&) override;
+    void processBlock (AudioBuffer<double>&, MidiBuffer&) override;
 	void processBlockBypassed(AudioBuffer<float>& buffer, MidiBuffer& midiMessages) override;
+	void processBlockBypassed(AudioBuffer<double>& buffer, MidiBuffer& midiMessages) override;
+	bool supportsDoublePrecisionProcessing() const override;
 
 	void startCapture(IRType type);
 
@@ -87,6 +96,7 @@ public:
 	int getTotalSweepBreakSamples();
 	int getMakeupIRLengthSamples();
 	int getSamplerate();
+	int getNumMissedConvolutionDeadlines();
 	bool filtReady();
 	AudioSampleBuffer getIRFilt();
 	
@@ -105,6 +115,9 @@ public:
 	void setAmplFilt(bool includeAmplitude);
 	void setPresweepSilence(int presweepSilence);
 	void setMakeupSize(int makeupSize);
+	void setPartitionSize(int partitionSize);
+	int getPartitionSize();
+	void setZeroLatency(bool zeroLatency);
 	void swapTargetBase();
 	void loadTarget(File file);
 
@@ -126,6 +139,9 @@ public:
 
     void getStateInformation (MemoryBlock& destData) override;
     void setStateInformation (const void* data, int sizeInBytes) override;
+
+	void parameterValueChanged (int parameterIndex, float newValue) override;
+	void parameterGestureChanged (int parameterIndex, bool gestureIsStarting) override;
 
 	
 	
@@ -139,13 +155,14 @@ private:
 	int sweepLengthSamples = totalSweepBreakSamples - silenceEndLengthSamples;
 	
 	int samplesWaitBeforeInputCapture = 16384;
-	int buffersWaitForInputCapture = 0;
-	int buffersWaitForResumeThroughput = 0;
+	int samplesWaitForInputCapture = 0;
+	int samplesWaitForResumeThroughput = 0;
 	
 	AudioSampleBuffer sweepBuf;
 	AudioSampleBuffer sweepBufForDeconv;
-	CircularBufferArray sweepBufArray;
-	CircularBufferArray inputCaptureArray;
+	/* the sweep is played and the mic is captured from the same sample on, sweepSampleIndex samples into sweepBuf */
+	AudioSampleBuffer inputCaptureBuffer;
+	int sweepSampleIndex = 0;
 
 	int makeupIRLengthSamples = 2048;
 	
@@ -157,11 +174,39 @@ private:
 	ReferenceCountedBuffer::Ptr IRBasePtr;
 	ReferenceCountedBuffer::Ptr IRFiltPtr;
 	AudioSampleBuffer IRpulse;
-	AudioSampleBuffer* IRtoConvolve;
+	
+	/* the target, base and filter buffers are written by the message thread and the print and thumbnail thread,
+	 * never by the audio thread */
+	CriticalSection IRBuffersLock;
+	
+	/* partition spectra of the IRs, built by the print and thumbnail thread.
+	 * The one to play is handed to the convolver by publishIR(), which frees the old one on the print and thumbnail thread */
+	PreparedIR::Ptr preparedIRpulse;
+	PreparedIR::Ptr preparedIRFilt;
+	PreparedIR::Ptr preparedIRFiltUnshaped;
+	CriticalSection IRSelectionLock;
+	std::atomic<bool> IRFiltNeedsUpdate { false };
+	std::atomic<int> playingIRTailLength { 0 };		// for getTailLengthSeconds()
+	std::atomic<bool> IRFiltNeedsPreparing { false };
+	
+	/* morph mode: instead of the filter, a PreparedIR that blends the spectra of the pair of IRs of morphSource is played.
+	 * The convolver moves it to the automatable amount a few partitions per block, so no second convolution runs.
+	 * The pair is prepared on the layout of the filter, so there is only a morph while there is a filter,
+	 * and like the filter it is only played with the filtered audio. A change of source or mode rebuilds it, see parameterValueChanged() */
+	AudioParameterFloat* morphAmount;
+	AudioParameterChoice* morphSource;
+	AudioParameterBool* morphPolar;
+	PreparedIR::Ptr preparedIRMorph;
+	std::atomic<bool> IRMorphNeedsPreparing { false };
+	
+	/* type of a capture that the audio thread finished, for processCapture() */
+	std::atomic<IRType> capturedType { IR_NONE };
+	std::atomic<bool> printPending { false };
 	
 	bool playFiltered = false;
 	
 	int generalInputAudioChannels = 2;
+	int generalOutputAudioChannels = 2;
 	int inputCaptureChannel = 2;
 	
 	
@@ -186,35 +231,88 @@ private:
 	float zoomBasedB = 0.0;
 	float zoomFiltdB = 0.0;
 	
-	bool includePhaseFilt = true;
-	bool includeAmplFilt = true;
+	/* whether the filter is deconvolved with the phase and the amplitude of the target over the base, see createIRFilt() */
+	std::atomic<bool> includePhaseFilt { true };
+	std::atomic<bool> includeAmplFilt { true };
+	
+	/* the deconvolved filter is shaped as a whole by the print and thumbnail thread (see PreparedIR::Shape),
+	 * so a change costs one FFT of the filter and no deconvolution, see parameterValueChanged(). The gains are the points of the gain curve,
+	 * at filtShapeFrequencies */
+	AudioParameterFloat* filtContrast;
+	AudioParameterFloat* filtTilt;
+	AudioParameterFloat* filtLowGain;
+	AudioParameterFloat* filtMidGain;
+	AudioParameterFloat* filtHighGain;
+	AudioParameterFloat* filtPhaseFlattening;
+	const float filtShapeFrequencies[3] = { 100.0f, 1000.0f, 10000.0f };
+	std::atomic<bool> IRFiltNeedsShaping { false };
 
 	
 	
 	// ====== convolution ==========
-	int irPartitions;
+	/* partition size of the head of the convolution, chosen in prepareToPlay().
+	 * partitionSizeSetting 0 means it follows the host block size */
+	std::atomic<int> processBlockSize { 256 };
+	int partitionSizeSetting = 0;
 	
-	const int processBlockSize = 256;
-	int N, fftBlockSize;
-
-	CircularBufferArray inputBufferArray;
-	CircularBufferArray audioFftBufferArray;
-	CircularBufferArray irFftBufferArray;
+	/* offline rendering, see prepareToPlay(). It keeps the partitioned latency of the last realtime prepareToPlay(), if there was one */
+	bool renderMode = false;
+	int realtimePartitionedLatency = 0;
+	const int minPartitionSize = 32;
+	const int maxHeadPartitionSize = 4096;
+	
+	/* the largest partition size and the number of worker threads are planned in prepareToPlay(), by timing the candidates
+	 * on this machine the first time a configuration comes up (see ConvolutionPlanner). The plans are kept in the user's wisdom file */
+	const int maxPartitionSizeLimit = 8192;
+	std::atomic<int> maxPartitionSize { 8192 };
+	ConvolutionPlanner convolutionPlanner;
+	
+	/* zero latency mode: the first directHeadTaps taps of the IR are convolved by the DirectFIR,
+	 * which covers the latency of the partitioned convolution of the rest */
+	bool zeroLatencySetting = false;
+	bool zeroLatency = false;
+	std::atomic<int> directHeadTaps { 0 };
+	const int maxDirectTaps = 1024;
+	const int maxDirectOnlyTaps = 512;
+	DirectFIR directFIR;
+	AudioSampleBuffer directOutputBuffer;
+	const int maxMakeupIRLengthSamples = 32768;
+	
+	/* multirate tail: the part of the IR after a split found per IR is convolved at 1 / tailDecimation of the sample rate
+	 * (see PreparedIR). The setting is off, 2 or 4, and is taken in prepareToPlay() */
+	AudioParameterChoice* tailDecimationSetting;
+	std::atomic<int> tailDecimation { 1 };
+	const int maxConvolutionWorkerThreads = 2;
 	
-	dsp::FFT *fftIR, *fftForward, *fftInverse;
-	AudioSampleBuffer inplaceBuffer;
-	AudioSampleBuffer overlapBuffer;
+	PartitionedConvolver convolver;
 	
-	CircularBufferArray convResultBufferArray;
-	CircularBufferArray outputBufferArray;
-	CircularBufferArray bypassOutputBufferArray;
+	/* IR partitions this far below their whole IR channel, in dB, are skipped by the convolver
+	 * (see PartitionedConvolver::setPartitionThreshold()). Takes effect right away */
+	AudioParameterFloat* partitionThreshold;
+	
+	/* the convolver sums its partitions in double (see PartitionedConvolver::setDoubleAccumulation()), for deep filters,
+	 * whatever precision the host processes in. Takes effect right away, and is planned for in the next prepareToPlay() */
+	AudioParameterBool* doubleAccumulation;
+
+	/* the input is gathered into processBlockSize blocks for the convolver, and the results queue in outputFifo,
+	 * which starts with the latency in silence. Host blocks of any size up to generalHostBlockSize are staged in one go,
+	 * larger ones in pieces */
+	AudioSampleBuffer inputBlockBuffer;
+	AudioSampleBuffer convResultBuffer;
+	AudioBufferFifo outputFifo;
+	AudioBufferFifo bypassFifo;
 	
 	int inputBufferSampleIndex = 0;
-	int outputBufferSampleIndex = 0;
-	int outputSampleIndex = 0;
-	int blocksToProcess = 0;
-	int blocksToOutputBuffer = 0;
-	int savedIndex = 0;
+	int outputDelayBlocks = 1;
+	
+	/* processBlock() and processBlockBypassed(), for float and double buffers. The convolver keeps float spectra,
+	 * double samples are rounded where they go into it and the direct taps, and converted back on the way out */
+	template <typename SampleType>
+	void processSamples(AudioBuffer<SampleType>& buffer);
+	template <typename SampleType>
+	void bypassSamples(AudioBuffer<SampleType>& buffer);
+	template <typename SampleType>
+	void convolve(AudioBuffer<SampleType>& buffer);
 	
 	
 	/* Print and thumbnail thread */
@@ -224,6 +322,15 @@ private:
 	void saveCustomExt(IRType type);
 	void printDebug();
 	void printThumbnails();
+	void processCapture();
+	void updateIRFilt();
+	void prepareIRFilt();
+	void shapeIRFilt();
+	void requestShaping();
+	void prepareIRMorph();
+	void publishIR();
+	void requestPrint();
+	int getNumDirectTaps(int irSamples);
 
 	
 	// ====== debug ==========
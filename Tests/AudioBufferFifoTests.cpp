@@ -0,0 +1,180 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+#include <fp_include_all.hpp>
+#include <JuceHeader.h>
+
+
+namespace fp {
+
+
+/* Streams numbered samples through an AudioBufferFifo in pieces of every size, and checks that they come out in order:
+ * across the fold back of the buffer, with writes to a full queue and reads from an empty one cut short,
+ * with silence pushed in between, and in float and double */
+class AudioBufferFifoTests : public UnitTest {
+public:
+	AudioBufferFifoTests() : UnitTest ("AudioBufferFifo", "IRBaboon") {}
+	
+	void runTest() override {
+		beginTest ("wrap-around");
+		checkWrapAround();
+		
+		beginTest ("partial write to a full queue");
+		checkPartialWrite();
+		
+		beginTest ("partial read from an empty queue");
+		checkPartialRead();
+		
+		beginTest ("silence");
+		checkSilence();
+		
+		beginTest ("random pieces, float");
+		checkRandomPieces<float>();
+		
+		beginTest ("random pieces, double");
+		checkRandomPieces<double>();
+	}
+	
+private:
+	static const int numChannels = 2;
+	static const int capacity = 100;
+	
+	Random random { 2021 };
+	
+	/* sample n of channel c of the stream, exact in float */
+	static float streamSample (int channel, int64 n){
+		return (float) (n % 65536) + (channel == 0 ? 0.0f : 0.5f);
+	}
+	
+	template <typename SampleType>
+	AudioBuffer<SampleType> stream (int64 firstSample, int numSamples){
+		AudioBuffer<SampleType> buffer (numChannels, numSamples);
+		for (int channel = 0; channel < numChannels; channel++)
+			for (int sample = 0; sample < numSamples; sample++)
+				buffer.setSample (channel, sample, (SampleType) streamSample (channel, firstSample + sample));
+		return buffer;
+	}
+	
+	/* whether numSamples of buffer from startSample on are the stream from firstSample on */
+	template <typename SampleType>
+	bool isStream (const AudioBuffer<SampleType>& buffer, int startSample, int numSamples, int64 firstSample){
+		for (int channel = 0; channel < numChannels; channel++)
+			for (int sample = 0; sample < numSamples; sample++)
+				if (buffer.getSample (channel, startSample + sample) != (SampleType) streamSample (channel, firstSample + sample))
+					return false;
+		return true;
+	}
+	
+	template <typename SampleType>
+	bool isSilent (const AudioBuffer<SampleType>& buffer, int startSample, int numSamples){
+		for (int channel = 0; channel < numChannels; channel++)
+			for (int sample = 0; sample < numSamples; sample++)
+				if (buffer.getSample (channel, startSample + sample) != (SampleType) 0)
+					return false;
+		return true;
+	}
+	
+	/* the second write and the reads after it fold back over the end of the buffer */
+	void checkWrapAround(){
+		AudioBufferFifo fifo (numChannels, capacity);
+		AudioBuffer<float> output (numChannels, capacity);
+		
+		expectEquals (fifo.push (stream<float> (0, 70), 0, 70), 70);
+		expectEquals (fifo.pop (output, 0, 50), 50);
+		expect (isStream (output, 0, 50, 0));
+		
+		expectEquals (fifo.push (stream<float> (70, 70), 0, 70), 70);
+		expectEquals (fifo.getNumReady(), 90);
+		expectEquals (fifo.getFreeSpace(), capacity - 90);
+		
+		expectEquals (fifo.pop (output, 0, 45), 45);
+		expectEquals (fifo.pop (output, 45, 45), 45);
+		expect (isStream (output, 0, 90, 50), "the samples across the fold back are out of order");
+		expectEquals (fifo.getNumReady(), 0);
+	}
+	
+	/* only what fits is written, from the start of the source */
+	void checkPartialWrite(){
+		AudioBufferFifo fifo (numChannels, capacity);
+		AudioBuffer<float> output (numChannels, capacity);
+		
+		expectEquals (fifo.push (stream<float> (0, 60), 0, 60), 60);
+		expectEquals (fifo.pop (output, 0, 30), 30);
+		
+		AudioBuffer<float> source = stream<float> (60, 100);
+		expectEquals (fifo.push (source, 0, 100), capacity - 30);
+		expectEquals (fifo.getFreeSpace(), 0);
+		expectEquals (fifo.push (source, 0, 1), 0);
+		
+		expectEquals (fifo.pop (output, 0, capacity), capacity);
+		expect (isStream (output, 0, capacity, 30), "a write to a full queue changed what was in it");
+	}
+	
+	/* what is there is read, and the rest of the destination is cleared */
+	void checkPartialRead(){
+		AudioBufferFifo fifo (numChannels, capacity);
+		AudioBuffer<float> output = stream<float> (1000, capacity);
+		
+		expectEquals (fifo.push (stream<float> (0, 80), 0, 80), 80);
+		expectEquals (fifo.pop (output, 0, 50), 50);
+		
+		/* 30 left, across the fold back after another write */
+		expectEquals (fifo.push (stream<float> (80, 40), 0, 40), 40);
+		expectEquals (fifo.pop (output, 10, 90), 70);
+		expect (isStream (output, 10, 70, 50));
+		expect (isSilent (output, 80, 20), "the part of the destination that wasn't read isn't cleared");
+		expect (isStream (output, 0, 10, 0), "samples before startSample were touched");
+		
+		expectEquals (fifo.pop (output, 0, 10), 0);
+		expect (isSilent (output, 0, 10));
+	}
+	
+	void checkSilence(){
+		AudioBufferFifo fifo (numChannels, capacity);
+		AudioBuffer<float> output (numChannels, capacity);
+		
+		expectEquals (fifo.push (stream<float> (0, 90), 0, 90), 90);
+		expectEquals (fifo.pop (output, 0, 90), 90);
+		expectEquals (fifo.pushSilence (20), 20);
+		expectEquals (fifo.push (stream<float> (20, 30), 0, 30), 30);
+		expectEquals (fifo.pushSilence (capacity), capacity - 50);
+		
+		expectEquals (fifo.pop (output, 0, capacity), capacity);
+		expect (isSilent (output, 0, 20));
+		expect (isStream (output, 20, 30, 20));
+		expect (isSilent (output, 50, capacity - 50));
+	}
+	
+	/* pieces of random sizes in and out, like host blocks into partitions and back, over many fold backs.
+	 * Double goes in and out in double, so it needs to pass unchanged as well */
+	template <typename SampleType>
+	void checkRandomPieces(){
+		AudioBufferFifo fifo (numChannels, capacity);
+		AudioBuffer<SampleType> output (numChannels, capacity);
+		int64 numPushed = 0, numPopped = 0;
+		bool inOrder = true;
+		
+		for (int i = 0; i < 2000; i++){
+			const int numToPush = random.nextInt (capacity + 1);
+			const int numPushable = jmin (numToPush, capacity - (int) (numPushed - numPopped));
+			expectEquals (fifo.push (stream<SampleType> (numPushed, numToPush), 0, numToPush), numPushable);
+			numPushed += numPushable;
+			
+			const int numToPop = random.nextInt (capacity + 1);
+			const int numPoppable = jmin (numToPop, (int) (numPushed - numPopped));
+			expectEquals (fifo.pop (output, 0, numToPop), numPoppable);
+			inOrder &= isStream (output, 0, numPoppable, numPopped);
+			inOrder &= isSilent (output, numPoppable, numToPop - numPoppable);
+			numPopped += numPoppable;
+		}
+		
+		expect (inOrder, "the samples came out of order");
+		expectEquals (fifo.getNumReady(), (int) (numPushed - numPopped));
+	}
+};
+
+static AudioBufferFifoTests audioBufferFifoTests;
+
+
+} // fp
@@ -0,0 +1,373 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+#include <fp_include_all.hpp>
+#include <JuceHeader.h>
+
+
+namespace fp {
+
+
+/* The benchmarks run with IRBaboonTests --benchmark [name], and print their timings. They only fail if what they time
+ * gives a wrong result, or if the callback timing misses its target. Times are the best of a few runs, in microseconds per call
+ * unless noted otherwise */
+
+namespace {
+
+	Random benchmarkRandom (2021);
+
+	std::vector<float> noise (int numFloats){
+		std::vector<float> floats (numFloats);
+		for (float& x : floats)
+			x = 2.0f * benchmarkRandom.nextFloat() - 1.0f;
+		return floats;
+	}
+
+	/* the shortest of numRuns runs of numCalls calls of call, in microseconds per call */
+	template <typename Call>
+	double bestMicroseconds (int numRuns, int numCalls, Call call){
+		double best = std::numeric_limits<double>::max();
+		for (int run = 0; run < numRuns; run++){
+			int64 startTicks = Time::getHighResolutionTicks();
+			for (int i = 0; i < numCalls; i++)
+				call();
+			best = jmin (best, Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks) * 1.0e6 / numCalls);
+		}
+		return best;
+	}
+
+	/* numSamples of stereo input through convolver in blocks of its block size, in seconds */
+	double convolveSeconds (PartitionedConvolver& convolver, AudioBuffer<float>& input){
+		const int blockSize = convolver.getBlockSize();
+		AudioBuffer<float> block (input.getNumChannels(), blockSize);
+		
+		int64 startTicks = Time::getHighResolutionTicks();
+		for (int position = 0; position + blockSize <= input.getNumSamples(); position += blockSize){
+			for (int channel = 0; channel < input.getNumChannels(); channel++)
+				block.copyFrom (channel, 0, input, channel, position, blockSize);
+			convolver.process (block, block);
+		}
+		return Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks);
+	}
+
+}
+
+
+/* float against double accumulation of the partition products (see PartitionedConvolver::setDoubleAccumulation()):
+ * the kernels, the error of the engine on a deep filter whose partitions cancel each other out, and the cost of the engine */
+class AccumulationBenchmark : public UnitTest {
+public:
+	AccumulationBenchmark() : UnitTest ("Accumulation", "Benchmarks") {}
+	
+	void runTest() override {
+		beginTest ("kernels, 40 partitions of 1025 bins");
+		{
+			const int numPartitions = 40, numBins = 1025, imagOffset = 1088;
+			std::vector<float> spectra = noise (2 * numPartitions * 2 * imagOffset);
+			std::vector<const float*> a, b;
+			for (int partition = 0; partition < numPartitions; partition++){
+				a.push_back (&spectra[partition * 2 * imagOffset]);
+				b.push_back (&spectra[(numPartitions + partition) * 2 * imagOffset]);
+			}
+			std::vector<float> accumulator (2 * imagOffset, 0.0f);
+			
+			double floatTime = bestMicroseconds (5, 2000, [&]{
+				kernels::complexMulAccumulateSplit (accumulator.data(), accumulator.data() + imagOffset, a.data(), b.data(), imagOffset, numPartitions, numBins); });
+			double doubleTime = bestMicroseconds (5, 2000, [&]{
+				kernels::complexMulAccumulateSplitWide (accumulator.data(), accumulator.data() + imagOffset, a.data(), b.data(), imagOffset, numPartitions, numBins); });
+			
+			logMessage (String (kernels::getInstructionSetName()) + ": float " + String (floatTime, 2) + " us, double " + String (doubleTime, 2) + " us");
+		}
+		
+		beginTest ("error on a deep filter");
+		{
+			/* two long decays of 60 dB more than their difference, which is what remains */
+			const int numIRSamples = 16384, blockSize = 256, numSamples = 188 * blockSize;
+			AudioBuffer<float> ir (1, numIRSamples);
+			std::vector<float> irNoise = noise (numIRSamples);
+			for (int sample = 0; sample < numIRSamples; sample++){
+				double decay = std::exp (-sample / 3000.0) * std::sin (sample * 0.001);
+				double delayedDecay = sample >= 4096 ? std::exp (-(sample - 4096) / 3000.0) * std::sin ((sample - 4096) * 0.001) : 0.0;
+				ir.setSample (0, sample, (float) (1000.0 * (decay - delayedDecay)) + 0.01f * irNoise[sample]);
+			}
+			
+			AudioBuffer<float> input (2, numSamples);
+			std::vector<float> inputNoise = noise (numSamples);
+			float lowpassed = 0.0f;
+			for (int sample = 0; sample < numSamples; sample++){
+				lowpassed = 0.999f * lowpassed + 0.001f * inputNoise[sample];
+				input.setSample (0, sample, lowpassed);
+				input.setSample (1, sample, lowpassed);
+			}
+			
+			/* the reference in double, direct form */
+			std::vector<double> expected (numSamples, 0.0);
+			double peak = 0.0;
+			for (int sample = 0; sample < numSamples; sample++){
+				for (int tap = 0; tap < numIRSamples && tap <= sample; tap++)
+					expected[sample] += (double) ir.getSample (0, tap) * (double) input.getSample (0, sample - tap);
+				peak = jmax (peak, std::abs (expected[sample]));
+			}
+			
+			double errordB[2];
+			for (bool wide : { false, true }){
+				PartitionedConvolver convolver;
+				convolver.prepare (2, 2, blockSize, 4096, numIRSamples);
+				convolver.setDoubleAccumulation (wide);
+				convolver.setIR (new PreparedIR (ir, blockSize, 4096));
+				
+				AudioBuffer<float> output (input);
+				AudioBuffer<float> block (2, blockSize);
+				double maxError = 0.0;
+				for (int position = 0; position < numSamples; position += blockSize){
+					block.copyFrom (0, 0, input, 0, position, blockSize);
+					block.copyFrom (1, 0, input, 1, position, blockSize);
+					convolver.process (block, block);
+					for (int sample = 0; sample < blockSize; sample++)
+						maxError = jmax (maxError, std::abs (block.getSample (0, sample) - expected[position + sample]));
+				}
+				
+				errordB[wide] = Decibels::gainToDecibels (maxError / peak, -400.0);
+				logMessage (String (wide ? "double" : "float") + " accumulation: max error " + String (errordB[wide], 1) + " dB below the peak");
+			}
+			
+			/* the FFTs are float either way, so the gain is small, but there shouldn't be a loss */
+			expect (errordB[true] <= errordB[false] + 0.5, "double accumulation is less accurate than float");
+		}
+		
+		beginTest ("engine, 10 s of stereo through 32768 samples, head 256, max partition 1024");
+		{
+			const int numIRSamples = 32768;
+			AudioBuffer<float> input (2, 10 * 48000);
+			for (int channel = 0; channel < 2; channel++){
+				std::vector<float> channelNoise = noise (input.getNumSamples());
+				input.copyFrom (channel, 0, channelNoise.data(), input.getNumSamples());
+			}
+			
+			for (int numIRChannels : { 1, 4 }){
+				AudioBuffer<float> ir (numIRChannels, numIRSamples);
+				for (int channel = 0; channel < numIRChannels; channel++){
+					std::vector<float> channelNoise = noise (numIRSamples);
+					for (int sample = 0; sample < numIRSamples; sample++)
+						ir.setSample (channel, sample, channelNoise[sample] * std::exp (-sample / 6000.0f));
+				}
+				
+				String timings;
+				for (bool wide : { false, true }){
+					PartitionedConvolver convolver;
+					convolver.prepare (2, 2, 256, 1024, numIRSamples);
+					convolver.setDoubleAccumulation (wide);
+					convolver.setIR (new PreparedIR (ir, 256, 1024));
+					timings += String (wide ? ", double " : "float ") + String (convolveSeconds (convolver, input), 3) + " s";
+				}
+				logMessage (String (numIRChannels) + " IR channel(s): " + timings);
+			}
+		}
+	}
+};
+
+static AccumulationBenchmark accumulationBenchmark;
+
+
+/* the split kernels compiled for the FFT sizes of partition sizes 64 to 1024 (see kernels::getSplitKernels()) against the generic ones,
+ * for stages of few and of many partitions: mono, stereo, and stereo with a mono IR */
+class SplitKernelSizeBenchmark : public UnitTest {
+public:
+	SplitKernelSizeBenchmark() : UnitTest ("Split kernel sizes", "Benchmarks") {}
+	
+	void runTest() override {
+		beginTest (String ("generic -> fixed size, ") + kernels::getInstructionSetName());
+		
+		for (int partitionSize : { 64, 128, 256, 512, 1024 }){
+			for (int numPartitions : { 3, 12 }){
+				const int numBins = partitionSize + 1;
+				const SpectralRing layout (1, 1, numBins, true);
+				const int imagOffset = layout.getImagOffset();
+				const int stride = layout.getSlotStride();
+				
+				std::vector<float> spectra = noise (4 * numPartitions * stride);
+				std::vector<const float*> a0, a1, b0, b1;
+				for (int partition = 0; partition < numPartitions; partition++){
+					a0.push_back (&spectra[partition * stride]);
+					a1.push_back (&spectra[(numPartitions + partition) * stride]);
+					b0.push_back (&spectra[(2 * numPartitions + partition) * stride]);
+					b1.push_back (&spectra[(3 * numPartitions + partition) * stride]);
+				}
+				
+				const kernels::SplitKernels& fixed = kernels::getSplitKernels (numBins, imagOffset);
+				expectEquals (fixed.numBins, numBins, "no fixed size kernels for partition size " + String (partitionSize));
+				
+				/* both give the same sums, up to float rounding */
+				std::vector<float> generic0 (2 * stride, 0.0f), generic1 (2 * stride, 0.0f), fixed0 (2 * stride, 0.0f), fixed1 (2 * stride, 0.0f);
+				kernels::complexMulAccumulateSplitStereo (generic0.data(), generic0.data() + imagOffset, generic1.data(), generic1.data() + imagOffset,
+														  a0.data(), a1.data(), b0.data(), b1.data(), imagOffset, numPartitions, numBins);
+				fixed.mulAccumulateStereo (fixed0.data(), fixed0.data() + imagOffset, fixed1.data(), fixed1.data() + imagOffset,
+										   a0.data(), a1.data(), b0.data(), b1.data(), imagOffset, numPartitions, numBins);
+				expect (isClose (generic0, fixed0) && isClose (generic1, fixed1), "the fixed size kernel differs for partition size " + String (partitionSize));
+				
+				const int numCalls = jmax (10, 2000000 / (numBins * numPartitions));
+				float* acc0 = generic0.data();
+				float* acc1 = generic1.data();
+				
+				double monoGeneric = bestMicroseconds (5, numCalls, [&]{
+					kernels::complexMulAccumulateSplit (acc0, acc0 + imagOffset, a0.data(), b0.data(), imagOffset, numPartitions, numBins); });
+				double monoFixed = bestMicroseconds (5, numCalls, [&]{
+					fixed.mulAccumulate (acc0, acc0 + imagOffset, a0.data(), b0.data(), imagOffset, numPartitions, numBins); });
+				double stereoGeneric = bestMicroseconds (5, numCalls, [&]{
+					kernels::complexMulAccumulateSplitStereo (acc0, acc0 + imagOffset, acc1, acc1 + imagOffset,
+															  a0.data(), a1.data(), b0.data(), b1.data(), imagOffset, numPartitions, numBins); });
+				double stereoFixed = bestMicroseconds (5, numCalls, [&]{
+					fixed.mulAccumulateStereo (acc0, acc0 + imagOffset, acc1, acc1 + imagOffset,
+											   a0.data(), a1.data(), b0.data(), b1.data(), imagOffset, numPartitions, numBins); });
+				double monoIRGeneric = bestMicroseconds (5, numCalls, [&]{
+					kernels::complexMulAccumulateSplitStereo (acc0, acc0 + imagOffset, acc1, acc1 + imagOffset,
+															  a0.data(), a1.data(), b0.data(), b0.data(), imagOffset, numPartitions, numBins); });
+				double monoIRFixed = bestMicroseconds (5, numCalls, [&]{
+					fixed.mulAccumulateStereo (acc0, acc0 + imagOffset, acc1, acc1 + imagOffset,
+											   a0.data(), a1.data(), b0.data(), b0.data(), imagOffset, numPartitions, numBins); });
+				
+				logMessage ("partition size " + String (partitionSize).paddedLeft (' ', 4) + ", " + String (numPartitions).paddedLeft (' ', 2) + " partitions:"
+							+ "  mono " + comparison (monoGeneric, monoFixed)
+							+ "  stereo " + comparison (stereoGeneric, stereoFixed)
+							+ "  mono IR " + comparison (monoIRGeneric, monoIRFixed));
+			}
+		}
+	}
+	
+private:
+	static bool isClose (const std::vector<float>& result, const std::vector<float>& expected){
+		for (size_t i = 0; i < result.size(); i++)
+			if (NOT (std::abs (result[i] - expected[i]) <= 1.0e-5f * (1.0f + std::abs (expected[i]))))
+				return false;
+		return true;
+	}
+	
+	static String comparison (double genericTime, double fixedTime){
+		return String (genericTime, 3) + " -> " + String (fixedTime, 3) + " us (x" + String (genericTime / fixedTime, 2) + ")";
+	}
+};
+
+static SplitKernelSizeBenchmark splitKernelSizeBenchmark;
+
+
+/* the time of every host callback of 64 samples that gathers 256 sample blocks for the convolver, the way the processor does,
+ * without and with processSlice(), and with a smaller largest partition. Reports the average, and the average of the callbacks
+ * that complete a block, which are left with the head's FFTs, IFFTs and newest partition.
+ * The work of a callback repeats with its position in the largest partition, so the peak is the slowest position, by the median
+ * of its callbacks. With processSlice() it has to stay within maxPeakToAverage times the average (see PartitionedConvolver::processSlice()),
+ * unless the head's own FFTs in the callbacks that complete a block are above that already, as they are with a short tail:
+ * then it has to stay within maxPeakToCompleting times their average, as no slicing can spread those.
+ * The 99th percentile and the maximum are informational, as on a busy machine they are set by the callbacks that the thread was preempted in */
+class CallbackTimingBenchmark : public UnitTest {
+public:
+	CallbackTimingBenchmark() : UnitTest ("Callback timing", "Benchmarks") {}
+	
+	static constexpr double maxPeakToAverage = 1.5;
+	static constexpr double maxPeakToCompleting = 1.15;
+	
+	void runTest() override {
+		const int hostBlockSize = 64, blockSize = 256;
+		
+		for (int numIRSamples : { 48000, 144000 }){
+			beginTest ("host blocks of " + String (hostBlockSize) + ", head " + String (blockSize) + ", 2x2, " + String (numIRSamples) + " sample IR");
+			
+			AudioBuffer<float> ir (2, numIRSamples);
+			for (int channel = 0; channel < 2; channel++){
+				std::vector<float> channelNoise = noise (numIRSamples);
+				for (int sample = 0; sample < numIRSamples; sample++)
+					ir.setSample (channel, sample, channelNoise[sample] * std::exp (-sample / (numIRSamples / 5.0f)));
+			}
+			
+			double peakToAverage = 0.0, completingToAverage = 0.0;
+			logMessage ("unsliced:              " + timeCallbacks (ir, hostBlockSize, blockSize, 8192, false, peakToAverage, completingToAverage));
+			
+			for (int maxPartitionSize : { 8192, 1024 }){
+				logMessage ("sliced, max part " + String (maxPartitionSize).paddedLeft (' ', 4) + ": "
+							+ timeCallbacks (ir, hostBlockSize, blockSize, maxPartitionSize, true, peakToAverage, completingToAverage));
+				
+				double maxPeak = jmax (maxPeakToAverage, maxPeakToCompleting * completingToAverage);
+				if (maxPeak > maxPeakToAverage)
+					logMessage ("  the head alone is at x" + String (completingToAverage, 2) + ", the peak may be up to x" + String (maxPeak, 2));
+				expectLessOrEqual (peakToAverage, maxPeak, "the peak callback with processSlice(), max part " + String (maxPartitionSize)
+								   + ", against the average");
+			}
+		}
+	}
+	
+private:
+	/* the timings as text, in peakToAverage the median of the slowest position against the average,
+	 * and in completingToAverage the average of the callbacks that complete a block against it */
+	String timeCallbacks (AudioBuffer<float>& ir, int hostBlockSize, int blockSize, int maxPartitionSize, bool slice,
+						  double& peakToAverage, double& completingToAverage){
+		PartitionedConvolver convolver;
+		convolver.prepare (2, 2, blockSize, maxPartitionSize, ir.getNumSamples());
+		convolver.setIR (new PreparedIR (ir, blockSize, maxPartitionSize));
+		
+		AudioBuffer<float> hostBlock (2, hostBlockSize);
+		AudioBuffer<float> block (2, blockSize);
+		int numSamplesGathered = 0;
+		
+		/* 4 s at 48 kHz, of which the first second isn't counted */
+		const int numCallbacks = 4 * 48000 / hostBlockSize;
+		const int numWarmUpCallbacks = numCallbacks / 4;
+		std::vector<double> times, completingTimes;
+		std::vector<std::vector<double>> positionTimes ((size_t) (maxPartitionSize / hostBlockSize));
+		
+		for (int callback = 0; callback < numCallbacks; callback++){
+			for (int channel = 0; channel < 2; channel++){
+				std::vector<float> channelNoise = noise (hostBlockSize);
+				hostBlock.copyFrom (channel, 0, channelNoise.data(), hostBlockSize);
+			}
+			
+			int64 startTicks = Time::getHighResolutionTicks();
+			bool completes = false;
+			
+			for (int position = 0; position < hostBlockSize; ){
+				const int numSamples = jmin (hostBlockSize - position, blockSize - numSamplesGathered);
+				for (int channel = 0; channel < 2; channel++)
+					block.copyFrom (channel, numSamplesGathered, hostBlock, channel, position, numSamples);
+				numSamplesGathered += numSamples;
+				position += numSamples;
+				
+				if (numSamplesGathered == blockSize){
+					convolver.process (block, block);
+					numSamplesGathered = 0;
+					completes = true;
+				}
+			}
+			if (slice && numSamplesGathered > 0)
+				convolver.processSlice (numSamplesGathered);
+			
+			double time = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks) * 1.0e6;
+			if (callback >= numWarmUpCallbacks){
+				times.push_back (time);
+				positionTimes[(size_t) callback % positionTimes.size()].push_back (time);
+				if (completes)
+					completingTimes.push_back (time);
+			}
+		}
+		
+		const double average = std::accumulate (times.begin(), times.end(), 0.0) / times.size();
+		const double completingAverage = std::accumulate (completingTimes.begin(), completingTimes.end(), 0.0) / completingTimes.size();
+		std::sort (times.begin(), times.end());
+		const double p99 = times[(times.size() * 99) / 100];
+		
+		double peak = 0.0;
+		for (std::vector<double>& position : positionTimes){
+			std::nth_element (position.begin(), position.begin() + position.size() / 2, position.end());
+			peak = jmax (peak, position[position.size() / 2]);
+		}
+		peakToAverage = peak / average;
+		completingToAverage = completingAverage / average;
+		
+		return "average " + String (average, 2) + " us, peak " + String (peak, 2) + " us (x" + String (peakToAverage, 2) + "), completing a block "
+			+ String (completingAverage, 2) + " us (x" + String (completingToAverage, 2) + "); p99 " + String (p99, 2) + " us (x"
+			+ String (p99 / average, 2) + "), max " + String (times.back(), 2) + " us";
+	}
+};
+
+static CallbackTimingBenchmark callbackTimingBenchmark;
+
+
+} // fp
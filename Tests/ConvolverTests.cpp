@@ -0,0 +1,442 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+#include <fp_include_all.hpp>
+#include <JuceHeader.h>
+
+
+namespace fp {
+
+
+/* Convolves random input with random IRs through PartitionedConvolver, and compares the result with
+ * convolution::convolveNonPeriodic() of the whole signal, per path of the IR. Covers uniform and non-uniform
+ * partitioning, mono, per channel and true stereo IRs, host blocks of random sizes with processSlice() in between,
+ * tail stages on a worker thread, zero latency with the direct taps in a DirectFIR, a sparse IR that is convolved tap by tap,
+ * an IR with a multirate tail, a mono source on a stereo track through the mirrored outputs, going idle in silence and waking up,
+ * and a shaped IR (see PreparedIR::Shape), which needs to be the same for every partitioning.
+ * The partitions of a polar morph need to stay within the samples of a partition, or they would wrap around in the convolution */
+class ConvolverTests : public UnitTest {
+public:
+	ConvolverTests() : UnitTest ("PartitionedConvolver", "IRBaboon") {}
+	
+	void runTest() override {
+		const int blockSize = 256;
+		
+		for (int maxPartitionSize : { blockSize, 4096 }){
+			const String partitioning = maxPartitionSize == blockSize ? "uniform" : "non-uniform";
+			
+			for (int numIRChannels : { 1, 2, 4 }){
+				beginTest (partitioning + ", " + String (numIRChannels) + " channel IR");
+				checkConvolver (numIRChannels, blockSize, maxPartitionSize, false, 0);
+				
+				beginTest (partitioning + ", " + String (numIRChannels) + " channel IR, random host blocks");
+				checkConvolver (numIRChannels, blockSize, maxPartitionSize, true, 0);
+			}
+		}
+		
+		beginTest ("non-uniform, tail stages on a worker");
+		checkConvolver (2, blockSize, 4096, true, 1);
+		
+		beginTest ("sparse IR");
+		checkSparseIR (blockSize, 4096, false);
+		
+		beginTest ("sparse IR, random host blocks");
+		checkSparseIR (blockSize, 4096, true);
+		
+		beginTest ("zero latency, direct taps and partitions");
+		checkZeroLatency (blockSize, 4096, false);
+		
+		beginTest ("zero latency, direct taps and partitions, random host blocks");
+		checkZeroLatency (blockSize, 4096, true);
+		
+		beginTest ("mirrored channels");
+		checkMirroredChannels (blockSize, 4096, false);
+		
+		beginTest ("mirrored channels, random host blocks");
+		checkMirroredChannels (blockSize, 4096, true);
+		
+		beginTest ("idle in silence, and waking up");
+		checkIdleWake (blockSize, 4096);
+		
+		beginTest ("rate converter round trip");
+		checkRateConverter (4, blockSize);
+		
+		beginTest ("multirate tail");
+		checkMultirateTail (blockSize, 4096, 4, false);
+		
+		beginTest ("multirate tail, random host blocks");
+		checkMultirateTail (blockSize, 4096, 4, true);
+		
+		beginTest ("shaped IR, uniform and non-uniform");
+		checkShapedIR (blockSize, 4096);
+		
+		beginTest ("polar morph, partitions within their samples");
+		checkPolarMorph (blockSize, 4096);
+	}
+	
+private:
+	static const int numChannels = 2;
+	static const int numIRSamples = 5000;
+	static const int numInputSamples = 20000;
+	
+	/* the error of a sine in the passband through the rate converters, and of the convolution with a multirate tail
+	 * relative to its peak: -60 dB, the error budget of the tail (see PreparedIR::tailErrorBudgetdB) */
+	static constexpr float rateConverterTolerance = 1.0e-3f;
+	static constexpr float tailTolerance = 1.0e-3f;
+	
+	Random random { 2021 };
+	
+	AudioBuffer<float> noise (int numBufferChannels, int numSamples, float decaySamples = 0.0f){
+		AudioBuffer<float> buffer (numBufferChannels, numSamples);
+		for (int channel = 0; channel < numBufferChannels; channel++)
+			for (int sample = 0; sample < numSamples; sample++)
+				buffer.setSample (channel, sample, (2.0f * random.nextFloat() - 1.0f) * (decaySamples > 0.0f ? std::exp (-sample / decaySamples) : 1.0f));
+		return buffer;
+	}
+	
+	/* the sum over the inputs of each output's paths, every path convolved on its own */
+	AudioBuffer<float> reference (AudioBuffer<float>& input, AudioBuffer<float>& ir, PreparedIR& preparedIR){
+		AudioBuffer<float> expected (numChannels, input.getNumSamples() + ir.getNumSamples() - 1);
+		expected.clear();
+		
+		for (int output = 0; output < numChannels; output++){
+			for (int inputChannel = 0; inputChannel < numChannels; inputChannel++){
+				const int irChannel = preparedIR.getPathChannel (inputChannel, output, numChannels, numChannels);
+				if (irChannel < 0)
+					continue;
+				
+				AudioBuffer<float> monoInput (1, input.getNumSamples());
+				AudioBuffer<float> monoIR (1, ir.getNumSamples());
+				monoInput.copyFrom (0, 0, input, inputChannel, 0, input.getNumSamples());
+				monoIR.copyFrom (0, 0, ir, irChannel, 0, ir.getNumSamples());
+				
+				AudioBuffer<float> path = convolution::convolveNonPeriodic (monoInput, monoIR);
+				expected.addFrom (output, 0, path, 0, 0, expected.getNumSamples());
+			}
+		}
+		return expected;
+	}
+	
+	/* input through a prepared convolver, gathering host blocks into blocks of its block size like the processor does,
+	 * and slicing the work in between. Only whole blocks are convolved, the rest of the result stays silent */
+	AudioBuffer<float> convolve (PartitionedConvolver& convolver, AudioBuffer<float>& input, bool randomHostBlocks){
+		const int blockSize = convolver.getBlockSize();
+		const int numSamplesConvolved = (input.getNumSamples() / blockSize) * blockSize;
+		AudioBuffer<float> block (numChannels, blockSize);
+		AudioBuffer<float> result (numChannels, input.getNumSamples());
+		result.clear();
+		int numSamplesGathered = 0;
+		int position = 0;
+		
+		while (position < numSamplesConvolved){
+			const int hostBlockSize = randomHostBlocks ? 1 + random.nextInt (blockSize) : blockSize;
+			const int numSamples = jmin (hostBlockSize, blockSize - numSamplesGathered);
+			
+			for (int channel = 0; channel < numChannels; channel++)
+				block.copyFrom (channel, numSamplesGathered, input, channel, position, numSamples);
+			numSamplesGathered += numSamples;
+			position += numSamples;
+			
+			if (numSamplesGathered < blockSize){
+				convolver.processSlice (numSamplesGathered);
+				continue;
+			}
+			
+			convolver.process (block, block);
+			for (int channel = 0; channel < numChannels; channel++)
+				result.copyFrom (channel, position - blockSize, block, channel, 0, blockSize);
+			numSamplesGathered = 0;
+		}
+		return result;
+	}
+	
+	/* result within tolerance times the peak of expected, over the first numSamples */
+	void expectMatches (const AudioBuffer<float>& result, const AudioBuffer<float>& expected, int numSamples, const String& failureMessage,
+						float tolerance = 1.0e-4f){
+		float maxError = 0.0f;
+		float peak = 0.0f;
+		for (int channel = 0; channel < numChannels; channel++){
+			for (int sample = 0; sample < numSamples; sample++){
+				maxError = jmax (maxError, std::abs (result.getSample (channel, sample) - expected.getSample (channel, sample)));
+				peak = jmax (peak, std::abs (expected.getSample (channel, sample)));
+			}
+		}
+		
+		expectLessThan (maxError, tolerance * peak, failureMessage);
+	}
+	
+	void checkConvolver (int numIRChannels, int blockSize, int maxPartitionSize, bool randomHostBlocks, int numWorkerThreads){
+		AudioBuffer<float> ir = noise (numIRChannels, numIRSamples, numIRSamples / 4.0f);
+		checkPreparedIR (ir, new PreparedIR (ir, blockSize, maxPartitionSize), randomHostBlocks, numWorkerThreads);
+	}
+	
+	/* random input through a convolver prepared for preparedIR, against the convolution with its samples ir */
+	void checkPreparedIR (AudioBuffer<float>& ir, PreparedIR::Ptr preparedIR, bool randomHostBlocks, int numWorkerThreads, float tolerance = 1.0e-4f){
+		const int blockSize = preparedIR->getHeadPartitionSize();
+		AudioBuffer<float> input = noise (numChannels, numInputSamples);
+		const AudioBuffer<float> expected = reference (input, ir, *preparedIR);
+		
+		PartitionedConvolver convolver;
+		convolver.prepare (numChannels, numChannels, blockSize, preparedIR->getMaxPartitionSize(), numIRSamples, numWorkerThreads,
+						   preparedIR->getTailDecimation(), numWorkerThreads > 0);
+		convolver.setIR (preparedIR);
+		
+		const AudioBuffer<float> result = convolve (convolver, input, randomHostBlocks);
+		expectMatches (result, expected, (numInputSamples / blockSize) * blockSize, "the convolution differs from convolveNonPeriodic()", tolerance);
+		expectEquals (convolver.getNumMissedDeadlines(), 0);
+	}
+	
+	/* a mono source on a stereo track, whose channels differ from halfway on. A mono IR is mirrorable, so while the inputs are
+	 * the same only output 0 is accumulated, and the other output copies it; the same IR in both channels of a per channel IR isn't,
+	 * so each channel is convolved on its own. Both need to give the same output, also across the switch */
+	void checkMirroredChannels (int blockSize, int maxPartitionSize, bool randomHostBlocks){
+		AudioBuffer<float> monoIR = noise (1, numIRSamples, numIRSamples / 4.0f);
+		AudioBuffer<float> dualIR (numChannels, numIRSamples);
+		for (int channel = 0; channel < numChannels; channel++)
+			dualIR.copyFrom (channel, 0, monoIR, 0, 0, numIRSamples);
+		
+		AudioBuffer<float> input = noise (numChannels, numInputSamples);
+		input.copyFrom (1, 0, input, 0, 0, numInputSamples / 2);
+		
+		AudioBuffer<float> results[2];
+		AudioBuffer<float>* irs[2] = { &monoIR, &dualIR };
+		const int numSamplesCompared = (numInputSamples / blockSize) * blockSize;
+		
+		for (int path = 0; path < 2; path++){
+			PreparedIR::Ptr preparedIR = new PreparedIR (*irs[path], blockSize, maxPartitionSize);
+			PartitionedConvolver convolver;
+			convolver.prepare (numChannels, numChannels, blockSize, maxPartitionSize, numIRSamples);
+			convolver.setIR (preparedIR);
+			results[path] = convolve (convolver, input, randomHostBlocks);
+			
+			expectMatches (results[path], reference (input, *irs[path], *preparedIR), numSamplesCompared, "the convolution differs from convolveNonPeriodic()");
+		}
+		
+		expectMatches (results[0], results[1], numSamplesCompared, "the mirrored outputs differ from the ones convolved per channel");
+	}
+	
+	/* noise, then silence for longer than the idle threshold, then an impulse and some more noise. The convolver needs to be idle
+	 * before the impulse, and wake up for it as if it had never slept */
+	void checkIdleWake (int blockSize, int maxPartitionSize){
+		AudioBuffer<float> ir = noise (numChannels, numIRSamples, numIRSamples / 4.0f);
+		PreparedIR::Ptr preparedIR = new PreparedIR (ir, blockSize, maxPartitionSize);
+		
+		PartitionedConvolver convolver;
+		convolver.prepare (numChannels, numChannels, blockSize, maxPartitionSize, numIRSamples);
+		convolver.setIR (preparedIR);
+		
+		/* takes the IR, which the idle threshold depends on */
+		convolver.reset();
+		
+		const int wakeSample = (numInputSamples / 2 / blockSize) * blockSize;
+		const int silenceStart = wakeSample - convolver.getIdleThreshold() - 2 * blockSize;
+		expectGreaterThan (silenceStart, 0);
+		
+		AudioBuffer<float> input = noise (numChannels, numInputSamples);
+		for (int channel = 0; channel < numChannels; channel++){
+			input.clear (channel, silenceStart, wakeSample - silenceStart);
+			input.setSample (channel, wakeSample, 1.0f);
+			input.clear (channel, wakeSample + 1, numInputSamples / 4);
+		}
+		
+		const int numSamplesCompared = (numInputSamples / blockSize) * blockSize;
+		AudioBuffer<float> block (numChannels, blockSize);
+		AudioBuffer<float> result (numChannels, numInputSamples);
+		result.clear();
+		
+		for (int position = 0; position < numSamplesCompared; position += blockSize){
+			if (position == wakeSample)
+				expect (convolver.isIdle(), "the convolver didn't go idle in the silence");
+			
+			for (int channel = 0; channel < numChannels; channel++)
+				block.copyFrom (channel, 0, input, channel, position, blockSize);
+			convolver.process (block, block);
+			for (int channel = 0; channel < numChannels; channel++)
+				result.copyFrom (channel, position, block, channel, 0, blockSize);
+		}
+		
+		expect (NOT convolver.isIdle(), "the convolver didn't wake up");
+		expectMatches (result, reference (input, ir, *preparedIR), numSamplesCompared, "the convolution differs from convolveNonPeriodic() after waking up");
+	}
+	
+	/* zero latency like the processor: the DirectFIR convolves the first blockSize taps straight from the input, in host blocks,
+	 * and the convolver the rest, whose output lags exactly those direct taps. Their sum needs to be the convolution with the whole IR */
+	void checkZeroLatency (int blockSize, int maxPartitionSize, bool randomHostBlocks){
+		const int numDirectTaps = blockSize;
+		AudioBuffer<float> ir = noise (numChannels, numIRSamples, numIRSamples / 4.0f);
+		AudioBuffer<float> input = noise (numChannels, numInputSamples);
+		PreparedIR::Ptr preparedIR = new PreparedIR (ir, blockSize, maxPartitionSize, 0, true, numDirectTaps);
+		expectEquals (preparedIR->getNumDirectTaps(), numDirectTaps);
+		
+		PartitionedConvolver convolver;
+		convolver.prepare (numChannels, numChannels, blockSize, maxPartitionSize, numIRSamples);
+		convolver.setIR (preparedIR);
+		const AudioBuffer<float> partitioned = convolve (convolver, input, randomHostBlocks);
+		
+		DirectFIR directFIR;
+		directFIR.prepare (numChannels, numChannels, numDirectTaps, blockSize);
+		AudioBuffer<float> result (numChannels, numInputSamples);
+		for (int position = 0; position < numInputSamples; ){
+			const int numSamples = jmin (randomHostBlocks ? 1 + random.nextInt (blockSize) : blockSize, numInputSamples - position);
+			directFIR.process (input, result, position, numSamples, preparedIR.get());
+			position += numSamples;
+		}
+		
+		for (int channel = 0; channel < numChannels; channel++)
+			result.addFrom (channel, numDirectTaps, partitioned, channel, 0, numInputSamples - numDirectTaps);
+		
+		expectMatches (result, reference (input, ir, *preparedIR), (numInputSamples / blockSize) * blockSize,
+					   "the direct taps and the partitions differ from convolveNonPeriodic()");
+	}
+	
+	/* a sine at a fraction of the passband edge, through decimate() and addInterpolated() in host sized blocks,
+	 * needs to come out delayed by getRoundTripDelay() */
+	void checkRateConverter (int decimation, int blockSize){
+		const float frequency = 0.5f * RateConverter::getPassbandEdge (decimation);
+		AudioBuffer<float> sine (1, numInputSamples);
+		for (int sample = 0; sample < numInputSamples; sample++)
+			sine.setSample (0, sample, std::sin (2.0f * (float) M_PI * frequency * (float) sample));
+		
+		RateConverter decimator, interpolator;
+		decimator.prepare (1, decimation, blockSize);
+		interpolator.prepare (1, decimation, blockSize);
+		AudioBuffer<float> block (1, blockSize);
+		AudioBuffer<float> decimated (1, blockSize / decimation);
+		AudioBuffer<float> result (1, numInputSamples);
+		result.clear();
+		
+		for (int position = 0; position + blockSize <= numInputSamples; position += blockSize){
+			block.copyFrom (0, 0, sine, 0, position, blockSize);
+			decimator.decimate (block, decimated, blockSize);
+			block.clear();
+			interpolator.addInterpolated (decimated, block, blockSize);
+			result.copyFrom (0, position, block, 0, 0, blockSize);
+		}
+		
+		/* after the filters have filled up */
+		const int delay = RateConverter::getRoundTripDelay (decimation);
+		float maxError = 0.0f;
+		for (int sample = 4 * delay; sample < (numInputSamples / blockSize) * blockSize; sample++)
+			maxError = jmax (maxError, std::abs (result.getSample (0, sample) - sine.getSample (0, sample - delay)));
+		
+		expectLessThan (maxError, rateConverterTolerance, "the round trip of the passband is off");
+	}
+	
+	/* 1, and a raised cosine to 0 over the last chunk of the IR, so that its end doesn't add high frequencies to the tail */
+	float endFade (int sample){
+		const int fadeStart = numIRSamples - PreparedIR::tailAnalysisSize;
+		if (sample < fadeStart)
+			return 1.0f;
+		return 0.5f + 0.5f * std::cos ((float) M_PI * (float) (sample - fadeStart) / (float) PreparedIR::tailAnalysisSize);
+	}
+	
+	/* a burst of noise, followed by a decay of a few sines well within the passband of the decimation, so that the IR gets a multirate tail.
+	 * The decimated tail needs to line up with the partitions, within tailTolerance */
+	void checkMultirateTail (int blockSize, int maxPartitionSize, int decimation, bool randomHostBlocks){
+		AudioBuffer<float> ir = noise (numChannels, numIRSamples, numIRSamples / 16.0f);
+		const float passbandEdge = RateConverter::getPassbandEdge (decimation);
+		
+		for (int channel = 0; channel < numChannels; channel++){
+			for (int sample = PreparedIR::tailAnalysisSize; sample < numIRSamples; sample++)
+				ir.setSample (channel, sample, 0.0f);
+			
+			for (float fraction : { 0.1f, 0.3f, 0.6f }){
+				const float frequency = fraction * passbandEdge;
+				const float phase = 2.0f * (float) M_PI * random.nextFloat();
+				for (int sample = 0; sample < numIRSamples; sample++)
+					ir.addSample (channel, sample, 0.3f * std::sin (2.0f * (float) M_PI * frequency * (float) sample + phase)
+												   * std::exp (-sample / (numIRSamples / 3.0f)) * endFade (sample));
+			}
+		}
+		
+		PreparedIR::Ptr preparedIR = new PreparedIR (ir, blockSize, maxPartitionSize, 0, true, 0, decimation);
+		expect (preparedIR->getTailIR() != nullptr, "the IR got no multirate tail");
+		checkPreparedIR (ir, preparedIR, randomHostBlocks, 0, tailTolerance);
+	}
+	
+	/* a few taps spread over the IR, with the gaps of a sparse IR: the convolver reads them from its input history */
+	void checkSparseIR (int blockSize, int maxPartitionSize, bool randomHostBlocks){
+		AudioBuffer<float> ir (numChannels, numIRSamples);
+		ir.clear();
+		for (int channel = 0; channel < numChannels; channel++){
+			ir.setSample (channel, 0, 1.0f);
+			for (int tap = 0; tap < PreparedIR::maxSparseTaps / 2; tap++)
+				ir.setSample (channel, 1 + random.nextInt (numIRSamples - 1), 2.0f * random.nextFloat() - 1.0f);
+		}
+		
+		PreparedIR::Ptr preparedIR = new PreparedIR (ir, blockSize, maxPartitionSize);
+		expect (preparedIR->isSparse(), "the IR is not sparse");
+		checkPreparedIR (ir, preparedIR, randomHostBlocks, 0);
+	}
+	
+	/* a stereo IR shaped as a whole, played uniformly partitioned, and on the non-uniform layout of the unshaped IR like the processor does.
+	 * Both need to be the convolution with the shaped samples */
+	void checkShapedIR (int blockSize, int maxPartitionSize){
+		AudioBuffer<float> ir = noise (numChannels, numIRSamples, numIRSamples / 4.0f);
+		AudioBuffer<float> input = noise (numChannels, numInputSamples);
+		PreparedIR::Ptr unshapedIR = new PreparedIR (ir, blockSize, maxPartitionSize);
+		
+		PreparedIR::Shape shape;
+		shape.contrast = 2.0f;
+		shape.tiltdBPerOctave = -3.0f;
+		shape.gainCurve = { { 100.0f, 6.0f }, { 1000.0f, -6.0f }, { 10000.0f, 3.0f } };
+		shape.phaseFlattening = 0.5f;
+		PreparedIR::applyShape (ir, shape, 48000.0);
+		
+		const int numSamplesCompared = (numInputSamples / blockSize) * blockSize;
+		AudioBuffer<float> results[2];
+		
+		for (int plan = 0; plan < 2; plan++){
+			const int planMaxPartitionSize = plan == 0 ? blockSize : maxPartitionSize;
+			PreparedIR::Ptr shapedIR = plan == 0 ? new PreparedIR (ir, blockSize, blockSize) : new PreparedIR (ir, *unshapedIR);
+			
+			PartitionedConvolver convolver;
+			convolver.prepare (numChannels, numChannels, blockSize, planMaxPartitionSize, numIRSamples);
+			convolver.setIR (shapedIR);
+			results[plan] = convolve (convolver, input, true);
+			
+			expectMatches (results[plan], reference (input, ir, *shapedIR), numSamplesCompared, "the shaped IR differs from its samples");
+		}
+		
+		expectMatches (results[1], results[0], numSamplesCompared, "the shaped IR depends on the partitioning");
+	}
+	
+	/* every partition of a polar morph of two unrelated IRs, halfway, back through an IFFT: the second half of the FFT,
+	 * past the samples of the partition, needs to be silent */
+	void checkPolarMorph (int blockSize, int maxPartitionSize){
+		AudioBuffer<float> irA = noise (numChannels, numIRSamples, numIRSamples / 4.0f);
+		AudioBuffer<float> irB = noise (numChannels, numIRSamples, numIRSamples / 8.0f);
+		PreparedIR::Ptr preparedA = new PreparedIR (irA, blockSize, maxPartitionSize);
+		PreparedIR::Ptr preparedB = new PreparedIR (irB, *preparedA);
+		PreparedIR::Ptr morph = new PreparedIR (preparedA, preparedB, PreparedIR::morphPolar, 0.5f);
+		
+		float maxSpread = 0.0f;
+		for (int s = 0; s < morph->getNumStages(); s++){
+			const PartitionStage layout = morph->getStage (s);
+			dsp::FFT fft (BigInteger (layout.fftSize).getHighestBit());
+			SpectralRing spectrum (1, 1, layout.fftSize / 2 + 1, true);
+			std::vector<float> samples ((size_t) (2 * layout.fftSize));
+			
+			for (int partition = 0; partition < layout.numPartitions; partition++){
+				for (int channel = 0; channel < numChannels; channel++){
+					FloatVectorOperations::copy (spectrum.getSlot (0, 0), morph->getPartitionSpectrum (s, partition, channel), spectrum.getSlotStride());
+					spectrum.copyToJuceLayout (0, 0, samples.data());
+					fft.performRealOnlyInverseTransform (samples.data());
+					
+					const float peak = FloatVectorOperations::findMaximum (samples.data(), layout.partitionSize)
+									   - FloatVectorOperations::findMinimum (samples.data(), layout.partitionSize);
+					for (int sample = layout.partitionSize; sample < layout.fftSize && peak > 0.0f; sample++)
+						maxSpread = jmax (maxSpread, std::abs (samples[(size_t) sample]) / peak);
+				}
+			}
+		}
+		
+		expectLessThan (maxSpread, 1.0e-5f, "a polar morph spreads past the samples of its partitions");
+	}
+};
+
+static ConvolverTests convolverTests;
+
+
+} // fp
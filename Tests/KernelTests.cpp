@@ -0,0 +1,100 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+#include <fp_include_all.hpp>
+#include <JuceHeader.h>
+
+#include "kernels.hpp"
+
+
+namespace fp {
+
+
+/* Forces every instruction set the CPU supports in turn, and checks its kernels against the scalar references,
+ * both directly (checkInstructionSet()) and through the public kernels that dispatch to it */
+class KernelTests : public UnitTest {
+public:
+	KernelTests() : UnitTest ("Kernels", "IRBaboon") {}
+	
+	void runTest() override {
+		const kernels::InstructionSet best = kernels::getBestInstructionSet();
+		
+		for (kernels::InstructionSet instructionSet : { kernels::scalar, kernels::sse2, kernels::avx2, kernels::avx512, kernels::neon }){
+			const String name = kernels::getInstructionSetName (instructionSet);
+			
+			if (NOT kernels::isInstructionSetSupported (instructionSet)){
+				beginTest (name + " (not supported)");
+				expect (NOT kernels::forceInstructionSet (instructionSet), "an unsupported instruction set was forced");
+				expect (kernels::getInstructionSet() != instructionSet);
+				continue;
+			}
+			
+			beginTest (name);
+			expect (kernels::forceInstructionSet (instructionSet));
+			expect (kernels::getInstructionSet() == instructionSet, "forced " + name + ", but the kernels use " + kernels::getInstructionSetName());
+			expect (kernels::checkInstructionSet (instructionSet), name + " kernels differ from the scalar references");
+			
+			for (int numBins : { 37, 257, 1025 })
+				checkDispatchedSplit (numBins);
+			checkDispatchedFir (31, 100);
+		}
+		
+		kernels::forceInstructionSet (best);
+		expect (kernels::getInstructionSet() == best);
+	}
+	
+private:
+	Random random { 2021 };
+	
+	std::vector<float> noise (int numFloats){
+		std::vector<float> floats (numFloats);
+		for (float& x : floats)
+			x = 2.0f * random.nextFloat() - 1.0f;
+		return floats;
+	}
+	
+	void expectClose (const std::vector<float>& result, const std::vector<float>& expected, const String& kernelName){
+		int numMismatches = 0;
+		for (size_t i = 0; i < result.size(); i++)
+			if (NOT (std::abs (result[i] - expected[i]) <= 1.0e-5f * (1.0f + std::abs (expected[i]))))
+				numMismatches++;
+		expect (numMismatches == 0, kernelName + " of " + kernels::getInstructionSetName() + " differs from the scalar reference in " + String (numMismatches) + " floats");
+	}
+	
+	/* complexMulAccumulateSplit() against its scalar reference, on 3 random partitions */
+	void checkDispatchedSplit (int numBins){
+		const int numPartitions = 3;
+		const int imagOffset = numBins + 15;		// any offset past the re parts will do
+		const int spectrumSize = 2 * imagOffset;
+		
+		std::vector<float> spectra = noise (2 * numPartitions * spectrumSize);
+		std::vector<const float*> a, b;
+		for (int partition = 0; partition < numPartitions; partition++){
+			a.push_back (&spectra[partition * spectrumSize]);
+			b.push_back (&spectra[(numPartitions + partition) * spectrumSize]);
+		}
+		
+		std::vector<float> result = noise (spectrumSize);
+		std::vector<float> expected = result;
+		kernels::complexMulAccumulateSplit (result.data(), result.data() + imagOffset, a.data(), b.data(), imagOffset, numPartitions, numBins);
+		kernels::complexMulAccumulateSplitScalar (expected.data(), expected.data() + imagOffset, a.data(), b.data(), imagOffset, numPartitions, numBins);
+		expectClose (result, expected, "complexMulAccumulateSplit");
+	}
+	
+	/* fir() against its scalar reference */
+	void checkDispatchedFir (int numTaps, int numSamples){
+		const std::vector<float> history = noise (numTaps - 1 + numSamples);
+		const std::vector<float> reversedTaps = noise (numTaps);
+		
+		std::vector<float> result (numSamples), expected (numSamples);
+		kernels::fir (result.data(), history.data(), reversedTaps.data(), numTaps, numSamples);
+		kernels::firScalar (expected.data(), history.data(), reversedTaps.data(), numTaps, numSamples);
+		expectClose (result, expected, "fir");
+	}
+};
+
+static KernelTests kernelTests;
+
+
+} // fp
@@ -0,0 +1,34 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+#include <JuceHeader.h>
+
+
+/* Runs the unit tests of the fp modules (category "IRBaboon"), or with --benchmark the benchmarks (category "Benchmarks"),
+ * all of them or those whose name contains the next argument. Returns 1 if any test failed */
+int main (int argc, char* argv[])
+{
+	UnitTestRunner runner;
+	runner.setAssertOnFailure (false);
+	
+	if (argc > 1 && String (argv[1]) == "--benchmark"){
+		const String name = argc > 2 ? String (argv[2]) : String();
+		
+		Array<UnitTest*> benchmarks;
+		for (UnitTest* benchmark : UnitTest::getTestsInCategory ("Benchmarks"))
+			if (name.isEmpty() || benchmark->getName().containsIgnoreCase (name))
+				benchmarks.add (benchmark);
+		
+		runner.runTests (benchmarks);
+	}
+	else{
+		runner.runTestsInCategory ("IRBaboon");
+	}
+	
+	int failures = 0;
+	for (int i = 0; i < runner.getNumResults(); i++)
+		failures += runner.getResult (i)->failures;
+	
+	return failures > 0 ? 1 : 0;
+}
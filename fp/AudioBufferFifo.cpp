@@ -0,0 +1,151 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+
+#include <fp_include_all.hpp>
+
+
+namespace fp {
+
+
+AudioBufferFifo::AudioBufferFifo(){
+}
+
+
+AudioBufferFifo::AudioBufferFifo(int numChannels, int capacity){
+	setSize(numChannels, capacity);
+}
+
+
+AudioBufferFifo::~AudioBufferFifo(){
+}
+
+
+void AudioBufferFifo::setSize(int numChannels, int capacity){
+
+	this->numChannels = numChannels;
+
+	/* an AbstractFifo of size N holds N - 1 items */
+	buffer.setSize(numChannels, capacity + 1);
+	buffer.clear();
+	fifo.setTotalSize(capacity + 1);
+}
+
+
+void AudioBufferFifo::reset(){
+	fifo.reset();
+}
+
+
+int AudioBufferFifo::push(const AudioBuffer<float>& source, int startSample, int numSamples){
+	return pushSamples(source, startSample, numSamples);
+}
+
+
+int AudioBufferFifo::push(const AudioBuffer<double>& source, int startSample, int numSamples){
+	return pushSamples(source, startSample, numSamples);
+}
+
+
+int AudioBufferFifo::pushSilence(int numSamples){
+
+	int start1, size1, start2, size2;
+	fifo.prepareToWrite(numSamples, start1, size1, start2, size2);
+
+	for (int channel = 0; channel < numChannels; channel++){
+		if (size1 > 0)
+			buffer.clear(channel, start1, size1);
+		if (size2 > 0)
+			buffer.clear(channel, start2, size2);
+	}
+
+	fifo.finishedWrite(size1 + size2);
+	return size1 + size2;
+}
+
+
+int AudioBufferFifo::pop(AudioBuffer<float>& destination, int startSample, int numSamples){
+	return popSamples(destination, startSample, numSamples);
+}
+
+
+int AudioBufferFifo::pop(AudioBuffer<double>& destination, int startSample, int numSamples){
+	return popSamples(destination, startSample, numSamples);
+}
+
+
+int AudioBufferFifo::getNumReady() const {
+	return fifo.getNumReady();
+}
+
+
+int AudioBufferFifo::getFreeSpace() const {
+	return fifo.getFreeSpace();
+}
+
+
+int AudioBufferFifo::getCapacity() const {
+	return fifo.getTotalSize() - 1;
+}
+
+
+int AudioBufferFifo::getNumChannels() const {
+	return numChannels;
+}
+
+
+
+// ==========================================
+// Private
+// ==========================================
+
+template <typename SampleType>
+int AudioBufferFifo::pushSamples(const AudioBuffer<SampleType>& source, int startSample, int numSamples){
+
+	if (source.getNumChannels() < numChannels){
+		DBG("AudioBufferFifo::push() error: source has fewer channels than the fifo.\n");
+		return 0;
+	}
+
+	int start1, size1, start2, size2;
+	fifo.prepareToWrite(numSamples, start1, size1, start2, size2);
+
+	for (int channel = 0; channel < numChannels; channel++){
+		if (size1 > 0)
+			tools::copySamples(buffer.getWritePointer(channel, start1), source.getReadPointer(channel, startSample), size1);
+		if (size2 > 0)
+			tools::copySamples(buffer.getWritePointer(channel, start2), source.getReadPointer(channel, startSample + size1), size2);
+	}
+
+	fifo.finishedWrite(size1 + size2);
+	return size1 + size2;
+}
+
+
+template <typename SampleType>
+int AudioBufferFifo::popSamples(AudioBuffer<SampleType>& destination, int startSample, int numSamples){
+
+	if (destination.getNumChannels() < numChannels){
+		DBG("AudioBufferFifo::pop() error: destination has fewer channels than the fifo.\n");
+		return 0;
+	}
+
+	int start1, size1, start2, size2;
+	fifo.prepareToRead(numSamples, start1, size1, start2, size2);
+	int numRead = size1 + size2;
+
+	for (int channel = 0; channel < numChannels; channel++){
+		if (size1 > 0)
+			tools::copySamples(destination.getWritePointer(channel, startSample), buffer.getReadPointer(channel, start1), size1);
+		if (size2 > 0)
+			tools::copySamples(destination.getWritePointer(channel, startSample + size1), buffer.getReadPointer(channel, start2), size2);
+		if (numRead < numSamples)
+			destination.clear(channel, startSample + numRead, numSamples - numRead);
+	}
+
+	fifo.finishedRead(numRead);
+	return numRead;
+}
+
+} // fp
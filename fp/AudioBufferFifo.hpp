@@ -0,0 +1,60 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+#pragma once
+
+#include <fp_include_all.hpp>
+#include <JuceHeader.h>
+
+
+namespace fp {
+
+
+/* The AudioBufferFifo class is a multichannel first-in-first-out queue of samples,
+ * for moving audio between blocks of different sizes, e.g. host blocks and convolution partitions.
+ * Any number of samples can be written and read per call, and all copies are bulk copies of at most two parts
+ * (before and after the fold back). The capacity is fixed by setSize(), so nothing is allocated while it is used.
+ * Reading never returns more samples than are in the queue: pop() clears the part of the destination it couldn't fill.
+ * The samples are kept in double, so that float and double buffers can be written and read alike, and pass unchanged.
+ */
+
+class AudioBufferFifo {
+
+public:
+	AudioBufferFifo();
+	AudioBufferFifo(int numChannels, int capacity);
+	~AudioBufferFifo();
+
+	/* resizes and empties the queue */
+	void setSize(int numChannels, int capacity);
+	void reset();
+
+	/* returns the number of samples written, which is less than numSamples if the queue is full */
+	int push(const AudioBuffer<float>& source, int startSample, int numSamples);
+	int push(const AudioBuffer<double>& source, int startSample, int numSamples);
+	int pushSilence(int numSamples);
+
+	/* returns the number of samples read, the rest of the numSamples in destination are cleared */
+	int pop(AudioBuffer<float>& destination, int startSample, int numSamples);
+	int pop(AudioBuffer<double>& destination, int startSample, int numSamples);
+
+	int getNumReady() const;
+	int getFreeSpace() const;
+	int getCapacity() const;
+	int getNumChannels() const;
+
+private:
+	template <typename SampleType>
+	int pushSamples(const AudioBuffer<SampleType>& source, int startSample, int numSamples);
+	template <typename SampleType>
+	int popSamples(AudioBuffer<SampleType>& destination, int startSample, int numSamples);
+
+	AudioBuffer<double> buffer;
+	AbstractFifo fifo { 1 };
+	int numChannels = 0;
+
+	JUCE_DECLARE_NON_COPYABLE (AudioBufferFifo)
+};
+
+} // fp
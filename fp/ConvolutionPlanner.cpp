@@ -0,0 +1,277 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+
+#include <fp_include_all.hpp>
+
+
+namespace fp {
+
+
+ConvolutionPlanner::ConvolutionPlanner(){
+}
+
+
+ConvolutionPlanner::~ConvolutionPlanner(){
+}
+
+
+void ConvolutionPlanner::setWisdomFile(const File& file){
+	wisdomFile = file;
+	wisdom = nullptr;
+}
+
+
+ConvolutionPlanner::Plan ConvolutionPlanner::getPlan(const Config& config, int maxPartitionSizeLimit){
+
+	String key = getKey(config, maxPartitionSizeLimit);
+
+	/* another instance may have planned since, and written the file */
+	loadWisdom();
+
+	if (XmlElement* entry = wisdom->getChildByAttribute("key", key)){
+		Plan plan;
+		plan.maxPartitionSize = entry->getIntAttribute("maxPartitionSize");
+		plan.numWorkerThreads = entry->getIntAttribute("numWorkerThreads");
+		plan.meanMicroseconds = (float) entry->getDoubleAttribute("meanMicroseconds");
+		plan.peakMicroseconds = (float) entry->getDoubleAttribute("peakMicroseconds");
+
+		if (plan.maxPartitionSize >= config.blockSize && plan.maxPartitionSize <= std::max(config.blockSize, maxPartitionSizeLimit)
+			&& plan.numWorkerThreads >= 0 && plan.numWorkerThreads <= config.maxWorkerThreads)
+			return plan;
+
+		DBG("ConvolutionPlanner::getPlan() error: invalid plan in the wisdom, measuring again.\n");
+		wisdom->removeChildElement(entry, true);
+	}
+
+	Plan plan = measurePlan(config, maxPartitionSizeLimit);
+
+	XmlElement* entry = wisdom->createNewChildElement("PLAN");
+	entry->setAttribute("key", key);
+	entry->setAttribute("maxPartitionSize", plan.maxPartitionSize);
+	entry->setAttribute("numWorkerThreads", plan.numWorkerThreads);
+	entry->setAttribute("meanMicroseconds", (double) plan.meanMicroseconds);
+	entry->setAttribute("peakMicroseconds", (double) plan.peakMicroseconds);
+	saveWisdom();
+
+	return plan;
+}
+
+
+ConvolutionPlanner::Plan ConvolutionPlanner::measurePlan(const Config& config, int maxPartitionSizeLimit){
+
+	makeBenchmarkSignals(config);
+
+	/* maximum partition sizes in between these give the same partitioning as the one below them */
+	Plan best;
+	bool bestFits = false;
+
+	for (int maxPartitionSize = config.blockSize; maxPartitionSize <= std::max(config.blockSize, maxPartitionSizeLimit);
+		 maxPartitionSize *= convolution::partitionGrowth){
+
+		/* an IR too short for a stage of this size gives the same partitioning as the previous candidate */
+		if (maxPartitionSize > config.blockSize
+			&& convolution::partitionScheme(config.maxIRSamples, config.blockSize, maxPartitionSize).back().partitionSize < maxPartitionSize)
+			break;
+
+		for (int numWorkerThreads = 0; numWorkerThreads <= (config.render ? config.maxWorkerThreads : 0); numWorkerThreads++){
+			Plan candidate = timeCandidate(config, maxPartitionSize, numWorkerThreads);
+			bool fits = config.render || fitsBudget(config, candidate);
+
+			/* there are no more stages to spread */
+			if (candidate.numWorkerThreads < numWorkerThreads)
+				break;
+
+			if (best.maxPartitionSize == 0 || (fits && NOT bestFits) || (fits == bestFits && candidate.meanMicroseconds < best.meanMicroseconds)){
+				best = candidate;
+				bestFits = fits;
+			}
+		}
+	}
+
+	/* the head stays on the audio thread, so workers can only help if there are other stages */
+	bool hasTailStages = convolution::partitionScheme(config.maxIRSamples, config.blockSize, best.maxPartitionSize).size() > 1
+		|| config.tailDecimation > 1;
+
+	if (bestFits || NOT hasTailStages)
+		return best;
+
+	Plan fastest = best;
+	for (int numWorkerThreads = 1; numWorkerThreads <= config.maxWorkerThreads; numWorkerThreads++){
+		Plan candidate = timeCandidate(config, best.maxPartitionSize, numWorkerThreads);
+
+		/* there are no more stages to spread */
+		if (candidate.numWorkerThreads < numWorkerThreads)
+			break;
+		if (fitsBudget(config, candidate))
+			return candidate;
+		if (candidate.peakMicroseconds < fastest.peakMicroseconds)
+			fastest = candidate;
+	}
+
+	DBG("ConvolutionPlanner::measurePlan(): no plan fits the callback budget, taking the fastest.\n");
+	return fastest;
+}
+
+
+
+// ==========================================
+// Private
+// ==========================================
+
+/* the audio thread's cost per host callback, fed like the plugin feeds the convolver.
+ * The timing starts once the FDLs are full, as silent partitions are skipped, and the round that was disturbed least counts */
+ConvolutionPlanner::Plan ConvolutionPlanner::timeCandidate(const Config& config, int maxPartitionSize, int numWorkerThreads){
+
+	PartitionedConvolver convolver;
+	convolver.prepare(config.numInputChannels, config.numOutputChannels, config.blockSize, maxPartitionSize, config.maxIRSamples,
+					  numWorkerThreads, config.tailDecimation, config.render);
+	convolver.setDoubleAccumulation(config.doubleAccumulation);
+
+	PreparedIR::Ptr ir = new PreparedIR(benchmarkIR, config.blockSize, maxPartitionSize, 0, true, 0, convolver.getTailDecimation());
+	convolver.setIR(ir);
+
+	int cycleSamples = convolution::partitionScheme(config.maxIRSamples, config.blockSize, maxPartitionSize).back().partitionSize;
+	int warmUpCallbacks = (config.maxIRSamples + cycleSamples) / config.hostBlockSize + 1;
+	int timedCallbacks = std::max(minTimedCallbacks, minTimedCycles * cycleSamples / config.hostBlockSize);
+
+	AudioBuffer<float> output (config.numOutputChannels, config.blockSize);
+	std::vector<double> callbackSeconds;
+	callbackSeconds.reserve((size_t) timedCallbacks);
+	int samplesGathered = 0;
+
+	Plan plan;
+	plan.maxPartitionSize = maxPartitionSize;
+	plan.numWorkerThreads = convolver.getNumWorkerThreads();
+
+	for (int round = -1; round < numTimingRounds; round++){
+		callbackSeconds.clear();
+
+		for (int callback = 0; callback < (round < 0 ? warmUpCallbacks : timedCallbacks); callback++){
+			int64 startTicks = Time::getHighResolutionTicks();
+
+			samplesGathered += config.hostBlockSize;
+			while (samplesGathered >= config.blockSize){
+				convolver.process(benchmarkInput, output);
+				samplesGathered -= config.blockSize;
+			}
+			if (samplesGathered > 0 && NOT config.render)
+				convolver.processSlice(samplesGathered);
+
+			callbackSeconds.push_back(Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks));
+		}
+
+		if (round < 0)
+			continue;
+
+		float meanMicroseconds = 1.0e6f * (float) (std::accumulate(callbackSeconds.begin(), callbackSeconds.end(), 0.0) / (double) callbackSeconds.size());
+		auto peak = callbackSeconds.begin() + (int) (peakPercentile * (float) (callbackSeconds.size() - 1));
+		std::nth_element(callbackSeconds.begin(), peak, callbackSeconds.end());
+
+		if (round == 0 || meanMicroseconds < plan.meanMicroseconds){
+			plan.meanMicroseconds = meanMicroseconds;
+			plan.peakMicroseconds = 1.0e6f * (float) *peak;
+		}
+	}
+
+	return plan;
+}
+
+
+/* an exponentially decaying noise IR, with one path per output when the inputs match the outputs, like the makeup filter.
+ * With a multirate tail its highs die out after the first quarter, so that PreparedIR finds a tail to decimate */
+void ConvolutionPlanner::makeBenchmarkSignals(const Config& config){
+
+	Random random (1);
+	int numIRChannels = config.numInputChannels == config.numOutputChannels ? config.numOutputChannels : 1;
+	int numSamples = std::max(1, config.maxIRSamples);
+	int D = config.tailDecimation;
+
+	benchmarkIR.setSize(numIRChannels, numSamples);
+	for (int channel = 0; channel < numIRChannels; channel++){
+		for (int sample = 0; sample < numSamples; sample++)
+			benchmarkIR.setSample(channel, sample, 2.0f * random.nextFloat() - 1.0f);
+	}
+
+	if (D > 1){
+		int numLowRateSamples = (numSamples + D - 1) / D;
+		AudioBuffer<float> lowRateNoise (numIRChannels, numLowRateSamples);
+		AudioBuffer<float> bandLimited (numIRChannels, numLowRateSamples * D);
+		for (int channel = 0; channel < numIRChannels; channel++){
+			for (int sample = 0; sample < numLowRateSamples; sample++)
+				lowRateNoise.setSample(channel, sample, 2.0f * random.nextFloat() - 1.0f);
+		}
+		bandLimited.clear();
+
+		RateConverter interpolator;
+		interpolator.prepare(numIRChannels, D, numLowRateSamples * D);
+		interpolator.addInterpolated(lowRateNoise, bandLimited, numLowRateSamples * D);
+
+		int split = numSamples / 4;
+		for (int channel = 0; channel < numIRChannels; channel++)
+			benchmarkIR.copyFrom(channel, split, bandLimited, channel, split, numSamples - split);
+	}
+
+	/* 60 dB down at the end */
+	for (int sample = 0; sample < numSamples; sample++){
+		float gain = std::pow(10.0f, -3.0f * (float) sample / (float) numSamples);
+		for (int channel = 0; channel < numIRChannels; channel++)
+			benchmarkIR.setSample(channel, sample, gain * benchmarkIR.getSample(channel, sample));
+	}
+
+	benchmarkInput.setSize(config.numInputChannels, config.blockSize);
+	for (int channel = 0; channel < config.numInputChannels; channel++){
+		for (int sample = 0; sample < config.blockSize; sample++)
+			benchmarkInput.setSample(channel, sample, 2.0f * random.nextFloat() - 1.0f);
+	}
+}
+
+
+bool ConvolutionPlanner::fitsBudget(const Config& config, const Plan& plan){
+	double callbackMicroseconds = 1.0e6 * (double) config.hostBlockSize / config.sampleRate;
+	return (double) plan.peakMicroseconds <= callbackBudget * callbackMicroseconds;
+}
+
+
+/* everything the plan depends on, and the machine */
+String ConvolutionPlanner::getKey(const Config& config, int maxPartitionSizeLimit){
+	return "v" + String(wisdomVersion)
+		+ " cpu " + SystemStats::getCpuModel() + " x" + String(SystemStats::getNumCpus()) + " " + kernels::getInstructionSetName()
+		+ " in " + String(config.numInputChannels) + " out " + String(config.numOutputChannels)
+		+ " block " + String(config.blockSize) + " host " + String(config.hostBlockSize)
+		+ " ir " + String(config.maxIRSamples) + " limit " + String(maxPartitionSizeLimit)
+		+ " decimation " + String(config.tailDecimation) + " workers " + String(config.maxWorkerThreads)
+		+ " rate " + String((int) config.sampleRate) + (config.render ? " render" : "") + (config.doubleAccumulation ? " double" : "");
+}
+
+
+/* keeps the wisdom in memory if there is no file, or it can't be read */
+void ConvolutionPlanner::loadWisdom(){
+
+	if (wisdomFile.existsAsFile()){
+		std::unique_ptr<XmlElement> loaded = parseXML(wisdomFile);
+
+		if (loaded != nullptr && loaded->hasTagName("CONVOLUTIONWISDOM") && loaded->getIntAttribute("version") == wisdomVersion)
+			wisdom = std::move(loaded);
+		else
+			DBG("ConvolutionPlanner::loadWisdom(): wisdom file unreadable or of another version, starting over.\n");
+	}
+
+	if (wisdom == nullptr){
+		wisdom.reset(new XmlElement("CONVOLUTIONWISDOM"));
+		wisdom->setAttribute("version", wisdomVersion);
+	}
+}
+
+
+void ConvolutionPlanner::saveWisdom(){
+
+	if (wisdomFile == File())
+		return;
+
+	if (NOT wisdomFile.getParentDirectory().createDirectory() || NOT wisdom->writeTo(wisdomFile))
+		DBG("ConvolutionPlanner::saveWisdom() error: can't write " + wisdomFile.getFullPathName() + "\n");
+}
+
+} // fp
@@ -0,0 +1,102 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+#pragma once
+
+#include <fp_include_all.hpp>
+#include <JuceHeader.h>
+
+
+namespace fp {
+
+
+/* The ConvolutionPlanner class chooses the maximum partition size and the number of worker threads of a PartitionedConvolver,
+ * by timing the candidates on this machine. The head partition size is the caller's, as it sets the latency,
+ * so every candidate meets the latency; the plan is about what it costs the audio thread to get there.
+ *
+ * The candidates are the maximum partition sizes that give a distinct partitionScheme(), each timed with all stages
+ * on the calling thread, in host callbacks of hostBlockSize like the plugin makes them (process() and processSlice()).
+ * The one with the lowest mean cost per callback is chosen, among those whose slowest callbacks (see peakPercentile)
+ * take at most callbackBudget of a callback's real time. Workers are only planned if no scheme fits that way on its own,
+ * and then as few as it takes to fit.
+ * For offline rendering only throughput counts: every scheme is also timed with each number of workers, which process() waits for,
+ * and the lowest mean cost wins.
+ *
+ * Plans are remembered in a wisdom file per user, keyed by the configuration and the CPU, so only the first use
+ * of a configuration on a machine is measured. A change of the engine that makes old measurements meaningless
+ * should bump wisdomVersion.
+ *
+ * getPlan() takes in the order of a second when it measures, so it is for prepareToPlay(), never for the audio thread.
+ */
+
+class ConvolutionPlanner {
+
+public:
+	/* what a plan is for */
+	struct Config {
+		int numInputChannels = 2;
+		int numOutputChannels = 2;
+		int blockSize = 256;				// the head partition size
+		int hostBlockSize = 256;
+		int maxIRSamples = 0;
+		int tailDecimation = 1;
+		int maxWorkerThreads = 0;
+		double sampleRate = 48000.0;
+		bool render = false;				// offline, see PartitionedConvolver::prepare()
+		bool doubleAccumulation = false;	// see PartitionedConvolver::setDoubleAccumulation()
+	};
+
+	struct Plan {
+		int maxPartitionSize = 0;
+		int numWorkerThreads = 0;
+		float meanMicroseconds = 0.0f;		// per host callback, on the audio thread
+		float peakMicroseconds = 0.0f;
+	};
+
+	ConvolutionPlanner();
+	~ConvolutionPlanner();
+
+	/* where the wisdom is read from and saved to. Without a file, plans are only remembered by this planner */
+	void setWisdomFile(const File& file);
+
+	/* the plan for config with maximum partition sizes up to maxPartitionSizeLimit: from the wisdom if it has one,
+	 * otherwise measured, and added to the wisdom */
+	Plan getPlan(const Config& config, int maxPartitionSizeLimit);
+
+	/* times the candidates, without looking at the wisdom */
+	Plan measurePlan(const Config& config, int maxPartitionSizeLimit);
+
+	/* the part of a host callback's real time that the audio thread's share of the convolution may take */
+	static constexpr float callbackBudget = 0.1f;
+
+	/* the callbacks of a timing run above this percentile count as outliers, e.g. the thread being preempted */
+	static constexpr float peakPercentile = 0.99f;
+
+	static const int wisdomVersion = 1;
+
+private:
+	/* a candidate is timed once its FDLs are full, in numTimingRounds rounds of at least minTimedCycles blocks of its largest stage
+	 * and minTimedCallbacks callbacks */
+	static const int numTimingRounds = 3;
+	static const int minTimedCycles = 2;
+	static const int minTimedCallbacks = 256;
+
+	Plan timeCandidate(const Config& config, int maxPartitionSize, int numWorkerThreads);
+	void makeBenchmarkSignals(const Config& config);
+	bool fitsBudget(const Config& config, const Plan& plan);
+	String getKey(const Config& config, int maxPartitionSizeLimit);
+	void loadWisdom();
+	void saveWisdom();
+
+	std::unique_ptr<XmlElement> wisdom;
+	File wisdomFile;
+
+	/* a dense IR of maxIRSamples and a block of noise for each input channel */
+	AudioBuffer<float> benchmarkIR;
+	AudioBuffer<float> benchmarkInput;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ConvolutionPlanner)
+};
+
+} // fp
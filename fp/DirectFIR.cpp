@@ -0,0 +1,153 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+
+#include <fp_include_all.hpp>
+
+
+namespace fp {
+
+
+DirectFIR::DirectFIR(){
+}
+
+
+DirectFIR::~DirectFIR(){
+}
+
+
+void DirectFIR::prepare(int numInputChannels, int numOutputChannels, int maxTaps, int maxBlockSize){
+
+	this->numInputChannels = numInputChannels;
+	this->numOutputChannels = numOutputChannels;
+	this->maxTaps = std::max(1, maxTaps);
+	this->maxBlockSize = maxBlockSize;
+
+	history.setSize(numInputChannels, this->maxTaps - 1 + maxBlockSize);
+	fadeOutputBuffer.setSize(1, maxBlockSize);
+	pathBuffer.setSize(1, maxBlockSize);
+	reset();
+}
+
+
+void DirectFIR::reset(){
+	history.clear();
+	silentHistorySamples = maxTaps - 1;
+	lastFadeGain = 1.0f;
+}
+
+
+void DirectFIR::process(const AudioSampleBuffer& input, AudioSampleBuffer& output, int startSample, int numSamples, PreparedIR* ir,
+						PreparedIR* fadingOutIR, float fadeGain){
+	processSamples(input, output, startSample, numSamples, ir, fadingOutIR, fadeGain);
+}
+
+
+void DirectFIR::process(const AudioBuffer<double>& input, AudioSampleBuffer& output, int startSample, int numSamples, PreparedIR* ir,
+						PreparedIR* fadingOutIR, float fadeGain){
+	processSamples(input, output, startSample, numSamples, ir, fadingOutIR, fadeGain);
+}
+
+
+int DirectFIR::getMaxTaps(){
+	return maxTaps;
+}
+
+
+// ==========================================
+// Private
+// ==========================================
+
+template <typename SampleType>
+void DirectFIR::processSamples(const AudioBuffer<SampleType>& input, AudioSampleBuffer& output, int startSample, int numSamples, PreparedIR* ir,
+							   PreparedIR* fadingOutIR, float fadeGain){
+
+	if (numSamples > maxBlockSize){
+		DBG("DirectFIR::process() error: more samples than prepared for.\n");
+		return;
+	}
+
+	int historySamples = maxTaps - 1;
+
+	bool silentInput = true;
+	for (int channel = 0; channel < numInputChannels && silentInput; channel++){
+		silentInput = input.getMagnitude(channel, startSample, numSamples) == (SampleType) 0;
+	}
+
+	/* silence in the whole history and the input gives silence, and leaves the history as it is */
+	if (silentInput && silentHistorySamples >= historySamples){
+		for (int channel = 0; channel < numOutputChannels; channel++)
+			output.clear(channel, startSample, numSamples);
+		lastFadeGain = fadingOutIR != nullptr ? fadeGain : 0.0f;
+		return;
+	}
+
+	silentHistorySamples = silentInput ? silentHistorySamples + numSamples : 0;
+
+	bool fading = fadingOutIR != nullptr && (fadeGain < 1.0f || lastFadeGain < 1.0f);
+	float startGain = fadingOutIR != nullptr ? lastFadeGain : 1.0f;
+
+	/* all input goes into the history first, as the output can overwrite it */
+	for (int channel = 0; channel < numInputChannels; channel++){
+		tools::copySamples(history.getWritePointer(channel, historySamples), input.getReadPointer(channel, startSample), numSamples);
+	}
+
+	for (int channel = 0; channel < numOutputChannels; channel++){
+		convolveTaps(output.getWritePointer(channel, startSample), ir, channel, numSamples);
+
+		if (fading){
+			convolveTaps(fadeOutputBuffer.getWritePointer(0, 0), fadingOutIR, channel, numSamples);
+			output.applyGainRamp(channel, startSample, numSamples, startGain, fadeGain);
+			output.addFromWithRamp(channel, startSample, fadeOutputBuffer.getReadPointer(0, 0), numSamples, 1.0f - startGain, 1.0f - fadeGain);
+		}
+	}
+
+	/* keep the most recent maxTaps - 1 samples for the next call */
+	for (int channel = 0; channel < numInputChannels; channel++){
+		float* historyPtr = history.getWritePointer(channel, 0);
+		memmove(historyPtr, historyPtr + numSamples, sizeof(float) * (size_t) historySamples);
+	}
+
+	/* the next crossfade starts from 0 */
+	lastFadeGain = fadingOutIR != nullptr ? fadeGain : 0.0f;
+}
+
+
+/* sums the paths from all inputs into one output channel, with the numSamples new samples at the end of the history */
+void DirectFIR::convolveTaps(float* output, PreparedIR* ir, int outputChannel, int numSamples){
+
+	int numTaps = ir != nullptr ? std::min(ir->getNumDirectTaps(), maxTaps) : 0;
+	bool hasPath = false;
+
+	for (int input = 0; input < numInputChannels && numTaps > 0; input++){
+		int irChannel = ir->getPathChannel(input, outputChannel, numInputChannels, numOutputChannels);
+		if (irChannel < 0)
+			continue;
+
+		/* the IR's taps only need its own numTaps - 1 samples of history */
+		const float* historyPtr = history.getReadPointer(input, maxTaps - 1 - (numTaps - 1));
+		float* pathPtr = hasPath ? pathBuffer.getWritePointer(0, 0) : output;
+
+		if (ir->isSparse()){
+			FloatVectorOperations::clear(pathPtr, numSamples);
+			for (const PreparedIR::SparseTap& tap : ir->getSparseTaps(irChannel)){
+				if (tap.delay >= numTaps)
+					break;
+				FloatVectorOperations::addWithMultiply(pathPtr, historyPtr + numTaps - 1 - tap.delay, tap.gain, numSamples);
+			}
+		}
+		else {
+			kernels::fir(pathPtr, historyPtr, ir->getDirectTaps(irChannel), numTaps, numSamples);
+		}
+
+		if (hasPath)
+			FloatVectorOperations::add(output, pathPtr, numSamples);
+		hasPath = true;
+	}
+
+	if (NOT hasPath)
+		FloatVectorOperations::clear(output, numSamples);
+}
+
+} // fp
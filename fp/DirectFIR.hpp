@@ -0,0 +1,72 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+#pragma once
+
+#include <fp_include_all.hpp>
+#include <JuceHeader.h>
+
+
+namespace fp {
+
+
+/* The DirectFIR class convolves the direct taps of a PreparedIR (see PreparedIR::getNumDirectTaps())
+ * in the time domain, with kernels::fir(). Unlike the PartitionedConvolver it needs no full block of input,
+ * so its output is there without latency, for any number of samples per call.
+ * Together with a PartitionedConvolver for the rest of the IR, whose latency is exactly numDirectTaps,
+ * this gives the convolution with the whole IR at zero latency.
+ *
+ * While the PartitionedConvolver crossfades to a new IR, the DirectFIR convolves with both and follows its gain,
+ * with a ramp over every call.
+ * The direct taps of a sparse IR are convolved one by one, only those that aren't zero.
+ * Once the history holds only silence, silent input is answered with silence without convolving.
+ *
+ * Only prepare() allocates; reset() and process() are meant for the audio thread.
+ */
+
+class DirectFIR {
+
+public:
+	DirectFIR();
+	~DirectFIR();
+
+	/* allocates for IRs with up to maxTaps direct taps, and calls of up to maxBlockSize samples.
+	 * The IR channels are routed from the inputs to the outputs as in PreparedIR::getPathChannel() */
+	void prepare(int numInputChannels, int numOutputChannels, int maxTaps, int maxBlockSize);
+
+	/* clears the input history */
+	void reset();
+
+	/* convolves numSamples samples of the input channels of input, from startSample on, with the direct taps of ir,
+	 * and writes them to the same samples of the output channels of output. input and output can be the same buffer.
+	 * With a fadingOutIR, the output is crossfaded to fadeGain times ir plus 1 - fadeGain times fadingOutIR,
+	 * starting at the fadeGain of the previous call. Double input is rounded to float as it goes into the history. */
+	void process(const AudioBuffer<float>& input, AudioBuffer<float>& output, int startSample, int numSamples, PreparedIR* ir,
+				 PreparedIR* fadingOutIR = nullptr, float fadeGain = 1.0f);
+	void process(const AudioBuffer<double>& input, AudioBuffer<float>& output, int startSample, int numSamples, PreparedIR* ir,
+				 PreparedIR* fadingOutIR = nullptr, float fadeGain = 1.0f);
+
+	int getMaxTaps();
+
+private:
+	template <typename SampleType>
+	void processSamples(const AudioBuffer<SampleType>& input, AudioBuffer<float>& output, int startSample, int numSamples, PreparedIR* ir,
+						PreparedIR* fadingOutIR, float fadeGain);
+	void convolveTaps(float* output, PreparedIR* ir, int outputChannel, int numSamples);
+
+	/* per input channel the maxTaps - 1 most recent input samples, followed by room for the new ones */
+	AudioBuffer<float> history;
+	AudioBuffer<float> fadeOutputBuffer;		// the output of the IR that is faded out
+	AudioBuffer<float> pathBuffer;				// the output of one path, before it is added to the others
+	float lastFadeGain = 1.0f;
+	int silentHistorySamples = 0;				// the number of most recent input samples that were all zero
+	int numInputChannels = 0;
+	int numOutputChannels = 0;
+	int maxTaps = 0;
+	int maxBlockSize = 0;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DirectFIR)
+};
+
+} // fp
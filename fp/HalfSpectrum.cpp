@@ -0,0 +1,76 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+
+#include <fp_include_all.hpp>
+
+
+namespace fp {
+
+
+HalfSpectrum::HalfSpectrum(){
+}
+
+
+HalfSpectrum::HalfSpectrum(int numChannels, int fftSize){
+	setSize(numChannels, fftSize);
+}
+
+
+HalfSpectrum::~HalfSpectrum(){
+}
+
+
+void HalfSpectrum::setSize(int numChannels, int fftSize){
+	this->fftSize = fftSize;
+	bins.setSize(numChannels, fftSize + 2);
+	bins.clear();
+}
+
+
+void HalfSpectrum::clear(){
+	bins.clear();
+}
+
+
+float* HalfSpectrum::getWritePointer(int channel){
+	return bins.getWritePointer(channel, 0);
+}
+
+
+const float* HalfSpectrum::getReadPointer(int channel) const {
+	return bins.getReadPointer(channel, 0);
+}
+
+
+void HalfSpectrum::copyFromJuceLayout(int channel, const float* juceSpectrum){
+	FloatVectorOperations::copy(bins.getWritePointer(channel, 0), juceSpectrum, fftSize + 2);
+}
+
+
+void HalfSpectrum::copyToJuceLayout(int channel, float* juceSpectrum) const {
+	FloatVectorOperations::copy(juceSpectrum, bins.getReadPointer(channel, 0), fftSize + 2);
+}
+
+
+int HalfSpectrum::getFftSize() const {
+	return fftSize;
+}
+
+
+int HalfSpectrum::getNumBins() const {
+	return fftSize / 2 + 1;
+}
+
+
+int HalfSpectrum::getNumChannels() const {
+	return bins.getNumChannels();
+}
+
+
+AudioBuffer<float>& HalfSpectrum::getBuffer(){
+	return bins;
+}
+
+} // fp
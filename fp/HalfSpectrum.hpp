@@ -0,0 +1,51 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+#pragma once
+
+#include <fp_include_all.hpp>
+#include <JuceHeader.h>
+
+
+namespace fp {
+
+
+/* The HalfSpectrum class holds the spectrum of a real signal of fftSize (N) samples:
+ * exactly the N/2+1 meaningful bins, interleaved {re, im}, bin 0 up to and including Nyquist.
+ * The JUCE RealOnly transforms need a 2N float buffer, of which the upper half is only workspace,
+ * so the conversion to and from that layout happens at the FFT boundary only.
+ * Bin k is at [2k] and [2k+1], the same indexing as the JUCE layout, so loops like (i = 0; i <= N; i += 2) still apply.
+ */
+
+class HalfSpectrum {
+
+public:
+	HalfSpectrum();
+	HalfSpectrum(int numChannels, int fftSize);
+	~HalfSpectrum();
+
+	void setSize(int numChannels, int fftSize);
+	void clear();
+
+	float* getWritePointer(int channel);
+	const float* getReadPointer(int channel) const;
+
+	/* copies the N/2+1 bins from / to a buffer in the performRealOnlyForwardTransform() layout.
+	 * copyToJuceLayout() only writes the first N+2 floats, the rest of the 2N buffer is left alone */
+	void copyFromJuceLayout(int channel, const float* juceSpectrum);
+	void copyToJuceLayout(int channel, float* juceSpectrum) const;
+
+	int getFftSize() const;
+	int getNumBins() const;
+	int getNumChannels() const;
+
+	/* N+2 floats per channel, for printing and the like */
+	AudioBuffer<float>& getBuffer();
+
+private:
+	AudioBuffer<float> bins;
+	int fftSize = 0;
+};
+
+} // fp
@@ -285,15 +285,15 @@ void ParallelBufferPrinter::printFreqToCsv (int sampleRate, std::string director
 	
 	for(int buf = 0; buf < bufferArray.size(); buf++){
 
-		int fftSize = bufferArray[buf].buffer.getNumSamples();
+		/* the buffers are HalfSpectrum buffers: N/2+1 interleaved bins, so N+2 samples */
+		int N = bufferArray[buf].buffer.getNumSamples() - 2;
 		
-		if (!tools::isPowerOfTwo(fftSize)) {
+		if (!tools::isPowerOfTwo(N)) {
 			String errstr ("ParallelBufferPrinter::printFreqToCsv error: buffer nr");
-			DBG(errstr + std::to_string(buf) + " size is not power of 2.");
+			DBG(errstr + std::to_string(buf) + " size is not N/2+1 bins with N a power of 2.");
 			continue;
 		}
-		
-		int N = fftSize / 2;
+
 		double freqPerBin = nyquist / (double) (N/2); // N/2 because juce fft style is {re, im, re im, ...}
 		
 		float* bufPtr = bufferArray[buf].buffer.getWritePointer(0);
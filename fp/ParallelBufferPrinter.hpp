@@ -46,7 +46,7 @@ public:
 
 	void printToWav(int startSample, int numSamples, int sampleRate, String directoryNameFullPath = "-");
 
-	// assumes that all added buffers have the same samplerate
+	// assumes that all added buffers have the same samplerate, and are HalfSpectrum::getBuffer()s
 	// don't forget to include libboost_filesystem.dylib in your project!
 	void printFreqToCsv (int sampleRate, std::string directoryNameFullPath = "-");
 	
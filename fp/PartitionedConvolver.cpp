@@ -0,0 +1,1566 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+
+#include <fp_include_all.hpp>
+
+
+namespace fp {
+
+
+PartitionedConvolver::PartitionedConvolver(){
+}
+
+
+PartitionedConvolver::~PartitionedConvolver(){
+	stopWorkers();
+	releaseAllIRs();
+}
+
+
+void PartitionedConvolver::prepare(int numInputChannels, int numOutputChannels, int blockSize, int maxPartitionSize, int maxIRSamples, int numWorkerThreads,
+								   int tailDecimation, bool waitForWorkers){
+
+	stopWorkers();
+
+	this->numInputChannels = numInputChannels;
+	this->numOutputChannels = numOutputChannels;
+	this->blockSize = blockSize;
+	this->maxPartitionSize = maxPartitionSize;
+
+	if (tailDecimation > 1 && (blockSize % tailDecimation != 0 || maxPartitionSize % tailDecimation != 0)){
+		DBG("PartitionedConvolver::prepare() error: block size not divisible by the tail decimation, no multirate tail.\n");
+		tailDecimation = 1;
+	}
+	this->tailDecimation = std::max(1, tailDecimation);
+
+	stages.clear();
+	addStages(convolution::partitionScheme(maxIRSamples, blockSize, maxPartitionSize), 1);
+	firstDecimatedStage = (int) stages.size();
+
+	/* a decimated tail is never longer than the IR, see PreparedIR::prepareTail() */
+	if (this->tailDecimation > 1){
+		int maxTailSamples = (maxIRSamples + this->tailDecimation - 1) / this->tailDecimation;
+		addStages(convolution::partitionScheme(maxTailSamples, blockSize / this->tailDecimation, maxPartitionSize / this->tailDecimation),
+				  this->tailDecimation);
+	}
+
+	/* the ring of each rate needs to hold everything from the block being read, up to the end of the furthest result */
+	int outputRingSize = blockSize;
+	int decimatedOutputRingSize = blockSize / this->tailDecimation;
+	int roundTripDelay = this->tailDecimation > 1 ? RateConverter::getRoundTripDelay(this->tailDecimation) : 0;
+	maxResultDelay = 0;
+
+	for (Stage& stage : stages){
+		int& ringSize = stage.decimation > 1 ? decimatedOutputRingSize : outputRingSize;
+		ringSize = std::max(ringSize, blockSize / stage.decimation + stage.layout.offset + 2 * stage.layout.partitionSize);
+		maxResultDelay = std::max(maxResultDelay, stage.decimation * stage.layout.partitionSize + (stage.decimation > 1 ? roundTripDelay : 0));
+	}
+
+	/* the head stays on the audio thread, and so does the head of the multirate tail, whose result is due right away.
+	 * The other stages are spread over the workers */
+	int numTailStages = (int) stages.size() - (this->tailDecimation > 1 ? 2 : 1);
+	this->numWorkerThreads = std::max(0, std::min(numWorkerThreads, numTailStages));
+	this->waitForWorkers = waitForWorkers;
+
+	for (int s = 1, workerStage = 0; s < (int) stages.size() && this->numWorkerThreads > 0; s++){
+		if (s == firstDecimatedStage)
+			continue;
+		stages[s].workerIndex = workerStage++ % this->numWorkerThreads;
+		stages[s].handOff.reset(new HandOff(numInputChannels, numOutputChannels, stages[s].layout));
+	}
+
+	/* tail stages without a worker are sliced on the audio thread, in steps of about half the head's FFT, so that a callback
+	 * that is a fraction of the head's block gets a few of them */
+	int headFFTOrder = BigInteger(stages[0].layout.fftSize).getHighestBit();
+	for (int s = 1; s < (int) stages.size(); s++){
+		int fftOrder = BigInteger(stages[s].layout.fftSize).getHighestBit();
+		if (stages[s].handOff == nullptr){
+			stages[s].slicedInput.setSize(numInputChannels, stages[s].layout.partitionSize);
+			if (fftOrder > headFFTOrder)
+				stages[s].slicedFFT.reset(new SlicedFFT(fftOrder, headFFTOrder - 1));
+		}
+	}
+
+	/* a stage of the multirate tail is due sooner than a full rate stage with the same partition size */
+	stagesByDeadline.resize(stages.size());
+	std::iota(stagesByDeadline.begin(), stagesByDeadline.end(), 0);
+	std::stable_sort(stagesByDeadline.begin(), stagesByDeadline.end(), [this] (int a, int b) {
+		return stages[(size_t) a].decimation * stages[(size_t) a].layout.partitionSize < stages[(size_t) b].decimation * stages[(size_t) b].layout.partitionSize;
+	});
+
+	workers.clear();
+	for (int w = 0; w < this->numWorkerThreads; w++){
+		workers.emplace_back(new Worker(*this, w));
+	}
+
+	outputRing.setSize(numOutputChannels, outputRingSize);
+	inputHistory.setSize(numInputChannels, maxIRSamples + blockSize);
+	missedDeadlines = 0;
+
+	decimatedInput.setSize(numInputChannels, blockSize / this->tailDecimation);
+	decimatedOutput.setSize(numOutputChannels, blockSize / this->tailDecimation);
+	decimatedOutputRing.setSize(numOutputChannels, decimatedOutputRingSize);
+	tailDecimator.prepare(numInputChannels, this->tailDecimation, blockSize);
+	tailInterpolator.prepare(numOutputChannels, this->tailDecimation, blockSize);
+
+	/* an IR partitioned for the previous block size, or routed for other channels, can't be used anymore */
+	if (ir != nullptr && NOT isUsable(ir)){
+		ir->decReferenceCount();
+		ir = nullptr;
+	}
+
+	reset();
+}
+
+
+void PartitionedConvolver::reset(){
+
+	stopWorkers();
+
+	for (Stage& stage : stages){
+		stage.inputBuffer.clear();
+		stage.inputSampleIndex = 0;
+		stage.fftBuffer.clear();
+		stage.fdl.clear();
+
+		if (stage.handOff != nullptr){
+			stage.handOff->inputFifo.reset();
+			stage.handOff->resultReady.reset();
+			stage.handOff->resultFifo.reset();
+			for (HandOffSlot& slot : stage.handOff->inputSlots){
+				slot.ir = nullptr;
+				slot.fadingOutIR = nullptr;
+			}
+			stage.handOff->blocksHandedOff = 0;
+			stage.handOff->nextBlockToCollect = 0;
+			stage.handOff->nextBlockToProcess = 0;
+		}
+
+		stage.fadePosition = 0;
+		stage.retireAfterBlock = 0;
+		stage.sliced = SlicedBlock();
+	}
+
+	silentInputSamples = 0;
+	inputSampleCount = 0;
+	lastSliceGathered = 0;
+	sliceStep = 0;
+	idle = false;
+
+	/* the workers are stopped, so a crossfade can be cut short here */
+	if (fadingOutIR != nullptr){
+		fadingOutIR->decReferenceCount();
+		fadingOutIR = nullptr;
+	}
+	if (retiringIR != nullptr){
+		retiringIR->decReferenceCount();
+		retiringIR = nullptr;
+	}
+	releaseRetiredIRs();
+
+	/* an IR that was set before is taken right away, so that getIR() has it before the first process() */
+	updateIR();
+
+	outputRing.clear();
+	outputRingReadIndex = 0;
+	decimatedOutputRing.clear();
+	decimatedOutputRingReadIndex = 0;
+	tailDecimator.reset();
+	tailInterpolator.reset();
+	inputHistory.clear();
+	inputHistoryWriteIndex = 0;
+
+	startWorkers();
+}
+
+
+void PartitionedConvolver::setIR(PreparedIR::Ptr newIR){
+
+	if (newIR == nullptr) return;
+
+	/* the reference travels with the pointer: to the audio thread, or back if it is replaced before being taken */
+	newIR->incReferenceCount();
+	PreparedIR* replacedIR = pendingIR.exchange(newIR.get());
+
+	if (replacedIR != nullptr)
+		replacedIR->decReferenceCount();
+}
+
+
+void PartitionedConvolver::releaseRetiredIRs(){
+
+	/* AbstractFifo has a single reader */
+	const ScopedLock releaseScopedLock (releaseLock);
+
+	int start1, size1, start2, size2;
+	retiredFifo.prepareToRead(retiredFifo.getNumReady(), start1, size1, start2, size2);
+
+	for (int i = 0; i < size1 + size2; i++){
+		PreparedIR*& retiredIR = retiredIRs[i < size1 ? start1 + i : start2 + i - size1];
+		retiredIR->decReferenceCount();
+		retiredIR = nullptr;
+	}
+
+	retiredFifo.finishedRead(size1 + size2);
+}
+
+
+void PartitionedConvolver::process(const AudioSampleBuffer& input, AudioSampleBuffer& output){
+
+	bool silentInput = true;
+	for (int channel = 0; channel < numInputChannels && silentInput; channel++){
+		silentInput = input.getMagnitude(channel, 0, blockSize) == 0.0f;
+	}
+	silentInputSamples = silentInput ? silentInputSamples + blockSize : 0;
+
+	/* idle: all that is left of past input is silence. A new IR wakes it up as well, so that its crossfade runs */
+	if (idle){
+		if (silentInput && pendingIR.load() == nullptr){
+			for (int channel = 0; channel < numOutputChannels; channel++)
+				output.clear(channel, 0, blockSize);
+			return;
+		}
+		idle = false;
+	}
+
+	updateIR();
+
+	/* the DirectFIR reads the direct taps on this thread */
+	float amount = morphAmount.load(std::memory_order_relaxed);
+	for (PreparedIR* morphIR : { ir, fadingOutIR }){
+		if (morphIR != nullptr && morphIR->isMorph())
+			morphIR->morphDirectTaps(amount);
+	}
+
+	int historySize = inputHistory.getNumSamples();
+	int firstHistoryPart = std::min(blockSize, historySize - inputHistoryWriteIndex);
+
+	for (int channel = 0; channel < numInputChannels; channel++){
+		inputHistory.copyFrom(channel, inputHistoryWriteIndex, input, channel, 0, firstHistoryPart);
+		if (firstHistoryPart < blockSize)
+			inputHistory.copyFrom(channel, 0, input, channel, firstHistoryPart, blockSize - firstHistoryPart);
+	}
+
+	inputHistoryWriteIndex += blockSize;
+	if (inputHistoryWriteIndex >= historySize)
+		inputHistoryWriteIndex -= historySize;
+
+	inputSampleCount += blockSize;
+	lastSliceGathered = 0;
+
+	/* the gain of the current IR during this block, for sparse IRs; the head stage steps it once per block */
+	float sparseStartGain = getFadeGain();
+
+	if (tailDecimation > 1)
+		tailDecimator.decimate(input, decimatedInput, blockSize);
+
+	/* every stage keeps its FDL up to date, even if the current IR doesn't reach it,
+	 * so that a longer IR can be swapped in at any moment */
+	for (int s = 0; s < (int) stages.size(); s++){
+		Stage& stage = stages[s];
+		const AudioSampleBuffer& stageInput = stage.decimation > 1 ? decimatedInput : input;
+		int stageBlockSize = blockSize / stage.decimation;
+
+		/* a sliced tail block is done by the time the next block of its stage is complete */
+		if (stage.handOff != nullptr)
+			collectResults(stage);
+		else if (s > 0)
+			advanceSliced(stage, stage.irStageIndex, inputSampleCount);
+
+		for (int channel = 0; channel < numInputChannels; channel++){
+			stage.inputBuffer.copyFrom(channel, stage.inputSampleIndex, stageInput, channel, 0, stageBlockSize);
+		}
+		stage.inputSampleIndex += stageBlockSize;
+
+		if (stage.inputSampleIndex >= stage.layout.partitionSize){
+			if (stage.handOff != nullptr && waitForWorkers)
+				waitForResults(stage);
+			if (stage.handOff != nullptr)
+				handOffStage(stage);
+			else if (s == 0)
+				processStage(stage, s);
+			else {
+				/* the head of the multirate tail is due right away, and finished here */
+				startSlicedTail(stage, stage.irStageIndex);
+				advanceSliced(stage, stage.irStageIndex, inputSampleCount);
+			}
+			stage.inputSampleIndex = 0;
+		}
+	}
+
+	/* read the finished block from the output ring, and clear it for future results */
+	readOutputRing(outputRing, outputRingReadIndex, output, blockSize);
+
+	if (tailDecimation > 1){
+		readOutputRing(decimatedOutputRing, decimatedOutputRingReadIndex, decimatedOutput, blockSize / tailDecimation);
+		tailInterpolator.addInterpolated(decimatedOutput, output, blockSize);
+	}
+
+	float sparseEndGain = getFadeGain();
+
+	if (ir != nullptr && ir->isSparse())
+		addSparseTaps(output, ir, sparseStartGain, sparseEndGain);
+	if (fadingOutIR != nullptr && fadingOutIR->isSparse())
+		addSparseTaps(output, fadingOutIR, 1.0f - sparseStartGain, 1.0f - sparseEndGain);
+
+	if (silentInput && silentInputSamples >= getIdleThreshold() && canSuspend())
+		suspend();
+}
+
+
+void PartitionedConvolver::processSlice(int numSamplesGathered){
+
+	if (idle || stages.empty())
+		return;
+
+	/* the host's callback size, from two slices of the same block, as the first one can follow a part of a callback */
+	if (lastSliceGathered > 0 && numSamplesGathered > lastSliceGathered)
+		sliceStep = numSamplesGathered - lastSliceGathered;
+	else if (sliceStep == 0)
+		sliceStep = numSamplesGathered;
+	lastSliceGathered = numSamplesGathered;
+
+	/* the clock runs ahead so that the last slice before the block is complete is at its end, which leaves process() with only the head */
+	int64 now = inputSampleCount + blockSize;
+	if (numSamplesGathered + sliceStep < blockSize)
+		now = inputSampleCount + (int64) numSamplesGathered * blockSize / (blockSize - sliceStep);
+
+	if (NOT stages[0].sliced.pending)
+		startSlicedHead(stages[0], 0);
+
+	for (Stage& stage : stages){
+		if (stage.handOff == nullptr)
+			advanceSliced(stage, stage.irStageIndex, now);
+	}
+}
+
+
+bool PartitionedConvolver::isIdle(){
+	return idle;
+}
+
+
+int PartitionedConvolver::getIdleThreshold(){
+	if (ir == nullptr || stages.empty())
+		return 0;
+
+	return std::max(0, ir->getTailLength() - ir->getNumDirectTaps()) + maxResultDelay;
+}
+
+
+int PartitionedConvolver::getBlockSize(){
+	return blockSize;
+}
+
+
+int PartitionedConvolver::getNumInputChannels(){
+	return numInputChannels;
+}
+
+
+int PartitionedConvolver::getNumOutputChannels(){
+	return numOutputChannels;
+}
+
+
+int PartitionedConvolver::getNumWorkerThreads(){
+	return numWorkerThreads;
+}
+
+
+int PartitionedConvolver::getTailDecimation(){
+	return tailDecimation;
+}
+
+
+int PartitionedConvolver::getNumMissedDeadlines(){
+	return missedDeadlines.load();
+}
+
+
+void PartitionedConvolver::setPartitionThreshold(float thresholddB){
+	partitionThreshold = std::pow(10.0f, thresholddB / 10.0f);
+}
+
+
+void PartitionedConvolver::setDoubleAccumulation(bool doubleAccumulation){
+	this->doubleAccumulation = doubleAccumulation;
+}
+
+
+bool PartitionedConvolver::isDoubleAccumulation(){
+	return doubleAccumulation.load(std::memory_order_relaxed);
+}
+
+
+void PartitionedConvolver::setMorphAmount(float amount){
+	morphAmount = jlimit(0.0f, 1.0f, amount);
+}
+
+
+PreparedIR* PartitionedConvolver::getIR(){
+	return ir;
+}
+
+
+PreparedIR* PartitionedConvolver::getFadingOutIR(){
+	return fadingOutIR;
+}
+
+
+float PartitionedConvolver::getFadeGain(){
+	if (fadingOutIR == nullptr || stages.empty())
+		return 1.0f;
+	return (float) stages[0].fadePosition / (float) stages[0].fadeBlocks;
+}
+
+
+// ==========================================
+// Private
+// ==========================================
+
+/* adds a stage for every layout, at a rate of 1 / decimation */
+void PartitionedConvolver::addStages(const std::vector<PartitionStage>& layouts, int decimation){
+
+	for (int s = 0; s < (int) layouts.size(); s++){
+		const PartitionStage& layout = layouts[(size_t) s];
+		Stage stage;
+		stage.layout = layout;
+		stage.decimation = decimation;
+		stage.irStageIndex = s;
+		stage.fadeBlocks = std::max(minCrossfadeBlocks, crossfadeSamples / (decimation * layout.partitionSize));
+
+		BigInteger fftBitMask = (BigInteger) layout.fftSize;
+		stage.fftForward.reset(new dsp::FFT (fftBitMask.getHighestBit()));
+		stage.fftInverse.reset(new dsp::FFT (fftBitMask.getHighestBit()));
+
+		/* a shorter IR can have up to partitionGrowth more partitions in a stage,
+		 * because the next stage is only started if there is a full partition left for it */
+		stage.inputBuffer.setSize(numInputChannels, layout.partitionSize);
+		stage.fdl.clearAndResize(layout.numPartitions + convolution::partitionGrowth, numInputChannels, layout.fftSize / 2 + 1, true);
+		stage.accumulator.clearAndResize(1, numOutputChannels, layout.fftSize / 2 + 1, true);
+		stage.fadeAccumulator.clearAndResize(1, numOutputChannels, layout.fftSize / 2 + 1, true);
+		stage.fftBuffer.setSize(std::max(numInputChannels, numOutputChannels), layout.fftSize * 2);
+		stage.audioSpectra.resize(2 * stage.fdl.getNumSlots());
+		stage.irSpectra.resize(2 * stage.fdl.getNumSlots());
+		stage.accumulatedOutputs.assign((size_t) (2 * numOutputChannels), false);
+		stage.splitKernels = &kernels::getSplitKernels(layout.fftSize / 2 + 1, stage.fdl.getImagOffset());
+		stage.binRangeKernels = &kernels::getSplitKernels(0, stage.fdl.getImagOffset());
+
+		stages.push_back(std::move(stage));
+	}
+}
+
+
+/* only without an IR change going on, and with the workers done with everything they got, so that their FDLs can be touched */
+bool PartitionedConvolver::canSuspend(){
+
+	if (fadingOutIR != nullptr || retiringIR != nullptr || pendingIR.load() != nullptr)
+		return false;
+
+	for (Stage& stage : stages){
+		if (stage.handOff != nullptr && stage.handOff->nextBlockToProcess.load() < stage.handOff->blocksHandedOff)
+			return false;
+	}
+
+	return true;
+}
+
+
+/* the FDLs only hold silence within reach of the current IR, and the output ring only rounding noise.
+ * The input from before the silence is forgotten too, so that a longer IR set later doesn't meet it:
+ * while idle, time doesn't move for the FDLs, so that input would seem more recent than it is */
+void PartitionedConvolver::suspend(){
+
+	for (Stage& stage : stages){
+		stage.fdl.markAllSilent();
+		stage.sliced.pending = false;
+	}
+
+	outputRing.clear();
+	decimatedOutputRing.clear();
+	tailDecimator.reset();
+	tailInterpolator.reset();
+	inputHistory.clear();
+	idle = true;
+}
+
+
+PartitionedConvolver::HandOff::HandOff(int numInputChannels, int numOutputChannels, const PartitionStage& layout){
+	for (int i = 0; i < numHandOffSlots; i++){
+		inputSlots[i].buffer.setSize(numInputChannels, layout.partitionSize);
+		resultSlots[i].buffer.setSize(numOutputChannels, layout.fftSize * 2);
+	}
+}
+
+
+PartitionedConvolver::Worker::Worker(PartitionedConvolver& owner, int workerIndex)
+: Thread("Convolution worker " + String(workerIndex)), owner(owner), workerIndex(workerIndex) {
+}
+
+
+void PartitionedConvolver::Worker::run(){
+	while (NOT threadShouldExit()) {
+		bool didWork = false;
+
+		for (int s : owner.stagesByDeadline){
+			if (owner.stages[s].workerIndex == workerIndex)
+				didWork |= owner.processHandOffs(owner.stages[s], owner.stages[s].irStageIndex);
+		}
+
+		/* notify() from the audio thread is remembered, so no block can slip by in between */
+		if (NOT didWork)
+			wait (-1);
+	}
+}
+
+
+/* audio thread: retires the old IR when the workers are done with it, and takes a new IR if there is one and no crossfade is going on */
+void PartitionedConvolver::updateIR(){
+
+	/* every stage has faded over in an earlier call, so the gain of 1 has been seen by getFadeGain() as well.
+	 * The old IR can go as soon as the workers are done with it */
+	if (fadingOutIR != nullptr){
+		bool fadeDone = true;
+		for (Stage& stage : stages)
+			fadeDone &= stage.fadePosition >= stage.fadeBlocks;
+
+		if (fadeDone){
+			for (Stage& stage : stages)
+				stage.retireAfterBlock = stage.handOff != nullptr ? stage.handOff->blocksHandedOff : 0;
+			retiringIR = fadingOutIR;
+			fadingOutIR = nullptr;
+		}
+	}
+
+	if (retiringIR != nullptr){
+		bool workersDone = true;
+		for (Stage& stage : stages){
+			if (stage.handOff != nullptr && stage.handOff->nextBlockToProcess.load() < stage.retireAfterBlock)
+				workersDone = false;
+		}
+
+		if (workersDone && retire(retiringIR))
+			retiringIR = nullptr;
+	}
+
+	if (fadingOutIR != nullptr || retiringIR != nullptr || pendingIR.load() == nullptr)
+		return;
+
+	PreparedIR* newIR = pendingIR.exchange(nullptr);
+
+	/* no worker has seen it, so it can be retired right away */
+	if (NOT isUsable(newIR)){
+		DBG("PartitionedConvolver::setIR() error: IR is not partitioned for this convolver.\n");
+		for (Stage& stage : stages)
+			stage.retireAfterBlock = 0;
+		retiringIR = newIR;
+		return;
+	}
+
+	if (ir == nullptr){
+		ir = newIR;
+		return;
+	}
+
+	fadingOutIR = ir;
+	ir = newIR;
+	for (Stage& stage : stages)
+		stage.fadePosition = 0;
+}
+
+
+/* whether an IR is partitioned and routed for this convolver */
+bool PartitionedConvolver::isUsable(PreparedIR* candidateIR){
+	return candidateIR->getHeadPartitionSize() == blockSize && candidateIR->getMaxPartitionSize() == maxPartitionSize
+		&& candidateIR->getTailDecimation() == tailDecimation
+		&& candidateIR->isSplitComplex() && candidateIR->isRoutable(numInputChannels, numOutputChannels);
+}
+
+
+/* the IR that a stage convolves with, for wholeIR: its tail IR for the stages of the multirate tail. Can be nullptr */
+PreparedIR* PartitionedConvolver::getStageIR(Stage& stage, PreparedIR* wholeIR){
+	if (wholeIR == nullptr || stage.decimation == 1)
+		return wholeIR;
+	return wholeIR->getTailIR();
+}
+
+
+/* where in its output ring the result of the block that a stage just completed starts: at the block's own start
+ * (partitionSize ago) plus the stage offset, relative to the block that is read from the ring after this */
+int PartitionedConvolver::getRingStartSample(Stage& stage){
+	bool decimated = stage.decimation > 1;
+	int readIndex = decimated ? decimatedOutputRingReadIndex : outputRingReadIndex;
+	int ringSize = decimated ? decimatedOutputRing.getNumSamples() : outputRing.getNumSamples();
+	return (readIndex + blockSize / stage.decimation - stage.layout.partitionSize + stage.layout.offset) % ringSize;
+}
+
+
+/* audio thread: the gain of the current IR for the next block of a stage */
+float PartitionedConvolver::nextFadeGain(Stage& stage){
+	if (fadingOutIR == nullptr)
+		return 1.0f;
+
+	stage.fadePosition = std::min(stage.fadePosition + 1, stage.fadeBlocks);
+	return (float) stage.fadePosition / (float) stage.fadeBlocks;
+}
+
+
+/* audio thread: passes an IR on to releaseRetiredIRs(), returns false if there's no room yet */
+bool PartitionedConvolver::retire(PreparedIR* oldIR){
+
+	int start1, size1, start2, size2;
+	retiredFifo.prepareToWrite(1, start1, size1, start2, size2);
+
+	if (size1 == 0)
+		return false;
+
+	retiredIRs[start1] = oldIR;
+	retiredFifo.finishedWrite(1);
+	return true;
+}
+
+
+/* not on the audio thread, with the workers stopped */
+void PartitionedConvolver::releaseAllIRs(){
+
+	for (PreparedIR** irPtr : { &ir, &fadingOutIR, &retiringIR }){
+		if (*irPtr != nullptr)
+			(*irPtr)->decReferenceCount();
+		*irPtr = nullptr;
+	}
+
+	PreparedIR* waitingIR = pendingIR.exchange(nullptr);
+	if (waitingIR != nullptr)
+		waitingIR->decReferenceCount();
+
+	releaseRetiredIRs();
+}
+
+
+void PartitionedConvolver::startWorkers(){
+	for (auto& worker : workers){
+		worker->startThread(Thread::realtimeAudioPriority);
+	}
+}
+
+
+void PartitionedConvolver::stopWorkers(){
+	for (auto& worker : workers){
+		worker->stopThread(-1);
+	}
+}
+
+
+/* audio thread: passes the completed input block of a tail stage to its worker */
+void PartitionedConvolver::handOffStage(Stage& stage){
+
+	HandOff& handOff = *stage.handOff;
+	int B = stage.layout.partitionSize;
+
+	/* the previous block was due now, it is too late for anything that hasn't been collected yet */
+	if (handOff.nextBlockToCollect < handOff.blocksHandedOff){
+		missedDeadlines += (int) (handOff.blocksHandedOff - handOff.nextBlockToCollect);
+		handOff.nextBlockToCollect = handOff.blocksHandedOff;
+	}
+
+	int start1, size1, start2, size2;
+	handOff.inputFifo.prepareToWrite(1, start1, size1, start2, size2);
+
+	/* if the worker is that far behind, the block is dropped, and the worker fills the gap with silence */
+	if (size1 > 0){
+		HandOffSlot& slot = handOff.inputSlots[start1];
+		for (int channel = 0; channel < numInputChannels; channel++){
+			slot.buffer.copyFrom(channel, 0, stage.inputBuffer, channel, 0, B);
+		}
+		slot.ir = getStageIR(stage, ir);
+		slot.fadingOutIR = getStageIR(stage, fadingOutIR);
+		slot.fadeGain = nextFadeGain(stage);
+		slot.blockNumber = handOff.blocksHandedOff;
+		slot.ringStartSample = getRingStartSample(stage);
+		handOff.inputFifo.finishedWrite(1);
+	}
+
+	handOff.blocksHandedOff++;
+	workers[stage.workerIndex]->notify();
+}
+
+
+/* audio thread: adds all results that came back in time to the output ring */
+void PartitionedConvolver::collectResults(Stage& stage){
+
+	HandOff& handOff = *stage.handOff;
+	int numSamples = 2 * stage.layout.partitionSize - 1;
+
+	int start1, size1, start2, size2;
+	handOff.resultFifo.prepareToRead(handOff.resultFifo.getNumReady(), start1, size1, start2, size2);
+
+	for (int i = 0; i < size1 + size2; i++){
+		HandOffSlot& slot = handOff.resultSlots[i < size1 ? start1 + i : start2 + i - size1];
+
+		/* late results were already counted as missed */
+		if (slot.blockNumber < handOff.nextBlockToCollect)
+			continue;
+
+		/* if the IR doesn't reach this stage there's nothing to add, but the block was on time */
+		for (int channel = 0; channel < numOutputChannels && slot.hasResult; channel++){
+			addToOutputRing(stage, channel, slot.buffer.getReadPointer(channel, 0), slot.ringStartSample, numSamples);
+		}
+		handOff.nextBlockToCollect = slot.blockNumber + 1;
+	}
+
+	handOff.resultFifo.finishedRead(size1 + size2);
+}
+
+
+/* audio thread, offline only: collects the result that handOffStage() is about to find due, waiting for the worker if need be */
+void PartitionedConvolver::waitForResults(Stage& stage){
+
+	HandOff& handOff = *stage.handOff;
+	collectResults(stage);
+
+	for (int waited = 0; handOff.nextBlockToCollect < handOff.blocksHandedOff && waited < maxWorkerWaitMilliseconds; waited++){
+		handOff.resultReady.wait(1);
+		collectResults(stage);
+	}
+}
+
+
+/* worker: processes all blocks waiting for a tail stage, returns false if there were none */
+bool PartitionedConvolver::processHandOffs(Stage& stage, int stageIndex){
+
+	HandOff& handOff = *stage.handOff;
+	bool didWork = false;
+
+	while (handOff.inputFifo.getNumReady() > 0){
+		int start1, size1, start2, size2;
+		handOff.inputFifo.prepareToRead(1, start1, size1, start2, size2);
+		HandOffSlot& inputSlot = handOff.inputSlots[start1];
+
+		/* blocks dropped by the audio thread enter the FDL as silence, to keep the partitions aligned */
+		while (handOff.nextBlockToProcess < inputSlot.blockNumber){
+			for (int channel = 0; channel < numInputChannels; channel++)
+				stage.fdl.setWriteSlotSilent(channel);
+			stage.fdl.finishedWrite();
+			handOff.nextBlockToProcess++;
+		}
+
+		/* without room for the result the FDL still needs the block, and the result is lost */
+		handOff.resultFifo.prepareToWrite(1, start1, size1, start2, size2);
+		AudioSampleBuffer& result = size1 > 0 ? handOff.resultSlots[start1].buffer : stage.fftBuffer;
+
+		bool hasResult = convolveStageBlock(stage, stageIndex, inputSlot.buffer, inputSlot.ir, inputSlot.fadingOutIR, inputSlot.fadeGain, result);
+
+		if (size1 > 0){
+			handOff.resultSlots[start1].hasResult = hasResult;
+			handOff.resultSlots[start1].blockNumber = inputSlot.blockNumber;
+			handOff.resultSlots[start1].ringStartSample = inputSlot.ringStartSample;
+			handOff.resultFifo.finishedWrite(1);
+
+			if (waitForWorkers)
+				handOff.resultReady.signal();
+		}
+
+		/* from here on the audio thread may retire the IRs of this block */
+		handOff.nextBlockToProcess = inputSlot.blockNumber + 1;
+		handOff.inputFifo.finishedRead(1);
+		didWork = true;
+	}
+
+	return didWork;
+}
+
+
+/* the head stage, once its input block is complete: what processSlice() did ahead is only of use
+ * if it was done for the IRs that this block gets, otherwise it starts over */
+void PartitionedConvolver::processStage(Stage& stage, int stageIndex){
+
+	SlicedBlock& ahead = stage.sliced;
+	if (NOT ahead.pending || ahead.ir != ir || ahead.fadingOutIR != fadingOutIR)
+		startSlicedHead(stage, stageIndex);
+
+	float fadeGain = nextFadeGain(stage);
+
+	for (int channel = 0; channel < numInputChannels; channel++){
+		transformInput(stage, channel, stage.inputBuffer);
+	}
+	stage.fdl.finishedWrite();
+
+	/* the newest partition, and the ones processSlice() didn't get to. The FDL has moved on since, so no shift */
+	accumulateSliced(stage, stageIndex, 0, 1, 0);
+	accumulateSliced(stage, stageIndex, ahead.nextPartition, ahead.endPartition, 0);
+	measureSliced(stage);
+	ahead.pending = false;
+
+	int B = stage.layout.partitionSize;
+	int ringStartSample = getRingStartSample(stage);
+
+	/* overlap-add: the linear convolution of two blocks of B is 2B - 1 long */
+	for (int channel = 0; channel < numOutputChannels; channel++){
+		if (finishStageBlock(stage, channel, fadeGain, ahead.hasResult, ahead.hasFadingOutResult, stage.fftBuffer))
+			addToOutputRing(stage, channel, stage.fftBuffer.getReadPointer(channel, 0), ringStartSample, 2 * B - 1);
+	}
+}
+
+
+/* moves the partitions of the morphs that a block of a stage is about to use towards the morph amount, a few per block.
+ * Only the thread that convolves the stage touches them */
+void PartitionedConvolver::morphStageIRs(int stageIndex, PreparedIR* stageIR, PreparedIR* stageFadingOutIR){
+
+	float amount = morphAmount.load(std::memory_order_relaxed);
+
+	for (PreparedIR* blockIR : { stageIR, stageFadingOutIR }){
+		if (blockIR != nullptr && blockIR->isMorph() && stageIndex < blockIR->getNumStages())
+			blockIR->morphStage(stageIndex, amount, morphPartitionsPerBlock);
+	}
+}
+
+
+/* sets up the sliced block of a stage for the current IR and blockFadingOutIR, to be done by dueSample.
+ * Its work is paced as a whole, FFTs included, in the seconds that the blocks of the stage took so far */
+void PartitionedConvolver::startSliced(Stage& stage, int stageIndex, PreparedIR* blockFadingOutIR, int64 dueSample){
+
+	SlicedBlock& block = stage.sliced;
+	int N = stage.layout.fftSize;
+	int maxPartitions = stage.fdl.getNumSlots();
+
+	block.ir = getStageIR(stage, ir);
+	block.fadingOutIR = getStageIR(stage, blockFadingOutIR);
+	morphStageIRs(stageIndex, block.ir, block.fadingOutIR);
+	block.startSample = inputSampleCount;
+	block.dueSample = dueSample;
+	block.macCost = 0.0f;
+	block.endPartition = 0;
+
+	for (PreparedIR* blockIR : { block.ir, block.fadingOutIR }){
+		if (blockIR == nullptr || blockIR->isSparse() || stageIndex >= blockIR->getNumStages())
+			continue;
+
+		block.endPartition = std::max(block.endPartition, std::min(blockIR->getStage(stageIndex).numPartitions, maxPartitions));
+
+		for (int input = 0; input < numInputChannels; input++){
+			for (int output = 0; output < numOutputChannels; output++){
+				if (blockIR->getPathChannel(input, output, numInputChannels, numOutputChannels) >= 0)
+					block.macCost += convolution::spectralMacCost(N);
+			}
+		}
+	}
+
+	block.paceCost = (float) numInputChannels * getTransformSeconds(stage, false) + (float) numOutputChannels * getTransformSeconds(stage, true)
+					 + (float) block.endPartition * block.macCost * getSecondsPerCost(stage, macStep);
+	block.costDone = 0.0f;
+	block.nextInputChannel = 0;
+	block.nextPartition = 0;
+	block.nextBin = 0;
+	block.nextOutputChannel = 0;
+	block.fftStep = 0;
+	block.hasResult = false;
+	block.hasFadingOutResult = false;
+	block.pending = true;
+
+	for (int kind = 0; kind < numSlicedStepKinds; kind++){
+		block.timedCost[kind] = 0.0f;
+		block.timedSeconds[kind] = 0.0f;
+	}
+
+	clearAccumulators(stage);
+}
+
+
+/* the partitions after the newest, for the head block that is being gathered. process() does the FFTs */
+void PartitionedConvolver::startSlicedHead(Stage& stage, int stageIndex){
+
+	SlicedBlock& block = stage.sliced;
+	startSliced(stage, stageIndex, fadingOutIR, inputSampleCount + blockSize);
+	block.nextInputChannel = numInputChannels;
+	block.nextPartition = 1;
+	block.paceCost = (float) std::max(0, block.endPartition - 1) * block.macCost * getSecondsPerCost(stage, macStep);
+}
+
+
+/* all of the block of a tail stage that was just completed. It is due when the next block of the stage is complete,
+ * or right away for the head of the multirate tail, the only one at offset 0 */
+void PartitionedConvolver::startSlicedTail(Stage& stage, int stageIndex){
+
+	int B = stage.layout.partitionSize;
+	float fadeGain = nextFadeGain(stage);
+	int64 dueSample = inputSampleCount + (stage.layout.offset > 0 ? (int64) (stage.decimation * B) : 0);
+
+	startSliced(stage, stageIndex, fadeGain < 1.0f ? fadingOutIR : nullptr, dueSample);
+	stage.sliced.fadeGain = fadeGain;
+	stage.sliced.ringStartSample = getRingStartSample(stage);
+
+	for (int channel = 0; channel < numInputChannels; channel++){
+		stage.slicedInput.copyFrom(channel, 0, stage.inputBuffer, channel, 0, B);
+	}
+}
+
+
+/* does the work of the sliced block of a stage up to the share that is due at input sample now, and all of it when it is due */
+void PartitionedConvolver::advanceSliced(Stage& stage, int stageIndex, int64 now){
+
+	SlicedBlock& block = stage.sliced;
+	bool isDue = now >= block.dueSample;
+	float targetCost = isDue ? block.paceCost : block.paceCost * (float) (now - block.startSample) / (float) (block.dueSample - block.startSample);
+
+	while (block.pending && (isDue || block.costDone < targetCost)){
+		if (NOT doSlicedStep(stage, stageIndex, isDue, targetCost))
+			break;
+	}
+}
+
+
+/* one step of the sliced block of a stage: an FFT of an input channel, a run of partitions of all paths up to targetCost,
+ * or an IFFT of an output channel, each of which a SlicedFFT splits up further. Returns false if there is nothing left
+ * that can be done ahead, which is at the FFTs of the head. The block stops pending after its last step */
+bool PartitionedConvolver::doSlicedStep(Stage& stage, int stageIndex, bool isDue, float targetCost){
+
+	SlicedBlock& block = stage.sliced;
+	bool isHead = &stage == &stages[0];
+	int N = stage.layout.fftSize;
+	int64 stepStart = Time::getHighResolutionTicks();
+
+	/* an FFT that isn't needed, of silence or of a copy, counts as done */
+	if (block.nextInputChannel < numInputChannels){
+		int channel = block.nextInputChannel;
+
+		if (block.fftStep > 0 || loadInput(stage, channel, stage.slicedInput)){
+			float* fftPtr = stage.fftBuffer.getWritePointer(channel, 0);
+			if (NOT doTransformStep(stage, fftPtr, false, stepStart))
+				return true;
+
+			stage.fdl.copyFromJuceLayout(stage.fdl.getWriteIndex(), channel, fftPtr);
+		}
+		else
+			block.costDone += getTransformSeconds(stage, false);
+
+		if (++block.nextInputChannel == numInputChannels)
+			stage.fdl.finishedWrite();
+		return true;
+	}
+
+	/* a run of partitions up to targetCost. In a stage with a SlicedFFT, where one partition costs more than a step of it,
+	 * the run stops short of targetCost, and the part of a partition that is left to do is done as a range of its bins */
+	if (block.nextPartition < block.endPartition){
+		int numBins = N / 2 + 1;
+		int numPartitions = block.nextBin > 0 ? 1 : block.endPartition - block.nextPartition;
+		int endBin = numBins;
+		float partitionCost = block.macCost * getSecondsPerCost(stage, macStep);
+
+		if (NOT isDue && partitionCost > 0.0f){
+			float partitionsDue = (targetCost - block.costDone) / partitionCost;
+
+			if (stage.slicedFFT == nullptr)
+				numPartitions = jlimit(1, numPartitions, (int) std::ceil(partitionsDue));
+			else if (block.nextBin == 0 && partitionsDue >= 1.0f)
+				numPartitions = jlimit(1, numPartitions, (int) partitionsDue);
+			else {
+				int binsDue = (int) std::ceil(partitionsDue * (float) numBins);
+				numPartitions = 1;
+				endBin = std::min(numBins, block.nextBin + (binsDue + macBinGranularity - 1) / macBinGranularity * macBinGranularity);
+			}
+		}
+
+		/* the head's FDL doesn't have the block yet, so its partition p meets what is partition p - 1 now */
+		accumulateSliced(stage, stageIndex, block.nextPartition, block.nextPartition + numPartitions, isHead ? 1 : 0,
+						 block.nextBin, endBin - block.nextBin);
+		addSlicedStep(stage, macStep, (float) numPartitions * block.macCost * (float) (endBin - block.nextBin) / (float) numBins, stepStart);
+
+		block.nextBin = endBin < numBins ? endBin : 0;
+		if (block.nextBin == 0)
+			block.nextPartition += numPartitions;
+		return true;
+	}
+
+	/* the head block is finished by process(), when its input is complete */
+	if (isHead)
+		return false;
+
+	/* an output that copies output 0's result, or that has nothing to add, counts as done as well */
+	if (block.nextOutputChannel < numOutputChannels){
+		int channel = block.nextOutputChannel;
+		float* result = stage.fftBuffer.getWritePointer(channel, 0);
+		bool isSpectrum = block.fftStep > 0;
+		bool hasOutput = isSpectrum || mixStageBlock(stage, channel, block.fadeGain, block.hasResult, block.hasFadingOutResult, stage.fftBuffer, isSpectrum);
+
+		if (hasOutput && isSpectrum){
+			if (NOT doTransformStep(stage, result, true, stepStart))
+				return true;
+		}
+		else
+			block.costDone += getTransformSeconds(stage, true);
+
+		if (hasOutput)
+			addToOutputRing(stage, channel, result, block.ringStartSample, 2 * stage.layout.partitionSize - 1);
+		block.nextOutputChannel++;
+		return true;
+	}
+
+	measureSliced(stage);
+	block.pending = false;
+	return true;
+}
+
+
+/* one step of the FFT of data in the sliced block of a stage, or of the IFFT if inverse: a step of its SlicedFFT,
+ * or all of it without one. Returns whether the transform is done */
+bool PartitionedConvolver::doTransformStep(Stage& stage, float* data, bool inverse, int64 startTicks){
+
+	SlicedBlock& block = stage.sliced;
+	SlicedFFT* slicedFFT = stage.slicedFFT.get();
+
+	if (slicedFFT == nullptr){
+		if (inverse)
+			stage.fftInverse->performRealOnlyInverseTransform(data);
+		else
+			stage.fftForward->performRealOnlyForwardTransform(data, true);
+		addSlicedStep(stage, transformStep, convolution::fftCost(stage.layout.fftSize), startTicks);
+		return true;
+	}
+
+	int step = block.fftStep;
+	if (inverse)
+		slicedFFT->performRealOnlyInverseStep(data, step);
+	else
+		slicedFFT->performRealOnlyForwardStep(data, step);
+	addSlicedStep(stage, slicedFFT->isLeafStep(step, inverse) ? transformStep : levelStep, slicedFFT->getStepCost(step, inverse), startTicks);
+
+	block.fftStep = step + 1 < slicedFFT->getNumSteps() ? step + 1 : 0;
+	return block.fftStep == 0;
+}
+
+
+/* the seconds that the FFT, or the IFFT if inverse, of a channel of a stage takes, by the step kinds that it is made of */
+float PartitionedConvolver::getTransformSeconds(Stage& stage, bool inverse){
+
+	SlicedFFT* slicedFFT = stage.slicedFFT.get();
+	if (slicedFFT == nullptr)
+		return convolution::fftCost(stage.layout.fftSize) * getSecondsPerCost(stage, transformStep);
+
+	float seconds = 0.0f;
+	for (int step = 0; step < slicedFFT->getNumSteps(); step++){
+		int kind = slicedFFT->isLeafStep(step, inverse) ? transformStep : levelStep;
+		seconds += slicedFFT->getStepCost(step, inverse) * getSecondsPerCost(stage, kind);
+	}
+	return seconds;
+}
+
+
+/* counts a step of the sliced block of a stage that started at startTicks, of kind and cost in the units of convolution::fftCost(),
+ * as done for the pacing and timed for the measurement */
+void PartitionedConvolver::addSlicedStep(Stage& stage, int kind, float cost, int64 startTicks){
+
+	SlicedBlock& block = stage.sliced;
+	block.costDone += cost * getSecondsPerCost(stage, kind);
+	block.timedCost[kind] += cost;
+	block.timedSeconds[kind] += (float) Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks);
+}
+
+
+float PartitionedConvolver::getSecondsPerCost(Stage& stage, int kind){
+	return stage.secondsPerCost[kind] > 0.0f ? stage.secondsPerCost[kind] : defaultSecondsPerCost;
+}
+
+
+/* moves the seconds per cost of a stage towards those of its sliced block, of the steps that were done as steps */
+void PartitionedConvolver::measureSliced(Stage& stage){
+
+	SlicedBlock& block = stage.sliced;
+
+	for (int kind = 0; kind < numSlicedStepKinds; kind++){
+		if (block.timedCost[kind] <= 0.0f)
+			continue;
+
+		float measured = block.timedSeconds[kind] / block.timedCost[kind];
+		float& secondsPerCost = stage.secondsPerCost[kind];
+
+		if (secondsPerCost > 0.0f)
+			secondsPerCost += secondsPerCostSmoothing * (std::min(measured, maxSecondsPerCostRise * secondsPerCost) - secondsPerCost);
+		else
+			secondsPerCost = measured;
+	}
+}
+
+
+/* partitions firstPartition to endPartition of both IRs of the sliced block of a stage */
+void PartitionedConvolver::accumulateSliced(Stage& stage, int stageIndex, int firstPartition, int endPartition, int fdlShift, int firstBin, int numBins){
+
+	SlicedBlock& block = stage.sliced;
+	block.hasResult |= accumulateStage(stage, stageIndex, block.ir, stage.accumulator, firstPartition, endPartition, fdlShift, firstBin, numBins);
+
+	if (block.fadingOutIR != nullptr)
+		block.hasFadingOutResult |= accumulateStage(stage, stageIndex, block.fadingOutIR, stage.fadeAccumulator, firstPartition, endPartition, fdlShift,
+													firstBin, numBins);
+}
+
+
+/* FFTs one block of input into the FDL of the stage, and convolves the FDL with the partitions of stageIR into result.
+ * During a crossfade the FDL is convolved with stageFadingOutIR as well, and the two spectra are mixed by fadeGain before the IFFT.
+ * Returns false if neither IR reaches this stage, in which case only the FDL is updated.
+ * result can be stage.fftBuffer, it is only written after the forward FFTs. */
+bool PartitionedConvolver::convolveStageBlock(Stage& stage, int stageIndex, const AudioSampleBuffer& input,
+											  PreparedIR* stageIR, PreparedIR* stageFadingOutIR, float fadeGain, AudioSampleBuffer& result){
+
+	morphStageIRs(stageIndex, stageIR, stageFadingOutIR);
+
+	for (int channel = 0; channel < numInputChannels; channel++){
+		transformInput(stage, channel, input);
+	}
+	stage.fdl.finishedWrite();
+
+	clearAccumulators(stage);
+	int maxPartitions = stage.fdl.getNumSlots();
+	bool hasResult = accumulateStage(stage, stageIndex, stageIR, stage.accumulator, 0, maxPartitions);
+	bool hasFadingOutResult = false;
+
+	if (stageFadingOutIR != nullptr && fadeGain < 1.0f)
+		hasFadingOutResult = accumulateStage(stage, stageIndex, stageFadingOutIR, stage.fadeAccumulator, 0, maxPartitions);
+
+	/* the result is added for all outputs, so those without one are cleared */
+	int numFinished = 0;
+	for (int channel = 0; channel < numOutputChannels; channel++){
+		if (finishStageBlock(stage, channel, fadeGain, hasResult, hasFadingOutResult, result))
+			numFinished++;
+		else
+			result.clear(channel, 0, 2 * stage.layout.partitionSize);
+	}
+
+	return numFinished > 0;
+}
+
+
+/* FFTs the completed block of one input channel into the write slot of the FDL; finishedWrite() is up to the caller.
+ * Only the N inputs of the FFT are written, the buffer isn't cleared as a whole.
+ * The spectrum of digital silence is all zero, so it isn't computed, and the slot is marked silent.
+ * Neither is that of a block that is bit-identical to input 0's, which is transformed first: it is copied */
+void PartitionedConvolver::transformInput(Stage& stage, int channel, const AudioSampleBuffer& input){
+
+	if (NOT loadInput(stage, channel, input))
+		return;
+
+	float* fftPtr = stage.fftBuffer.getWritePointer(channel, 0);
+	stage.fftForward->performRealOnlyForwardTransform(fftPtr, true);
+	stage.fdl.copyFromJuceLayout(stage.fdl.getWriteIndex(), channel, fftPtr);
+}
+
+
+/* the part of transformInput() before the FFT: returns false if the write slot was copied or marked silent,
+ * otherwise the block of the channel is in its fftBuffer, zero padded to N */
+bool PartitionedConvolver::loadInput(Stage& stage, int channel, const AudioSampleBuffer& input){
+
+	int B = stage.layout.partitionSize;
+	int N = stage.layout.fftSize;
+
+	if (channel > 0 && std::memcmp(input.getReadPointer(channel, 0), input.getReadPointer(0, 0), (size_t) B * sizeof(float)) == 0){
+		stage.fdl.copyWriteSlot(0, channel);
+		return false;
+	}
+
+	if (input.getMagnitude(channel, 0, B) == 0.0f){
+		stage.fdl.setWriteSlotSilent(channel);
+		return false;
+	}
+
+	stage.fdl.setWriteSlotNotSilent(channel);
+	float* fftPtr = stage.fftBuffer.getWritePointer(channel, 0);
+	FloatVectorOperations::copy(fftPtr, input.getReadPointer(channel, 0), B);
+	FloatVectorOperations::clear(fftPtr + B, N - B);
+	return true;
+}
+
+
+/* starts a new block of the accumulators. Their slots are only cleared once something is added to them, see startAccumulating() */
+void PartitionedConvolver::clearAccumulators(Stage& stage){
+	std::fill(stage.accumulatedOutputs.begin(), stage.accumulatedOutputs.end(), false);
+	stage.mirrored[0] = stage.mirrored[1] = true;
+}
+
+
+/* the slot of an output of accumulator to add to, cleared first if nothing was added to it since clearAccumulators() */
+float* PartitionedConvolver::startAccumulating(Stage& stage, SpectralRing& accumulator, int output){
+
+	size_t index = (size_t) (getAccumulatorIndex(stage, accumulator) * numOutputChannels + output);
+	float* acc = accumulator.getSlot(0, output);
+
+	if (NOT stage.accumulatedOutputs[index]){
+		FloatVectorOperations::clear(acc, accumulator.getSlotStride());
+		stage.accumulatedOutputs[index] = true;
+	}
+	return acc;
+}
+
+
+/* mixes the accumulated spectra of one output channel of the current and the faded out IR by fadeGain, and IFFTs them into result.
+ * An IR that doesn't reach this stage counts as silence in the crossfade. Returns false if there is nothing to add.
+ * Outputs that mirror output 0 (see accumulateStage()) copy its result, so output 0 has to be finished first */
+bool PartitionedConvolver::finishStageBlock(Stage& stage, int channel, float fadeGain, bool hasResult, bool hasFadingOutResult, AudioSampleBuffer& result){
+
+	bool isSpectrum = false;
+	if (NOT mixStageBlock(stage, channel, fadeGain, hasResult, hasFadingOutResult, result, isSpectrum))
+		return false;
+
+	/* FDL method -> IFFT after summing */
+	if (isSpectrum)
+		stage.fftInverse->performRealOnlyInverseTransform(result.getWritePointer(channel, 0));
+	return true;
+}
+
+
+/* the part of finishStageBlock() before the IFFT. isSpectrum is set if result has the spectrum to IFFT,
+ * and cleared if it has the finished samples copied from output 0 */
+bool PartitionedConvolver::mixStageBlock(Stage& stage, int channel, float fadeGain, bool hasResult, bool hasFadingOutResult, AudioSampleBuffer& result,
+										 bool& isSpectrum){
+
+	bool mirrored = stage.mirrored[0] && (fadeGain >= 1.0f || stage.mirrored[1]);
+
+	/* mixing changes output 0's accumulator, so one that only the other accumulator mirrors is spread out before */
+	if (channel == 0 && NOT mirrored){
+		unmirrorAccumulator(stage, 0);
+		unmirrorAccumulator(stage, 1);
+	}
+
+	int source = mirrored ? 0 : channel;
+	hasResult = hasResult && stage.accumulatedOutputs[(size_t) source];
+	hasFadingOutResult = hasFadingOutResult && stage.accumulatedOutputs[(size_t) (numOutputChannels + source)];
+
+	if (mirrored && channel > 0){
+		bool hasMirroredResult = hasResult || (fadeGain < 1.0f && hasFadingOutResult);
+		if (hasMirroredResult)
+			FloatVectorOperations::copy(result.getWritePointer(channel, 0), result.getReadPointer(0, 0), stage.layout.fftSize);
+		isSpectrum = false;
+		return hasMirroredResult;
+	}
+
+	if (fadeGain < 1.0f){
+		int stride = stage.accumulator.getSlotStride();
+		float* acc = stage.accumulator.getSlot(0, channel);
+
+		/* an accumulator slot that nothing was added to isn't cleared, see startAccumulating() */
+		if (hasResult)
+			FloatVectorOperations::multiply(acc, fadeGain, stride);
+		if (hasFadingOutResult && hasResult)
+			FloatVectorOperations::addWithMultiply(acc, stage.fadeAccumulator.getSlot(0, channel), 1.0f - fadeGain, stride);
+		else if (hasFadingOutResult)
+			FloatVectorOperations::copyWithMultiply(acc, stage.fadeAccumulator.getSlot(0, channel), 1.0f - fadeGain, stride);
+
+		hasResult |= hasFadingOutResult;
+	}
+
+	if (NOT hasResult)
+		return false;
+
+	stage.accumulator.copyToJuceLayout(0, channel, result.getWritePointer(channel, 0));
+	isSpectrum = true;
+	return true;
+}
+
+
+/* multiplies the FDL of a stage with partitions firstPartition to endPartition of stageIR, and adds them to the first slot
+ * of accumulator. IR partition p meets FDL partition p - fdlShift. Only numBins bins from firstBin on are done, or the rest
+ * from firstBin on if numBins is 0. Returns false if nothing was accumulated:
+ * stageIR doesn't reach this stage or these partitions, or they were all skipped.
+ * With a mirrorable IR, while every one of these partitions of the other inputs is a copy of input 0's (a mono source
+ * on a stereo track), only output 0 is accumulated, and the other outputs copy its result. Copies are kept per FDL slot,
+ * so this is back to per channel work as soon as the inputs differ anywhere in the partitions, and the output is the same either way */
+bool PartitionedConvolver::accumulateStage(Stage& stage, int stageIndex, PreparedIR* stageIR, SpectralRing& accumulator,
+										   int firstPartition, int endPartition, int fdlShift, int firstBin, int numBins){
+
+	if (stageIR == nullptr || stageIR->isSparse() || stageIndex >= stageIR->getNumStages())
+		return false;
+
+	int maxPartitions = stage.fdl.getNumSlots();
+	endPartition = std::min(endPartition, std::min(stageIR->getStage(stageIndex).numPartitions, maxPartitions));
+
+	if (firstPartition >= endPartition)
+		return false;
+
+	if (numBins == 0)
+		numBins = stage.layout.fftSize / 2 + 1 - firstBin;
+
+	/* with a mono IR, an output is its own input, or the only input, times IR channel 0, so while the other inputs are copies
+	 * of input 0 in these partitions all outputs come out the same. Once they aren't, what output 0 has got so far is copied to the others */
+	int accumulatorIndex = getAccumulatorIndex(stage, accumulator);
+	if (stage.mirrored[accumulatorIndex] && isMirrorable(stageIR) && areInputsMirrored(stage, firstPartition, endPartition, fdlShift))
+		return accumulatePath(stage, stageIndex, stageIR, accumulator, 0, 0, 0, firstPartition, endPartition, fdlShift, firstBin, numBins) > 0;
+
+	unmirrorAccumulator(stage, accumulatorIndex);
+
+	/* every path from an input to an output adds the input's FDL times an IR channel to the output's accumulator.
+	 * Two paths into different outputs go through the stereo kernel together, which shares what they have in common:
+	 * the input for true stereo or a mono input, the IR for a mono IR on stereo audio */
+	int pendingInput = -1, pendingOutput = -1, pendingIRChannel = -1;
+	int numAccumulated = 0;
+
+	for (int input = 0; input < numInputChannels; input++){
+		for (int output = 0; output < numOutputChannels; output++){
+			int irChannel = stageIR->getPathChannel(input, output, numInputChannels, numOutputChannels);
+			if (irChannel < 0)
+				continue;
+
+			if (pendingOutput >= 0 && pendingOutput != output){
+				numAccumulated += accumulatePair(stage, stageIndex, stageIR, accumulator, pendingInput, pendingOutput, pendingIRChannel,
+												 input, output, irChannel, firstPartition, endPartition, fdlShift, firstBin, numBins);
+				pendingOutput = -1;
+				continue;
+			}
+
+			if (pendingOutput >= 0)
+				numAccumulated += accumulatePath(stage, stageIndex, stageIR, accumulator, pendingInput, pendingOutput, pendingIRChannel,
+												 firstPartition, endPartition, fdlShift, firstBin, numBins);
+
+			pendingInput = input;
+			pendingOutput = output;
+			pendingIRChannel = irChannel;
+		}
+	}
+
+	if (pendingOutput >= 0)
+		numAccumulated += accumulatePath(stage, stageIndex, stageIR, accumulator, pendingInput, pendingOutput, pendingIRChannel,
+										 firstPartition, endPartition, fdlShift, firstBin, numBins);
+
+	return numAccumulated > 0;
+}
+
+
+/* a single path, see accumulateStage(). Only the partitions that aren't skipped are gathered for the kernel.
+ * Returns the number of partitions multiplied */
+int PartitionedConvolver::accumulatePath(Stage& stage, int stageIndex, PreparedIR* stageIR, SpectralRing& accumulator,
+										 int input, int output, int irChannel, int firstPartition, int endPartition, int fdlShift, int firstBin, int numBins){
+
+	int numActive = 0;
+
+	for (int partition = firstPartition; partition < endPartition; partition++){
+		if (isSkipped(stage, stageIndex, stageIR, input, irChannel, partition, fdlShift))
+			continue;
+
+		stage.audioSpectra[numActive] = stage.fdl.getPartition(partition - fdlShift, input) + firstBin;
+		stage.irSpectra[numActive] = stageIR->getPartitionSpectrum(stageIndex, partition, irChannel) + firstBin;
+		numActive++;
+	}
+
+	if (numActive == 0)
+		return 0;
+
+	int imagOffset = stage.fdl.getImagOffset();
+	float* acc = startAccumulating(stage, accumulator, output) + firstBin;
+	const kernels::SplitKernels* splitKernels = getSplitKernels(stage, numBins);
+
+	if (isDoubleAccumulation())
+		splitKernels->mulAccumulateWide(acc, acc + imagOffset, stage.audioSpectra.data(), stage.irSpectra.data(), imagOffset, numActive, numBins);
+	else
+		splitKernels->mulAccumulate(acc, acc + imagOffset, stage.audioSpectra.data(), stage.irSpectra.data(), imagOffset, numActive, numBins);
+	return numActive;
+}
+
+
+/* two paths into different outputs, see accumulateStage().
+ * The kernel only needs the same number of partitions for both, not the same ones, so each path gathers its own;
+ * what one has more than the other goes through the single kernel. From the same input both paths share
+ * one list of FDL slots, so that the kernel loads them once; a partition is then only skipped if it is skipped for both */
+int PartitionedConvolver::accumulatePair(Stage& stage, int stageIndex, PreparedIR* stageIR, SpectralRing& accumulator,
+										 int input0, int output0, int irChannel0, int input1, int output1, int irChannel1,
+										 int firstPartition, int endPartition, int fdlShift, int firstBin, int numBins){
+
+	int maxPartitions = stage.fdl.getNumSlots();
+	int imagOffset = stage.fdl.getImagOffset();
+
+	const float** audio0 = stage.audioSpectra.data();
+	const float** audio1 = stage.audioSpectra.data() + maxPartitions;
+	const float** ir0 = stage.irSpectra.data();
+	const float** ir1 = stage.irSpectra.data() + maxPartitions;
+	int numActive0 = 0, numActive1 = 0;
+
+	if (input0 == input1){
+		audio1 = audio0;
+
+		for (int partition = firstPartition; partition < endPartition; partition++){
+			if (isSkipped(stage, stageIndex, stageIR, input0, irChannel0, partition, fdlShift)
+				&& isSkipped(stage, stageIndex, stageIR, input1, irChannel1, partition, fdlShift))
+				continue;
+
+			audio0[numActive0] = stage.fdl.getPartition(partition - fdlShift, input0) + firstBin;
+			ir0[numActive0] = stageIR->getPartitionSpectrum(stageIndex, partition, irChannel0) + firstBin;
+			ir1[numActive0] = stageIR->getPartitionSpectrum(stageIndex, partition, irChannel1) + firstBin;
+			numActive0++;
+		}
+
+		numActive1 = numActive0;
+	}
+	else {
+		for (int partition = firstPartition; partition < endPartition; partition++){
+			if (NOT isSkipped(stage, stageIndex, stageIR, input0, irChannel0, partition, fdlShift)){
+				audio0[numActive0] = stage.fdl.getPartition(partition - fdlShift, input0) + firstBin;
+				ir0[numActive0] = stageIR->getPartitionSpectrum(stageIndex, partition, irChannel0) + firstBin;
+				numActive0++;
+			}
+			if (NOT isSkipped(stage, stageIndex, stageIR, input1, irChannel1, partition, fdlShift)){
+				audio1[numActive1] = stage.fdl.getPartition(partition - fdlShift, input1) + firstBin;
+				ir1[numActive1] = stageIR->getPartitionSpectrum(stageIndex, partition, irChannel1) + firstBin;
+				numActive1++;
+			}
+		}
+	}
+
+	float* acc0 = numActive0 > 0 ? startAccumulating(stage, accumulator, output0) + firstBin : nullptr;
+	float* acc1 = numActive1 > 0 ? startAccumulating(stage, accumulator, output1) + firstBin : nullptr;
+	int numShared = std::min(numActive0, numActive1);
+	const kernels::SplitKernels* splitKernels = getSplitKernels(stage, numBins);
+
+	/* there is no stereo kernel in double, the wide one takes the paths one by one */
+	if (isDoubleAccumulation()){
+		if (numActive0 > 0)
+			splitKernels->mulAccumulateWide(acc0, acc0 + imagOffset, audio0, ir0, imagOffset, numActive0, numBins);
+		if (numActive1 > 0)
+			splitKernels->mulAccumulateWide(acc1, acc1 + imagOffset, audio1, ir1, imagOffset, numActive1, numBins);
+		return numActive0 + numActive1;
+	}
+
+	if (numShared > 0)
+		splitKernels->mulAccumulateStereo(acc0, acc0 + imagOffset, acc1, acc1 + imagOffset,
+										  audio0, audio1, ir0, ir1, imagOffset, numShared, numBins);
+
+	if (numActive0 > numShared)
+		splitKernels->mulAccumulate(acc0, acc0 + imagOffset, audio0 + numShared, ir0 + numShared,
+									imagOffset, numActive0 - numShared, numBins);
+
+	if (numActive1 > numShared)
+		splitKernels->mulAccumulate(acc1, acc1 + imagOffset, audio1 + numShared, ir1 + numShared,
+									imagOffset, numActive1 - numShared, numBins);
+
+	return numActive0 + numActive1;
+}
+
+
+/* the stage's kernels for all of its bins, or the generic ones for fewer */
+const kernels::SplitKernels* PartitionedConvolver::getSplitKernels(Stage& stage, int numBins){
+	return numBins == stage.layout.fftSize / 2 + 1 ? stage.splitKernels : stage.binRangeKernels;
+}
+
+
+/* a partition adds nothing if the input block it meets was silent, or if the IR partition is below the threshold */
+bool PartitionedConvolver::isSkipped(Stage& stage, int stageIndex, PreparedIR* stageIR, int input, int irChannel, int partition, int fdlShift){
+	return stage.fdl.isPartitionSilent(partition - fdlShift, input)
+		|| stageIR->getPartitionLevel(stageIndex, partition, irChannel) <= partitionThreshold.load(std::memory_order_relaxed);
+}
+
+
+/* whether all outputs get the same from stageIR when the inputs are the same, see accumulateStage() */
+bool PartitionedConvolver::isMirrorable(PreparedIR* stageIR){
+	return numOutputChannels > 1 && stageIR->getNumChannels() == 1 && (numInputChannels == 1 || numInputChannels == numOutputChannels);
+}
+
+
+/* whether partitions firstPartition to endPartition of every input are the same as input 0's, see SpectralRing::isPartitionCopy() */
+bool PartitionedConvolver::areInputsMirrored(Stage& stage, int firstPartition, int endPartition, int fdlShift){
+	for (int input = 1; input < numInputChannels; input++){
+		for (int partition = firstPartition; partition < endPartition; partition++){
+			if (NOT stage.fdl.isPartitionCopy(partition - fdlShift, input, 0))
+				return false;
+		}
+	}
+	return true;
+}
+
+
+/* gives the other outputs of an accumulator what has been added to output 0 while they mirrored it */
+void PartitionedConvolver::unmirrorAccumulator(Stage& stage, int accumulatorIndex){
+
+	if (NOT stage.mirrored[accumulatorIndex])
+		return;
+
+	stage.mirrored[accumulatorIndex] = false;
+	size_t first = (size_t) (accumulatorIndex * numOutputChannels);
+	if (NOT stage.accumulatedOutputs[first])
+		return;
+
+	SpectralRing& accumulator = accumulatorIndex == 0 ? stage.accumulator : stage.fadeAccumulator;
+	for (int output = 1; output < numOutputChannels; output++){
+		FloatVectorOperations::copy(accumulator.getSlot(0, output), accumulator.getSlot(0, 0), accumulator.getSlotStride());
+		stage.accumulatedOutputs[first + (size_t) output] = true;
+	}
+}
+
+
+int PartitionedConvolver::getAccumulatorIndex(Stage& stage, SpectralRing& accumulator){
+	return &accumulator == &stage.accumulator ? 0 : 1;
+}
+
+
+/* adds the taps of a sparse IR after its direct taps to the block in output, with a gain ramp for crossfades.
+ * Tap delays count from the end of the direct taps, like the partitions */
+void PartitionedConvolver::addSparseTaps(AudioSampleBuffer& output, PreparedIR* sparseIR, float startGain, float endGain){
+
+	int historySize = inputHistory.getNumSamples();
+	int numDirectTaps = sparseIR->getNumDirectTaps();
+
+	for (int input = 0; input < numInputChannels; input++){
+		for (int outputChannel = 0; outputChannel < numOutputChannels; outputChannel++){
+			int irChannel = sparseIR->getPathChannel(input, outputChannel, numInputChannels, numOutputChannels);
+			if (irChannel < 0)
+				continue;
+
+			for (const PreparedIR::SparseTap& tap : sparseIR->getSparseTaps(irChannel)){
+				int delay = tap.delay - numDirectTaps;
+				if (delay < 0)
+					continue;
+				if (delay > historySize - blockSize)
+					break;
+
+				/* the current block starts blockSize before the write index */
+				int readIndex = inputHistoryWriteIndex - blockSize - delay;
+				if (readIndex < 0)
+					readIndex += historySize;
+
+				int firstPart = std::min(blockSize, historySize - readIndex);
+				float midGain = startGain + (endGain - startGain) * (float) firstPart / (float) blockSize;
+
+				output.addFromWithRamp(outputChannel, 0, inputHistory.getReadPointer(input, readIndex), firstPart,
+									   tap.gain * startGain, tap.gain * midGain);
+				if (firstPart < blockSize)
+					output.addFromWithRamp(outputChannel, firstPart, inputHistory.getReadPointer(input, 0), blockSize - firstPart,
+										   tap.gain * midGain, tap.gain * endGain);
+			}
+		}
+	}
+}
+
+
+/* into the output ring of the stage's rate */
+void PartitionedConvolver::addToOutputRing(Stage& stage, int channel, const float* source, int ringStartSample, int numSamples){
+
+	AudioSampleBuffer& ring = stage.decimation > 1 ? decimatedOutputRing : outputRing;
+	int ringSize = ring.getNumSamples();
+	ringStartSample %= ringSize;
+
+	int firstPart = std::min(numSamples, ringSize - ringStartSample);
+	ring.addFrom(channel, ringStartSample, source, firstPart);
+
+	if (firstPart < numSamples)
+		ring.addFrom(channel, 0, source + firstPart, numSamples - firstPart);
+}
+
+
+/* copies the next numSamples of a ring to destination, and clears them for future results */
+void PartitionedConvolver::readOutputRing(AudioSampleBuffer& ring, int& readIndex, AudioSampleBuffer& destination, int numSamples){
+
+	int ringSize = ring.getNumSamples();
+	int firstPart = std::min(numSamples, ringSize - readIndex);
+
+	for (int channel = 0; channel < numOutputChannels; channel++){
+		destination.copyFrom(channel, 0, ring, channel, readIndex, firstPart);
+		ring.clear(channel, readIndex, firstPart);
+
+		if (firstPart < numSamples){
+			destination.copyFrom(channel, firstPart, ring, channel, 0, numSamples - firstPart);
+			ring.clear(channel, 0, numSamples - firstPart);
+		}
+	}
+
+	readIndex += numSamples;
+	if (readIndex >= ringSize)
+		readIndex -= ringSize;
+}
+
+} // fp
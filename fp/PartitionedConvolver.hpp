@@ -0,0 +1,344 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+#pragma once
+
+#include <fp_include_all.hpp>
+#include <JuceHeader.h>
+
+
+namespace fp {
+
+
+/* The PartitionedConvolver class is the realtime convolution engine. It convolves blocks of blockSize samples with a PreparedIR,
+ * with a frequency-domain delay line (FDL) per input channel and stage of the non-uniform partitioning from convolution::partitionScheme().
+ * The output of a block is ready right after its input, so latency is whatever the caller needs to gather a block.
+ * Only prepare() and reset() allocate or start and stop threads; process() and the getters are meant for the audio thread.
+ */
+
+class PartitionedConvolver {
+
+public:
+	PartitionedConvolver();
+	~PartitionedConvolver();
+
+	/* allocates for IRs of up to maxIRSamples, partitioned with blockSize as head and maxPartitionSize as max.
+	 * The IR channels are routed from the inputs to the outputs as in PreparedIR::getPathChannel().
+	 * With numWorkerThreads > 0 all stages after the head are processed by that many realtime priority threads.
+	 * A stage with partition size B is only due B samples after its input block is complete (see partitionScheme()),
+	 * so a worker gets B / blockSize calls of process() to deliver; a result that isn't back in time is dropped and counted.
+	 * With tailDecimation > 1 the stages of a multirate tail are added, for IRs prepared with the same tailDecimation;
+	 * blockSize and maxPartitionSize need to be multiples of it.
+	 * With waitForWorkers, for offline rendering, process() waits for a worker's result that is due instead of dropping it,
+	 * so the workers only add throughput. Not for a realtime thread. */
+	void prepare(int numInputChannels, int numOutputChannels, int blockSize, int maxPartitionSize, int maxIRSamples, int numWorkerThreads = 0,
+				 int tailDecimation = 1, bool waitForWorkers = false);
+
+	/* clears FDLs, hand-offs and the output ring, and cuts a crossfade short. Keeps the IR, or takes the one set since */
+	void reset();
+
+	/* hands a new IR to the audio thread. Call it from any thread but the audio thread; a nullptr is ignored.
+	 * The IR needs to be partitioned with the same blockSize, maxPartitionSize and tailDecimation as prepare() got, and be routable.
+	 * process() takes it when no crossfade is going on, so of several IRs set in quick succession only the last is used.
+	 * The FDLs are kept, so the new IR is convolved with all past input right away, and crossfaded in (see crossfadeSamples).
+	 * The audio thread never frees an IR, that is left to releaseRetiredIRs() */
+	void setIR(PreparedIR::Ptr newIR);
+
+	/* drops the references to the IRs that the audio thread is done with, which can free them.
+	 * Call it regularly from a background thread */
+	void releaseRetiredIRs();
+
+	/* convolves the first blockSize samples of the input channels of input, and writes them to the output channels of output.
+	 * Every input is FFT'd once, for all outputs it feeds. input and output can be the same buffer.
+	 * Silent input blocks aren't FFT'd, partitions of silent input or below the partition threshold aren't multiplied,
+	 * and an output that nothing was added to isn't IFFT'd, so a silent track costs little more than the silence check */
+	void process(const AudioBuffer<float>& input, AudioBuffer<float>& output);
+
+	/* audio thread: does a share of the work of the coming process() calls ahead, in proportion to the numSamplesGathered
+	 * of the next blockSize samples of input that the caller has gathered so far. Call it from callbacks that gather input
+	 * without completing a block. The output doesn't change, only when the work is done.
+	 * The multiply-accumulate of all head partitions but the newest only needs past input, so it is done ahead,
+	 * and process() is left with the head's FFTs and its newest partition. Tail stages without a worker are spread
+	 * over the samples until their result is due, with the FFTs larger than the head's in steps of a SlicedFFT,
+	 * and their partitions in ranges of bins.
+	 * As the callback that completes a block has the head's FFTs to do, the callbacks before it take its share:
+	 * the clock of the slices runs ahead by the samples that the host gathers per callback, so that the last of them
+	 * finishes everything that is due with the block. The work is paced by what its steps took in the blocks before,
+	 * so the cost of every callback stays close to the average, see the "Callback timing" benchmark */
+	void processSlice(int numSamplesGathered);
+
+	/* audio thread: whether process() is idle, only checking the input and writing zeros until a block isn't silent,
+	 * and the samples of silent input after which it goes idle:
+	 * the current IR's tail after the direct taps, plus the largest partition whose result can still be on its way,
+	 * with the delay of the rate conversion for the multirate tail */
+	bool isIdle();
+	int getIdleThreshold();
+
+	int getBlockSize();
+	int getNumInputChannels();
+	int getNumOutputChannels();
+	int getNumWorkerThreads();
+	int getTailDecimation();
+
+	/* audio thread: the current IR, and during a crossfade the IR that is being faded out and the gain of the
+	 * current one in the head stage, so that a DirectFIR for the direct taps can follow along */
+	PreparedIR* getIR();
+	PreparedIR* getFadingOutIR();
+	float getFadeGain();
+
+	/* length of a crossfade between IRs, during which both are multiplied with the FDLs and their spectra mixed before the IFFT.
+	 * The gain steps once per block, so a stage with large partitions still takes minCrossfadeBlocks blocks */
+	static const int crossfadeSamples = 8192;
+	static const int minCrossfadeBlocks = 4;
+
+	/* number of tail results that were not back from a worker in time, since prepare() */
+	int getNumMissedDeadlines();
+
+	/* IR partitions with an energy this far below that of their whole IR channel are skipped (see PreparedIR::getPartitionLevel()).
+	 * Partitions that are all zero are always skipped. Can be called from any thread */
+	void setPartitionThreshold(float thresholddB);
+	static constexpr float defaultPartitionThresholddB = -120.0f;
+
+	/* with doubleAccumulation the partition products of a stage are summed in double, and rounded to float once per block
+	 * (see kernels::complexMulAccumulateSplitWide()), for deep filters whose partitions cancel each other out.
+	 * The spectra and the FFTs stay float. Can be called from any thread */
+	void setDoubleAccumulation(bool doubleAccumulation);
+	bool isDoubleAccumulation();
+
+	/* the amount that a morph IR (see PreparedIR) is moved to, from 0 for its first IR to 1 for its second. Can be called from any thread.
+	 * There is no crossfade: every stage blends up to morphPartitionsPerBlock of its partitions for the new amount before it uses them,
+	 * on the thread that convolves it, so the partitions of a long IR catch up over a few blocks while the amount keeps moving */
+	void setMorphAmount(float amount);
+	static const int morphPartitionsPerBlock = 2;
+
+private:
+	/* an AbstractFifo holds one less than its size, so a worker can fall 3 blocks behind before input is dropped */
+	static const int numHandOffSlots = 4;
+
+	/* IRs waiting for releaseRetiredIRs() */
+	static const int numRetiredSlots = 8;
+
+	/* with waitForWorkers, how long process() waits for a result before it counts it as missed, in case a worker is stuck */
+	static const int maxWorkerWaitMilliseconds = 1000;
+
+	/* the steps of a sliced block are timed per kind, as the FFTs, the levels of a SlicedFFT and the multiply-accumulates
+	 * run at rates that differ per machine. A stage is paced with defaultSecondsPerCost per unit of convolution::fftCost()
+	 * until its first block is measured, after that each block moves it by secondsPerCostSmoothing, and by at most
+	 * maxSecondsPerCostRise times, so that a step in which the thread was preempted doesn't throw the pacing off */
+	enum SlicedStepKind { transformStep, levelStep, macStep, numSlicedStepKinds };
+	static constexpr float defaultSecondsPerCost = 1.0e-10f;
+	static constexpr float secondsPerCostSmoothing = 0.25f;
+	static constexpr float maxSecondsPerCostRise = 4.0f;
+
+	/* a range of bins that a sliced partition is split into is a multiple of this */
+	static const int macBinGranularity = 64;
+
+	/* a block of input on its way to a worker, or of output on its way back.
+	 * The IRs are kept alive by the convolver until the worker is done with them */
+	struct HandOffSlot {
+		AudioBuffer<float> buffer;
+		PreparedIR* ir = nullptr;
+		PreparedIR* fadingOutIR = nullptr;
+		float fadeGain = 1.0f;
+		int64 blockNumber = 0;
+		int ringStartSample = 0;
+		bool hasResult = false;
+	};
+
+	/* the lock-free FIFOs between the audio thread and the worker of one stage */
+	struct HandOff {
+		HandOff(int numInputChannels, int numOutputChannels, const PartitionStage& layout);
+
+		AbstractFifo inputFifo { numHandOffSlots };
+		AbstractFifo resultFifo { numHandOffSlots };
+		HandOffSlot inputSlots[numHandOffSlots];
+		HandOffSlot resultSlots[numHandOffSlots];
+
+		/* audio thread only */
+		int64 blocksHandedOff = 0;
+		int64 nextBlockToCollect = 0;
+
+		/* written by the worker, read by the audio thread to know when an old IR is not in use anymore */
+		std::atomic<int64> nextBlockToProcess { 0 };
+
+		/* signalled by the worker for every result, with waitForWorkers */
+		WaitableEvent resultReady;
+	};
+
+	/* the work on one block of a stage that processSlice() spreads out: for the head stage the partitions after the newest,
+	 * for the block that is being gathered, and for a tail stage without a worker all of a completed block.
+	 * Its cost is paced over the input samples from startSample to dueSample */
+	struct SlicedBlock {
+		PreparedIR* ir = nullptr;
+		PreparedIR* fadingOutIR = nullptr;
+		float fadeGain = 1.0f;
+		int ringStartSample = 0;
+		int64 startSample = 0;
+		int64 dueSample = 0;
+		float paceCost = 0.0f;				// in seconds, with the stage's secondsPerCost
+		float costDone = 0.0f;
+		float macCost = 0.0f;				// of a partition, for all paths of both IRs, in the units of convolution::fftCost()
+		float timedCost[numSlicedStepKinds] = {};		// of the steps that were timed, and the seconds they took
+		float timedSeconds[numSlicedStepKinds] = {};
+		int nextInputChannel = 0;			// FFTs done
+		int nextPartition = 0;				// partitions accumulated
+		int nextBin = 0;					// bins accumulated of the partition at nextPartition, when it is split up
+		int endPartition = 0;
+		int nextOutputChannel = 0;			// IFFTs done
+		int fftStep = 0;					// steps done of the SlicedFFT transform of the next channel
+		bool hasResult = false;
+		bool hasFadingOutResult = false;
+		bool pending = false;
+	};
+
+	struct Stage {
+		PartitionStage layout;
+		int decimation = 1;						// 1, or tailDecimation for the stages of the multirate tail
+		int irStageIndex = 0;					// the stage in the IR, or in its tail IR
+		std::unique_ptr<dsp::FFT> fftForward;
+		std::unique_ptr<dsp::FFT> fftInverse;
+		AudioBuffer<float> inputBuffer;
+		int inputSampleIndex;
+		SpectralRing fdl;						// per input channel, split into re and im parts like the PreparedIR's spectra
+		SpectralRing accumulator;				// 1 slot, the spectrum of the result before the IFFT
+		SpectralRing fadeAccumulator;			// 1 slot, the same for the IR that is faded out
+		AudioBuffer<float> fftBuffer;			// 2N floats per input or output channel, for the in-place FFTs
+		std::vector<const float*> audioSpectra;	// for two paths, the FDL slots of the partitions that aren't skipped
+		std::vector<const float*> irSpectra;	// for two paths, the IR partitions that go with them
+		const kernels::SplitKernels* splitKernels = nullptr;	// picked for the FFT size in prepare()
+		const kernels::SplitKernels* binRangeKernels = nullptr;	// the generic ones, for a part of the bins
+		std::vector<bool> accumulatedOutputs;	// per output of accumulator, then of fadeAccumulator: whether anything was added this block, which clears it
+		bool mirrored[2] = { true, true };		// per accumulator: whether the outputs after the first only mirror it, see areInputsMirrored()
+		std::unique_ptr<HandOff> handOff;
+		int workerIndex = -1;
+		int fadeBlocks = 1;						// length of a crossfade in blocks of this stage
+		int fadePosition = 0;					// blocks of the current crossfade done
+		int64 retireAfterBlock = 0;				// blocks the worker needs to finish before retiringIR can go
+		SlicedBlock sliced;
+		AudioBuffer<float> slicedInput;			// a tail stage's completed block, until sliced has FFT'd it
+		std::unique_ptr<SlicedFFT> slicedFFT;	// for a sliced tail stage with a larger FFT than the head's, in steps of half of that
+		float secondsPerCost[numSlicedStepKinds] = {};	// of the sliced blocks done so far, 0 before the first
+	};
+
+	class Worker : public Thread {
+	public:
+		Worker(PartitionedConvolver& owner, int workerIndex);
+		void run() override;
+
+	private:
+		PartitionedConvolver& owner;
+		int workerIndex;
+	};
+
+	void addStages(const std::vector<PartitionStage>& layouts, int decimation);
+	void processStage(Stage& stage, int stageIndex);
+	void handOffStage(Stage& stage);
+	void collectResults(Stage& stage);
+	void waitForResults(Stage& stage);
+	bool processHandOffs(Stage& stage, int stageIndex);
+	bool convolveStageBlock(Stage& stage, int stageIndex, const AudioBuffer<float>& input,
+							PreparedIR* stageIR, PreparedIR* stageFadingOutIR, float fadeGain, AudioBuffer<float>& result);
+	void transformInput(Stage& stage, int channel, const AudioBuffer<float>& input);
+	bool loadInput(Stage& stage, int channel, const AudioBuffer<float>& input);
+	void clearAccumulators(Stage& stage);
+	float* startAccumulating(Stage& stage, SpectralRing& accumulator, int output);
+	bool finishStageBlock(Stage& stage, int channel, float fadeGain, bool hasResult, bool hasFadingOutResult, AudioBuffer<float>& result);
+	bool mixStageBlock(Stage& stage, int channel, float fadeGain, bool hasResult, bool hasFadingOutResult, AudioBuffer<float>& result,
+					   bool& isSpectrum);
+	bool accumulateStage(Stage& stage, int stageIndex, PreparedIR* stageIR, SpectralRing& accumulator,
+						 int firstPartition, int endPartition, int fdlShift = 0, int firstBin = 0, int numBins = 0);
+	int accumulatePath(Stage& stage, int stageIndex, PreparedIR* stageIR, SpectralRing& accumulator,
+					   int input, int output, int irChannel, int firstPartition, int endPartition, int fdlShift, int firstBin, int numBins);
+	int accumulatePair(Stage& stage, int stageIndex, PreparedIR* stageIR, SpectralRing& accumulator,
+					   int input0, int output0, int irChannel0, int input1, int output1, int irChannel1,
+					   int firstPartition, int endPartition, int fdlShift, int firstBin, int numBins);
+	const kernels::SplitKernels* getSplitKernels(Stage& stage, int numBins);
+	bool isSkipped(Stage& stage, int stageIndex, PreparedIR* stageIR, int input, int irChannel, int partition, int fdlShift);
+	bool isMirrorable(PreparedIR* stageIR);
+	bool areInputsMirrored(Stage& stage, int firstPartition, int endPartition, int fdlShift);
+	void unmirrorAccumulator(Stage& stage, int accumulatorIndex);
+	int getAccumulatorIndex(Stage& stage, SpectralRing& accumulator);
+	void morphStageIRs(int stageIndex, PreparedIR* stageIR, PreparedIR* stageFadingOutIR);
+	void startSliced(Stage& stage, int stageIndex, PreparedIR* blockFadingOutIR, int64 dueSample);
+	void startSlicedHead(Stage& stage, int stageIndex);
+	void startSlicedTail(Stage& stage, int stageIndex);
+	void advanceSliced(Stage& stage, int stageIndex, int64 now);
+	bool doSlicedStep(Stage& stage, int stageIndex, bool isDue, float targetCost);
+	bool doTransformStep(Stage& stage, float* data, bool inverse, int64 startTicks);
+	float getTransformSeconds(Stage& stage, bool inverse);
+	void addSlicedStep(Stage& stage, int kind, float cost, int64 startTicks);
+	float getSecondsPerCost(Stage& stage, int kind);
+	void measureSliced(Stage& stage);
+	void accumulateSliced(Stage& stage, int stageIndex, int firstPartition, int endPartition, int fdlShift, int firstBin = 0, int numBins = 0);
+	PreparedIR* getStageIR(Stage& stage, PreparedIR* wholeIR);
+	int getRingStartSample(Stage& stage);
+	bool isUsable(PreparedIR* candidateIR);
+	void updateIR();
+	float nextFadeGain(Stage& stage);
+	bool retire(PreparedIR* oldIR);
+	void releaseAllIRs();
+	bool canSuspend();
+	void suspend();
+	void addToOutputRing(Stage& stage, int channel, const float* source, int ringStartSample, int numSamples);
+	void readOutputRing(AudioBuffer<float>& ring, int& readIndex, AudioBuffer<float>& destination, int numSamples);
+	void addSparseTaps(AudioBuffer<float>& output, PreparedIR* sparseIR, float startGain, float endGain);
+	void startWorkers();
+	void stopWorkers();
+
+	std::vector<Stage> stages;
+	std::vector<int> stagesByDeadline;		// the order in which a worker takes its stages, the soonest due first
+
+	/* each of these holds a reference, see setIR() and releaseRetiredIRs() */
+	std::atomic<PreparedIR*> pendingIR { nullptr };
+	PreparedIR* ir = nullptr;
+	PreparedIR* fadingOutIR = nullptr;
+	PreparedIR* retiringIR = nullptr;
+	AbstractFifo retiredFifo { numRetiredSlots };
+	PreparedIR* retiredIRs[numRetiredSlots] = {};
+	CriticalSection releaseLock;
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	int numWorkerThreads = 0;
+	bool waitForWorkers = false;
+	std::atomic<int> missedDeadlines { 0 };
+	int64 silentInputSamples = 0;
+	int64 inputSampleCount = 0;			// input samples in completed blocks, the clock of the sliced blocks
+	int lastSliceGathered = 0;			// numSamplesGathered of the last processSlice() of the block, 0 before the first
+	int sliceStep = 0;					// the samples gathered between two of them, the host's callback size
+	bool idle = false;
+	std::atomic<float> partitionThreshold { 1.0e-12f };	// power ratio of defaultPartitionThresholddB
+	std::atomic<bool> doubleAccumulation { false };
+	std::atomic<float> morphAmount { 0.0f };
+
+	AudioBuffer<float> outputRing;
+	int outputRingReadIndex = 0;
+	int maxResultDelay = 0;				// the samples that the result of a block can take to come out, see getIdleThreshold()
+
+	/* the multirate tail (see PreparedIR::getTailIR()): the stages from firstDecimatedStage on, partitioned with blockSize / tailDecimation
+	 * as head, convolve decimatedInput, and add to decimatedOutputRing, which is interpolated back and added to the output.
+	 * The first of them is due right away, so it stays on the audio thread like the head */
+	int tailDecimation = 1;
+	int firstDecimatedStage = 0;
+	RateConverter tailDecimator;
+	RateConverter tailInterpolator;
+	AudioBuffer<float> decimatedInput;
+	AudioBuffer<float> decimatedOutput;
+	AudioBuffer<float> decimatedOutputRing;
+	int decimatedOutputRingReadIndex = 0;
+
+	/* the most recent input of every input channel, for sparse IRs (see PreparedIR::isSparse()): their taps after the direct taps
+	 * are read from it instead of multiplied with the FDLs, which are still kept up to date for a dense IR to be swapped in.
+	 * The current block ends at inputHistoryWriteIndex */
+	AudioBuffer<float> inputHistory;
+	int inputHistoryWriteIndex = 0;
+
+	int numInputChannels = 0;
+	int numOutputChannels = 0;
+	int blockSize = 0;
+	int maxPartitionSize = 0;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PartitionedConvolver)
+};
+
+} // fp
@@ -0,0 +1,615 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+
+#include <fp_include_all.hpp>
+
+
+namespace fp {
+
+
+PreparedIR::PreparedIR(AudioSampleBuffer& ir, int headPartitionSize, int maxPartitionSize, int numSamples, bool splitComplex, int numDirectTaps,
+					   int tailDecimation){
+
+	this->headPartitionSize = headPartitionSize;
+	this->maxPartitionSize = maxPartitionSize;
+	this->splitComplex = splitComplex;
+	this->numSamples = numSamples > 0 ? numSamples : ir.getNumSamples();
+	this->numDirectTaps = jlimit(0, this->numSamples, numDirectTaps);
+	this->tailDecimation = std::max(1, tailDecimation);
+
+	prepare(ir, nullptr);
+}
+
+
+PreparedIR::PreparedIR(AudioSampleBuffer& ir, PreparedIR& layout){
+
+	headPartitionSize = layout.headPartitionSize;
+	maxPartitionSize = layout.maxPartitionSize;
+	splitComplex = layout.splitComplex;
+	numSamples = layout.numSamples;
+	numDirectTaps = layout.numDirectTaps;
+	tailDecimation = layout.tailDecimation;
+
+	prepare(ir, &layout);
+}
+
+
+PreparedIR::PreparedIR(Ptr from, Ptr to, MorphMode mode, float amount){
+
+	jassert (isMorphable(*from, *to));
+
+	copyLayout(*from);
+	tailLength = std::max(from->tailLength, to->tailLength);
+
+	morphFrom = from;
+	morphTo = to;
+	morphMode = mode;
+
+	/* a blend can only be as loud as the louder of the two in any bin */
+	for (int s = 0; s < (int) stages.size(); s++){
+		PartitionStage& stage = stages[s];
+		stageSpectra.emplace_back(stage.numPartitions, numChannels, stage.fftSize / 2 + 1, splitComplex);
+		stageLevels.emplace_back((size_t) (stage.numPartitions * numChannels), 0.0f);
+
+		for (size_t i = 0; i < stageLevels[s].size(); i++)
+			stageLevels[s][i] = std::max(from->stageLevels[s][i], to->stageLevels[s][i]);
+
+		stageAmounts.emplace_back((size_t) stage.numPartitions, -1.0f);
+		morphCursors.push_back(0);
+
+		if (mode == morphPolar && splitComplex){
+			BigInteger fftBitMask = (BigInteger) stage.fftSize;
+			morphFFTs.emplace_back(new dsp::FFT (fftBitMask.getHighestBit()));
+			morphBuffers.emplace_back((size_t) (2 * stage.fftSize), 0.0f);
+		}
+
+		morphStage(s, amount, stage.numPartitions);
+	}
+
+	directTaps.setSize(numChannels, std::max(1, numDirectTaps));
+	directTaps.clear();
+	morphDirectTaps(amount);
+
+	if (from->tailIR != nullptr)
+		tailIR = new PreparedIR(from->tailIR, to->tailIR, mode, amount);
+}
+
+
+PreparedIR::~PreparedIR(){
+}
+
+
+void PreparedIR::applyShape(AudioSampleBuffer& ir, const Shape& shape, double sampleRate){
+
+	int numChannels = ir.getNumChannels();
+	int numSamples = ir.getNumSamples();
+	if (numChannels == 0 || numSamples == 0)
+		return;
+
+	/* the middle of the IR goes to a quarter of the FFT size, the delay that shapeSplit() flattens the phase towards */
+	int fftSize = 2 * tools::nextPowerOfTwo(numSamples);
+	int startSample = fftSize / 4 - numSamples / 2;
+	BigInteger fftBitMask = (BigInteger) fftSize;
+	dsp::FFT fft (fftBitMask.getHighestBit());
+	AudioSampleBuffer fftBuffer (1, 2 * fftSize);
+	float* fftPtr = fftBuffer.getWritePointer(0, 0);
+	SpectralRing spectra (1, numChannels, fftSize / 2 + 1, true);
+	int imagOffset = spectra.getImagOffset();
+	int numBins = spectra.getNumBins();
+	double sumOfSquares = 0.0;
+
+	for (int channel = 0; channel < numChannels; channel++){
+		fftBuffer.clear();
+		FloatVectorOperations::copy(fftPtr + startSample, ir.getReadPointer(channel, 0), numSamples);
+		fft.performRealOnlyForwardTransform(fftPtr, true);
+		spectra.copyFromJuceLayout(0, channel, fftPtr);
+
+		const float* spectrum = spectra.getSlot(0, channel);
+		for (int bin = 0; bin < numBins; bin++)
+			sumOfSquares += (double) spectrum[bin] * spectrum[bin] + (double) spectrum[bin + imagOffset] * spectrum[bin + imagOffset];
+	}
+
+	if (sumOfSquares == 0.0)
+		return;
+
+	/* the contrast is taken relative to the RMS magnitude of all channels, so that it keeps about the level and the balance of the IR */
+	float rmsMagnitude = (float) std::sqrt(sumOfSquares / (numChannels * numBins));
+	std::vector<float> binGains = getBinGains(shape, sampleRate, fftSize);
+
+	for (int channel = 0; channel < numChannels; channel++){
+		float* spectrum = spectra.getSlot(0, channel);
+		kernels::shapeSplit(spectrum, spectrum, binGains.data(), rmsMagnitude, shape.contrast, shape.phaseFlattening, imagOffset, numBins);
+		spectra.copyToJuceLayout(0, channel, fftPtr);
+		fft.performRealOnlyInverseTransform(fftPtr);
+		ir.copyFrom(channel, 0, fftPtr + startSample, numSamples);
+	}
+}
+
+
+/* the constructors without a morph. With a layout, its tail split is taken instead of finding one, and a tail is made
+ * whenever the layout has one */
+void PreparedIR::prepare(AudioSampleBuffer& ir, PreparedIR* layout){
+
+	numChannels = ir.getNumChannels();
+	tailSplit = this->numSamples;
+
+	/* the IR can be shorter than numSamples, in which case the remainder stays zero */
+	int irSamples = std::min(this->numSamples, ir.getNumSamples());
+
+	directTaps.setSize(numChannels, std::max(1, this->numDirectTaps));
+	directTaps.clear();
+
+	for (int channel = 0; channel < numChannels; channel++){
+		float* tapsPtr = directTaps.getWritePointer(channel, 0);
+		for (int tap = 0; tap < std::min(this->numDirectTaps, irSamples); tap++)
+			tapsPtr[this->numDirectTaps - 1 - tap] = ir.getSample(channel, tap);
+	}
+
+	int partitionedSamples = this->numSamples - this->numDirectTaps;
+
+	std::vector<double> channelEnergy ((size_t) numChannels, 0.0);
+
+	for (int channel = 0; channel < numChannels; channel++){
+		const float* irPtr = ir.getReadPointer(channel, 0);
+		for (int sample = 0; sample < irSamples; sample++){
+			channelEnergy[(size_t) channel] += (double) irPtr[sample] * irPtr[sample];
+			if (irPtr[sample] != 0.0f)
+				tailLength = std::max(tailLength, sample + 1);
+		}
+	}
+
+	/* sparse if tap by tap costs less than the direct taps and the partitions */
+	int maxTapsInChannel = 0;
+	for (int channel = 0; channel < numChannels; channel++){
+		const float* irPtr = ir.getReadPointer(channel, 0);
+		maxTapsInChannel = std::max(maxTapsInChannel, (int) std::count_if(irPtr, irPtr + irSamples, [] (float sample) { return sample != 0.0f; }));
+	}
+
+	sparse = layout == nullptr && maxTapsInChannel <= maxSparseTaps
+		&& convolution::directFormCost(maxTapsInChannel)
+			< convolution::directFormCost(this->numDirectTaps) + convolution::partitionedCost(partitionedSamples, headPartitionSize, maxPartitionSize);
+
+	if (sparse){
+		sparseTaps.resize((size_t) numChannels);
+		for (int channel = 0; channel < numChannels; channel++){
+			for (int sample = 0; sample < irSamples; sample++){
+				if (ir.getSample(channel, sample) != 0.0f)
+					sparseTaps[(size_t) channel].push_back({ sample, ir.getSample(channel, sample) });
+			}
+		}
+	}
+
+	if (layout != nullptr){
+		tailSplit = layout->tailSplit;
+		if (layout->tailIR != nullptr)
+			prepareTail(ir, irSamples, layout->tailIR.get());
+	}
+	else if (this->tailDecimation > 1 && NOT sparse && headPartitionSize % this->tailDecimation == 0 && maxPartitionSize % this->tailDecimation == 0){
+		tailSplit = findTailSplit(ir, irSamples, channelEnergy);
+		if (tailSplit < tailLength)
+			prepareTail(ir, irSamples, nullptr);
+		else
+			tailSplit = this->numSamples;
+	}
+
+	/* the partitions cover what is left after the direct taps, up to the tail if there is one. Its crossover is faded out */
+	AudioSampleBuffer fadedIR;
+	if (tailIR != nullptr){
+		irSamples = std::min(irSamples, tailSplit);
+		fadedIR.setSize(numChannels, irSamples);
+		for (int channel = 0; channel < numChannels; channel++){
+			for (int sample = 0; sample < irSamples; sample++)
+				fadedIR.setSample(channel, sample, ir.getSample(channel, sample) * (1.0f - getTailGain(sample)));
+		}
+		partitionedSamples = tailSplit - this->numDirectTaps;
+	}
+	AudioSampleBuffer& partitionedIR = tailIR != nullptr ? fadedIR : ir;
+
+	if (partitionedSamples > 0)
+		stages = convolution::partitionScheme(partitionedSamples, headPartitionSize, maxPartitionSize);
+
+	for (int s = 0; s < (int) stages.size(); s++){
+		PartitionStage& stage = stages[s];
+
+		stageSpectra.emplace_back(stage.numPartitions, numChannels, stage.fftSize / 2 + 1, splitComplex);
+		stageLevels.emplace_back((size_t) (stage.numPartitions * numChannels), 0.0f);
+
+		BigInteger fftBitMask = (BigInteger) stage.fftSize;
+		dsp::FFT fftIR (fftBitMask.getHighestBit());
+		AudioSampleBuffer fftBuffer (1, stage.fftSize * 2);
+
+		for (int partition = 0; partition < stage.numPartitions; partition++){
+
+			int startSample = this->numDirectTaps + stage.offset + partition * stage.partitionSize;
+			int samplesToCopy = std::min(stage.partitionSize, irSamples - startSample);
+
+			for (int channel = 0; channel < numChannels; channel++){
+				fftBuffer.clear();
+				if (samplesToCopy > 0)
+					fftBuffer.copyFrom(0, 0, partitionedIR, channel, startSample, samplesToCopy);
+
+				double partitionEnergy = 0.0;
+				for (int sample = 0; sample < samplesToCopy; sample++)
+					partitionEnergy += (double) fftBuffer.getSample(0, sample) * fftBuffer.getSample(0, sample);
+				if (channelEnergy[(size_t) channel] > 0.0)
+					stageLevels[(size_t) s][(size_t) (channel * stage.numPartitions + partition)] = (float) (partitionEnergy / channelEnergy[(size_t) channel]);
+
+				fftIR.performRealOnlyForwardTransform(fftBuffer.getWritePointer(0, 0), true);
+				stageSpectra[s].copyFromJuceLayout(partition, channel, fftBuffer.getReadPointer(0, 0));
+			}
+		}
+	}
+}
+
+
+const float* PreparedIR::getPartitionSpectrum(int stage, int partition, int channel){
+	return stageSpectra[stage].getSlot(partition, channel);
+}
+
+
+float PreparedIR::getPartitionLevel(int stage, int partition, int channel){
+	return stageLevels[(size_t) stage][(size_t) (channel * stages[(size_t) stage].numPartitions + partition)];
+}
+
+
+const float* PreparedIR::getDirectTaps(int channel){
+	return directTaps.getReadPointer(channel, 0);
+}
+
+
+int PreparedIR::getNumDirectTaps(){
+	return numDirectTaps;
+}
+
+
+int PreparedIR::getNumStages(){
+	return (int) stages.size();
+}
+
+
+PartitionStage PreparedIR::getStage(int stage){
+	return stages[stage];
+}
+
+
+int PreparedIR::getHeadPartitionSize(){
+	return headPartitionSize;
+}
+
+
+int PreparedIR::getMaxPartitionSize(){
+	return maxPartitionSize;
+}
+
+
+int PreparedIR::getNumChannels(){
+	return numChannels;
+}
+
+
+int PreparedIR::getNumSamples(){
+	return numSamples;
+}
+
+
+int PreparedIR::getTailLength(){
+	return tailLength;
+}
+
+
+bool PreparedIR::isSparse(){
+	return sparse;
+}
+
+
+const std::vector<PreparedIR::SparseTap>& PreparedIR::getSparseTaps(int channel){
+	return sparseTaps[(size_t) channel];
+}
+
+
+int PreparedIR::getPathChannel(int input, int output, int numInputs, int numOutputs){
+
+	if (numChannels == numInputs * numOutputs)
+		return input * numOutputs + output;
+
+	if (numChannels == 1)
+		return (input == output || numInputs == 1 || numOutputs == 1) ? 0 : -1;
+
+	if (numChannels == numInputs && numInputs == numOutputs)
+		return input == output ? input : -1;
+
+	return -1;
+}
+
+
+bool PreparedIR::isRoutable(int numInputs, int numOutputs){
+	return numChannels == numInputs * numOutputs || numChannels == 1 || (numChannels == numInputs && numInputs == numOutputs);
+}
+
+
+bool PreparedIR::isSplitComplex(){
+	return splitComplex;
+}
+
+
+PreparedIR* PreparedIR::getTailIR(){
+	return tailIR.get();
+}
+
+
+int PreparedIR::getTailDecimation(){
+	return tailDecimation;
+}
+
+
+int PreparedIR::getTailSplit(){
+	return tailSplit;
+}
+
+
+bool PreparedIR::Shape::isNeutral() const {
+	return contrast == 1.0f && tiltdBPerOctave == 0.0f && gainCurve.empty() && phaseFlattening == 0.0f;
+}
+
+
+float PreparedIR::Shape::getGaindB(float frequency) const {
+
+	float gaindB = tiltdBPerOctave * std::log2(jlimit(20.0f, 20000.0f, frequency) / tiltPivot);
+
+	if (gainCurve.empty())
+		return gaindB;
+	if (frequency <= gainCurve.front().frequency)
+		return gaindB + gainCurve.front().gaindB;
+	if (frequency >= gainCurve.back().frequency)
+		return gaindB + gainCurve.back().gaindB;
+
+	size_t point = 1;
+	while (gainCurve[point].frequency < frequency)
+		point++;
+
+	const ShapePoint& below = gainCurve[point - 1];
+	const ShapePoint& above = gainCurve[point];
+	float position = std::log(frequency / below.frequency) / std::log(above.frequency / below.frequency);
+	return gaindB + below.gaindB + position * (above.gaindB - below.gaindB);
+}
+
+
+bool PreparedIR::isMorphable(PreparedIR& a, PreparedIR& b){
+
+	if (a.headPartitionSize != b.headPartitionSize || a.maxPartitionSize != b.maxPartitionSize || a.numSamples != b.numSamples
+		|| a.numDirectTaps != b.numDirectTaps || a.numChannels != b.numChannels || a.splitComplex != b.splitComplex
+		|| a.tailDecimation != b.tailDecimation || a.tailSplit != b.tailSplit || a.stages.size() != b.stages.size())
+		return false;
+
+	for (size_t s = 0; s < a.stages.size(); s++){
+		if (a.stages[s].partitionSize != b.stages[s].partitionSize || a.stages[s].offset != b.stages[s].offset
+			|| a.stages[s].numPartitions != b.stages[s].numPartitions)
+			return false;
+	}
+
+	if (a.tailIR == nullptr || b.tailIR == nullptr)
+		return a.tailIR == b.tailIR;
+
+	return isMorphable(*a.tailIR, *b.tailIR);
+}
+
+
+bool PreparedIR::isMorph(){
+	return morphFrom != nullptr;
+}
+
+
+/* the partitions are taken in turn from where the last call stopped, so that while the amount keeps moving,
+ * every partition still follows it within numPartitions / maxPartitions calls */
+int PreparedIR::morphStage(int stage, float amount, int maxPartitions){
+
+	if (morphFrom == nullptr)
+		return 0;
+
+	const PartitionStage& layout = stages[(size_t) stage];
+	SpectralRing& spectra = stageSpectra[(size_t) stage];
+	std::vector<float>& amounts = stageAmounts[(size_t) stage];
+	int& cursor = morphCursors[(size_t) stage];
+	int numPartitions = (int) amounts.size();
+	bool polar = morphMode == morphPolar && splitComplex;
+	int numMorphed = 0;
+
+	for (int i = 0; i < numPartitions && numMorphed < maxPartitions; i++){
+		int partition = cursor;
+		cursor = (cursor + 1) % numPartitions;
+
+		if (amounts[(size_t) partition] == amount)
+			continue;
+
+		for (int channel = 0; channel < numChannels; channel++){
+			float* spectrum = spectra.getSlot(partition, channel);
+			const float* fromSpectrum = morphFrom->getPartitionSpectrum(stage, partition, channel);
+			const float* toSpectrum = morphTo->getPartitionSpectrum(stage, partition, channel);
+
+			if (NOT polar){
+				kernels::blend(spectrum, fromSpectrum, toSpectrum, amount, spectra.getSlotStride());
+				continue;
+			}
+
+			/* back to the samples of the partition, which fill the first half of the FFT, see prepare() */
+			kernels::blendPolarSplit(spectrum, fromSpectrum, toSpectrum, amount, spectra.getImagOffset(), spectra.getNumBins());
+
+			float* fftPtr = morphBuffers[(size_t) stage].data();
+			spectra.copyToJuceLayout(partition, channel, fftPtr);
+			morphFFTs[(size_t) stage]->performRealOnlyInverseTransform(fftPtr);
+			FloatVectorOperations::clear(fftPtr + layout.partitionSize, layout.fftSize - layout.partitionSize);
+			morphFFTs[(size_t) stage]->performRealOnlyForwardTransform(fftPtr, true);
+			spectra.copyFromJuceLayout(partition, channel, fftPtr);
+		}
+
+		amounts[(size_t) partition] = amount;
+		numMorphed++;
+	}
+
+	return numMorphed;
+}
+
+
+/* samples, not spectra, so they are blended linearly in either mode */
+void PreparedIR::morphDirectTaps(float amount){
+
+	if (morphFrom == nullptr || numDirectTaps == 0 || directTapsAmount == amount)
+		return;
+
+	for (int channel = 0; channel < numChannels; channel++)
+		kernels::blend(directTaps.getWritePointer(channel, 0), morphFrom->getDirectTaps(channel), morphTo->getDirectTaps(channel), amount, numDirectTaps);
+
+	directTapsAmount = amount;
+}
+
+
+// ==========================================
+// Private
+// ==========================================
+
+/* the earliest split from where on every channel has less energy above the passband of the decimation than tailErrorBudgetdB
+ * below that of the whole channel. A chunk's share of it is measured with a Hann window, so that the low frequencies don't leak
+ * into the high ones. The chunk before the split is the crossover, and the tail needs room for the delay of its lowpass before that.
+ * Returns irSamples if there is no such split */
+int PreparedIR::findTailSplit(AudioSampleBuffer& ir, int irSamples, const std::vector<double>& channelEnergy){
+
+	int N = tailAnalysisSize;
+	int numChunks = (irSamples + N - 1) / N;
+	int firstHighBin = (int) std::ceil(RateConverter::getPassbandEdge(tailDecimation) * (float) N);
+	double budget = std::pow(10.0, tailErrorBudgetdB / 10.0);
+
+	BigInteger fftBitMask = (BigInteger) N;
+	dsp::FFT fft (fftBitMask.getHighestBit());
+	AudioSampleBuffer fftBuffer (1, 2 * N);
+	std::vector<float> window ((size_t) N);
+	dsp::WindowingFunction<float>::fillWindowingTables(window.data(), (size_t) N, dsp::WindowingFunction<float>::hann, false);
+
+	int halfOrder = ((int) RateConverter::designLowpass(tailDecimation).size() - 1) / 2;
+	int minSplit = numDirectTaps + N + halfOrder + RateConverter::getRoundTripDelay(tailDecimation);
+	int split = N * ((minSplit + N - 1) / N);
+
+	for (int channel = 0; channel < numChannels; channel++){
+		if (channelEnergy[(size_t) channel] <= 0.0)
+			continue;
+
+		/* the tail can start after the earliest chunk from which on the high energy is within budget */
+		double highEnergy = 0.0;
+		int firstChunk = numChunks;
+
+		for (int chunk = numChunks - 1; chunk >= 0; chunk--){
+			int startSample = chunk * N;
+			int chunkSamples = std::min(N, irSamples - startSample);
+			const float* irPtr = ir.getReadPointer(channel, startSample);
+
+			double chunkEnergy = 0.0;
+			fftBuffer.clear();
+			float* fftPtr = fftBuffer.getWritePointer(0, 0);
+			for (int sample = 0; sample < chunkSamples; sample++){
+				chunkEnergy += (double) irPtr[sample] * irPtr[sample];
+				fftPtr[sample] = irPtr[sample] * window[(size_t) sample];
+			}
+			fft.performRealOnlyForwardTransform(fftPtr, true);
+
+			double bandEnergy = 0.0, totalEnergy = 0.0;
+			for (int bin = 0; bin <= N / 2; bin++){
+				double binEnergy = (double) fftPtr[2 * bin] * fftPtr[2 * bin] + (double) fftPtr[2 * bin + 1] * fftPtr[2 * bin + 1];
+				totalEnergy += binEnergy;
+				if (bin >= firstHighBin)
+					bandEnergy += binEnergy;
+			}
+
+			if (totalEnergy > 0.0)
+				highEnergy += chunkEnergy * bandEnergy / totalEnergy;
+			if (highEnergy > budget * channelEnergy[(size_t) channel])
+				break;
+			firstChunk = chunk;
+		}
+
+		split = std::max(split, (firstChunk + 1) * N);
+	}
+
+	return std::min(split, irSamples);
+}
+
+
+/* the IR from the crossover on, faded in, band-limited by the lowpass of the RateConverter, and sampled at every tailDecimation-th sample
+ * from the round trip delay on (see getTailIR()). The gain of tailDecimation makes up for the samples that are left out */
+void PreparedIR::prepareTail(AudioSampleBuffer& ir, int irSamples, PreparedIR* tailLayout){
+
+	std::vector<float> lowpass = RateConverter::designLowpass(tailDecimation);
+	int halfOrder = ((int) lowpass.size() - 1) / 2;
+	int delay = numDirectTaps + RateConverter::getRoundTripDelay(tailDecimation);
+	int fadeStart = tailSplit - tailAnalysisSize;
+
+	/* up to the last sample that the lowpass spreads the IR to. On a layout the tail is padded to that of the layout */
+	int tailSamples = (irSamples - 1 + halfOrder - delay) / tailDecimation + 1;
+	if (tailLayout != nullptr)
+		tailSamples = std::max(1, tailSamples);
+	if (tailSamples <= 0)
+		return;
+
+	AudioSampleBuffer decimatedTail (numChannels, tailSamples);
+
+	for (int channel = 0; channel < numChannels; channel++){
+		const float* irPtr = ir.getReadPointer(channel, 0);
+
+		for (int sample = 0; sample < tailSamples; sample++){
+			int center = sample * tailDecimation + delay;
+			double sum = 0.0;
+
+			for (int tap = std::max(0, center + halfOrder - irSamples + 1); tap < (int) lowpass.size(); tap++){
+				int irSample = center + halfOrder - tap;
+				if (irSample < fadeStart)
+					break;
+				sum += (double) lowpass[(size_t) tap] * irPtr[irSample] * getTailGain(irSample);
+			}
+
+			decimatedTail.setSample(channel, sample, (float) (tailDecimation * sum));
+		}
+	}
+
+	if (tailLayout != nullptr)
+		tailIR = new PreparedIR(decimatedTail, *tailLayout);
+	else
+		tailIR = new PreparedIR(decimatedTail, headPartitionSize / tailDecimation, maxPartitionSize / tailDecimation, 0, splitComplex);
+}
+
+
+/* the layout of another IR, for the IRs that are made from prepared ones */
+void PreparedIR::copyLayout(PreparedIR& source){
+	headPartitionSize = source.headPartitionSize;
+	maxPartitionSize = source.maxPartitionSize;
+	splitComplex = source.splitComplex;
+	numSamples = source.numSamples;
+	numDirectTaps = source.numDirectTaps;
+	numChannels = source.numChannels;
+	tailDecimation = source.tailDecimation;
+	tailSplit = source.tailSplit;
+	stages = source.stages;
+}
+
+
+/* the linear gain of the tilt and gain curve of shape for every bin of an FFT of fftSize at sampleRate */
+std::vector<float> PreparedIR::getBinGains(const Shape& shape, double sampleRate, int fftSize){
+	std::vector<float> binGains ((size_t) (fftSize / 2 + 1));
+	for (int bin = 0; bin <= fftSize / 2; bin++)
+		binGains[(size_t) bin] = tools::dBToLin(shape.getGaindB((float) (bin * sampleRate / fftSize)));
+	return binGains;
+}
+
+
+/* the raised cosine crossover from the partitions into the tail, over the chunk before the split */
+float PreparedIR::getTailGain(int sample){
+
+	int fadeStart = tailSplit - tailAnalysisSize;
+	if (sample < fadeStart)
+		return 0.0f;
+	if (sample >= tailSplit)
+		return 1.0f;
+
+	return 0.5f - 0.5f * std::cos((float) M_PI * ((float) (sample - fadeStart) + 0.5f) / (float) tailAnalysisSize);
+}
+
+} // fp
@@ -0,0 +1,214 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+#pragma once
+
+#include <fp_include_all.hpp>
+#include <JuceHeader.h>
+
+
+namespace fp {
+
+
+/* The PreparedIR class holds the spectra of all partitions of an IR,
+ * so that the realtime convolution only needs to FFT the incoming audio.
+ * The IR is partitioned according to convolution::partitionScheme().
+ * It should be built off the audio thread whenever the IR changes,
+ * after which it can be handed to the audio thread as a Ptr.
+ * The first numDirectTaps samples can be kept in the time domain for a DirectFIR instead,
+ * in which case only the rest of the IR is partitioned, starting at partition offset 0.
+ * An IR with only a few taps that aren't zero, like a delay times a gain, is sparse: it is cheaper to convolve tap by tap
+ * from a delay line than with its partitions, see getSparseTaps().
+ * For every partition the energy relative to the whole channel is kept, so that a convolution can skip
+ * the partitions that are too soft to matter, e.g. the far end of a reverb tail.
+ *
+ * With a tailDecimation > 1 the IR can get a multirate tail: from the split where what is left of the IR above the passband
+ * of a RateConverter is within tailErrorBudgetdB of the whole channel, the IR is band-limited and decimated
+ * into a PreparedIR of its own (see getTailIR()), for a convolution at 1 / tailDecimation of the sample rate, with FFTs that are
+ * that much smaller. The partitions then only cover the IR up to the split, and are crossfaded into the tail over the chunk before it.
+ * The split is found per IR from the spectra of its chunks of tailAnalysisSize samples; an IR whose high frequencies
+ * reach to its end, or a sparse IR, gets no tail.
+ *
+ * Two IRs of the same layout (see isMorphable()) can be morphed: a third PreparedIR, the working set, holds a blend of their spectra,
+ * linear or by magnitude and phase (see MorphMode). It is moved to a new amount a few partitions at a time with morphStage(),
+ * by the convolution itself while it plays, so a morph costs about as much as a single IR. Its direct taps are blended in the
+ * time domain, and its tail is a morph of the two tails. To morph IRs that would be partitioned differently on their own,
+ * like a pulse and a long filter, one is prepared on the layout of the other.
+ *
+ * An IR can also be reshaped before it is prepared (see Shape and applyShape()), for a filter that changes in real time.
+ * The ops act on the spectrum of the whole IR, so the shaped IR is the same however it is partitioned. Prepared on the
+ * layout of the unshaped IR, it can replace it on the fly, or be morphed.
+ *
+ * The channels of the IR are routed from the inputs to the outputs of a convolution according to getPathChannel():
+ * - numInputs * numOutputs channels: a matrix, with the path from input i to output o in channel i * numOutputs + o.
+ *   For stereo that is true stereo: L->L, L->R, R->L, R->R.
+ * - 1 channel: every input to the output with the same index, or to all outputs if there is 1 input,
+ *   or all inputs to the only output.
+ * - numInputs channels, if numInputs == numOutputs: a separate IR per channel.
+ */
+
+class PreparedIR : public ReferenceCountedObject {
+
+public:
+	typedef ReferenceCountedObjectPtr<PreparedIR> Ptr;
+
+	/* a tap of a sparse IR: gain times the input of delay samples ago */
+	struct SparseTap {
+		int delay;
+		float gain;
+	};
+
+	/* IRs with up to this many taps that aren't zero per channel can be sparse */
+	static const int maxSparseTaps = 32;
+
+	/* the energy above the passband that a multirate tail may leave out, relative to that of the whole channel,
+	 * and the chunks in which the IR is measured to find the split */
+	static constexpr float tailErrorBudgetdB = -60.0f;
+	static const int tailAnalysisSize = 1024;
+
+	/* how a morph blends the spectra: linearly, or the magnitude linearly and the phase along the shorter arc,
+	 * see kernels::blendPolarSplit(). Interleaved spectra are always blended linearly.
+	 * A polar blend of two partitions isn't limited to the samples of a partition anymore, and would wrap around into the blocks
+	 * next to it, so it is cut back to them through an IFFT and an FFT */
+	enum MorphMode {
+		morphLinear,
+		morphPolar
+	};
+
+	/* a point of a gain curve */
+	struct ShapePoint {
+		float frequency;
+		float gaindB;
+	};
+
+	/* per bin ops on the spectrum of the whole IR, in this order (see kernels::shapeSplit()):
+	 * - the contrast, the exponent of the magnitude relative to the RMS magnitude over all channels: > 1 exaggerates the peaks
+	 *   and notches, < 1 compresses them, and 0 flattens the magnitude, like a filter without amplitude.
+	 * - a tilt of tiltdBPerOctave around tiltPivot Hz, over 20 Hz to 20 kHz, and a gain curve in dB,
+	 *   interpolated over log frequency between its points (in order of frequency) and held beyond them.
+	 * - phaseFlattening from 0 to 1: towards a linear phase with the delay of half the IR. 1 is like a filter without phase */
+	struct Shape {
+		float contrast = 1.0f;
+		float tiltdBPerOctave = 0.0f;
+		float tiltPivot = 1000.0f;
+		std::vector<ShapePoint> gainCurve;
+		float phaseFlattening = 0.0f;
+
+		bool isNeutral() const;
+		float getGaindB(float frequency) const;
+	};
+
+	/* maxPartitionSize == headPartitionSize gives uniform partitioning.
+	 * numSamples <= 0 means the whole IR is used, otherwise the IR is truncated or zero-padded.
+	 * The spectra are stored in a SpectralRing per stage, split into re and im parts or interleaved.
+	 * If numDirectTaps covers the whole IR, there are no stages at all.
+	 * With tailDecimation > 1, headPartitionSize and maxPartitionSize need to be multiples of it for a multirate tail */
+	PreparedIR(AudioBuffer<float>& ir, int headPartitionSize, int maxPartitionSize, int numSamples = 0, bool splitComplex = true, int numDirectTaps = 0,
+			   int tailDecimation = 1);
+
+	/* prepares ir on the layout of another IR: with its partitions, direct taps, length and tail split, so that the two are morphable.
+	 * It is never sparse, and it has a tail if layout has one */
+	PreparedIR(AudioBuffer<float>& ir, PreparedIR& layout);
+
+	/* a morph of from and to, which need to be morphable, starting at amount (0 is from, 1 is to). It keeps both alive */
+	PreparedIR(Ptr from, Ptr to, MorphMode mode, float amount);
+
+	~PreparedIR();
+
+	/* reshapes all samples of ir, an IR at sampleRate, through one FFT of at least twice its length.
+	 * What the shape spreads beyond the length of ir is cut off. A silent IR stays silent */
+	static void applyShape(AudioBuffer<float>& ir, const Shape& shape, double sampleRate);
+
+	/* N/2+1 bins, in the SpectralRing layout of the stage */
+	const float* getPartitionSpectrum(int stage, int partition, int channel = 0);
+
+	/* energy of the samples of a partition, as a fraction of the energy of the whole channel (0 for a silent channel) */
+	float getPartitionLevel(int stage, int partition, int channel = 0);
+
+	/* the first numDirectTaps samples of the IR, in reverse order, see kernels::fir() */
+	const float* getDirectTaps(int channel = 0);
+	int getNumDirectTaps();
+
+	int getNumStages();
+	PartitionStage getStage(int stage);
+	int getHeadPartitionSize();
+	int getMaxPartitionSize();
+	int getNumChannels();
+	int getNumSamples();
+
+	/* the length up to the last sample that isn't zero, in any channel, including the direct taps */
+	int getTailLength();
+
+	/* whether the IR has few enough taps that aren't zero to convolve them one by one cheaper than the partitions.
+	 * The taps of a channel are in order of delay, from the start of the IR, so including the direct taps */
+	bool isSparse();
+	const std::vector<SparseTap>& getSparseTaps(int channel = 0);
+
+	/* the channel of the IR that convolves input with output, or -1 if there is no path from input to output */
+	int getPathChannel(int input, int output, int numInputs, int numOutputs);
+
+	/* whether the channels of the IR fit a convolution with numInputs inputs and numOutputs outputs */
+	bool isRoutable(int numInputs, int numOutputs);
+	bool isSplitComplex();
+
+	/* the decimated tail, partitioned with headPartitionSize and maxPartitionSize divided by the tailDecimation,
+	 * or nullptr if the IR has none. Its sample i is convolved with the decimated input to give the output at
+	 * i * tailDecimation + RateConverter::getRoundTripDelay(), counting from the direct taps like the partitions */
+	PreparedIR* getTailIR();
+
+	/* the decimation the IR was prepared for, also if it got no tail, and the sample where the tail takes over
+	 * (getNumSamples() without tail) */
+	int getTailDecimation();
+	int getTailSplit();
+
+	/* whether two IRs have the same partitions, channels, direct taps and tails, so that they can be morphed */
+	static bool isMorphable(PreparedIR& a, PreparedIR& b);
+	bool isMorph();
+
+	/* morph only: blends up to maxPartitions partitions of a stage that aren't at amount yet for amount, and returns how many.
+	 * Not for the tail, which is a morph of its own. These write what the convolution reads, so they are only for the thread
+	 * that convolves the stage, or the direct taps, before it reads them. They don't allocate */
+	int morphStage(int stage, float amount, int maxPartitions);
+	void morphDirectTaps(float amount);
+
+private:
+	void prepare(AudioBuffer<float>& ir, PreparedIR* layout);
+	int findTailSplit(AudioBuffer<float>& ir, int irSamples, const std::vector<double>& channelEnergy);
+	void prepareTail(AudioBuffer<float>& ir, int irSamples, PreparedIR* tailLayout);
+	void copyLayout(PreparedIR& source);
+	static std::vector<float> getBinGains(const Shape& shape, double sampleRate, int fftSize);
+	float getTailGain(int sample);
+
+	std::vector<PartitionStage> stages;
+	std::vector<SpectralRing> stageSpectra;
+	std::vector<std::vector<float>> stageLevels;	// per stage, numPartitions per channel
+	AudioBuffer<float> directTaps;
+	int numDirectTaps;
+	int headPartitionSize;
+	int maxPartitionSize;
+	int numChannels;
+	int numSamples;
+	int tailLength = 0;
+	bool sparse = false;
+	std::vector<std::vector<SparseTap>> sparseTaps;	// per channel, only if sparse
+	bool splitComplex;
+	Ptr tailIR;
+	int tailDecimation;
+	int tailSplit;
+
+	/* a morph's IRs, and per stage the amount of every partition (-1 before the first blend) and where morphStage() goes on.
+	 * A polar morph has an FFT per stage and room for it, for the stages can be morphed on different threads */
+	Ptr morphFrom;
+	Ptr morphTo;
+	MorphMode morphMode = morphLinear;
+	std::vector<std::vector<float>> stageAmounts;
+	std::vector<int> morphCursors;
+	std::vector<std::unique_ptr<dsp::FFT>> morphFFTs;
+	std::vector<std::vector<float>> morphBuffers;
+	float directTapsAmount = -1.0f;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PreparedIR)
+};
+
+} // fp
@@ -0,0 +1,180 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+
+#include <fp_include_all.hpp>
+
+
+namespace fp {
+
+
+RateConverter::RateConverter(){
+}
+
+
+RateConverter::~RateConverter(){
+}
+
+
+void RateConverter::prepare(int numChannels, int decimation, int maxBlockSize){
+
+	this->numChannels = numChannels;
+	this->decimation = std::max(1, decimation);
+	this->maxBlockSize = maxBlockSize;
+
+	/* the lowpass is padded with zeros to a whole number of taps per phase */
+	std::vector<float> lowpass = designLowpass(this->decimation);
+	numPhaseTaps = ((int) lowpass.size() + this->decimation - 1) / this->decimation;
+	lowpass.resize((size_t) (numPhaseTaps * this->decimation), 0.0f);
+
+	/* phase p has taps p, p + decimation, p + 2 * decimation, ... */
+	phaseTaps.setSize(this->decimation, numPhaseTaps);
+	for (int phase = 0; phase < this->decimation; phase++){
+		for (int tap = 0; tap < numPhaseTaps; tap++)
+			phaseTaps.setSample(phase, numPhaseTaps - 1 - tap, lowpass[(size_t) (tap * this->decimation + phase)]);
+	}
+
+	int maxPhaseSamples = maxBlockSize / this->decimation;
+	history.setSize(numChannels * this->decimation, numPhaseTaps - 1 + maxPhaseSamples);
+	phaseOutput.setSize(1, maxPhaseSamples);
+	reset();
+}
+
+
+void RateConverter::reset(){
+	history.clear();
+	silentHistorySamples = numPhaseTaps - 1;
+}
+
+
+void RateConverter::decimate(const AudioSampleBuffer& input, AudioSampleBuffer& output, int numSamples){
+
+	if (numSamples > maxBlockSize || numSamples % decimation != 0){
+		DBG("RateConverter::decimate() error: block size not prepared for.\n");
+		return;
+	}
+
+	int numPhaseSamples = numSamples / decimation;
+	int historySamples = numPhaseTaps - 1;
+
+	bool silentInput = true;
+	for (int channel = 0; channel < numChannels && silentInput; channel++){
+		silentInput = input.getMagnitude(channel, 0, numSamples) == 0.0f;
+	}
+
+	if (silentInput && silentHistorySamples >= historySamples){
+		for (int channel = 0; channel < numChannels; channel++)
+			output.clear(channel, 0, numPhaseSamples);
+		return;
+	}
+
+	silentHistorySamples = silentInput ? silentHistorySamples + numPhaseSamples : 0;
+
+	for (int channel = 0; channel < numChannels; channel++){
+		const float* inputPtr = input.getReadPointer(channel, 0);
+		float* outputPtr = output.getWritePointer(channel, 0);
+
+		/* phase p meets the input samples m * decimation + decimation - 1 - p, so that its taps are consecutive */
+		for (int phase = 0; phase < decimation; phase++){
+			float* phasePtr = history.getWritePointer(channel * decimation + phase, historySamples);
+			for (int sample = 0; sample < numPhaseSamples; sample++)
+				phasePtr[sample] = inputPtr[sample * decimation + decimation - 1 - phase];
+		}
+
+		for (int phase = 0; phase < decimation; phase++){
+			float* phaseOutputPtr = phase == 0 ? outputPtr : phaseOutput.getWritePointer(0, 0);
+			kernels::fir(phaseOutputPtr, history.getReadPointer(channel * decimation + phase, 0), phaseTaps.getReadPointer(phase, 0),
+						 numPhaseTaps, numPhaseSamples);
+			if (phase > 0)
+				FloatVectorOperations::add(outputPtr, phaseOutputPtr, numPhaseSamples);
+
+			float* historyPtr = history.getWritePointer(channel * decimation + phase, 0);
+			memmove(historyPtr, historyPtr + numPhaseSamples, sizeof(float) * (size_t) historySamples);
+		}
+	}
+}
+
+
+void RateConverter::addInterpolated(const AudioSampleBuffer& input, AudioSampleBuffer& output, int numSamples){
+
+	if (numSamples > maxBlockSize || numSamples % decimation != 0){
+		DBG("RateConverter::addInterpolated() error: block size not prepared for.\n");
+		return;
+	}
+
+	int numPhaseSamples = numSamples / decimation;
+	int historySamples = numPhaseTaps - 1;
+
+	bool silentInput = true;
+	for (int channel = 0; channel < numChannels && silentInput; channel++){
+		silentInput = input.getMagnitude(channel, 0, numPhaseSamples) == 0.0f;
+	}
+
+	if (silentInput && silentHistorySamples >= historySamples)
+		return;
+
+	silentHistorySamples = silentInput ? silentHistorySamples + numPhaseSamples : 0;
+
+	for (int channel = 0; channel < numChannels; channel++){
+		float* historyPtr = history.getWritePointer(channel * decimation, 0);
+		float* outputPtr = output.getWritePointer(channel, 0);
+		const float* phaseOutputPtr = phaseOutput.getReadPointer(0, 0);
+		FloatVectorOperations::copy(historyPtr + historySamples, input.getReadPointer(channel, 0), numPhaseSamples);
+
+		/* output sample m * decimation + p only meets taps p, p + decimation, ... of the upsampled signal that aren't zero.
+		 * The gain of decimation makes up for the zeros */
+		for (int phase = 0; phase < decimation; phase++){
+			kernels::fir(phaseOutput.getWritePointer(0, 0), historyPtr, phaseTaps.getReadPointer(phase, 0), numPhaseTaps, numPhaseSamples);
+			for (int sample = 0; sample < numPhaseSamples; sample++)
+				outputPtr[sample * decimation + phase] += (float) decimation * phaseOutputPtr[sample];
+		}
+
+		memmove(historyPtr, historyPtr + numPhaseSamples, sizeof(float) * (size_t) historySamples);
+	}
+}
+
+
+int RateConverter::getDecimation(){
+	return decimation;
+}
+
+
+/* a Kaiser window design, with Kaiser's estimates of the order and beta for the attenuation.
+ * The stopband starts at the Nyquist frequency of the lower rate, so what is above it can't alias into the passband */
+std::vector<float> RateConverter::designLowpass(int decimation){
+
+	double stopbandEdge = 0.5 / (double) decimation;
+	double transitionWidth = transitionFraction * stopbandEdge;
+
+	int order = (int) std::ceil((stopbandAttenuationdB - 7.95) / (2.285 * 2.0 * M_PI * transitionWidth));
+	order += order % 2;
+	float beta = 0.1102f * (stopbandAttenuationdB - 8.7f);
+
+	auto coefficients = dsp::FilterDesign<float>::designFIRLowpassWindowMethod((float) (stopbandEdge - 0.5 * transitionWidth), 1.0, (size_t) order,
+																			   dsp::WindowingFunction<float>::kaiser, beta);
+
+	const float* coefficientsPtr = coefficients->getRawCoefficients();
+	std::vector<float> lowpass (coefficientsPtr, coefficientsPtr + order + 1);
+
+	float sum = std::accumulate(lowpass.begin(), lowpass.end(), 0.0f);
+	for (float& tap : lowpass)
+		tap /= sum;
+
+	return lowpass;
+}
+
+
+float RateConverter::getPassbandEdge(int decimation){
+	return (1.0f - transitionFraction) * 0.5f / (float) decimation;
+}
+
+
+/* each lowpass delays by half its order, and the decimated sample m stands for the input at m * decimation + decimation - 1,
+ * while addInterpolated() puts it at m * decimation */
+int RateConverter::getRoundTripDelay(int decimation){
+	int halfOrder = ((int) designLowpass(decimation).size() - 1) / 2;
+	return 2 * halfOrder - (decimation - 1);
+}
+
+} // fp
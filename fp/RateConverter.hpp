@@ -0,0 +1,74 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+#pragma once
+
+#include <fp_include_all.hpp>
+#include <JuceHeader.h>
+
+
+namespace fp {
+
+
+/* The RateConverter class converts audio to 1 / decimation of its sample rate and back, for the multirate tail
+ * of the PartitionedConvolver (see PreparedIR::getTailIR()).
+ * Both ways go through the same linear phase lowpass from designLowpass(), which is flat up to getPassbandEdge()
+ * and blocks everything above the band of the lower rate. It is split into decimation polyphase FIRs for kernels::fir(),
+ * so only the samples that are kept are computed, and the zeros of the upsampled signal are never multiplied.
+ * An instance either decimates or interpolates, as its history is that of the one signal it converts.
+ * Once the history holds only silence, silent input is answered with silence without filtering.
+ *
+ * Only prepare() allocates; reset(), decimate() and addInterpolated() are meant for the audio thread.
+ */
+
+class RateConverter {
+
+public:
+	RateConverter();
+	~RateConverter();
+
+	/* allocates for calls of up to maxBlockSize samples at the higher rate, which needs to be a multiple of decimation */
+	void prepare(int numChannels, int decimation, int maxBlockSize);
+
+	/* clears the history */
+	void reset();
+
+	/* lowpasses numSamples samples of the channels of input, and writes every decimation-th to the first numSamples / decimation
+	 * samples of output. The output sample m is the filtered input at m * decimation + decimation - 1 */
+	void decimate(const AudioBuffer<float>& input, AudioBuffer<float>& output, int numSamples);
+
+	/* upsamples the first numSamples / decimation samples of the channels of input to numSamples, and adds them to output */
+	void addInterpolated(const AudioBuffer<float>& input, AudioBuffer<float>& output, int numSamples);
+
+	int getDecimation();
+
+	/* the odd length lowpass with a DC gain of 1, whose delay is half its order */
+	static std::vector<float> designLowpass(int decimation);
+
+	/* the frequency up to which decimate() and addInterpolated() are flat, as a fraction of the higher sample rate */
+	static float getPassbandEdge(int decimation);
+
+	/* the delay of the passband through decimate() and then addInterpolated() at the lower rate, in samples of the higher rate */
+	static int getRoundTripDelay(int decimation);
+
+	/* the part of the band of the lower rate that the lowpass uses to fall off, and how far it falls */
+	static constexpr float transitionFraction = 0.25f;
+	static constexpr float stopbandAttenuationdB = 70.0f;
+
+private:
+	/* per channel the numPhaseTaps - 1 previous samples, followed by room for the new ones.
+	 * Decimating, there is such a history per phase of the input, in channel * decimation + phase */
+	AudioBuffer<float> history;
+	AudioBuffer<float> phaseTaps;		// per phase, its taps in reverse order, see kernels::fir()
+	AudioBuffer<float> phaseOutput;
+	int silentHistorySamples = 0;		// the number of most recent samples in the history that were all zero
+	int numChannels = 0;
+	int decimation = 1;
+	int numPhaseTaps = 1;
+	int maxBlockSize = 0;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RateConverter)
+};
+
+} // fp
@@ -0,0 +1,202 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+
+#include <fp_include_all.hpp>
+
+
+namespace fp {
+
+
+SlicedFFT::SlicedFFT(int order, int leafOrder) :
+	leafFFT (leafOrder),
+	fftSize (1 << order),
+	leafSize (1 << leafOrder),
+	numLeaves (1 << (order - leafOrder)),
+	numLevels (order - leafOrder)
+{
+	jassert(leafOrder < order);
+
+	float leafCost = convolution::fftCost(leafSize);
+
+	for (int leaf = 0; leaf < numLeaves; leaf++){
+		forwardSteps.push_back({ 0, leaf, leaf + 1, leafCost });
+	}
+
+	twiddles.resize((size_t) numLevels + 1);
+
+	for (int level = 1; level <= numLevels; level++){
+		int S = leafSize << (level - 1);
+		int numSequences = numLeaves >> level;
+
+		std::vector<std::complex<float>>& levelTwiddles = twiddles[(size_t) level];
+		levelTwiddles.resize((size_t) S + 1);
+		for (int k = 0; k <= S; k++){
+			levelTwiddles[(size_t) k] = (std::complex<float>) std::polar(1.0, -M_PI * (double) k / (double) S);
+		}
+
+		/* about the cost of a leaf FFT per step: a butterfly per bin going up, and two bins per butterfly going down */
+		addLevelSteps(forwardSteps, level, numSequences * (S + 1), 2 * leafSize, leafCost);
+	}
+
+	for (int level = numLevels; level >= 1; level--){
+		int S = leafSize << (level - 1);
+		addLevelSteps(inverseSteps, level, (numLeaves >> level) * (S / 2 + 1), leafSize, leafCost);
+	}
+
+	for (int leaf = 0; leaf < numLeaves; leaf++){
+		inverseSteps.push_back({ 0, leaf, leaf + 1, leafCost });
+	}
+
+	/* the even levels need N + 2 floats per sequence left, the leaves 2M each, which is 2N */
+	leafBuffer.resize((size_t) (2 * fftSize));
+	levelBuffer.resize((size_t) (fftSize + 2 * numLeaves));
+}
+
+
+SlicedFFT::~SlicedFFT(){
+}
+
+
+int SlicedFFT::getSize() const {
+	return fftSize;
+}
+
+
+int SlicedFFT::getNumSteps() const {
+	return (int) forwardSteps.size();
+}
+
+
+bool SlicedFFT::isLeafStep(int step, bool inverse) const {
+	return (inverse ? inverseSteps : forwardSteps)[(size_t) step].level == 0;
+}
+
+
+float SlicedFFT::getStepCost(int step, bool inverse) const {
+	return (inverse ? inverseSteps : forwardSteps)[(size_t) step].cost;
+}
+
+
+void SlicedFFT::performRealOnlyForwardStep(float* data, int step){
+
+	const Step& s = forwardSteps[(size_t) step];
+
+	if (s.level > 0){
+		combine(data, s.level, s.begin, s.end);
+		return;
+	}
+
+	float* leaf = reinterpret_cast<float*>(getSpectra(data, 0, s.begin));
+	for (int m = 0; m < leafSize; m++){
+		leaf[m] = data[s.begin + numLeaves * m];
+	}
+	leafFFT.performRealOnlyForwardTransform(leaf, true);
+}
+
+
+void SlicedFFT::performRealOnlyInverseStep(float* data, int step){
+
+	const Step& s = inverseSteps[(size_t) step];
+
+	if (s.level > 0){
+		split(data, s.level, s.begin, s.end);
+		return;
+	}
+
+	float* leaf = reinterpret_cast<float*>(getSpectra(data, 0, s.begin));
+	leafFFT.performRealOnlyInverseTransform(leaf);
+	for (int m = 0; m < leafSize; m++){
+		data[s.begin + numLeaves * m] = leaf[m];
+	}
+}
+
+
+// ==========================================
+// Private
+// ==========================================
+
+
+/* the numBins bins of a level in steps of about stepBins each, of leafCost per stepBins */
+void SlicedFFT::addLevelSteps(std::vector<Step>& steps, int level, int numBins, int stepBins, float leafCost){
+
+	int numSteps = (numBins + stepBins - 1) / stepBins;
+
+	for (int i = 0; i < numSteps; i++){
+		int begin = numBins * i / numSteps;
+		int end = numBins * (i + 1) / numSteps;
+		steps.push_back({ level, begin, end, leafCost * (float) (end - begin) / (float) stepBins });
+	}
+}
+
+
+/* the half spectrum of sequence of a level, the samples whose index modulo the number of sequences of the level is sequence */
+std::complex<float>* SlicedFFT::getSpectra(float* data, int level, int sequence){
+
+	float* spectra = data;
+
+	if (level == 0)
+		spectra = leafBuffer.data() + (size_t) (sequence * 2 * leafSize);
+	else if (level < numLevels)
+		spectra = (level % 2 == 1 ? levelBuffer.data() : leafBuffer.data()) + (size_t) (sequence * ((leafSize << level) + 2));
+
+	return reinterpret_cast<std::complex<float>*>(spectra);
+}
+
+
+/* bins begin to end of the sequences of level, counted over all of them, from the spectra of the even and odd samples one level down */
+void SlicedFFT::combine(float* data, int level, int begin, int end){
+
+	int S = leafSize << (level - 1);
+	int numSequences = numLeaves >> level;
+	const std::complex<float>* levelTwiddles = twiddles[(size_t) level].data();
+
+	for (int bin = begin; bin < end; ){
+		int sequence = bin / (S + 1);
+		int k = bin % (S + 1);
+		int endK = std::min(S + 1, k + end - bin);
+		bin += endK - k;
+
+		const std::complex<float>* even = getSpectra(data, level - 1, sequence);
+		const std::complex<float>* odd = getSpectra(data, level - 1, sequence + numSequences);
+		std::complex<float>* spectrum = getSpectra(data, level, sequence);
+
+		for (; k < endK; k++){
+			bool lower = k <= S / 2;
+			std::complex<float> e = lower ? even[k] : std::conj(even[S - k]);
+			std::complex<float> o = lower ? odd[k] : std::conj(odd[S - k]);
+			spectrum[k] = e + levelTwiddles[k] * o;
+		}
+	}
+}
+
+
+/* bins begin to end of the spectra of the even and odd samples of the sequences of level, counted over all of them, from those of level */
+void SlicedFFT::split(float* data, int level, int begin, int end){
+
+	int S = leafSize << (level - 1);
+	int numSequences = numLeaves >> level;
+	const std::complex<float>* levelTwiddles = twiddles[(size_t) level].data();
+
+	for (int bin = begin; bin < end; ){
+		int sequence = bin / (S / 2 + 1);
+		int k = bin % (S / 2 + 1);
+		int endK = std::min(S / 2 + 1, k + end - bin);
+		bin += endK - k;
+
+		const std::complex<float>* spectrum = getSpectra(data, level, sequence);
+		std::complex<float>* even = getSpectra(data, level - 1, sequence);
+		std::complex<float>* odd = getSpectra(data, level - 1, sequence + numSequences);
+
+		for (; k < endK; k++){
+			std::complex<float> lower = spectrum[k];
+			std::complex<float> upper = std::conj(spectrum[S - k]);
+			even[k] = 0.5f * (lower + upper);
+			odd[k] = 0.5f * (lower - upper) * std::conj(levelTwiddles[k]);
+		}
+	}
+}
+
+
+} // fp
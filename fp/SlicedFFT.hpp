@@ -0,0 +1,77 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+#pragma once
+
+#include <fp_include_all.hpp>
+#include <JuceHeader.h>
+
+
+namespace fp {
+
+
+/* The SlicedFFT class does the real-only FFT and IFFT of a dsp::FFT in steps, so that a large transform can be spread over several calls.
+ * The fftSize (N) samples are split by their index modulo R = N / leafSize into R interleaved sequences, which get a dsp::FFT of leafSize (M) each,
+ * and the spectra are combined into the whole one by log2(R) levels of radix-2 butterflies: X[k] = E[k] + e^(-2 pi i k / S) O[k], for the spectra E
+ * and O of the even and odd samples of a sequence of S. The half spectra of real signals are enough for that, with E[S/2 + k] = conj(E[S/2 - k]).
+ * A step is one of the R leaf FFTs, or an even share of about 2M bins of a level, so each costs about the same as a dsp::FFT of M.
+ * The inverse does the same backwards, and the results match those of dsp::FFT, up to rounding.
+ *
+ * Only the constructor allocates. The steps of one transform need to be done in order, 0 up to getNumSteps(), without another transform
+ * in between, as the levels are kept in the SlicedFFT; the data buffer needs to stay the same and untouched in the meantime.
+ */
+
+class SlicedFFT {
+
+public:
+	/* for an fftSize of 2^order in steps of leaf FFTs of 2^leafOrder, with leafOrder < order */
+	SlicedFFT(int order, int leafOrder);
+	~SlicedFFT();
+
+	int getSize() const;
+	int getNumSteps() const;
+
+	/* whether a step is one of the leaf FFTs, and what it costs in the units of convolution::fftCost(). The leaves and the steps of the levels
+	 * can take different times per unit, so it is up to the caller to tell them apart when timing them */
+	bool isLeafStep(int step, bool inverse) const;
+	float getStepCost(int step, bool inverse) const;
+
+	/* step of performRealOnlyForwardTransform(data, true): data holds N samples before step 0, and N/2+1 bins in the JUCE layout
+	 * after the last step. Like there, data needs room for 2N floats */
+	void performRealOnlyForwardStep(float* data, int step);
+
+	/* step of performRealOnlyInverseTransform(data): data holds N/2+1 bins in the JUCE layout before step 0,
+	 * and N samples, scaled by 1/N, after the last step */
+	void performRealOnlyInverseStep(float* data, int step);
+
+private:
+	/* a step is leaf FFT begin, if level == 0, or bins begin to end of all sequences of a level together */
+	struct Step {
+		int level;
+		int begin;
+		int end;
+		float cost;
+	};
+
+	void addLevelSteps(std::vector<Step>& steps, int level, int numBins, int stepBins, float leafCost);
+
+	std::complex<float>* getSpectra(float* data, int level, int sequence);
+	void combine(float* data, int level, int begin, int end);
+	void split(float* data, int level, int begin, int end);
+
+	dsp::FFT leafFFT;
+	int fftSize;
+	int leafSize;
+	int numLeaves;
+	int numLevels;
+	std::vector<Step> forwardSteps;							// the leaves, then the levels up; the inverse goes through the levels down, then the leaves
+	std::vector<Step> inverseSteps;
+	std::vector<std::vector<std::complex<float>>> twiddles;	// per level, e^(-2 pi i k / S) for the sequences of S, k from 0 to S/2
+	std::vector<float> leafBuffer;							// the leaves, 2M floats each, and after them the even levels
+	std::vector<float> levelBuffer;							// the odd levels below the last one, which is in data
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SlicedFFT)
+};
+
+} // fp
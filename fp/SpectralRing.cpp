@@ -0,0 +1,220 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+
+#include <fp_include_all.hpp>
+
+
+namespace fp {
+
+
+namespace {
+	const int floatsPerCacheLine = 64 / sizeof(float);
+
+	int roundUpToCacheLine(int numFloats){
+		return ((numFloats + floatsPerCacheLine - 1) / floatsPerCacheLine) * floatsPerCacheLine;
+	}
+}
+
+
+SpectralRing::SpectralRing(){
+}
+
+
+SpectralRing::SpectralRing(int numSlots, int numChannels, int numBins, bool splitComplex){
+	clearAndResize(numSlots, numChannels, numBins, splitComplex);
+}
+
+
+SpectralRing::~SpectralRing(){
+}
+
+
+void SpectralRing::clearAndResize(int numSlots, int numChannels, int numBins, bool splitComplex){
+
+	this->numSlots = numSlots;
+	this->numChannels = numChannels;
+	this->numBins = numBins;
+	this->splitComplex = splitComplex;
+
+	slotStride = slotStrideFor(numBins, splitComplex);
+	imagOffset = splitComplex ? roundUpToCacheLine(numBins) : 1;
+
+	/* one extra cache line to align the start with */
+	data.allocate((size_t) (numSlots * numChannels * slotStride + floatsPerCacheLine), true);
+	alignedData = reinterpret_cast<float*> ((reinterpret_cast<uintptr_t> (data.get()) + 63) & ~ (uintptr_t) 63);
+	silentSlots.assign((size_t) (numSlots * numChannels), true);
+	sourceChannels.assign((size_t) (numSlots * numChannels), -1);
+
+	writeIndex = 0;
+	newestIndex = 0;
+}
+
+
+void SpectralRing::clear(){
+	FloatVectorOperations::clear(alignedData, numSlots * numChannels * slotStride);
+	std::fill(silentSlots.begin(), silentSlots.end(), true);
+	std::fill(sourceChannels.begin(), sourceChannels.end(), -1);
+	writeIndex = 0;
+	newestIndex = 0;
+}
+
+
+float* SpectralRing::getSlot(int slot, int channel){
+	return alignedData + (channel * numSlots + slot) * slotStride;
+}
+
+
+const float* SpectralRing::getSlot(int slot, int channel) const {
+	return alignedData + (channel * numSlots + slot) * slotStride;
+}
+
+
+float* SpectralRing::getWriteSlot(int channel){
+	return getSlot(writeIndex, channel);
+}
+
+
+void SpectralRing::finishedWrite(){
+	newestIndex = writeIndex;
+	writeIndex = writeIndex > 0 ? writeIndex - 1 : numSlots - 1;
+}
+
+
+const float* SpectralRing::getPartition(int partition, int channel) const {
+	int slot = newestIndex + partition;
+	if (slot >= numSlots)
+		slot -= numSlots;
+	return getSlot(slot, channel);
+}
+
+
+void SpectralRing::setWriteSlotSilent(int channel){
+	FloatVectorOperations::clear(getWriteSlot(channel), slotStride);
+	silentSlots[(size_t) (channel * numSlots + writeIndex)] = true;
+	sourceChannels[(size_t) (channel * numSlots + writeIndex)] = -1;
+}
+
+
+void SpectralRing::setWriteSlotNotSilent(int channel){
+	silentSlots[(size_t) (channel * numSlots + writeIndex)] = false;
+	sourceChannels[(size_t) (channel * numSlots + writeIndex)] = -1;
+}
+
+
+void SpectralRing::markAllSilent(){
+	std::fill(silentSlots.begin(), silentSlots.end(), true);
+}
+
+
+bool SpectralRing::isPartitionSilent(int partition, int channel) const {
+	int slot = newestIndex + partition;
+	if (slot >= numSlots)
+		slot -= numSlots;
+	return silentSlots[(size_t) (channel * numSlots + slot)];
+}
+
+
+void SpectralRing::copyWriteSlot(int sourceChannel, int channel){
+	size_t source = (size_t) (sourceChannel * numSlots + writeIndex);
+	size_t destination = (size_t) (channel * numSlots + writeIndex);
+
+	if (silentSlots[source])
+		FloatVectorOperations::clear(getWriteSlot(channel), slotStride);
+	else
+		FloatVectorOperations::copy(getWriteSlot(channel), getWriteSlot(sourceChannel), slotStride);
+
+	silentSlots[destination] = silentSlots[source];
+	sourceChannels[destination] = sourceChannel;
+}
+
+
+bool SpectralRing::isPartitionCopy(int partition, int channel, int sourceChannel) const {
+	int slot = newestIndex + partition;
+	if (slot >= numSlots)
+		slot -= numSlots;
+
+	size_t index = (size_t) (channel * numSlots + slot);
+	return sourceChannels[index] == sourceChannel
+		|| (silentSlots[index] && silentSlots[(size_t) (sourceChannel * numSlots + slot)]);
+}
+
+
+void SpectralRing::copyFromJuceLayout(int slot, int channel, const float* juceSpectrum){
+	float* slotPtr = getSlot(slot, channel);
+
+	if (NOT splitComplex){
+		FloatVectorOperations::copy(slotPtr, juceSpectrum, 2 * numBins);
+		return;
+	}
+
+	float* imPtr = slotPtr + imagOffset;
+	for (int bin = 0; bin < numBins; bin++){
+		slotPtr[bin] = juceSpectrum[2 * bin];
+		imPtr[bin] = juceSpectrum[2 * bin + 1];
+	}
+}
+
+
+void SpectralRing::copyToJuceLayout(int slot, int channel, float* juceSpectrum) const {
+	const float* slotPtr = getSlot(slot, channel);
+
+	if (NOT splitComplex){
+		FloatVectorOperations::copy(juceSpectrum, slotPtr, 2 * numBins);
+		return;
+	}
+
+	const float* imPtr = slotPtr + imagOffset;
+	for (int bin = 0; bin < numBins; bin++){
+		juceSpectrum[2 * bin] = slotPtr[bin];
+		juceSpectrum[2 * bin + 1] = imPtr[bin];
+	}
+}
+
+
+int SpectralRing::getNumSlots() const {
+	return numSlots;
+}
+
+
+int SpectralRing::getNumChannels() const {
+	return numChannels;
+}
+
+
+int SpectralRing::getNumBins() const {
+	return numBins;
+}
+
+
+int SpectralRing::getSlotStride() const {
+	return slotStride;
+}
+
+
+int SpectralRing::getImagOffset() const {
+	return imagOffset;
+}
+
+
+bool SpectralRing::isSplitComplex() const {
+	return splitComplex;
+}
+
+
+int SpectralRing::getWriteIndex() const {
+	return writeIndex;
+}
+
+
+int SpectralRing::slotStrideFor(int numBins, bool splitComplex){
+	int stride = splitComplex ? 2 * roundUpToCacheLine(numBins) : roundUpToCacheLine(2 * numBins);
+
+	if ((stride * (int) sizeof(float)) % 4096 == 0)
+		stride += floatsPerCacheLine;
+
+	return stride;
+}
+
+} // fp
@@ -0,0 +1,100 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+#pragma once
+
+#include <fp_include_all.hpp>
+#include <JuceHeader.h>
+
+
+namespace fp {
+
+
+/* The SpectralRing class holds a ring of spectra of numBins bins (N/2+1 for an FFT of size N),
+ * for instance the partitions of an FDL or of an IR.
+ * All slots of a channel are in one 64-byte aligned block of memory, one slotStride after the other.
+ * Slots are interleaved {re, im} like the JUCE FFT, or split: numBins re, then numBins im at getImagOffset().
+ * The write index moves down through memory, so that the newest partition and the ones before it
+ * (getPartition(0), getPartition(1), ...) are read in ascending order, which the prefetcher can stream.
+ * Every slot has a flag that says whether its spectrum is all zero, so that silence can be skipped,
+ * and remembers if it was copied from another channel's slot, so that work on identical channels can be shared.
+ */
+
+class SpectralRing {
+
+public:
+	SpectralRing();
+	SpectralRing(int numSlots, int numChannels, int numBins, bool splitComplex = false);
+	~SpectralRing();
+
+	SpectralRing(SpectralRing&&) = default;
+	SpectralRing& operator= (SpectralRing&&) = default;
+
+	void clearAndResize(int numSlots, int numChannels, int numBins, bool splitComplex = false);
+	void clear();
+
+	float* getSlot(int slot, int channel);
+	const float* getSlot(int slot, int channel) const;
+
+	/* the slot to write the next spectrum to. finishedWrite() makes it partition 0 */
+	float* getWriteSlot(int channel);
+	void finishedWrite();
+
+	/* partition 0 is the most recently written spectrum, partition 1 the one before, etc. */
+	const float* getPartition(int partition, int channel) const;
+
+	/* marks the write slot as all zero or not; clear() and clearAndResize() mark all slots silent.
+	 * setWriteSlotSilent(channel) also clears the slot */
+	void setWriteSlotSilent(int channel);
+	void setWriteSlotNotSilent(int channel);
+	bool isPartitionSilent(int partition, int channel) const;
+
+	/* marks all slots silent without clearing them, for when everything in the ring is to be forgotten.
+	 * Their spectra must not be read after this, only skipped on their flags */
+	void markAllSilent();
+
+	/* copies the write slot of sourceChannel, and its silence flag, to the write slot of channel, and remembers that it did.
+	 * Marking the slot silent or not forgets it again */
+	void copyWriteSlot(int sourceChannel, int channel);
+
+	/* whether partition of channel holds the same spectrum as that of sourceChannel because it was copied from it,
+	 * or because both are silent */
+	bool isPartitionCopy(int partition, int channel, int sourceChannel) const;
+
+	/* conversion from and to the layout of dsp::FFT::performRealOnlyForwardTransform(),
+	 * only the first numBins bins are read from or written to juceSpectrum */
+	void copyFromJuceLayout(int slot, int channel, const float* juceSpectrum);
+	void copyToJuceLayout(int slot, int channel, float* juceSpectrum) const;
+
+	int getNumSlots() const;
+	int getNumChannels() const;
+	int getNumBins() const;
+	int getSlotStride() const;
+	int getImagOffset() const;
+	bool isSplitComplex() const;
+	int getWriteIndex() const;
+
+	/* the stride of a slot: 64-byte aligned, and not a multiple of 4 kB,
+	 * so that streams through different rings don't alias in the cache */
+	static int slotStrideFor(int numBins, bool splitComplex);
+
+private:
+	HeapBlock<float> data;
+	float* alignedData = nullptr;
+	std::vector<bool> silentSlots;
+	std::vector<int> sourceChannels;		// per slot, the channel it was copied from, or -1
+
+	int numSlots = 0;
+	int numChannels = 0;
+	int numBins = 0;
+	int slotStride = 0;
+	int imagOffset = 0;
+	bool splitComplex = false;
+	int writeIndex = 0;
+	int newestIndex = 0;
+
+	JUCE_DECLARE_NON_COPYABLE (SpectralRing)
+};
+
+} // fp
@@ -51,21 +51,16 @@ namespace convolution {
 		
 		int irPartitions = (int) std::ceil( (float) buffer2.getNumSamples() / (float) processBlockSize);
 		
-		// allocate memory for buffers
-		std::vector<AudioSampleBuffer> irFftBufferArray;
+		// allocate memory for buffers.
+		// The spectra are kept in contiguous rings of N/2+1 bins, interleaved like the JUCE FFT output,
+		// the FFTs themselves are done in the 2N sized fft buffers
+		SpectralRing irSpectra (irPartitions, chLayout == IRStereoAudioStereo ? 2 : 1, N / 2 + 1);
+		AudioSampleBuffer irFftBuffer (numChannelsIR, fftBlockSize);
 		int irFftBufferArraySize = 0;
-		for (int i = 0; i < irPartitions; i++){
-			irFftBufferArray.push_back({numChannelsIR, fftBlockSize});
-			irFftBufferArray[i].clear();
-		}
 		
-		// audio input array will have as many partitions as the IR --> circular buffer
-		std::vector<AudioSampleBuffer> audioFftBufferArray;
-		int audioFftBufferArrayIndex = 0;
-		for (int i = 0; i < irPartitions; i++){
-			audioFftBufferArray.push_back({numChannelsAudio, fftBlockSize});
-			audioFftBufferArray[i].clear();
-		}
+		// audio input ring will have as many partitions as the IR
+		SpectralRing audioSpectra (irPartitions, numChannelsAudio, N / 2 + 1);
+		AudioSampleBuffer audioFftBuffer (numChannelsAudio, fftBlockSize);
 		
 		//  bitmask is handy to determine the exact power of 2 N is (juce fft object wants this for constructor)
 		BigInteger fftBitMask = (BigInteger) N;
@@ -80,8 +75,9 @@ namespace convolution {
 		AudioSampleBuffer convResultBuffer (numChannelsAudio, fftBlockSize);
 		convResultBuffer.clear();
 		
-		AudioSampleBuffer inplaceBuffer (numChannelsAudio, fftBlockSize);
-		inplaceBuffer.clear();
+		// per audio channel: spectra to multiply-accumulate, in partition order
+		std::vector<std::vector<const float*>> audioFftPtrs (numChannelsAudio, std::vector<const float*> (irPartitions));
+		std::vector<std::vector<const float*>> irFftPtrs (numChannelsAudio, std::vector<const float*> (irPartitions));
 		
 		AudioSampleBuffer overlapBuffer (numChannelsAudio, processBlockSize); // actually audioBlockSize - 1
 		overlapBuffer.clear();
@@ -105,8 +101,9 @@ namespace convolution {
 			// read and fft IR block if not all of IR has been read
 			if (processIncrementor < irPartitions){
 
+				irFftBuffer.clear();
 				for (int channel = 0; channel < numChannelsIR; channel++){
-					irFftBufferArray[processIncrementor].copyFrom(channel,		// destChannel,
+					irFftBuffer.copyFrom(channel,		// destChannel,
 																  0, 		// destStartSample,
 																  buffer2,	// AudioBuffer< float > & 	source,
 																  channel, 		// sourceChannel,
@@ -118,19 +115,20 @@ namespace convolution {
 																  )	;
 				}
 				if (chLayout == IRStereoAudioMono)
-					tools::sumToMono(&irFftBufferArray[processIncrementor]);
-				for (int channel = 0; channel < irFftFwdChMax; channel++)
-					fftIR.performRealOnlyForwardTransform(irFftBufferArray[processIncrementor].getWritePointer(channel, 0), true);
+					tools::sumToMono(&irFftBuffer);
+				for (int channel = 0; channel < irFftFwdChMax; channel++){
+					fftIR.performRealOnlyForwardTransform(irFftBuffer.getWritePointer(channel, 0), true);
+					irSpectra.copyFromJuceLayout(processIncrementor, channel, irFftBuffer.getReadPointer(channel, 0));
+				}
 				irFftBufferArraySize++;
 			}
 			
 			// read and fft audio block if not all audio has been read
 			if (processIncrementor * processBlockSize <= buffer1.getNumSamples()){
-				audioFftBufferArrayIndex = processIncrementor % irPartitions;       // fold back
-				audioFftBufferArray[audioFftBufferArrayIndex].clear();
+				audioFftBuffer.clear();
 		
 				for (int channel = 0; channel < numChannelsAudio; channel++){
-					audioFftBufferArray[audioFftBufferArrayIndex].copyFrom(channel,		// destChannel,
+					audioFftBuffer.copyFrom(channel,		// destChannel,
 																		   0, 		// destStartSample,
 																		   buffer1,	// AudioBuffer< float > & 	source,
 																		   channel, 		// sourceChannel,
@@ -141,8 +139,10 @@ namespace convolution {
 																		   // copyFrom() doesn't 'see' the end of the buffer; with this conditional copyFrom() doesn't go out of bounds of the buffer
 																		   )	;
 					
-					fftForward.performRealOnlyForwardTransform(audioFftBufferArray[audioFftBufferArrayIndex].getWritePointer(channel, 0), true);
+					fftForward.performRealOnlyForwardTransform(audioFftBuffer.getWritePointer(channel, 0), true);
+					audioSpectra.copyFromJuceLayout(audioSpectra.getWriteIndex(), channel, audioFftBuffer.getReadPointer(channel, 0));
 				}
+				audioSpectra.finishedWrite();       // fold back is built in
 				
 				if ((processIncrementor + 1) * processBlockSize > buffer1.getNumSamples() )
 					endAudioIncrementor++;
@@ -157,50 +157,43 @@ namespace convolution {
 			// DSP loop per audio channel
 			convResultBuffer.clear();
 			
+			int firstIrBlock = std::max(0, endAudioIncrementor - 1);
+			int numMacBlocks = irFftBufferArraySize - firstIrBlock;
+			
+			// collect the audio and IR spectra of all partitions
+			for (int channel = 0; channel < numChannelsAudio; channel++) {
+				
+				int irCh = 0;
+				if (chLayout == IRMonoAudioMono || chLayout == IRStereoAudioStereo)
+					irCh = channel;
+				else // if IRStereoAudioMono: ir has been summed into channel 0
+					irCh = 0;
+				
+				// the newest audio block goes with the first IR block that is still needed, and so on
+				for (int block = 0; block < numMacBlocks; block++){
+					audioFftPtrs[channel][block] = audioSpectra.getPartition(block, channel);
+					irFftPtrs[channel][block] = irSpectra.getSlot(firstIrBlock + block, irCh);
+				}
+			}
+			
+			// complex multiply and sum all audio fft blocks with their IR fft blocks in one go
+			if (numChannelsAudio == 2){
+				// a mono IR has the same pointers for both channels, which the kernel can share
+				kernels::complexMulAccumulateStereo(convResultBuffer.getWritePointer(0, 0), convResultBuffer.getWritePointer(1, 0),
+													audioFftPtrs[0].data(), audioFftPtrs[1].data(),
+													irFftPtrs[0].data(), chLayout == IRMonoAudioStereo ? irFftPtrs[0].data() : irFftPtrs[1].data(),
+													numMacBlocks, N / 2 + 1);
+			}
+			else {
+				kernels::complexMulAccumulate(convResultBuffer.getWritePointer(0, 0), audioFftPtrs[0].data(), irFftPtrs[0].data(), numMacBlocks, N / 2 + 1);
+			}
+			
 			for (int channel = 0; channel < numChannelsAudio; channel++) {
 				
 				// prep
 				float* convResultPtr = convResultBuffer.getWritePointer(channel, 0);
 				float* overlapBufferPtr = overlapBuffer.getWritePointer(channel, 0);
 				
-				int irBlockIncrementor = std::max(0, endAudioIncrementor - 1);
-				int audioBlockDecrementor = audioFftBufferArrayIndex;
-				
-				
-				// DSP loop: compl mult, summing and ifft
-				while (irBlockIncrementor < irFftBufferArraySize) {
-					
-					inplaceBuffer.makeCopyOf(audioFftBufferArray[audioBlockDecrementor]);
-					float* inplaceBufferPtr = inplaceBuffer.getWritePointer(channel, 0);
-					
-					int irCh = 0;
-					if (chLayout == IRMonoAudioMono || chLayout == IRStereoAudioStereo)
-						irCh = channel;
-					else // if IRStereoAudioMono: ir has been summed into channel 0
-						irCh = 0;
-					const float* irFftPtr = irFftBufferArray[irBlockIncrementor].getReadPointer(irCh, 0);
-					
-					// complex multiply 1 audio fft block and 1 IR fft block
-					for (int i = 0; i <= N; i += 2){
-						tools::complexMul(inplaceBufferPtr + i,
-								   inplaceBufferPtr + i + 1,
-								   irFftPtr[i],
-								   irFftPtr[i + 1]);
-					}
-					
-					
-					// add to total conv result buffer
-					for (int i = 0; i < fftBlockSize; i++){
-						convResultPtr[i] += inplaceBufferPtr[i];
-					}
-					
-					
-					irBlockIncrementor++;
-					audioBlockDecrementor--;
-					if (audioBlockDecrementor < 0)
-						audioBlockDecrementor = irPartitions - 1;   // fold back
-				}
-				
 				
 				// FDL method --> summing and then IFFT
 				fftInverse.performRealOnlyInverseTransform(convResultPtr);
@@ -289,8 +282,6 @@ namespace convolution {
 		
 		
 		inputBuffer.setSize(numChannelsAudio, fftBlockSize, true);
-		
-		irBuffer.setSize(numChannelsIR, fftBlockSize, true);
 
 		
 		int irFftFwdChMax = 0;
@@ -303,9 +294,16 @@ namespace convolution {
 			default: break;
 		}
 		
-		// FFT
-		for (int channel = 0; channel < irFftFwdChMax; channel++)
-			fftIR.performRealOnlyForwardTransform(irBuffer.getWritePointer(channel, 0), true);
+		// FFT, only the N/2+1 bins of the IR are kept
+		HalfSpectrum irSpectrum (irFftFwdChMax, N);
+		AudioSampleBuffer irFftBuffer (1, fftBlockSize);
+		
+		for (int channel = 0; channel < irFftFwdChMax; channel++){
+			irFftBuffer.clear();
+			irFftBuffer.copyFrom(0, 0, irBuffer.getReadPointer(channel), irBuffer.getNumSamples());
+			fftIR.performRealOnlyForwardTransform(irFftBuffer.getWritePointer(0, 0), true);
+			irSpectrum.copyFromJuceLayout(channel, irFftBuffer.getReadPointer(0, 0));
+		}
 		
 		// DSP loop
 		for (int channel = 0; channel < numChannelsAudio; channel++){
@@ -320,18 +318,13 @@ namespace convolution {
 				irCh = channel;
 			else 	// if IRStereoAudioMono: ir has been summed into channel 0
 				irCh = 0;
-			const float* irFftPtr = irBuffer.getReadPointer(irCh, 0);
+			const float* irFftPtr = irSpectrum.getReadPointer(irCh);
 			
 			
-			for (int i = 0; i <= N; i += 2){
-				tools::complexMul(audioFftPtr + i,
-								   audioFftPtr + i + 1,
-								   irFftPtr[i],
-								   irFftPtr[i + 1]);
-				
-				/* unnecessary to "normalize" to JUCE FFT standard again (max ampl in freq domain = N) by dividing by N!
-				 * JUCE does this automatically */
-			}
+			kernels::complexMultiply(audioFftPtr, irFftPtr, N / 2 + 1);
+			
+			/* unnecessary to "normalize" to JUCE FFT standard again (max ampl in freq domain = N) by dividing by N!
+			 * JUCE does this automatically */
 			
 			fftInverse.performRealOnlyInverseTransform(audioFftPtr);
 		}
@@ -362,23 +355,18 @@ namespace convolution {
 			numBuf.setSize(numBuf.getNumChannels(), denomBuf.getNumSamples(), true);
 
 		/* FFT */
-		AudioSampleBuffer numBufFft (tools::fftTransform(numBuf));
-		AudioSampleBuffer denomBufFft (tools::fftTransform(denomBuf));
+		HalfSpectrum numBufFft (tools::fftTransform(numBuf));
+		HalfSpectrum denomBufFft (tools::fftTransform(denomBuf));
 
 
 		/* DSP loop */
-		int N = numBufFft.getNumSamples() / 2;
-		float* numBufFftPtr = numBufFft.getWritePointer(0, 0);
-		const float* denomBufFftPtr = denomBufFft.getReadPointer(0, 0);
-		for (int i = 0; i <= N; i += 2){
-			tools::complexDivCartesian(numBufFftPtr + i,
-										  numBufFftPtr + i + 1,
-										  *(denomBufFftPtr + i),
-										  *(denomBufFftPtr + i + 1));
-			
-			/* unnecessary to "normalize" to JUCE FFT standard again (max ampl in freq domain = N) by multiplying with N!
-			 * JUCE does this automatically */
-		}
+		int N = numBufFft.getFftSize();
+		float* numBufFftPtr = numBufFft.getWritePointer(0);
+		const float* denomBufFftPtr = denomBufFft.getReadPointer(0);
+		kernels::complexDivide(numBufFftPtr, denomBufFftPtr, N / 2 + 1);
+		
+		/* unnecessary to "normalize" to JUCE FFT standard again (max ampl in freq domain = N) by multiplying with N!
+		 * JUCE does this automatically */
 
 		
 		/* averagingFilter() applies a averaging based on moving, octave-based, rectangular window.
@@ -403,23 +391,23 @@ namespace convolution {
 	}
 
 
-	void averagingFilter (AudioSampleBuffer* buffer, double octaveFraction, double sampleRate, bool logAvg, bool includePhase, bool includeAmplitude){
+	void averagingFilter (HalfSpectrum* buffer, double octaveFraction, double sampleRate, bool logAvg, bool includePhase, bool includeAmplitude){
 		
 		
-		int fftSize = buffer->getNumSamples();
+		int N = buffer->getFftSize();
+		int fftSize = N * 2; // size of the JUCE layout, which the bin indices below are still counted in
 		int numChannels = buffer->getNumChannels();
 		
-		if (!tools::isPowerOfTwo(fftSize)) {
+		if (!tools::isPowerOfTwo(N)) {
 			DBG("applyBucket() error: input buffer size is not power of 2.\n");
 			return;
 		}
 		
-		AudioBuffer<float> oldAmplBuf (numChannels, fftSize/2); // will only contain ampls for real freqs
-		AudioBuffer<float> newAmplBuf (numChannels, fftSize);
+		AudioBuffer<float> oldAmplBuf (numChannels, N); // will only contain ampls for real freqs, the rest stays 0
+		AudioBuffer<float> newAmplBuf (numChannels, N + 2);
 		oldAmplBuf.clear();
 		newAmplBuf.clear();
 		
-		int N = fftSize / 2;
 		double fractPerSide = octaveFraction / 2.0;
 		double nyquist = sampleRate / 2;
 		double freqPerBin = nyquist / (double) (N/2); // N/2 because juce fft style is {re, im, re im, ...}
@@ -430,9 +418,7 @@ namespace convolution {
 			float* bufPtr = buffer->getWritePointer(channel);
 			float* oldAmplBufPtr = oldAmplBuf.getWritePointer(channel);
 			
-			for (int bin = 0; bin <= N; bin += 2){
-				*(oldAmplBufPtr + bin/2) = tools::binAmpl(bufPtr + bin);
-			}
+			kernels::binAmplitudes(oldAmplBufPtr, bufPtr, N / 2 + 1);
 		}
 		
 		
@@ -547,6 +533,86 @@ namespace convolution {
 
 
 	
+	std::vector<PartitionStage> partitionScheme(int numSamples, int headPartitionSize, int maxPartitionSize){
+		
+		std::vector<PartitionStage> stages;
+		maxPartitionSize = std::max(maxPartitionSize, headPartitionSize);
+		
+		int offset = 0;
+		int partitionSize = headPartitionSize;
+		
+		while (offset < numSamples || stages.size() == 0){
+			
+			PartitionStage stage;
+			stage.partitionSize = partitionSize;
+			stage.offset = offset;
+			stage.fftSize = 1;
+			while (stage.fftSize < (partitionSize * 2 - 1)){
+				stage.fftSize *= 2;
+			}
+			
+			/* the next stage needs to start at 2 * nextPartitionSize - headPartitionSize at the earliest,
+			 * and is only worth it if there is at least one full partition of IR left for it */
+			int nextPartitionSize = partitionSize * partitionGrowth;
+			int nextOffset = 2 * nextPartitionSize - headPartitionSize;
+			int partitionsUntilNextStage = (int) std::ceil((float) (nextOffset - offset) / (float) partitionSize);
+			int partitionsUntilEnd = std::max(1, (int) std::ceil((float) (numSamples - offset) / (float) partitionSize));
+			
+			if (nextPartitionSize > maxPartitionSize
+				|| offset + partitionsUntilNextStage * partitionSize + nextPartitionSize > numSamples){
+				stage.numPartitions = partitionsUntilEnd;
+			}
+			else {
+				stage.numPartitions = partitionsUntilNextStage;
+			}
+			
+			stages.push_back(stage);
+			offset += stage.numPartitions * partitionSize;
+			partitionSize = nextPartitionSize;
+		}
+		
+		return stages;
+	}
+	
+	
+	
+	float directFormCost(int numTaps){
+		/* a multiply-add per tap, but vectorised FIR loops run at several times the flop rate of
+		 * FFTs and spectral MACs, which are bound by shuffles and memory traffic */
+		const float directFormEfficiency = 4.0f;
+		return 2.0f * (float) numTaps / directFormEfficiency;
+	}
+	
+	
+	
+	float partitionedCost(int numSamples, int headPartitionSize, int maxPartitionSize){
+		
+		if (numSamples <= 0) return 0.0f;
+		
+		float cost = 0.0f;
+		
+		/* per block of a stage: a forward and an inverse FFT, and a complex MAC per bin per partition */
+		for (PartitionStage& stage : partitionScheme(numSamples, headPartitionSize, maxPartitionSize)){
+			float macCost = spectralMacCost(stage.fftSize) * (float) stage.numPartitions;
+			cost += (2.0f * fftCost(stage.fftSize) + macCost) / (float) stage.partitionSize;
+		}
+		
+		return cost;
+	}
+	
+	
+	
+	float fftCost(int fftSize){
+		return 2.5f * (float) fftSize * std::log2((float) fftSize);
+	}
+	
+	
+	
+	float spectralMacCost(int fftSize){
+		return 8.0f * (float) (fftSize / 2 + 1);
+	}
+	
+	
 } // convolution
 } // fp
 
@@ -23,6 +23,16 @@ namespace fp {
 		IRStereoAudioStereo
 	};
 	
+	/* One stage of a (non-uniform) partitioning of an IR:
+	 * numPartitions partitions of partitionSize samples, the first one starting at IR sample offset.
+	 * fftSize is the N of the FFT that a partition and an input block of partitionSize are transformed with. */
+	struct PartitionStage {
+		int partitionSize;
+		int fftSize;
+		int offset;
+		int numPartitions;
+	};
+	
 	namespace convolution {
 		
 		
@@ -37,11 +47,28 @@ namespace fp {
 		 * The denominator buffer needs to be mono! */
 		AudioBuffer<float> deconvolve(AudioBuffer<float>* numeratorBuffer, AudioBuffer<float>* denominatorBuffer, double sampleRate, bool smoothing = true, bool includePhase = true, bool includeAmplitude = true);
 
-		/* averagingFilter has a low-pass effect in the upper freqs if the fft method performForwardRealFreqOnly() has been used,
-		 * because the upper bin range will eventually go into negative freq bin territory, where the contents of the bins are 0,
+		/* averagingFilter has a low-pass effect in the upper freqs, because the upper bin range
+		 * will eventually go beyond nyquist, where the amplitudes are taken as 0,
 		 * but these bins still count towards the average. 
 		 * negative logAvg = linear average instead. */
-		void averagingFilter (AudioBuffer<float>* buffer, double octaveFraction, double sampleRate, bool logAvg, bool nullifyPhase = false, bool nullifyAmplitude = false);
+		void averagingFilter (HalfSpectrum* buffer, double octaveFraction, double sampleRate, bool logAvg, bool nullifyPhase = false, bool nullifyAmplitude = false);
+		
+		/* Non-uniform partitioning for realtime convolution with a latency of headPartitionSize:
+		 * the partition size grows by a factor partitionGrowth per stage, up to maxPartitionSize.
+		 * A stage with partition size B starts at an offset of at least 2B - headPartitionSize,
+		 * so its result is only due a full B later than its input block is complete.
+		 * If maxPartitionSize == headPartitionSize, this is plain uniform partitioning. */
+		std::vector<PartitionStage> partitionScheme(int numSamples, int headPartitionSize, int maxPartitionSize);
+		const int partitionGrowth = 4;
+		
+		/* Rough cost of convolving one channel, in flops per sample, to choose between direct form (DirectFIR)
+		 * and partitioned FFT convolution of numSamples IR samples. A real FFT of size N counts as 2.5 N log2(N) flops */
+		float directFormCost(int numTaps);
+		float partitionedCost(int numSamples, int headPartitionSize, int maxPartitionSize);
+		
+		/* the same rough costs for one real FFT of size fftSize, and one complex MAC over an FDL partition of its spectrum */
+		float fftCost(int fftSize);
+		float spectralMacCost(int fftSize);
 
 	} // convolution
 	
@@ -20,12 +20,22 @@
 #include "boost/algorithm/string.hpp"
 #define BOOST_FILESYSTEM_NO_DEPRECATED // recommended by boost
 
+#include "HalfSpectrum.hpp"
 #include "tools.hpp"
+#include "kernels.hpp"
 #include "CircularBufferArray.hpp"
+#include "AudioBufferFifo.hpp"
+#include "SpectralRing.hpp"
 #include "ParallelBufferPrinter.hpp"
 #include "convolution.hpp"
 #include "ExpSineSweep.hpp"
 #include "ir.hpp"
+#include "RateConverter.hpp"
+#include "PreparedIR.hpp"
+#include "DirectFIR.hpp"
+#include "SlicedFFT.hpp"
+#include "PartitionedConvolver.hpp"
+#include "ConvolutionPlanner.hpp"
 
 using namespace fp;
 
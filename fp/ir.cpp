@@ -118,14 +118,15 @@ namespace ir {
 			bufferSample++;
 			
 			if ((bufferSample % irPartSize == 0) || (bufferSample == buffer.getNumSamples())){
-				AudioSampleBuffer fft (tools::fftTransform(*array.getWriteBufferPtr()));
+				HalfSpectrum fft (tools::fftTransform(*array.getWriteBufferPtr()));
+				float* fftPtr = fft.getWritePointer(0);
 				
 				// replace im(0) with re(N/2)
-				fft.setSample(0, 1, fft.getSample(0, fft.getNumSamples()/2));
+				fftPtr[1] = fftPtr[fft.getFftSize()];
 				
 				// replace array buffer with fft version
 				for (int j = 0; j < N; j++){
-					array.getWriteBufferPtr()->setSample(0, j, fft.getSample(0, j));
+					array.getWriteBufferPtr()->setSample(0, j, fftPtr[j]);
 				}
 				array.incrWriteIndex();
 			}
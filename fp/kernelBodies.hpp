@@ -0,0 +1,528 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+
+/* The vectorised kernels, written once against a vector type Simd of Simd::numFloats floats,
+ * and a vector type SimdWide of SimdWide::numDoubles doubles that loads and stores floats.
+ * kernels.cpp includes this file once per instruction set, inside a namespace that defines Simd and SimdWide
+ * for it, and compiles it for that instruction set. So there is no #pragma once, and nothing else should include it.
+ * Each inclusion defines getKernelTable(), the table that kernels.cpp dispatches to at runtime.
+ */
+
+
+/* The bodies of the split kernels. They are inlined into the generic kernels, and into the ones specialised
+ * for one size (see getSplitKernels()), where numBins and imagOffset are constants */
+
+forcedinline void complexMulAccumulateSplitBody(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int numBins){
+
+	typedef Simd::V V;
+	const int nf = Simd::numFloats;
+	int bin = 0;
+
+	/* a chunk is 2 vectors of re and 2 of im */
+	for (; bin + 2 * nf <= numBins; bin += 2 * nf){
+		V accRe0 = Simd::load(accRe + bin);
+		V accRe1 = Simd::load(accRe + bin + nf);
+		V accIm0 = Simd::load(accIm + bin);
+		V accIm1 = Simd::load(accIm + bin + nf);
+
+		for (int partition = 0; partition < numPartitions; partition++){
+			const float* aPtr = a[partition] + bin;
+			const float* bPtr = b[partition] + bin;
+			V aRe0 = Simd::load(aPtr), aRe1 = Simd::load(aPtr + nf);
+			V aIm0 = Simd::load(aPtr + imagOffset), aIm1 = Simd::load(aPtr + imagOffset + nf);
+			V bRe0 = Simd::load(bPtr), bRe1 = Simd::load(bPtr + nf);
+			V bIm0 = Simd::load(bPtr + imagOffset), bIm1 = Simd::load(bPtr + imagOffset + nf);
+
+			accRe0 = Simd::mulSub(aIm0, bIm0, Simd::mulAdd(aRe0, bRe0, accRe0));
+			accRe1 = Simd::mulSub(aIm1, bIm1, Simd::mulAdd(aRe1, bRe1, accRe1));
+			accIm0 = Simd::mulAdd(aIm0, bRe0, Simd::mulAdd(aRe0, bIm0, accIm0));
+			accIm1 = Simd::mulAdd(aIm1, bRe1, Simd::mulAdd(aRe1, bIm1, accIm1));
+		}
+
+		Simd::store(accRe + bin, accRe0);
+		Simd::store(accRe + bin + nf, accRe1);
+		Simd::store(accIm + bin, accIm0);
+		Simd::store(accIm + bin + nf, accIm1);
+	}
+
+	complexMulAccumulateSplitBins(accRe, accIm, a, b, imagOffset, numPartitions, bin, numBins);
+}
+
+
+template <bool sharedIR, bool sharedAudio>
+forcedinline void complexMulAccumulateSplitStereoBody(float* accRe0, float* accIm0, float* accRe1, float* accIm1,
+													   const float* const* a0, const float* const* a1,
+													   const float* const* b0, const float* const* b1,
+													   int imagOffset, int numPartitions, int numBins){
+
+	typedef Simd::V V;
+	const int nf = Simd::numFloats;
+	int bin = 0;
+
+	for (; bin + nf <= numBins; bin += nf){
+		V accReL = Simd::load(accRe0 + bin);
+		V accImL = Simd::load(accIm0 + bin);
+		V accReR = Simd::load(accRe1 + bin);
+		V accImR = Simd::load(accIm1 + bin);
+
+		for (int partition = 0; partition < numPartitions; partition++){
+			V bReL = Simd::load(b0[partition] + bin);
+			V bImL = Simd::load(b0[partition] + imagOffset + bin);
+			V bReR = bReL, bImR = bImL;
+			if (NOT sharedIR){
+				bReR = Simd::load(b1[partition] + bin);
+				bImR = Simd::load(b1[partition] + imagOffset + bin);
+			}
+
+			V aReL = Simd::load(a0[partition] + bin);
+			V aImL = Simd::load(a0[partition] + imagOffset + bin);
+			V aReR = aReL, aImR = aImL;
+			if (NOT sharedAudio){
+				aReR = Simd::load(a1[partition] + bin);
+				aImR = Simd::load(a1[partition] + imagOffset + bin);
+			}
+
+			accReL = Simd::mulSub(aImL, bImL, Simd::mulAdd(aReL, bReL, accReL));
+			accImL = Simd::mulAdd(aImL, bReL, Simd::mulAdd(aReL, bImL, accImL));
+			accReR = Simd::mulSub(aImR, bImR, Simd::mulAdd(aReR, bReR, accReR));
+			accImR = Simd::mulAdd(aImR, bReR, Simd::mulAdd(aReR, bImR, accImR));
+		}
+
+		Simd::store(accRe0 + bin, accReL);
+		Simd::store(accIm0 + bin, accImL);
+		Simd::store(accRe1 + bin, accReR);
+		Simd::store(accIm1 + bin, accImR);
+	}
+
+	complexMulAccumulateSplitBins(accRe0, accIm0, a0, b0, imagOffset, numPartitions, bin, numBins);
+	complexMulAccumulateSplitBins(accRe1, accIm1, a1, b1, imagOffset, numPartitions, bin, numBins);
+}
+
+
+forcedinline void complexMulAccumulateSplitWideBody(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int numBins){
+
+	typedef SimdWide::W W;
+	const int nd = SimdWide::numDoubles;
+	int bin = 0;
+
+	/* a chunk is 2 vectors of re and 2 of im, like complexMulAccumulateSplit() but of half as many bins */
+	for (; bin + 2 * nd <= numBins; bin += 2 * nd){
+		W accRe0 = SimdWide::load(accRe + bin);
+		W accRe1 = SimdWide::load(accRe + bin + nd);
+		W accIm0 = SimdWide::load(accIm + bin);
+		W accIm1 = SimdWide::load(accIm + bin + nd);
+
+		for (int partition = 0; partition < numPartitions; partition++){
+			const float* aPtr = a[partition] + bin;
+			const float* bPtr = b[partition] + bin;
+			W aRe0 = SimdWide::load(aPtr), aRe1 = SimdWide::load(aPtr + nd);
+			W aIm0 = SimdWide::load(aPtr + imagOffset), aIm1 = SimdWide::load(aPtr + imagOffset + nd);
+			W bRe0 = SimdWide::load(bPtr), bRe1 = SimdWide::load(bPtr + nd);
+			W bIm0 = SimdWide::load(bPtr + imagOffset), bIm1 = SimdWide::load(bPtr + imagOffset + nd);
+
+			accRe0 = SimdWide::mulSub(aIm0, bIm0, SimdWide::mulAdd(aRe0, bRe0, accRe0));
+			accRe1 = SimdWide::mulSub(aIm1, bIm1, SimdWide::mulAdd(aRe1, bRe1, accRe1));
+			accIm0 = SimdWide::mulAdd(aIm0, bRe0, SimdWide::mulAdd(aRe0, bIm0, accIm0));
+			accIm1 = SimdWide::mulAdd(aIm1, bRe1, SimdWide::mulAdd(aRe1, bIm1, accIm1));
+		}
+
+		SimdWide::store(accRe + bin, accRe0);
+		SimdWide::store(accRe + bin + nd, accRe1);
+		SimdWide::store(accIm + bin, accIm0);
+		SimdWide::store(accIm + bin + nd, accIm1);
+	}
+
+	complexMulAccumulateSplitWideBins(accRe, accIm, a, b, imagOffset, numPartitions, bin, numBins);
+}
+
+
+/* a mono IR or a mono input is loaded once for both channels, decided once per call rather than per partition */
+forcedinline void complexMulAccumulateSplitStereoDispatch(float* accRe0, float* accIm0, float* accRe1, float* accIm1,
+														  const float* const* a0, const float* const* a1,
+														  const float* const* b0, const float* const* b1,
+														  int imagOffset, int numPartitions, int numBins){
+	if (b0 == b1 && a0 == a1)
+		complexMulAccumulateSplitStereoBody<true, true>(accRe0, accIm0, accRe1, accIm1, a0, a1, b0, b1, imagOffset, numPartitions, numBins);
+	else if (b0 == b1)
+		complexMulAccumulateSplitStereoBody<true, false>(accRe0, accIm0, accRe1, accIm1, a0, a1, b0, b1, imagOffset, numPartitions, numBins);
+	else if (a0 == a1)
+		complexMulAccumulateSplitStereoBody<false, true>(accRe0, accIm0, accRe1, accIm1, a0, a1, b0, b1, imagOffset, numPartitions, numBins);
+	else
+		complexMulAccumulateSplitStereoBody<false, false>(accRe0, accIm0, accRe1, accIm1, a0, a1, b0, b1, imagOffset, numPartitions, numBins);
+}
+
+
+/* The kernels for spectra of numBins bins, with every bound known at compile time. The imagOffset and numBins arguments
+ * are only there to match the generic kernels; getSplitKernels() only hands these out when they are the same */
+template <int numBins>
+void complexMulAccumulateSplitFixed(float* accRe, float* accIm, const float* const* a, const float* const* b, int, int numPartitions, int){
+	complexMulAccumulateSplitBody(accRe, accIm, a, b, splitImagOffset(numBins), numPartitions, numBins);
+}
+
+template <int numBins>
+void complexMulAccumulateSplitStereoFixed(float* accRe0, float* accIm0, float* accRe1, float* accIm1,
+										  const float* const* a0, const float* const* a1,
+										  const float* const* b0, const float* const* b1,
+										  int, int numPartitions, int){
+	complexMulAccumulateSplitStereoDispatch(accRe0, accIm0, accRe1, accIm1, a0, a1, b0, b1, splitImagOffset(numBins), numPartitions, numBins);
+}
+
+template <int numBins>
+void complexMulAccumulateSplitWideFixed(float* accRe, float* accIm, const float* const* a, const float* const* b, int, int numPartitions, int){
+	complexMulAccumulateSplitWideBody(accRe, accIm, a, b, splitImagOffset(numBins), numPartitions, numBins);
+}
+
+template <int numBins>
+SplitKernels fixedSplitKernels(){
+	return { complexMulAccumulateSplitFixed<numBins>, complexMulAccumulateSplitStereoFixed<numBins>, complexMulAccumulateSplitWideFixed<numBins>, numBins };
+}
+
+
+void complexMulAccumulate(float* acc, const float* const* a, const float* const* b, int numPartitions, int numBins){
+
+	typedef Simd::V V;
+	const int nf = Simd::numFloats;
+	int bin = 0;
+
+	/* a chunk is 2 vectors, which stay in registers while all partitions are added to them */
+	for (; bin + nf <= numBins; bin += nf){
+		int i = 2 * bin;
+		V acc0 = Simd::load(acc + i);
+		V acc1 = Simd::load(acc + i + nf);
+
+		for (int partition = 0; partition < numPartitions; partition++){
+			V a0 = Simd::load(a[partition] + i);
+			V a1 = Simd::load(a[partition] + i + nf);
+			V b0 = Simd::load(b[partition] + i);
+			V b1 = Simd::load(b[partition] + i + nf);
+
+			acc0 = Simd::mulAdd(Simd::dupImSigned(b0), Simd::swapPairs(a0), Simd::mulAdd(Simd::dupRe(b0), a0, acc0));
+			acc1 = Simd::mulAdd(Simd::dupImSigned(b1), Simd::swapPairs(a1), Simd::mulAdd(Simd::dupRe(b1), a1, acc1));
+		}
+
+		Simd::store(acc + i, acc0);
+		Simd::store(acc + i + nf, acc1);
+	}
+
+	/* the remaining bins, at least the Nyquist bin */
+	complexMulAccumulateBins(acc, a, b, numPartitions, bin, numBins);
+}
+
+
+void complexMulAccumulateStereo(float* acc0, float* acc1,
+								const float* const* a0, const float* const* a1,
+								const float* const* b0, const float* const* b1,
+								int numPartitions, int numBins){
+
+	typedef Simd::V V;
+	const int nf = Simd::numFloats;
+	bool sharedIR = b0 == b1;
+	int bin = 0;
+
+	for (; bin + nf <= numBins; bin += nf){
+		int i = 2 * bin;
+		V accL0 = Simd::load(acc0 + i);
+		V accL1 = Simd::load(acc0 + i + nf);
+		V accR0 = Simd::load(acc1 + i);
+		V accR1 = Simd::load(acc1 + i + nf);
+
+		for (int partition = 0; partition < numPartitions; partition++){
+			V bL0 = Simd::load(b0[partition] + i);
+			V bL1 = Simd::load(b0[partition] + i + nf);
+			V reL0 = Simd::dupRe(bL0), imL0 = Simd::dupImSigned(bL0);
+			V reL1 = Simd::dupRe(bL1), imL1 = Simd::dupImSigned(bL1);
+
+			V reR0 = reL0, imR0 = imL0, reR1 = reL1, imR1 = imL1;
+			if (NOT sharedIR){
+				V bR0 = Simd::load(b1[partition] + i);
+				V bR1 = Simd::load(b1[partition] + i + nf);
+				reR0 = Simd::dupRe(bR0); imR0 = Simd::dupImSigned(bR0);
+				reR1 = Simd::dupRe(bR1); imR1 = Simd::dupImSigned(bR1);
+			}
+
+			V aL0 = Simd::load(a0[partition] + i);
+			V aL1 = Simd::load(a0[partition] + i + nf);
+			V aR0 = Simd::load(a1[partition] + i);
+			V aR1 = Simd::load(a1[partition] + i + nf);
+
+			accL0 = Simd::mulAdd(imL0, Simd::swapPairs(aL0), Simd::mulAdd(reL0, aL0, accL0));
+			accL1 = Simd::mulAdd(imL1, Simd::swapPairs(aL1), Simd::mulAdd(reL1, aL1, accL1));
+			accR0 = Simd::mulAdd(imR0, Simd::swapPairs(aR0), Simd::mulAdd(reR0, aR0, accR0));
+			accR1 = Simd::mulAdd(imR1, Simd::swapPairs(aR1), Simd::mulAdd(reR1, aR1, accR1));
+		}
+
+		Simd::store(acc0 + i, accL0);
+		Simd::store(acc0 + i + nf, accL1);
+		Simd::store(acc1 + i, accR0);
+		Simd::store(acc1 + i + nf, accR1);
+	}
+
+	complexMulAccumulateBins(acc0, a0, b0, numPartitions, bin, numBins);
+	complexMulAccumulateBins(acc1, a1, b1, numPartitions, bin, numBins);
+}
+
+
+void complexMulAccumulateSplit(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int numBins){
+	complexMulAccumulateSplitBody(accRe, accIm, a, b, imagOffset, numPartitions, numBins);
+}
+
+
+void complexMulAccumulateSplitStereo(float* accRe0, float* accIm0, float* accRe1, float* accIm1,
+									 const float* const* a0, const float* const* a1,
+									 const float* const* b0, const float* const* b1,
+									 int imagOffset, int numPartitions, int numBins){
+	complexMulAccumulateSplitStereoDispatch(accRe0, accIm0, accRe1, accIm1, a0, a1, b0, b1, imagOffset, numPartitions, numBins);
+}
+
+
+void complexMulAccumulateSplitWide(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int numBins){
+	complexMulAccumulateSplitWideBody(accRe, accIm, a, b, imagOffset, numPartitions, numBins);
+}
+
+
+void fir(float* output, const float* history, const float* reversedTaps, int numTaps, int numSamples){
+
+	typedef Simd::V V;
+	const int nf = Simd::numFloats;
+	int n = 0;
+
+	/* 4 vectors of output samples stay in registers, while every tap is broadcast once for all of them */
+	for (; n + 4 * nf <= numSamples; n += 4 * nf){
+		V sum0 = Simd::broadcast(0.0f);
+		V sum1 = sum0, sum2 = sum0, sum3 = sum0;
+		const float* h = history + n;
+
+		for (int k = 0; k < numTaps; k++){
+			V tap = Simd::broadcast(reversedTaps[k]);
+			sum0 = Simd::mulAdd(tap, Simd::load(h + k), sum0);
+			sum1 = Simd::mulAdd(tap, Simd::load(h + k + nf), sum1);
+			sum2 = Simd::mulAdd(tap, Simd::load(h + k + 2 * nf), sum2);
+			sum3 = Simd::mulAdd(tap, Simd::load(h + k + 3 * nf), sum3);
+		}
+
+		Simd::store(output + n, sum0);
+		Simd::store(output + n + nf, sum1);
+		Simd::store(output + n + 2 * nf, sum2);
+		Simd::store(output + n + 3 * nf, sum3);
+	}
+
+	for (; n + nf <= numSamples; n += nf){
+		V sum = Simd::broadcast(0.0f);
+		for (int k = 0; k < numTaps; k++)
+			sum = Simd::mulAdd(Simd::broadcast(reversedTaps[k]), Simd::load(history + n + k), sum);
+		Simd::store(output + n, sum);
+	}
+
+	firSamples(output, history, reversedTaps, numTaps, n, numSamples);
+}
+
+
+/* a vector holds numFloats / 2 interleaved bins */
+void complexMultiply(float* a, const float* b, int numBins){
+
+	typedef Simd::V V;
+	const int binsPerVector = Simd::numFloats / 2;
+	int bin = 0;
+
+	for (; bin + binsPerVector <= numBins; bin += binsPerVector){
+		V aBins = Simd::load(a + 2 * bin);
+		V bBins = Simd::load(b + 2 * bin);
+		Simd::store(a + 2 * bin, Simd::mulAdd(Simd::dupImSigned(bBins), Simd::swapPairs(aBins), Simd::mul(Simd::dupRe(bBins), aBins)));
+	}
+
+	complexMultiplyBins(a, b, bin, numBins);
+}
+
+
+/* a / b = a * conj(b) / |b|^2 */
+void complexDivide(float* a, const float* b, int numBins){
+
+	typedef Simd::V V;
+	const int binsPerVector = Simd::numFloats / 2;
+	int bin = 0;
+
+	for (; bin + binsPerVector <= numBins; bin += binsPerVector){
+		V aBins = Simd::load(a + 2 * bin);
+		V bBins = Simd::load(b + 2 * bin);
+		V bRe = Simd::dupRe(bBins);
+		V bIm = Simd::dupImSigned(bBins);
+
+		V numerator = Simd::mulSub(bIm, Simd::swapPairs(aBins), Simd::mul(bRe, aBins));
+		V denominator = Simd::mulAdd(bIm, bIm, Simd::mul(bRe, bRe));
+		Simd::store(a + 2 * bin, Simd::selectWhereZero(denominator, aBins, Simd::div(numerator, denominator)));
+	}
+
+	complexDivideBins(a, b, bin, numBins);
+}
+
+
+/* a chunk is the numFloats bins of 2 vectors: their squared re parts are the even elements, the im parts the odd ones */
+void binAmplitudes(float* amplitudes, const float* bins, int numBins){
+
+	typedef Simd::V V;
+	const int nf = Simd::numFloats;
+	int bin = 0;
+
+	for (; bin + nf <= numBins; bin += nf){
+		V bins0 = Simd::load(bins + 2 * bin);
+		V bins1 = Simd::load(bins + 2 * bin + nf);
+		V squares0 = Simd::mul(bins0, bins0);
+		V squares1 = Simd::mul(bins1, bins1);
+		Simd::store(amplitudes + bin, Simd::sqrt(Simd::add(Simd::evens(squares0, squares1), Simd::odds(squares0, squares1))));
+	}
+
+	binAmplitudesBins(amplitudes, bins, bin, numBins);
+}
+
+
+/* the gain of a sample is computed from its index, like the scalar version, so the ramp does not drift */
+void applyGainRamp(float* samples, int numSamples, float startGain, float gainPerSample){
+
+	typedef Simd::V V;
+	const int nf = Simd::numFloats;
+	const V indices = Simd::load(sampleIndices);
+	const V start = Simd::broadcast(startGain);
+	const V step = Simd::broadcast(gainPerSample);
+	int n = 0;
+
+	for (; n + nf <= numSamples; n += nf){
+		V gain = Simd::mulAdd(Simd::add(Simd::broadcast((float) n), indices), step, start);
+		Simd::store(samples + n, Simd::mul(Simd::load(samples + n), gain));
+	}
+
+	gainRampSamples(samples, startGain, gainPerSample, n, numSamples);
+}
+
+
+void sumToMono(float* left, float* right, int numSamples){
+
+	typedef Simd::V V;
+	const int nf = Simd::numFloats;
+	const V half = Simd::broadcast(0.5f);
+	const V zero = Simd::broadcast(0.0f);
+	int n = 0;
+
+	for (; n + nf <= numSamples; n += nf){
+		Simd::store(left + n, Simd::mul(Simd::add(Simd::load(left + n), Simd::load(right + n)), half));
+		Simd::store(right + n, zero);
+	}
+
+	sumToMonoSamples(left, right, n, numSamples);
+}
+
+
+void blend(float* dest, const float* a, const float* b, float amount, int numFloats){
+
+	typedef Simd::V V;
+	const int nf = Simd::numFloats;
+	const V t = Simd::broadcast(amount);
+	int n = 0;
+
+	for (; n + nf <= numFloats; n += nf){
+		V aFloats = Simd::load(a + n);
+		Simd::store(dest + n, Simd::mulAdd(t, Simd::load(b + n), Simd::mulSub(t, aFloats, aFloats)));
+	}
+
+	blendFloats(dest, a, b, amount, n, numFloats);
+}
+
+
+/* see blendPolarSplitBins(): the unit vectors are weighted by (1 - amount) / |a| and amount / |b|, 0 for a bin that is 0 */
+void blendPolarSplit(float* dest, const float* a, const float* b, float amount, int imagOffset, int numBins){
+
+	typedef Simd::V V;
+	const int nf = Simd::numFloats;
+	const V t = Simd::broadcast(amount);
+	const V oneMinusT = Simd::broadcast(1.0f - amount);
+	const V zero = Simd::broadcast(0.0f);
+	int bin = 0;
+
+	for (; bin + nf <= numBins; bin += nf){
+		V aRe = Simd::load(a + bin), aIm = Simd::load(a + bin + imagOffset);
+		V bRe = Simd::load(b + bin), bIm = Simd::load(b + bin + imagOffset);
+		V aMagnitude = Simd::sqrt(Simd::mulAdd(aIm, aIm, Simd::mul(aRe, aRe)));
+		V bMagnitude = Simd::sqrt(Simd::mulAdd(bIm, bIm, Simd::mul(bRe, bRe)));
+		V aWeight = Simd::selectWhereZero(aMagnitude, zero, Simd::div(oneMinusT, aMagnitude));
+		V bWeight = Simd::selectWhereZero(bMagnitude, zero, Simd::div(t, bMagnitude));
+
+		V re = Simd::mulAdd(bRe, bWeight, Simd::mul(aRe, aWeight));
+		V im = Simd::mulAdd(bIm, bWeight, Simd::mul(aIm, aWeight));
+		V directionMagnitude = Simd::sqrt(Simd::mulAdd(im, im, Simd::mul(re, re)));
+		V magnitude = Simd::mulAdd(t, bMagnitude, Simd::mulSub(t, aMagnitude, aMagnitude));
+		V scale = Simd::selectWhereZero(directionMagnitude, zero, Simd::div(magnitude, directionMagnitude));
+
+		Simd::store(dest + bin, Simd::mul(re, scale));
+		Simd::store(dest + bin + imagOffset, Simd::mul(im, scale));
+	}
+
+	blendPolarSplitBins(dest, a, b, amount, imagOffset, bin, numBins);
+}
+
+
+/* see shapeSplitBins(). A vector starts at a multiple of 4 bins, so the flat phase is the same for every vector */
+void shapeSplit(float* dest, const float* source, const float* binGains, float reference, float exponent, float flattening, int imagOffset, int numBins){
+
+	typedef Simd::V V;
+	const int nf = Simd::numFloats;
+	int wholePower, fractionBits;
+	splitShapeExponent(exponent, wholePower, fractionBits);
+
+	const V referenceV = Simd::broadcast(reference);
+	const V inverseReference = Simd::broadcast(1.0f / reference);
+	const V keep = Simd::broadcast(1.0f - flattening);
+	const V flatRe = Simd::mul(Simd::broadcast(flattening), Simd::load(quarterDelayRe));
+	const V flatIm = Simd::mul(Simd::broadcast(flattening), Simd::load(quarterDelayIm));
+	const V zero = Simd::broadcast(0.0f);
+	const V one = Simd::broadcast(1.0f);
+	int bin = 0;
+
+	for (; bin + nf <= numBins; bin += nf){
+		V re = Simd::load(source + bin), im = Simd::load(source + bin + imagOffset);
+		V magnitude = Simd::sqrt(Simd::mulAdd(im, im, Simd::mul(re, re)));
+		V relativeMagnitude = Simd::mul(magnitude, inverseReference);
+
+		V power = one, root = relativeMagnitude;
+		for (int i = 0; i < wholePower; i++)
+			power = Simd::mul(power, relativeMagnitude);
+		for (int bit = 7; bit >= 0 && (fractionBits & ((2 << bit) - 1)) != 0; bit--){
+			root = Simd::sqrt(root);
+			if ((fractionBits >> bit) & 1)
+				power = Simd::mul(power, root);
+		}
+
+		V weight = Simd::selectWhereZero(magnitude, zero, Simd::div(keep, magnitude));
+		V directionRe = Simd::mulAdd(re, weight, flatRe);
+		V directionIm = Simd::mulAdd(im, weight, flatIm);
+		V directionMagnitude = Simd::sqrt(Simd::mulAdd(directionIm, directionIm, Simd::mul(directionRe, directionRe)));
+		V shaped = Simd::mul(Simd::mul(Simd::load(binGains + bin), referenceV), power);
+		V scale = Simd::selectWhereZero(directionMagnitude, zero, Simd::div(shaped, directionMagnitude));
+
+		Simd::store(dest + bin, Simd::mul(directionRe, scale));
+		Simd::store(dest + bin + imagOffset, Simd::mul(directionIm, scale));
+	}
+
+	shapeSplitBins(dest, source, binGains, reference, exponent, flattening, imagOffset, bin, numBins);
+}
+
+
+const KernelTable& getKernelTable(){
+	static const KernelTable table = {
+		Simd::instructionSet,
+		complexMulAccumulate,
+		complexMulAccumulateStereo,
+		{ complexMulAccumulateSplit, complexMulAccumulateSplitStereo, complexMulAccumulateSplitWide, 0 },
+		{ fixedSplitKernels<65>(), fixedSplitKernels<129>(), fixedSplitKernels<257>(), fixedSplitKernels<513>(), fixedSplitKernels<1025>() },
+		fir,
+		complexMultiply,
+		complexDivide,
+		binAmplitudes,
+		applyGainRamp,
+		sumToMono,
+		blend,
+		blendPolarSplit,
+		shapeSplit
+	};
+	return table;
+}
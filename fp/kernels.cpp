@@ -0,0 +1,913 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+
+#include <fp_include_all.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	#include <immintrin.h>
+	#define FP_KERNELS_X86 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+	#include <arm_neon.h>
+	#define FP_KERNELS_NEON 1
+#endif
+
+/* FP_KERNELS_TARGET_BEGIN(isa) and FP_KERNELS_TARGET_END compile the functions in between for an instruction set
+ * the rest of the project is not compiled for, so that they can be picked at runtime.
+ * MSVC compiles any intrinsic without that */
+#define FP_KERNELS_PRAGMA(x) _Pragma(#x)
+
+#if defined(__clang__)
+	#define FP_KERNELS_TARGET_BEGIN(isa) FP_KERNELS_PRAGMA(clang attribute push (__attribute__((target(isa))), apply_to = function))
+	#define FP_KERNELS_TARGET_END FP_KERNELS_PRAGMA(clang attribute pop)
+#elif defined(__GNUC__)
+	#define FP_KERNELS_TARGET_BEGIN(isa) FP_KERNELS_PRAGMA(GCC push_options) FP_KERNELS_PRAGMA(GCC target(isa))
+	#define FP_KERNELS_TARGET_END FP_KERNELS_PRAGMA(GCC pop_options)
+#else
+	#define FP_KERNELS_TARGET_BEGIN(isa)
+	#define FP_KERNELS_TARGET_END
+#endif
+
+
+namespace fp {
+namespace kernels {
+
+
+namespace {
+
+/* The scalar versions of the kernels. They are the references the vectorised ones are checked against,
+ * and the vectorised ones finish the bins or samples that don't fill a vector with them */
+
+/* acc += a * b for bins [startBin, numBins) */
+inline void complexMulAccumulateBins(float* acc, const float* const* a, const float* const* b, int numPartitions, int startBin, int numBins){
+	for (int partition = 0; partition < numPartitions; partition++){
+		const float* aPtr = a[partition];
+		const float* bPtr = b[partition];
+
+		for (int i = 2 * startBin; i < 2 * numBins; i += 2){
+			acc[i]     += aPtr[i] * bPtr[i]     - aPtr[i + 1] * bPtr[i + 1];
+			acc[i + 1] += aPtr[i] * bPtr[i + 1] + aPtr[i + 1] * bPtr[i];
+		}
+	}
+}
+
+/* output[n] = sum of reversedTaps[k] * history[n + k], for samples [startSample, numSamples) */
+inline void firSamples(float* output, const float* history, const float* reversedTaps, int numTaps, int startSample, int numSamples){
+	for (int n = startSample; n < numSamples; n++){
+		float sum = 0.0f;
+		for (int k = 0; k < numTaps; k++)
+			sum += reversedTaps[k] * history[n + k];
+		output[n] = sum;
+	}
+}
+
+/* split version of complexMulAccumulateBins() */
+inline void complexMulAccumulateSplitBins(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int startBin, int numBins){
+	for (int partition = 0; partition < numPartitions; partition++){
+		const float* aRe = a[partition];
+		const float* aIm = a[partition] + imagOffset;
+		const float* bRe = b[partition];
+		const float* bIm = b[partition] + imagOffset;
+
+		for (int bin = startBin; bin < numBins; bin++){
+			accRe[bin] += aRe[bin] * bRe[bin] - aIm[bin] * bIm[bin];
+			accIm[bin] += aRe[bin] * bIm[bin] + aIm[bin] * bRe[bin];
+		}
+	}
+}
+
+/* complexMulAccumulateSplitBins() in double, with all partitions of a bin summed before it is stored */
+inline void complexMulAccumulateSplitWideBins(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int startBin, int numBins){
+	for (int bin = startBin; bin < numBins; bin++){
+		double re = accRe[bin];
+		double im = accIm[bin];
+
+		for (int partition = 0; partition < numPartitions; partition++){
+			double aRe = a[partition][bin], aIm = a[partition][bin + imagOffset];
+			double bRe = b[partition][bin], bIm = b[partition][bin + imagOffset];
+			re += aRe * bRe - aIm * bIm;
+			im += aRe * bIm + aIm * bRe;
+		}
+
+		accRe[bin] = (float) re;
+		accIm[bin] = (float) im;
+	}
+}
+
+/* a *= b for bins [startBin, numBins), like tools::complexMul() */
+inline void complexMultiplyBins(float* a, const float* b, int startBin, int numBins){
+	for (int i = 2 * startBin; i < 2 * numBins; i += 2){
+		float re = a[i] * b[i] - a[i + 1] * b[i + 1];
+		float im = a[i + 1] * b[i] + a[i] * b[i + 1];
+		a[i] = re;
+		a[i + 1] = im;
+	}
+}
+
+/* a /= b for bins [startBin, numBins), like tools::complexDivCartesian() */
+inline void complexDivideBins(float* a, const float* b, int startBin, int numBins){
+	for (int i = 2 * startBin; i < 2 * numBins; i += 2){
+		float denominator = b[i] * b[i] + b[i + 1] * b[i + 1];
+		if (denominator == 0.0f)
+			continue;
+
+		float re = (a[i] * b[i] + a[i + 1] * b[i + 1]) / denominator;
+		float im = (a[i + 1] * b[i] - a[i] * b[i + 1]) / denominator;
+		a[i] = re;
+		a[i + 1] = im;
+	}
+}
+
+/* amplitudes[bin] = |bins[bin]| for bins [startBin, numBins) */
+inline void binAmplitudesBins(float* amplitudes, const float* bins, int startBin, int numBins){
+	for (int bin = startBin; bin < numBins; bin++)
+		amplitudes[bin] = std::sqrt(bins[2 * bin] * bins[2 * bin] + bins[2 * bin + 1] * bins[2 * bin + 1]);
+}
+
+/* samples[n] *= startGain + n * gainPerSample for samples [startSample, numSamples) */
+inline void gainRampSamples(float* samples, float startGain, float gainPerSample, int startSample, int numSamples){
+	for (int n = startSample; n < numSamples; n++)
+		samples[n] *= startGain + n * gainPerSample;
+}
+
+/* left := (left + right) / 2 and right := 0 for samples [startSample, numSamples) */
+inline void sumToMonoSamples(float* left, float* right, int startSample, int numSamples){
+	for (int n = startSample; n < numSamples; n++){
+		left[n] = (left[n] + right[n]) / 2.0f;
+		right[n] = 0.0f;
+	}
+}
+
+/* dest = a + amount * (b - a) for floats [start, numFloats) */
+inline void blendFloats(float* dest, const float* a, const float* b, float amount, int start, int numFloats){
+	for (int n = start; n < numFloats; n++)
+		dest[n] = a[n] - amount * a[n] + amount * b[n];
+}
+
+/* for split bins [startBin, numBins): the magnitude blended linearly, and the phase along the shorter arc between those of a and b,
+ * as the direction of the blend of the unit vectors of a and b. A bin where the two are opposite passes through 0 halfway */
+inline void blendPolarSplitBins(float* dest, const float* a, const float* b, float amount, int imagOffset, int startBin, int numBins){
+	for (int bin = startBin; bin < numBins; bin++){
+		float aRe = a[bin], aIm = a[bin + imagOffset];
+		float bRe = b[bin], bIm = b[bin + imagOffset];
+		float aMagnitude = std::sqrt(aRe * aRe + aIm * aIm);
+		float bMagnitude = std::sqrt(bRe * bRe + bIm * bIm);
+		float aWeight = aMagnitude == 0.0f ? 0.0f : (1.0f - amount) / aMagnitude;
+		float bWeight = bMagnitude == 0.0f ? 0.0f : amount / bMagnitude;
+
+		float re = aRe * aWeight + bRe * bWeight;
+		float im = aIm * aWeight + bIm * bWeight;
+		float directionMagnitude = std::sqrt(re * re + im * im);
+		float scale = directionMagnitude == 0.0f ? 0.0f : (aMagnitude - amount * aMagnitude + amount * bMagnitude) / directionMagnitude;
+
+		dest[bin] = re * scale;
+		dest[bin + imagOffset] = im * scale;
+	}
+}
+
+
+/* an exponent of shapeSplit(), limited to [0, maxShapeExponent], as a whole power and 8 bits of fraction:
+ * x^exponent is x^wholePower times x^(1/2) if bit 7 is set, times x^(1/4) if bit 6 is set, etc. So it takes only products and square roots */
+inline void splitShapeExponent(float exponent, int& wholePower, int& fractionBits){
+	int steps = (int) std::lround(jlimit(0.0f, maxShapeExponent, exponent) * 256.0f);
+	wholePower = steps >> 8;
+	fractionBits = steps & 255;
+}
+
+/* the unit phasors of a delay of a quarter of the FFT size, e^(-j pi bin / 2), for every bin of the widest vector */
+const float quarterDelayRe[16] = { 1.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, -1.0f, 0.0f };
+const float quarterDelayIm[16] = { 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, -1.0f, 0.0f, 1.0f };
+
+/* see shapeSplit(), for split bins [startBin, numBins) */
+inline void shapeSplitBins(float* dest, const float* source, const float* binGains, float reference, float exponent, float flattening,
+						   int imagOffset, int startBin, int numBins){
+	int wholePower, fractionBits;
+	splitShapeExponent(exponent, wholePower, fractionBits);
+	float inverseReference = 1.0f / reference;
+
+	for (int bin = startBin; bin < numBins; bin++){
+		float re = source[bin], im = source[bin + imagOffset];
+		float magnitude = std::sqrt(re * re + im * im);
+		float relativeMagnitude = magnitude * inverseReference;
+
+		float power = 1.0f, root = relativeMagnitude;
+		for (int i = 0; i < wholePower; i++)
+			power *= relativeMagnitude;
+		for (int bit = 7; bit >= 0 && (fractionBits & ((2 << bit) - 1)) != 0; bit--){
+			root = std::sqrt(root);
+			if ((fractionBits >> bit) & 1)
+				power *= root;
+		}
+
+		float weight = magnitude == 0.0f ? 0.0f : (1.0f - flattening) / magnitude;
+		float directionRe = re * weight + flattening * quarterDelayRe[bin & 3];
+		float directionIm = im * weight + flattening * quarterDelayIm[bin & 3];
+		float directionMagnitude = std::sqrt(directionRe * directionRe + directionIm * directionIm);
+		float scale = directionMagnitude == 0.0f ? 0.0f : binGains[bin] * reference * power / directionMagnitude;
+
+		dest[bin] = directionRe * scale;
+		dest[bin + imagOffset] = directionIm * scale;
+	}
+}
+
+
+/* the imagOffset of split spectra of numBins bins, see SpectralRing */
+constexpr int splitImagOffset(int numBins){
+	return (numBins + 15) / 16 * 16;
+}
+
+/* the sizes there are fixed split kernels for: partition sizes 64 to 1024 */
+const int numFixedSplitSizes = 5;
+
+/* the index of every element of the widest vector, for applyGainRamp() */
+const float sampleIndices[16] = { 0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f, 8.0f, 9.0f, 10.0f, 11.0f, 12.0f, 13.0f, 14.0f, 15.0f };
+
+
+/* all kernels of one instruction set. The public functions call the ones of the selected instruction set */
+struct KernelTable {
+	InstructionSet instructionSet;
+	void (*complexMulAccumulate)(float* acc, const float* const* a, const float* const* b, int numPartitions, int numBins);
+	void (*complexMulAccumulateStereo)(float* acc0, float* acc1,
+									   const float* const* a0, const float* const* a1,
+									   const float* const* b0, const float* const* b1,
+									   int numPartitions, int numBins);
+	SplitKernels split;
+	SplitKernels fixedSplit[numFixedSplitSizes];
+	void (*fir)(float* output, const float* history, const float* reversedTaps, int numTaps, int numSamples);
+	void (*complexMultiply)(float* a, const float* b, int numBins);
+	void (*complexDivide)(float* a, const float* b, int numBins);
+	void (*binAmplitudes)(float* amplitudes, const float* bins, int numBins);
+	void (*applyGainRamp)(float* samples, int numSamples, float startGain, float gainPerSample);
+	void (*sumToMono)(float* left, float* right, int numSamples);
+	void (*blend)(float* dest, const float* a, const float* b, float amount, int numFloats);
+	void (*blendPolarSplit)(float* dest, const float* a, const float* b, float amount, int imagOffset, int numBins);
+	void (*shapeSplit)(float* dest, const float* source, const float* binGains, float reference, float exponent, float flattening, int imagOffset, int numBins);
+};
+
+
+/* The scalar instruction set: the references themselves */
+namespace scalarKernels {
+
+	void complexMulAccumulate(float* acc, const float* const* a, const float* const* b, int numPartitions, int numBins){
+		complexMulAccumulateBins(acc, a, b, numPartitions, 0, numBins);
+	}
+
+	void complexMulAccumulateStereo(float* acc0, float* acc1,
+									const float* const* a0, const float* const* a1,
+									const float* const* b0, const float* const* b1,
+									int numPartitions, int numBins){
+		complexMulAccumulateBins(acc0, a0, b0, numPartitions, 0, numBins);
+		complexMulAccumulateBins(acc1, a1, b1, numPartitions, 0, numBins);
+	}
+
+	void complexMulAccumulateSplit(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int numBins){
+		complexMulAccumulateSplitBins(accRe, accIm, a, b, imagOffset, numPartitions, 0, numBins);
+	}
+
+	void complexMulAccumulateSplitStereo(float* accRe0, float* accIm0, float* accRe1, float* accIm1,
+										 const float* const* a0, const float* const* a1,
+										 const float* const* b0, const float* const* b1,
+										 int imagOffset, int numPartitions, int numBins){
+		complexMulAccumulateSplitBins(accRe0, accIm0, a0, b0, imagOffset, numPartitions, 0, numBins);
+		complexMulAccumulateSplitBins(accRe1, accIm1, a1, b1, imagOffset, numPartitions, 0, numBins);
+	}
+
+	void complexMulAccumulateSplitWide(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int numBins){
+		complexMulAccumulateSplitWideBins(accRe, accIm, a, b, imagOffset, numPartitions, 0, numBins);
+	}
+
+	void fir(float* output, const float* history, const float* reversedTaps, int numTaps, int numSamples){
+		firSamples(output, history, reversedTaps, numTaps, 0, numSamples);
+	}
+
+	void complexMultiply(float* a, const float* b, int numBins){
+		complexMultiplyBins(a, b, 0, numBins);
+	}
+
+	void complexDivide(float* a, const float* b, int numBins){
+		complexDivideBins(a, b, 0, numBins);
+	}
+
+	void binAmplitudes(float* amplitudes, const float* bins, int numBins){
+		binAmplitudesBins(amplitudes, bins, 0, numBins);
+	}
+
+	void applyGainRamp(float* samples, int numSamples, float startGain, float gainPerSample){
+		gainRampSamples(samples, startGain, gainPerSample, 0, numSamples);
+	}
+
+	void sumToMono(float* left, float* right, int numSamples){
+		sumToMonoSamples(left, right, 0, numSamples);
+	}
+
+	void blend(float* dest, const float* a, const float* b, float amount, int numFloats){
+		blendFloats(dest, a, b, amount, 0, numFloats);
+	}
+
+	void blendPolarSplit(float* dest, const float* a, const float* b, float amount, int imagOffset, int numBins){
+		blendPolarSplitBins(dest, a, b, amount, imagOffset, 0, numBins);
+	}
+
+	void shapeSplit(float* dest, const float* source, const float* binGains, float reference, float exponent, float flattening, int imagOffset, int numBins){
+		shapeSplitBins(dest, source, binGains, reference, exponent, flattening, imagOffset, 0, numBins);
+	}
+
+	const KernelTable& getKernelTable(){
+		static const SplitKernels split = { complexMulAccumulateSplit, complexMulAccumulateSplitStereo, complexMulAccumulateSplitWide, 0 };
+		static const KernelTable table = {
+			scalar,
+			complexMulAccumulate,
+			complexMulAccumulateStereo,
+			split,
+			{ split, split, split, split, split },
+			fir,
+			complexMultiply,
+			complexDivide,
+			binAmplitudes,
+			applyGainRamp,
+			sumToMono,
+			blend,
+			blendPolarSplit,
+			shapeSplit
+		};
+		return table;
+	}
+
+} // scalarKernels
+
+
+/* Per instruction set: a vector Simd::V of numFloats floats, holding numFloats / 2 interleaved complex bins,
+ * and a vector SimdWide::W of numDoubles doubles, loaded from and stored to as many floats,
+ * for the kernels that accumulate in double.
+ * A complex product a * b is computed as  re(b) * a  +  {-im(b), im(b)} * swapPairs(a),
+ * so the two shuffles of b can be shared between channels that use the same IR.
+ * Split spectra need no shuffles at all: a vector holds numFloats re or numFloats im parts. */
+
+#if FP_KERNELS_X86
+
+FP_KERNELS_TARGET_BEGIN("sse2")
+
+namespace x86Sse2 {
+
+	struct Simd {
+		typedef __m128 V;
+		static const int numFloats = 4;
+		static const InstructionSet instructionSet = sse2;
+
+		static inline V load(const float* p) 				{ return _mm_loadu_ps(p); }
+		static inline V broadcast(float x) 					{ return _mm_set1_ps(x); }
+		static inline void store(float* p, V v) 			{ _mm_storeu_ps(p, v); }
+		static inline V add(V a, V b) 						{ return _mm_add_ps(a, b); }
+		static inline V mul(V a, V b) 						{ return _mm_mul_ps(a, b); }
+		static inline V div(V a, V b) 						{ return _mm_div_ps(a, b); }
+		static inline V sqrt(V v) 							{ return _mm_sqrt_ps(v); }
+		static inline V mulAdd(V a, V b, V acc) 			{ return _mm_add_ps(acc, _mm_mul_ps(a, b)); }
+		static inline V mulSub(V a, V b, V acc) 			{ return _mm_sub_ps(acc, _mm_mul_ps(a, b)); }
+		static inline V swapPairs(V v) 						{ return _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)); }
+		static inline V dupRe(V v) 							{ return _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 0, 0)); }
+		static inline V dupImSigned(V v) 					{ return _mm_xor_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 1, 1)), _mm_setr_ps(-0.0f, 0.0f, -0.0f, 0.0f)); }
+		static inline V evens(V a, V b) 					{ return _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)); }
+		static inline V odds(V a, V b) 						{ return _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)); }
+		static inline V selectWhereZero(V x, V ifZero, V otherwise) {
+			V zero = _mm_cmpeq_ps(x, _mm_setzero_ps());
+			return _mm_or_ps(_mm_and_ps(zero, ifZero), _mm_andnot_ps(zero, otherwise));
+		}
+	};
+
+	struct SimdWide {
+		typedef __m128d W;
+		static const int numDoubles = 2;
+
+		static inline W load(const float* p) 				{ return _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*> (p)))); }
+		static inline void store(float* p, W w) 			{ _mm_store_sd(reinterpret_cast<double*> (p), _mm_castps_pd(_mm_cvtpd_ps(w))); }
+		static inline W mulAdd(W a, W b, W acc) 			{ return _mm_add_pd(acc, _mm_mul_pd(a, b)); }
+		static inline W mulSub(W a, W b, W acc) 			{ return _mm_sub_pd(acc, _mm_mul_pd(a, b)); }
+	};
+
+	#include "kernelBodies.hpp"
+
+} // x86Sse2
+
+FP_KERNELS_TARGET_END
+
+
+FP_KERNELS_TARGET_BEGIN("avx2,fma")
+
+namespace x86Avx2 {
+
+	struct Simd {
+		typedef __m256 V;
+		static const int numFloats = 8;
+		static const InstructionSet instructionSet = avx2;
+
+		static inline V load(const float* p) 				{ return _mm256_loadu_ps(p); }
+		static inline V broadcast(float x) 					{ return _mm256_set1_ps(x); }
+		static inline void store(float* p, V v) 			{ _mm256_storeu_ps(p, v); }
+		static inline V add(V a, V b) 						{ return _mm256_add_ps(a, b); }
+		static inline V mul(V a, V b) 						{ return _mm256_mul_ps(a, b); }
+		static inline V div(V a, V b) 						{ return _mm256_div_ps(a, b); }
+		static inline V sqrt(V v) 							{ return _mm256_sqrt_ps(v); }
+		static inline V mulAdd(V a, V b, V acc) 			{ return _mm256_fmadd_ps(a, b, acc); }
+		static inline V mulSub(V a, V b, V acc) 			{ return _mm256_fnmadd_ps(a, b, acc); }
+		static inline V swapPairs(V v) 						{ return _mm256_permute_ps(v, 0xB1); }
+		static inline V dupRe(V v) 							{ return _mm256_moveldup_ps(v); }
+		static inline V dupImSigned(V v) 					{ return _mm256_xor_ps(_mm256_movehdup_ps(v), _mm256_setr_ps(-0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f)); }
+		/* the shuffle works per 128 bit lane, the permute puts the lanes' halves in order */
+		static inline V evens(V a, V b) 					{ return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b, 0x88)), 0xD8)); }
+		static inline V odds(V a, V b) 						{ return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b, 0xDD)), 0xD8)); }
+		static inline V selectWhereZero(V x, V ifZero, V otherwise) {
+			return _mm256_blendv_ps(otherwise, ifZero, _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_EQ_OQ));
+		}
+	};
+
+	struct SimdWide {
+		typedef __m256d W;
+		static const int numDoubles = 4;
+
+		static inline W load(const float* p) 				{ return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+		static inline void store(float* p, W w) 			{ _mm_storeu_ps(p, _mm256_cvtpd_ps(w)); }
+		static inline W mulAdd(W a, W b, W acc) 			{ return _mm256_fmadd_pd(a, b, acc); }
+		static inline W mulSub(W a, W b, W acc) 			{ return _mm256_fnmadd_pd(a, b, acc); }
+	};
+
+	#include "kernelBodies.hpp"
+
+} // x86Avx2
+
+FP_KERNELS_TARGET_END
+
+
+FP_KERNELS_TARGET_BEGIN("avx512f,avx2,fma")
+
+namespace x86Avx512 {
+
+	struct Simd {
+		typedef __m512 V;
+		static const int numFloats = 16;
+		static const InstructionSet instructionSet = avx512;
+
+		static inline V load(const float* p) 				{ return _mm512_loadu_ps(p); }
+		static inline V broadcast(float x) 					{ return _mm512_set1_ps(x); }
+		static inline void store(float* p, V v) 			{ _mm512_storeu_ps(p, v); }
+		static inline V add(V a, V b) 						{ return _mm512_add_ps(a, b); }
+		static inline V mul(V a, V b) 						{ return _mm512_mul_ps(a, b); }
+		static inline V div(V a, V b) 						{ return _mm512_div_ps(a, b); }
+		static inline V sqrt(V v) 							{ return _mm512_sqrt_ps(v); }
+		static inline V mulAdd(V a, V b, V acc) 			{ return _mm512_fmadd_ps(a, b, acc); }
+		static inline V mulSub(V a, V b, V acc) 			{ return _mm512_fnmadd_ps(a, b, acc); }
+		static inline V swapPairs(V v) 						{ return _mm512_permute_ps(v, 0xB1); }
+		static inline V dupRe(V v) 							{ return _mm512_moveldup_ps(v); }
+		/* AVX-512F has no float xor, so the sign of the re elements is flipped as integers */
+		static inline V dupImSigned(V v) 					{ return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(_mm512_movehdup_ps(v)), _mm512_set1_epi64(0x80000000LL))); }
+		static inline V evens(V a, V b) 					{ return _mm512_permutex2var_ps(a, _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30), b); }
+		static inline V odds(V a, V b) 						{ return _mm512_permutex2var_ps(a, _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31), b); }
+		static inline V selectWhereZero(V x, V ifZero, V otherwise) {
+			return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_EQ_OQ), otherwise, ifZero);
+		}
+	};
+
+	struct SimdWide {
+		typedef __m512d W;
+		static const int numDoubles = 8;
+
+		static inline W load(const float* p) 				{ return _mm512_cvtps_pd(_mm256_loadu_ps(p)); }
+		static inline void store(float* p, W w) 			{ _mm256_storeu_ps(p, _mm512_cvtpd_ps(w)); }
+		static inline W mulAdd(W a, W b, W acc) 			{ return _mm512_fmadd_pd(a, b, acc); }
+		static inline W mulSub(W a, W b, W acc) 			{ return _mm512_fnmadd_pd(a, b, acc); }
+	};
+
+	#include "kernelBodies.hpp"
+
+} // x86Avx512
+
+FP_KERNELS_TARGET_END
+
+#elif FP_KERNELS_NEON
+
+/* NEON is part of every 64-bit ARM CPU, so it needs no target and no runtime check */
+namespace armNeon {
+
+	struct Simd {
+		typedef float32x4_t V;
+		static const int numFloats = 4;
+		static const InstructionSet instructionSet = neon;
+
+		static inline V load(const float* p) 				{ return vld1q_f32(p); }
+		static inline V broadcast(float x) 					{ return vdupq_n_f32(x); }
+		static inline void store(float* p, V v) 			{ vst1q_f32(p, v); }
+		static inline V add(V a, V b) 						{ return vaddq_f32(a, b); }
+		static inline V mul(V a, V b) 						{ return vmulq_f32(a, b); }
+		static inline V div(V a, V b) 						{ return vdivq_f32(a, b); }
+		static inline V sqrt(V v) 							{ return vsqrtq_f32(v); }
+		static inline V mulAdd(V a, V b, V acc) 			{ return vmlaq_f32(acc, a, b); }
+		static inline V mulSub(V a, V b, V acc) 			{ return vmlsq_f32(acc, a, b); }
+		static inline V swapPairs(V v) 						{ return vrev64q_f32(v); }
+		static inline V dupRe(V v) 							{ return vtrn1q_f32(v, v); }
+		static inline V dupImSigned(V v) 					{ const float sign[4] = {-1.0f, 1.0f, -1.0f, 1.0f}; return vmulq_f32(vtrn2q_f32(v, v), vld1q_f32(sign)); }
+		static inline V evens(V a, V b) 					{ return vuzp1q_f32(a, b); }
+		static inline V odds(V a, V b) 						{ return vuzp2q_f32(a, b); }
+		static inline V selectWhereZero(V x, V ifZero, V otherwise) {
+			return vbslq_f32(vceqzq_f32(x), ifZero, otherwise);
+		}
+	};
+
+	struct SimdWide {
+		typedef float64x2_t W;
+		static const int numDoubles = 2;
+
+		static inline W load(const float* p) 				{ return vcvt_f64_f32(vld1_f32(p)); }
+		static inline void store(float* p, W w) 			{ vst1_f32(p, vcvt_f32_f64(w)); }
+		static inline W mulAdd(W a, W b, W acc) 			{ return vfmaq_f64(acc, a, b); }
+		static inline W mulSub(W a, W b, W acc) 			{ return vfmsq_f64(acc, a, b); }
+	};
+
+	#include "kernelBodies.hpp"
+
+} // armNeon
+
+#endif
+
+
+/* the kernels of an instruction set, or nullptr if they are not compiled in */
+const KernelTable* getKernelTableFor(InstructionSet instructionSet){
+	switch (instructionSet){
+		case scalar:	return &scalarKernels::getKernelTable();
+#if FP_KERNELS_X86
+		case sse2:		return &x86Sse2::getKernelTable();
+		case avx2:		return &x86Avx2::getKernelTable();
+		case avx512:	return &x86Avx512::getKernelTable();
+#elif FP_KERNELS_NEON
+		case neon:		return &armNeon::getKernelTable();
+#endif
+		default:		return nullptr;
+	}
+}
+
+/* Picked once, the first time a kernel is used. forceInstructionSet() replaces it */
+std::atomic<const KernelTable*>& getSelectedTable(){
+	static std::atomic<const KernelTable*> selected (getKernelTableFor(getBestInstructionSet()));
+	return selected;
+}
+
+inline const KernelTable& selected(){
+	return *getSelectedTable().load(std::memory_order_relaxed);
+}
+
+const SplitKernels& findSplitKernels(const KernelTable& table, int numBins, int imagOffset){
+	if (imagOffset != splitImagOffset(numBins))
+		return table.split;
+
+	for (const SplitKernels& kernels : table.fixedSplit){
+		if (kernels.numBins == numBins)
+			return kernels;
+	}
+	return table.split;
+}
+
+
+/* ==== Self-check, see checkInstructionSet() ==== */
+
+std::vector<float> noise(Random& random, int numFloats){
+	std::vector<float> floats (numFloats);
+	for (float& x : floats)
+		x = 2.0f * random.nextFloat() - 1.0f;
+	return floats;
+}
+
+bool matches(const char* kernelName, InstructionSet instructionSet, const std::vector<float>& result, const std::vector<float>& expected){
+	const float tolerance = 1.0e-5f;
+
+	for (size_t i = 0; i < result.size(); i++){
+		if (NOT (std::abs(result[i] - expected[i]) <= tolerance * (1.0f + std::abs(expected[i])))){
+			DBG("kernels::checkInstructionSet(): " + String(kernelName) + " of " + String(getInstructionSetName(instructionSet))
+				+ " differs from the scalar reference at " + String((int) i) + "\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+/* the spectral kernels on numPartitions random partitions of numBins bins, 2 sets per channel pair */
+bool checkSpectralKernels(const KernelTable& kernels, Random& random, int numBins){
+	const KernelTable& reference = scalarKernels::getKernelTable();
+	const InstructionSet instructionSet = kernels.instructionSet;
+	const int numPartitions = 3;
+	const int imagOffset = splitImagOffset(numBins);
+	const int spectrumSize = 2 * imagOffset;
+
+	std::vector<float> spectra = noise(random, 4 * numPartitions * spectrumSize);
+	std::vector<const float*> a0, a1, b0, b1;
+	for (int partition = 0; partition < numPartitions; partition++){
+		a0.push_back(&spectra[partition * spectrumSize]);
+		a1.push_back(&spectra[(numPartitions + partition) * spectrumSize]);
+		b0.push_back(&spectra[(2 * numPartitions + partition) * spectrumSize]);
+		b1.push_back(&spectra[(3 * numPartitions + partition) * spectrumSize]);
+	}
+
+	/* one accumulator per channel */
+	const std::vector<float> accumulators = noise(random, 2 * spectrumSize);
+	std::vector<float> result, expected;
+	bool passed = true;
+
+	result = expected = accumulators;
+	kernels.complexMulAccumulate(result.data(), a0.data(), b0.data(), numPartitions, numBins);
+	reference.complexMulAccumulate(expected.data(), a0.data(), b0.data(), numPartitions, numBins);
+	passed = matches("complexMulAccumulate", instructionSet, result, expected) && passed;
+
+	for (bool sharedIR : { false, true }){
+		const float* const* irRight = sharedIR ? b0.data() : b1.data();
+
+		result = expected = accumulators;
+		kernels.complexMulAccumulateStereo(result.data(), result.data() + spectrumSize, a0.data(), a1.data(), b0.data(), irRight, numPartitions, numBins);
+		reference.complexMulAccumulateStereo(expected.data(), expected.data() + spectrumSize, a0.data(), a1.data(), b0.data(), irRight, numPartitions, numBins);
+		passed = matches("complexMulAccumulateStereo", instructionSet, result, expected) && passed;
+	}
+
+	const SplitKernels& split = findSplitKernels(kernels, numBins, imagOffset);
+
+	result = expected = accumulators;
+	split.mulAccumulate(result.data(), result.data() + imagOffset, a0.data(), b0.data(), imagOffset, numPartitions, numBins);
+	reference.split.mulAccumulate(expected.data(), expected.data() + imagOffset, a0.data(), b0.data(), imagOffset, numPartitions, numBins);
+	passed = matches("complexMulAccumulateSplit", instructionSet, result, expected) && passed;
+
+	result = expected = accumulators;
+	split.mulAccumulateWide(result.data(), result.data() + imagOffset, a0.data(), b0.data(), imagOffset, numPartitions, numBins);
+	reference.split.mulAccumulateWide(expected.data(), expected.data() + imagOffset, a0.data(), b0.data(), imagOffset, numPartitions, numBins);
+	passed = matches("complexMulAccumulateSplitWide", instructionSet, result, expected) && passed;
+
+	/* the blends of the first partitions, with a bin of a at 0 */
+	std::vector<float> from (a0[0], a0[0] + spectrumSize);
+	from[1] = from[1 + imagOffset] = 0.0f;
+
+	result = expected = accumulators;
+	kernels.blendPolarSplit(result.data(), from.data(), b0[0], 0.3f, imagOffset, numBins);
+	reference.blendPolarSplit(expected.data(), from.data(), b0[0], 0.3f, imagOffset, numBins);
+	passed = matches("blendPolarSplit", instructionSet, result, expected) && passed;
+
+	result = expected = accumulators;
+	kernels.blend(result.data(), from.data(), b0[0], 0.3f, spectrumSize);
+	reference.blend(expected.data(), from.data(), b0[0], 0.3f, spectrumSize);
+	passed = matches("blend", instructionSet, result, expected) && passed;
+
+	/* gains from the first partition of a1, and exponents with and without a fraction */
+	std::vector<float> binGains (a1[0], a1[0] + numBins);
+	for (float exponent : { 1.0f, 0.0f, 1.6f }){
+		result = expected = accumulators;
+		kernels.shapeSplit(result.data(), from.data(), binGains.data(), 0.7f, exponent, 0.4f, imagOffset, numBins);
+		reference.shapeSplit(expected.data(), from.data(), binGains.data(), 0.7f, exponent, 0.4f, imagOffset, numBins);
+		passed = matches("shapeSplit", instructionSet, result, expected) && passed;
+	}
+
+	for (bool sharedIR : { false, true }){
+		for (bool sharedAudio : { false, true }){
+			const float* const* irRight = sharedIR ? b0.data() : b1.data();
+			const float* const* audioRight = sharedAudio ? a0.data() : a1.data();
+
+			result = expected = accumulators;
+			split.mulAccumulateStereo(result.data(), result.data() + imagOffset, result.data() + spectrumSize, result.data() + spectrumSize + imagOffset,
+									  a0.data(), audioRight, b0.data(), irRight, imagOffset, numPartitions, numBins);
+			reference.split.mulAccumulateStereo(expected.data(), expected.data() + imagOffset, expected.data() + spectrumSize, expected.data() + spectrumSize + imagOffset,
+												a0.data(), audioRight, b0.data(), irRight, imagOffset, numPartitions, numBins);
+			passed = matches("complexMulAccumulateSplitStereo", instructionSet, result, expected) && passed;
+		}
+	}
+
+	/* the element-wise kernels on the first partitions as interleaved bins, with one divisor of 0 */
+	const std::vector<float> bins (a0[0], a0[0] + 2 * numBins);
+	std::vector<float> divisors (b0[0], b0[0] + 2 * numBins);
+	divisors[2] = divisors[3] = 0.0f;
+
+	result = expected = bins;
+	kernels.complexMultiply(result.data(), b0[0], numBins);
+	reference.complexMultiply(expected.data(), b0[0], numBins);
+	passed = matches("complexMultiply", instructionSet, result, expected) && passed;
+
+	result = expected = bins;
+	kernels.complexDivide(result.data(), divisors.data(), numBins);
+	reference.complexDivide(expected.data(), divisors.data(), numBins);
+	passed = matches("complexDivide", instructionSet, result, expected) && passed;
+
+	result.assign(numBins, 0.0f);
+	expected.assign(numBins, 0.0f);
+	kernels.binAmplitudes(result.data(), bins.data(), numBins);
+	reference.binAmplitudes(expected.data(), bins.data(), numBins);
+	passed = matches("binAmplitudes", instructionSet, result, expected) && passed;
+
+	return passed;
+}
+
+/* the sample kernels on numSamples random samples */
+bool checkSampleKernels(const KernelTable& kernels, Random& random, int numSamples){
+	const KernelTable& reference = scalarKernels::getKernelTable();
+	const InstructionSet instructionSet = kernels.instructionSet;
+	const int numTaps = 29;
+	std::vector<float> result, expected;
+	bool passed = true;
+
+	const std::vector<float> history = noise(random, numTaps - 1 + numSamples);
+	const std::vector<float> taps = noise(random, numTaps);
+	result.assign(numSamples, 0.0f);
+	expected.assign(numSamples, 0.0f);
+	kernels.fir(result.data(), history.data(), taps.data(), numTaps, numSamples);
+	reference.fir(expected.data(), history.data(), taps.data(), numTaps, numSamples);
+	passed = matches("fir", instructionSet, result, expected) && passed;
+
+	const std::vector<float> samples = noise(random, 2 * numSamples);
+
+	result = expected = samples;
+	kernels.applyGainRamp(result.data(), numSamples, 1.0f, -1.0f / numSamples);
+	reference.applyGainRamp(expected.data(), numSamples, 1.0f, -1.0f / numSamples);
+	passed = matches("applyGainRamp", instructionSet, result, expected) && passed;
+
+	result = expected = samples;
+	kernels.sumToMono(result.data(), result.data() + numSamples, numSamples);
+	reference.sumToMono(expected.data(), expected.data() + numSamples, numSamples);
+	passed = matches("sumToMono", instructionSet, result, expected) && passed;
+
+	return passed;
+}
+
+} // namespace
+
+
+void complexMulAccumulate(float* acc, const float* const* a, const float* const* b, int numPartitions, int numBins){
+	selected().complexMulAccumulate(acc, a, b, numPartitions, numBins);
+}
+
+
+void complexMulAccumulateStereo(float* acc0, float* acc1,
+								const float* const* a0, const float* const* a1,
+								const float* const* b0, const float* const* b1,
+								int numPartitions, int numBins){
+	selected().complexMulAccumulateStereo(acc0, acc1, a0, a1, b0, b1, numPartitions, numBins);
+}
+
+
+void complexMulAccumulateSplit(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int numBins){
+	selected().split.mulAccumulate(accRe, accIm, a, b, imagOffset, numPartitions, numBins);
+}
+
+
+void complexMulAccumulateSplitStereo(float* accRe0, float* accIm0, float* accRe1, float* accIm1,
+									 const float* const* a0, const float* const* a1,
+									 const float* const* b0, const float* const* b1,
+									 int imagOffset, int numPartitions, int numBins){
+	selected().split.mulAccumulateStereo(accRe0, accIm0, accRe1, accIm1, a0, a1, b0, b1, imagOffset, numPartitions, numBins);
+}
+
+
+void complexMulAccumulateSplitWide(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int numBins){
+	selected().split.mulAccumulateWide(accRe, accIm, a, b, imagOffset, numPartitions, numBins);
+}
+
+
+const SplitKernels& getSplitKernels(int numBins, int imagOffset){
+	return findSplitKernels(selected(), numBins, imagOffset);
+}
+
+
+void fir(float* output, const float* history, const float* reversedTaps, int numTaps, int numSamples){
+	selected().fir(output, history, reversedTaps, numTaps, numSamples);
+}
+
+
+void complexMultiply(float* a, const float* b, int numBins){
+	selected().complexMultiply(a, b, numBins);
+}
+
+
+void complexDivide(float* a, const float* b, int numBins){
+	selected().complexDivide(a, b, numBins);
+}
+
+
+void binAmplitudes(float* amplitudes, const float* bins, int numBins){
+	selected().binAmplitudes(amplitudes, bins, numBins);
+}
+
+
+void applyGainRamp(float* samples, int numSamples, float startGain, float gainPerSample){
+	selected().applyGainRamp(samples, numSamples, startGain, gainPerSample);
+}
+
+
+void sumToMono(float* left, float* right, int numSamples){
+	selected().sumToMono(left, right, numSamples);
+}
+
+
+void blend(float* dest, const float* a, const float* b, float amount, int numFloats){
+	selected().blend(dest, a, b, amount, numFloats);
+}
+
+
+void blendPolarSplit(float* dest, const float* a, const float* b, float amount, int imagOffset, int numBins){
+	selected().blendPolarSplit(dest, a, b, amount, imagOffset, numBins);
+}
+
+
+void shapeSplit(float* dest, const float* source, const float* binGains, float reference, float exponent, float flattening, int imagOffset, int numBins){
+	selected().shapeSplit(dest, source, binGains, reference, exponent, flattening, imagOffset, numBins);
+}
+
+
+void firScalar(float* output, const float* history, const float* reversedTaps, int numTaps, int numSamples){
+	firSamples(output, history, reversedTaps, numTaps, 0, numSamples);
+}
+
+
+void complexMulAccumulateScalar(float* acc, const float* const* a, const float* const* b, int numPartitions, int numBins){
+	complexMulAccumulateBins(acc, a, b, numPartitions, 0, numBins);
+}
+
+
+void complexMulAccumulateSplitScalar(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int numBins){
+	complexMulAccumulateSplitBins(accRe, accIm, a, b, imagOffset, numPartitions, 0, numBins);
+}
+
+
+void complexMulAccumulateSplitWideScalar(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int numBins){
+	complexMulAccumulateSplitWideBins(accRe, accIm, a, b, imagOffset, numPartitions, 0, numBins);
+}
+
+
+bool isInstructionSetSupported(InstructionSet instructionSet){
+	switch (instructionSet){
+		case scalar:	return true;
+#if FP_KERNELS_X86
+		case sse2:		return SystemStats::hasSSE2();
+		case avx2:		return SystemStats::hasAVX2() && SystemStats::hasFMA3();
+		case avx512:	return SystemStats::hasAVX512F() && SystemStats::hasAVX2() && SystemStats::hasFMA3();
+#elif FP_KERNELS_NEON
+		case neon:		return true;
+#endif
+		default:		return false;
+	}
+}
+
+
+InstructionSet getBestInstructionSet(){
+	static const InstructionSet best = [] {
+		for (InstructionSet instructionSet : { avx512, avx2, sse2, neon }){
+			if (isInstructionSetSupported(instructionSet))
+				return instructionSet;
+		}
+		return scalar;
+	}();
+	return best;
+}
+
+
+InstructionSet getInstructionSet(){
+	return selected().instructionSet;
+}
+
+
+bool forceInstructionSet(InstructionSet instructionSet){
+	if (NOT isInstructionSetSupported(instructionSet)){
+		DBG("kernels::forceInstructionSet(): " + String(getInstructionSetName(instructionSet)) + " is not supported by this CPU or build\n");
+		return false;
+	}
+
+	getSelectedTable().store(getKernelTableFor(instructionSet));
+	return true;
+}
+
+
+bool checkInstructionSet(InstructionSet instructionSet){
+	if (NOT isInstructionSetSupported(instructionSet))
+		return false;
+
+	const KernelTable& kernels = *getKernelTableFor(instructionSet);
+	Random random (2021);
+	bool passed = true;
+
+	/* a size without fixed split kernels, the smallest and largest with, and sizes that leave a scalar tail */
+	for (int numBins : { 37, 65, 257, 1025 })
+		passed = checkSpectralKernels(kernels, random, numBins) && passed;
+	for (int numSamples : { 13, 100, 1024 })
+		passed = checkSampleKernels(kernels, random, numSamples) && passed;
+
+	return passed;
+}
+
+
+const char* getInstructionSetName(InstructionSet instructionSet){
+	switch (instructionSet){
+		case scalar:	return "scalar";
+		case sse2:		return "SSE2";
+		case avx2:		return "AVX2";
+		case avx512:	return "AVX-512";
+		case neon:		return "NEON";
+		default:		return "unknown";
+	}
+}
+
+
+const char* getInstructionSetName(){
+	return getInstructionSetName(getInstructionSet());
+}
+
+} // kernels
+} // fp
@@ -0,0 +1,135 @@
+/*
+ *  Copyright © 2021 Felix Postma. 
+ */
+
+#pragma once
+
+#include <fp_include_all.hpp>
+#include <JuceHeader.h>
+
+
+namespace fp {
+
+
+/* The kernels namespace contains the vectorised inner loops of the convolution.
+ * Spectra are in the JUCE performRealOnlyForwardTransform layout: interleaved {re, im} bins,
+ * or split into re and im parts, see SpectralRing.
+ * Every kernel has a scalar reference that gives the same result up to float rounding.
+ * All instruction sets the CPU architecture has are compiled in (see kernelBodies.hpp). The best one the CPU supports
+ * is picked the first time a kernel is called, and can be replaced with forceInstructionSet() for testing.
+ */
+
+namespace kernels {
+
+	/* instruction sets there can be kernels for, from scalar references to the widest vectors */
+	enum InstructionSet {
+		scalar,
+		sse2,
+		avx2,			// with FMA
+		avx512,			// AVX-512F, with AVX2 and FMA
+		neon			// 64-bit ARM
+	};
+
+	/* fused complex multiply-accumulate over all partitions of an FDL:
+	 * acc += a[p] * b[p] for p < numPartitions, for the first numBins bins.
+	 * acc is only loaded and stored once per chunk of bins, not once per partition */
+	void complexMulAccumulate(float* acc, const float* const* a, const float* const* b, int numPartitions, int numBins);
+
+	/* the same for 2 channels in one pass.
+	 * If b1 == b0 (a mono IR for stereo audio), the IR is only loaded and shuffled once for both channels.
+	 * The split version also loads the audio once if a1 == a0 (one input feeding two outputs) */
+	void complexMulAccumulateStereo(float* acc0, float* acc1,
+									const float* const* a0, const float* const* a1,
+									const float* const* b0, const float* const* b1,
+									int numPartitions, int numBins);
+
+	/* the same for split spectra (see SpectralRing): re parts at a[p], im parts at a[p] + imagOffset,
+	 * and the accumulator in separate re and im arrays */
+	void complexMulAccumulateSplit(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int numBins);
+	void complexMulAccumulateSplitStereo(float* accRe0, float* accIm0, float* accRe1, float* accIm1,
+										 const float* const* a0, const float* const* a1,
+										 const float* const* b0, const float* const* b1,
+										 int imagOffset, int numPartitions, int numBins);
+
+	/* complexMulAccumulateSplit() with the products summed in double, and rounded to float once per call,
+	 * for IRs whose partitions cancel each other out, like deep inverse filters. The spectra stay float */
+	void complexMulAccumulateSplitWide(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int numBins);
+
+	/* The split kernels for spectra of one size, for a caller to pick once (see getSplitKernels()) and call many times */
+	struct SplitKernels {
+		void (*mulAccumulate)(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int numBins);
+		void (*mulAccumulateStereo)(float* accRe0, float* accIm0, float* accRe1, float* accIm1,
+									const float* const* a0, const float* const* a1,
+									const float* const* b0, const float* const* b1,
+									int imagOffset, int numPartitions, int numBins);
+		void (*mulAccumulateWide)(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int numBins);
+		int numBins;			// 0 for the generic kernels
+	};
+
+	/* the split kernels for spectra of numBins bins at imagOffset. For the FFT sizes of partition sizes 64 to 1024
+	 * with the imagOffset of a SpectralRing, they are compiled for that size: bounds and offsets are constants,
+	 * so the bin loops can be unrolled. For any other size they are complexMulAccumulateSplit() and its siblings */
+	const SplitKernels& getSplitKernels(int numBins, int imagOffset);
+
+	/* direct form FIR: output[n] = sum of reversedTaps[k] * history[n + k] for k < numTaps, for n < numSamples.
+	 * history holds the numTaps - 1 previous input samples, followed by the numSamples new ones */
+	void fir(float* output, const float* history, const float* reversedTaps, int numTaps, int numSamples);
+
+	/* element-wise kernels on numBins interleaved {re, im} bins, the array versions of tools::complexMul(),
+	 * tools::complexDivCartesian() and tools::binAmpl(). complexDivide() leaves the bins of a where |b|^2 is 0 as they are */
+	void complexMultiply(float* a, const float* b, int numBins);
+	void complexDivide(float* a, const float* b, int numBins);
+	void binAmplitudes(float* amplitudes, const float* bins, int numBins);
+
+	/* samples[n] *= startGain + n * gainPerSample, for n < numSamples */
+	void applyGainRamp(float* samples, int numSamples, float startGain, float gainPerSample);
+
+	/* left := (left + right) / 2 and right := 0, like tools::sumToMono() */
+	void sumToMono(float* left, float* right, int numSamples);
+
+	/* dest = a + amount * (b - a), for numFloats floats of samples or spectra in any layout. dest can be a or b */
+	void blend(float* dest, const float* a, const float* b, float amount, int numFloats);
+
+	/* blends numBins split bins (see SpectralRing) of a and b by magnitude and phase: the magnitude linearly, and the phase
+	 * along the shorter arc from that of a to that of b. For IRs whose phase follows from the magnitude, like minimum phase ones,
+	 * where a linear blend of the spectra would notch the bins in which the two differ in phase. dest can be a or b */
+	void blendPolarSplit(float* dest, const float* a, const float* b, float amount, int imagOffset, int numBins);
+
+	/* reshapes numBins split bins of source into dest, per bin: the magnitude to binGains[bin] * reference * (|source| / reference)^exponent,
+	 * and the phase blended by flattening from that of source towards a flat one, the linear phase of a delay of a quarter
+	 * of the FFT size (the middle of an IR that fills half of it), along the shorter arc like blendPolarSplit().
+	 * The exponent is taken in steps of 1/256 up to maxShapeExponent, and reference needs to be > 0. dest can be source */
+	void shapeSplit(float* dest, const float* source, const float* binGains, float reference, float exponent, float flattening, int imagOffset, int numBins);
+	static constexpr float maxShapeExponent = 4.0f;
+
+	/* scalar references of complexMulAccumulate(), complexMulAccumulateSplit(), complexMulAccumulateSplitWide() and fir(), for verification */
+	void firScalar(float* output, const float* history, const float* reversedTaps, int numTaps, int numSamples);
+	void complexMulAccumulateScalar(float* acc, const float* const* a, const float* const* b, int numPartitions, int numBins);
+	void complexMulAccumulateSplitScalar(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int numBins);
+	void complexMulAccumulateSplitWideScalar(float* accRe, float* accIm, const float* const* a, const float* const* b, int imagOffset, int numPartitions, int numBins);
+
+	/* true if the instruction set is compiled in, and the CPU has it (from CPUID, see SystemStats) */
+	bool isInstructionSetSupported(InstructionSet instructionSet);
+
+	/* the widest supported instruction set, which the kernels use unless another one is forced */
+	InstructionSet getBestInstructionSet();
+
+	/* the instruction set the kernels use now */
+	InstructionSet getInstructionSet();
+
+	/* makes the kernels use instructionSet, for testing and comparing them. Returns false if it is not supported.
+	 * Kernels that callers picked before, like the SplitKernels of a prepared PartitionedConvolver, stay the same */
+	bool forceInstructionSet(InstructionSet instructionSet);
+
+	/* runs every kernel of instructionSet and the scalar references on the same random data, at sizes with and without
+	 * scalar tails, and returns true if they all agree up to float rounding. Mismatches are printed with DBG.
+	 * Allocates, so not for the audio thread */
+	bool checkInstructionSet(InstructionSet instructionSet);
+
+	/* name of an instruction set, or of the one the kernels use now */
+	const char* getInstructionSetName(InstructionSet instructionSet);
+	const char* getInstructionSetName();
+
+} // kernels
+
+} // fp
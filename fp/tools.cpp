@@ -11,6 +11,54 @@ namespace fp {
 namespace tools {
 	
 	
+	namespace {
+		
+		template <typename SampleType>
+		void normalizeSamples(AudioBuffer<SampleType>* buffer, float dBGoalLevel, bool printGain){
+			SampleType realGoal = dBToLin((SampleType) dBGoalLevel);
+			SampleType gain = realGoal / buffer->getMagnitude(0, buffer->getNumSamples());
+			buffer->applyGain(gain);
+			
+			if(printGain) printf("normalize gain: %g, dB: %9.6f\n", (double) gain, (double) linTodB(gain));
+		}
+		
+		template <typename SampleType>
+		void linearFadeSamples(AudioBuffer<SampleType>* buffer, bool fadeIn, int startSample, int numSamples){
+			
+			if (startSample + numSamples > buffer->getNumSamples()){
+				DBG("linearFade: startSample + numSamples exceeds buffer size.\n");
+				return;
+			}
+			
+			SampleType fadePerSample = (SampleType) 1.0 / numSamples;
+			SampleType gain;
+			
+			for (int channel = 0; channel < buffer->getNumChannels(); channel++){
+				for (int sample = startSample; sample < startSample + numSamples; sample++){
+					
+					if (fadeIn) gain = (sample - startSample) * fadePerSample;
+					else gain = (SampleType) 1.0 - (sample - startSample) * fadePerSample;
+					
+					buffer->setSample(channel, sample,
+									  buffer->getSample(channel, sample) * gain);
+				}
+			}
+		}
+		
+		template <typename DestType, typename SourceType>
+		void convertSamples(DestType* dest, const SourceType* source, int numSamples){
+			for (int sample = 0; sample < numSamples; sample++)
+				dest[sample] = (DestType) source[sample];
+		}
+		
+		template <typename DestType, typename SourceType>
+		void addConvertedSamples(DestType* dest, const SourceType* source, int numSamples){
+			for (int sample = 0; sample < numSamples; sample++)
+				dest[sample] += (DestType) source[sample];
+		}
+	}
+	
+	
 	void sumToMono(AudioSampleBuffer* buffer){
 		
 		if (buffer->getNumChannels() != 2){
@@ -18,15 +66,8 @@ namespace tools {
 			return;
 		}
 		
-		float* p0 = buffer->getWritePointer(0, 0);
-		float* p1 = buffer->getWritePointer(1, 0);
-		
-		int n = buffer->getNumSamples();
-		for (int i = 0; i < n; i++){
-			p0[i] += p1[i];
-			p0[i] /= 2.0f;		// -6 dB
-			p1[i] = 0.0f;
-		}
+		/* -6 dB */
+		kernels::sumToMono(buffer->getWritePointer(0, 0), buffer->getWritePointer(1, 0), buffer->getNumSamples());
 	}
 	
 	
@@ -109,11 +150,12 @@ namespace tools {
 	
 	
 	void normalize(AudioSampleBuffer* buffer, float dBGoalLevel, bool printGain){
-		float realGoal = dBToLin(dBGoalLevel);
-		float gain = realGoal / buffer->getMagnitude(0, buffer->getNumSamples());
-		buffer->applyGain(gain);
-		
-		if(printGain) printf("normalize gain: %g, dB: %9.6f\n", gain, linTodB(gain));
+		normalizeSamples(buffer, dBGoalLevel, printGain);
+	};
+	
+	
+	void normalize(AudioBuffer<double>* buffer, float dBGoalLevel, bool printGain){
+		normalizeSamples(buffer, dBGoalLevel, printGain);
 	};
 	
 	
@@ -248,19 +290,56 @@ namespace tools {
 			return;
 		}
 		
-		float fadePerSample = 1.0 / numSamples;
-		float gain;
-		
-		for (int channel = 0; channel < buffer->getNumChannels(); channel++){
-			for (int sample = startSample; sample < startSample + numSamples; sample++){
-				
-				if (fadeIn) gain = (sample - startSample) * fadePerSample;
-				else gain = 1.0 - (sample - startSample) * fadePerSample;
-				
-				buffer->setSample(channel, sample,
-								  buffer->getSample(channel, sample) * gain);
-			}
-		}
+		float fadePerSample = 1.0f / numSamples;
+		
+		for (int channel = 0; channel < buffer->getNumChannels(); channel++)
+			kernels::applyGainRamp(buffer->getWritePointer(channel, startSample), numSamples,
+								   fadeIn ? 0.0f : 1.0f, fadeIn ? fadePerSample : -fadePerSample);
+	}
+	
+	
+	void linearFade (AudioBuffer<double>* buffer, bool fadeIn, int startSample, int numSamples){
+		linearFadeSamples(buffer, fadeIn, startSample, numSamples);
+	}
+	
+	
+	void copySamples (float* dest, const float* source, int numSamples){
+		FloatVectorOperations::copy(dest, source, numSamples);
+	}
+	
+	
+	void copySamples (float* dest, const double* source, int numSamples){
+		convertSamples(dest, source, numSamples);
+	}
+	
+	
+	void copySamples (double* dest, const float* source, int numSamples){
+		convertSamples(dest, source, numSamples);
+	}
+	
+	
+	void copySamples (double* dest, const double* source, int numSamples){
+		FloatVectorOperations::copy(dest, source, numSamples);
+	}
+	
+	
+	void addSamples (float* dest, const float* source, int numSamples){
+		FloatVectorOperations::add(dest, source, numSamples);
+	}
+	
+	
+	void addSamples (float* dest, const double* source, int numSamples){
+		addConvertedSamples(dest, source, numSamples);
+	}
+	
+	
+	void addSamples (double* dest, const float* source, int numSamples){
+		addConvertedSamples(dest, source, numSamples);
+	}
+	
+	
+	void addSamples (double* dest, const double* source, int numSamples){
+		FloatVectorOperations::add(dest, source, numSamples);
 	}
 	
 	
@@ -318,54 +397,61 @@ namespace tools {
 	
 
 	
-	AudioBuffer<float> fftTransform(AudioBuffer<float> &buffer, bool formatAmplPhase) {
+	HalfSpectrum fftTransform(AudioBuffer<float> &buffer, bool formatAmplPhase) {
 		
 		int N = tools::nextPowerOfTwo(buffer.getNumSamples());
 		int fftBlockSize = N * 2;
 		
-		AudioSampleBuffer fftBuffer (buffer.getNumChannels(), fftBlockSize);
-		fftBuffer.clear();
-		fftBuffer.copyFrom(0, 0, buffer.getReadPointer(0), buffer.getNumSamples());
+		/* workspace for the JUCE transform, only the first N+2 floats are kept */
+		AudioSampleBuffer fftBuffer (1, fftBlockSize);
+		HalfSpectrum spectrum (buffer.getNumChannels(), N);
 		
 		BigInteger fftBitMask = (BigInteger) N;
 		dsp::FFT::FFT fftForward    (fftBitMask.getHighestBit());
 		
-		for (int channel = 0; channel < fftBuffer.getNumChannels(); channel++){
-			float* fftBufferPtr = fftBuffer.getWritePointer(channel);
+		for (int channel = 0; channel < buffer.getNumChannels(); channel++){
+			fftBuffer.clear();
+			fftBuffer.copyFrom(0, 0, buffer.getReadPointer(channel), buffer.getNumSamples());
+			
+			float* fftBufferPtr = fftBuffer.getWritePointer(0);
 			fftForward.performRealOnlyForwardTransform(fftBufferPtr, true);
+			spectrum.copyFromJuceLayout(channel, fftBufferPtr);
 			
 			if(formatAmplPhase){
+				float* binPtr = spectrum.getWritePointer(channel);
 				for (int bin = 0; bin <= N; bin += 2){
-					*(fftBufferPtr + bin) = tools::binAmpl(fftBufferPtr + bin);
-					*(fftBufferPtr + bin + 1) = tools::binPhase(fftBufferPtr + bin);
+					float ampl = tools::binAmpl(binPtr + bin);
+					*(binPtr + bin + 1) = tools::binPhase(binPtr + bin);
+					*(binPtr + bin) = ampl;
 				}
 			}
 		}
 		
-		return fftBuffer;
+		return spectrum;
 	}
 	
 	
 	
 	
-	AudioBuffer<float> fftInvTransform(AudioBuffer<float> &buffer) {
+	AudioBuffer<float> fftInvTransform(HalfSpectrum &spectrum) {
 		
-		int fftSize = buffer.getNumSamples();
-		int N  = fftSize / 2;
+		int N  = spectrum.getFftSize();
+		int fftBlockSize = N * 2;
 		
-		AudioSampleBuffer fftBuffer (buffer);
+		AudioSampleBuffer fftBuffer (1, fftBlockSize);
+		AudioSampleBuffer result (spectrum.getNumChannels(), N);
 		
 		BigInteger fftBitMask = (BigInteger) N;
 		dsp::FFT::FFT fftInverse   (fftBitMask.getHighestBit());
 		
-		for (int channel = 0; channel < fftBuffer.getNumChannels(); channel++){
-			float* fftBufferPtr = fftBuffer.getWritePointer(channel);
+		for (int channel = 0; channel < spectrum.getNumChannels(); channel++){
+			float* fftBufferPtr = fftBuffer.getWritePointer(0);
+			spectrum.copyToJuceLayout(channel, fftBufferPtr);
 			fftInverse.performRealOnlyInverseTransform(fftBufferPtr);
+			result.copyFrom(channel, 0, fftBufferPtr, N); // performRealOnlyInverseTransform() returns the result in the first half of the buffer
 		}
 		
-		fftBuffer.setSize(fftBuffer.getNumChannels(), N, true); // performRealOnlyInverseTransform() returns the result in the first half of the buffer
-		
-		return fftBuffer;
+		return result;
 	}
 
 
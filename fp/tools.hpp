@@ -34,6 +34,7 @@ namespace tools {
 	
 	// applies gain to all buffer samples, such that the maximum sample level is equal to dBGoalLevel
 	void normalize(AudioBuffer<float>* buffer, float dBGoalLevel = 0.0f, bool printGain = false);
+	void normalize(AudioBuffer<double>* buffer, float dBGoalLevel = 0.0f, bool printGain = false);
 	
 	// converts dB to a linear value (0.0 dB = 1.0 linear)
 	float dBToLin (float dB);
@@ -71,6 +72,18 @@ namespace tools {
 	// performs linear fade, fade per sample being 1.0 / numSamples.
 	// !fadeIn means fadeout
 	void linearFade (AudioBuffer<float>* buffer, bool fadeIn, int startSample, int numSamples);
+	void linearFade (AudioBuffer<double>* buffer, bool fadeIn, int startSample, int numSamples);
+	
+	/* copies or adds numSamples samples from source to dest, converting between float and double,
+	 * so that code for both sample types can move samples between its own buffers and float ones */
+	void copySamples (float* dest, const float* source, int numSamples);
+	void copySamples (float* dest, const double* source, int numSamples);
+	void copySamples (double* dest, const float* source, int numSamples);
+	void copySamples (double* dest, const double* source, int numSamples);
+	void addSamples (float* dest, const float* source, int numSamples);
+	void addSamples (float* dest, const double* source, int numSamples);
+	void addSamples (double* dest, const float* source, int numSamples);
+	void addSamples (double* dest, const double* source, int numSamples);
 	
 	/* fills every channel of the buffer with a sine wave with the specified freq and ampl */
 	void sineFill (AudioBuffer<float> *buffer, float freq, float sampleRate, float ampl = 1.0f);
@@ -82,11 +95,10 @@ namespace tools {
 	std::string DescribeIosFailure(const std::ios& stream);
 	
 	/* these transforms use the RealOnly transforms in the Juce library.
-	 * This means that all the negative freq bins have contents 0.
-	 * fftSize = length of result, N = fftSize / 2
-	 * Beware: RealOnly also means N/2+1 bins have data in them! (last one is nyquist) */
-	AudioBuffer<float> fftTransform (AudioBuffer<float>& buffer, bool formatAmplPhase = false);
-	AudioBuffer<float> fftInvTransform (AudioBuffer<float>& buffer);
+	 * N = nextPowerOfTwo(numSamples), the result holds only the N/2+1 bins that have data (last one is nyquist),
+	 * see HalfSpectrum. fftInvTransform() returns N samples per channel */
+	HalfSpectrum fftTransform (AudioBuffer<float>& buffer, bool formatAmplPhase = false);
+	AudioBuffer<float> fftInvTransform (HalfSpectrum& spectrum);
 	
 	
 } // tools